@@ -31,6 +31,8 @@ else()
 endif()
 option(ENABLE_LOG_PERFORMANCE "Faster log message generation" OFF)
 option(ENABLE_DRIVE_NOTIFICATIONS "Allows to monitor (external) drives being [dis]connected to the computer" OFF)
+option(ENABLE_HW_CRC32 "Computes CRC32 with carry-less multiplication on x86 CPUs supporting it" ON)
+option(ENABLE_FANOTIFY "Monitors whole filesystems with fanotify on Linux when permitted, instead of one inotify watch per synced folder" OFF)
 option(ENABLE_QT_BINDINGS "Enable the target to build the Qt Bindings" OFF)
 option(ENABLE_JAVA_BINDINGS "Enable the target to build the Java Bindings" OFF)
 option(ENABLE_PYTHON_BINDINGS "Enable the target to build the Python Bindings" OFF)
@@ -706,7 +706,6 @@ private:
     NodeHandle targethandle;
     Completion mResultFunction;
 
-    void removePendingDBRecordsAndTempFiles();
     void performAppCallback(Error e,
                             vector<NewNode>&,
                             bool targetOverride = false,
@@ -714,6 +713,9 @@ private:
 
 public:
 
+    // release the transfer db records and temporary files kept for the upload with this tag
+    static void removePendingDBRecordsAndTempFiles(MegaClient* client, int tag);
+
     bool procresult(Result, JSON&) override;
 
     CommandPutNodes(MegaClient*,
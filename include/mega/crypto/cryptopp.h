@@ -91,6 +91,49 @@ private:
     CryptoPP::GCM<CryptoPP::AES>::Encryption aesgcm_e;
     CryptoPP::GCM<CryptoPP::AES>::Decryption aesgcm_d;
 
+    // Most ciphers (one per node key, share key...) only ever use one or two modes, so
+    // rather than expanding all ten key schedules in setkey(), each is keyed on first use.
+    // ECB is the exception: it is keyed in setkey(), so that ecb_encrypt()/ecb_decrypt()
+    // don't modify the cipher and a keyed cipher can be used by several threads at once.
+    enum : unsigned
+    {
+        MODE_ECB_E = 1 << 0,
+        MODE_ECB_D = 1 << 1,
+        MODE_CBC_E = 1 << 2,
+        MODE_CBC_D = 1 << 3,
+        MODE_CCM16_E = 1 << 4,
+        MODE_CCM16_D = 1 << 5,
+        MODE_CCM8_E = 1 << 6,
+        MODE_CCM8_D = 1 << 7,
+        MODE_GCM_E = 1 << 8,
+        MODE_GCM_D = 1 << 9,
+        MODE_ALL = (1 << 10) - 1
+    };
+
+    // modes not keyed with `key` since the last setkey()
+    unsigned mUnkeyedModes = 0;
+
+    // modes keyed with a caller supplied key instead of `key` (see *_with_key())
+    unsigned mForeignKeyedModes = 0;
+
+    bool mKeySet = false;
+
+    void keyModes(unsigned modes)
+    {
+        if (mUnkeyedModes & modes)
+        {
+            expandKeys(mUnkeyedModes & modes);
+        }
+    }
+
+    void expandKeys(unsigned modes);
+
+    void foreignKeyed(unsigned modes)
+    {
+        mUnkeyedModes &= ~modes;
+        mForeignKeyedModes |= modes;
+    }
+
     /**
      * @brief Authenticated symmetric encryption using AES in GCM mode.
      *
@@ -152,9 +195,21 @@ public:
 
     // type != 1 will enatil xoring the second KEYLENGTH bytes into the first ones
     // otherwise only first KEYLENGTH raw bytes will be used.
+    // Setting the key already in use keeps the expanded key schedules.
     void setkey(const byte*, int type = 1);
     bool setkey(const std::string*);
 
+    // number of keyed ciphers each thread keeps for threadLocalCipher()
+    static constexpr unsigned THREAD_CIPHER_CACHE_SIZE = 8;
+
+    // Returns a cipher keyed with the given key (same conventions as setkey()) that belongs
+    // to the calling thread, so it can be used from worker threads without sharing a cipher.
+    // Ciphers of the keys used most recently are kept, reusing their expanded key schedules.
+    // The pointer stays valid until the thread asks for THREAD_CIPHER_CACHE_SIZE other keys;
+    // it must not be rekeyed or passed to other threads.
+    static SymmCipher* threadLocalCipher(const byte* key, int type = 1);
+    static SymmCipher* threadLocalCipher(const std::string& key); // nullptr unless node key sized
+
     /**
      * @brief Encrypt symmetrically using AES in ECB mode.
      *
@@ -415,6 +470,67 @@ public:
                               const byte* tag, const size_t taglen, const byte* iv, const size_t ivlen, byte* result,
                               const size_t resultSize);
 
+    /**
+     * @brief Authenticated encryption of a buffer using AES in GCM mode, without intermediate copies.
+     *
+     * Same output as gcm_encrypt(const std::string*, ...), but the ciphertext is written to
+     * out and the tag to a separate buffer, so callers can lay out containers themselves.
+     *
+     * @param in Data to be encrypted.
+     * @param out Receives len bytes of ciphertext. May be the same buffer as in.
+     * @param len Length of data.
+     * @param iv Initialisation vector or nonce to use for encryption.
+     * @param ivlen Length of IV.
+     * @param tag Receives the authentication tag.
+     * @param taglen Length of the authentication tag.
+     * @return true if encryption was successful.
+     */
+    bool gcm_encrypt_buffer(const byte* in, byte* out, size_t len, const byte* iv, unsigned ivlen, byte* tag, unsigned taglen);
+
+    /**
+     * @brief Authenticated decryption of a buffer using AES in GCM mode, without intermediate copies.
+     *
+     * @param in Data to be decrypted, not including the authentication tag.
+     * @param out Receives len bytes of plain text. May be the same buffer as in.
+     * @param len Length of data.
+     * @param iv Initialisation vector or nonce.
+     * @param ivlen Length of IV.
+     * @param tag Authentication tag.
+     * @param taglen Length of the authentication tag.
+     * @return true if decryption and verification were successful. The contents of out are
+     * undefined otherwise.
+     */
+    bool gcm_decrypt_buffer(const byte* in, byte* out, size_t len, const byte* iv, unsigned ivlen, const byte* tag, unsigned taglen);
+
+    // CCM counterparts of the above. Allowed tag lengths are 8 and 16 bytes.
+    bool ccm_encrypt_buffer(const byte* in, byte* out, size_t len, const byte* iv, unsigned ivlen, byte* tag, unsigned taglen);
+    bool ccm_decrypt_buffer(const byte* in, byte* out, size_t len, const byte* iv, unsigned ivlen, const byte* tag, unsigned taglen);
+
+    /**
+     * @brief Incremental AES-GCM encryption of data too large, or not yet available, to be passed at once.
+     *
+     * Call gcm_encrypt_init() once, gcm_encrypt_update() for each consecutive piece of data
+     * and gcm_encrypt_final() to obtain the tag. The result is the same as encrypting all the
+     * pieces in one go. The stream uses the cipher's GCM state, so only one encryption stream
+     * can be in progress per cipher at a time, and other GCM encryptions must not be
+     * interleaved with it.
+     *
+     * @return false if the cipher rejected the input (i.e. the IV length).
+     */
+    bool gcm_encrypt_init(const byte* iv, unsigned ivlen);
+    bool gcm_encrypt_update(const byte* in, byte* out, size_t len);
+    bool gcm_encrypt_final(byte* tag, unsigned taglen);
+
+    /**
+     * @brief Incremental AES-GCM decryption, see gcm_encrypt_init().
+     *
+     * Decrypted data is handed out before the tag is checked: callers must discard it unless
+     * gcm_decrypt_final() returns true.
+     */
+    bool gcm_decrypt_init(const byte* iv, unsigned ivlen);
+    bool gcm_decrypt_update(const byte* in, byte* out, size_t len);
+    bool gcm_decrypt_final(const byte* tag, unsigned taglen);
+
     /**
      * @brief Serialize key for compatibility with the webclient
      *
@@ -427,6 +543,36 @@ public:
 
     void ctr_crypt(byte *, unsigned, m_off_t, ctr_iv, byte *mac, bool encrypt, bool initmac = true);
 
+    // number of counter blocks ctr_crypt hands to the cipher per call, so AES-NI can pipeline them
+    static constexpr unsigned CTR_BATCH_BLOCKS = 8;
+
+    // max number of independent pieces ctr_encrypt_lanes processes together
+    static constexpr unsigned MAX_CTR_LANES = 8;
+
+    // A piece of file data for ctr_encrypt_lanes: data at file position pos (BLOCKSIZE aligned),
+    // NUL-padded to BLOCKSIZE, and the buffer receiving its CBC-MAC
+    struct CtrLane
+    {
+        byte* data;
+        unsigned len;
+        m_off_t pos;
+        byte* mac;
+    };
+
+    /**
+     * @brief Encrypt several independent pieces in CTR mode and compute the CBC-MAC of each,
+     * with the same results as a ctr_crypt(encrypt, initmac) call per piece.
+     *
+     * Each AES call advances the MAC of every piece by one block and generates the matching
+     * keystream blocks, so the cipher works on up to 2 * MAX_CTR_LANES independent blocks at a
+     * time instead of waiting on the previous block of a single MAC chain.
+     *
+     * @param lanes Pieces to encrypt, at most MAX_CTR_LANES
+     * @param count Number of pieces
+     * @param ctriv CTR initialization vector
+     */
+    void ctr_encrypt_lanes(const CtrLane* lanes, unsigned count, ctr_iv ctriv);
+
     static void setint64(int64_t, byte*);
 
     static void xorblock(const byte*, byte*);
@@ -647,9 +793,22 @@ class MEGA_API HashCRC32
 {
     CryptoPP::CRC32 hash;
 
+    // running CRC when using the accelerated implementation instead of `hash`
+    uint32_t mCrc = 0xFFFFFFFF;
+    bool mAccelerated;
+
 public:
+    HashCRC32();
+
     void add(const byte*, unsigned);
     void get(byte*);
+
+    // true if CRCs are computed with carry-less multiplication (PCLMULQDQ) on this machine.
+    // Both implementations produce the same output.
+    static bool accelerated();
+
+    // allows benchmarks and tests to compare against the portable implementation (affects new instances)
+    static void setAccelerationEnabled(bool enabled);
 };
 
 /**
@@ -26,6 +26,10 @@
 #include "logging.h"
 #include "node.h"
 
+#include <condition_variable>
+#include <optional>
+#include <thread>
+
 namespace mega {
 // generic host transactional database access interface
 class DBTableTransactionCommitter;
@@ -58,6 +62,7 @@ protected:
     DBTableTransactionCommitter* mTransactionCommitter = nullptr;
     DBErrorCallback mDBErrorCallBack;
     friend class DBTableTransactionCommitter;
+    friend class DbTableAsyncWriter;
     void checkTransaction();
     // should be called by the subclass' destructor
     void resetCommitter();
@@ -244,6 +249,115 @@ public:
 };
 
 
+class DbTableAsyncWriter;
+
+// The background thread doing the writes of any number of DbTableAsyncWriters,
+// so that many tables (one per sync) don't each need a thread of their own.
+// Writers are served in the order they flushed, one batch at a time.
+class MEGA_API DbTableWriterThread
+{
+public:
+    DbTableWriterThread();
+
+    // Every writer using the thread must be gone by now.
+    ~DbTableWriterThread();
+
+    MEGA_DISABLE_COPY_MOVE(DbTableWriterThread)
+
+private:
+    friend class DbTableAsyncWriter;
+
+    // Have writer's pending batch written.
+    void schedule(DbTableAsyncWriter& writer);
+
+    void loop();
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<DbTableAsyncWriter*> mScheduled;
+    bool mTerminating = false;
+
+    std::thread mThread;
+};
+
+// Applies record puts and deletes to a DbTable on a DbTableWriterThread.
+// Changes are coalesced per record id until the worker takes them, so only
+// the last put or delete of each id is written, and each batch the worker
+// takes is written in a single transaction.
+// The writer takes the table over, including the assignment of record ids:
+// it starts from the table's nextid and hands its own back on destruction.
+// While it exists only its worker may touch the table; drain() first if it
+// must be used directly.  Everything but the worker's writes (encryption,
+// id assignment, queuing) happens on the thread calling put(), del() and
+// flush(), which must always be the same one.
+class MEGA_API DbTableAsyncWriter
+{
+public:
+    DbTableAsyncWriter(unique_ptr<DbTable>& table, shared_ptr<DbTableWriterThread> thread);
+
+    // Writes anything still queued before returning.
+    ~DbTableAsyncWriter();
+
+    MEGA_DISABLE_COPY_MOVE(DbTableAsyncWriter)
+
+    void put(uint32_t id, string&& data);
+    void del(uint32_t id);
+
+    // Pads and encrypts an already serialized record, assigning the record an id if it has none yet.
+    void put(uint32_t type, Cacheable& record, string&& data, SymmCipher* key);
+
+    // The id the next new record would be numbered from.
+    uint32_t nextid() const { return mNextid; }
+
+    // Hand the changes queued so far to the worker.
+    void flush();
+
+    // Flush, and wait until the worker has written everything.
+    void drain();
+
+    struct Stats
+    {
+        uint64_t bytesWritten = 0;
+        uint64_t recordsWritten = 0;
+        uint64_t recordsDeleted = 0;
+
+        // changes superseded by a later change to the same record before being written
+        uint64_t changesCoalesced = 0;
+
+        uint64_t batches = 0;
+    };
+
+    Stats stats() const;
+
+private:
+    friend class DbTableWriterThread;
+
+    // nullopt for a delete
+    using Batch = std::map<uint32_t, std::optional<string>>;
+
+    // Called by the worker: writes the pending batch, and reschedules if more arrived meanwhile.
+    void writePending();
+    void write(Batch& batch);
+
+    unique_ptr<DbTable>& mTable;
+
+    // Changes not yet flushed, and record numbering.  Only touched by the calling thread.
+    Batch mQueued;
+    uint64_t mQueuedCoalesced = 0;
+    uint32_t mNextid = 0;
+
+    shared_ptr<DbTableWriterThread> mThread;
+
+    // Everything below is guarded by mMutex.
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    Batch mPending;
+
+    // queued with the worker, or being written by it
+    bool mScheduled = false;
+    Stats mStats;
+};
+
 class MEGA_API TransferDbCommitter : public DBTableTransactionCommitter
 {
 public:
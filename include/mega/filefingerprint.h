@@ -22,6 +22,10 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 #include "types.h"
 
@@ -85,5 +89,105 @@ struct MEGA_API FileFingerprintCmp
 bool operator==(const FileFingerprint& lhs, const FileFingerprint& rhs);
 bool operator!=(const FileFingerprint& lhs, const FileFingerprint& rhs);
 
+class DbTable;
+class fsfp_t;
+
+// Remembers the fingerprints of local files across sessions, so that files
+// first seen by a new sync, backup or folder upload need not be read again
+// if they were fingerprinted before.  Entries are keyed by filesystem and
+// fsid and are only reused while size, mtime and ctime are all unchanged.
+//
+// Lookups and stores are thread safe.  The backing table is only touched by
+// attach(), flush() and detach(), which must be called from one thread;
+// flush() writes without holding the lock, so lookups aren't held up by the disk.
+class MEGA_API FingerprintCache
+{
+public:
+    // Entries beyond this are dropped, least recently used first.
+    // About a million, enough for the largest syncs we see
+    // (some 200 bytes each in memory, so around 200 MB when full)
+    static constexpr size_t MAX_ENTRIES = 1 << 20;
+
+    FingerprintCache();
+    ~FingerprintCache();
+
+    MEGA_DISABLE_COPY_MOVE(FingerprintCache)
+
+    // Identifies the filesystem a file lives on, or empty if unknown.
+    static string filesystemKey(const fsfp_t& fsfp);
+
+    // Fills in fingerprint if a still valid entry exists.
+    bool lookup(const string& filesystem,
+                handle fsid,
+                m_off_t size,
+                m_time_t mtime,
+                m_time_t ctime,
+                FileFingerprint& fingerprint);
+
+    // Records (or replaces) the fingerprint of a file.
+    void store(const string& filesystem,
+               handle fsid,
+               m_time_t ctime,
+               const FileFingerprint& fingerprint);
+
+    // Loads entries from table and keeps it for later flush() calls.
+    void attach(unique_ptr<DbTable> table, const SymmCipher& key);
+
+    // Writes entries changed since the last flush in a single transaction.
+    void flush();
+
+    // Flushes and releases the table, optionally removing it from disk.
+    void detach(bool remove);
+
+    bool hasPendingWrites() const;
+
+    // Whether a table is attached.
+    bool attached() const;
+
+    size_t size() const;
+
+    // Lookup statistics since construction.
+    uint64_t hits() const { return mHits; }
+    uint64_t misses() const { return mMisses; }
+
+private:
+    struct Key
+    {
+        string filesystem;
+        handle fsid;
+
+        bool operator<(const Key& rhs) const
+        {
+            return std::tie(fsid, filesystem) < std::tie(rhs.fsid, rhs.filesystem);
+        }
+    };
+
+    struct Entry : public Cacheable
+    {
+        Key key;
+        m_time_t ctime = 0;
+        m_time_t lastUsed = 0;
+        FileFingerprint fingerprint;
+        bool dirty = false;
+
+        bool serialize(string* d) const override;
+        static bool unserialize(const string& d, Entry& entry);
+    };
+
+    // Drops the least recently used entries beyond MAX_ENTRIES.
+    void trim();
+
+    std::map<Key, Entry> mEntries;
+    size_t mDirty = 0;
+    vector<uint32_t> mDeleted;
+    mutable std::mutex mMutex;
+
+    unique_ptr<DbTable> mTable;
+    unique_ptr<SymmCipher> mKey;
+
+    std::atomic<uint64_t> mHits{0};
+    std::atomic<uint64_t> mMisses{0};
+};
+
 
 } // mega
@@ -29,6 +29,7 @@
 #include "waiter.h"
 
 #include <atomic>
+#include <unordered_map>
 
 namespace mega {
 
@@ -159,6 +160,10 @@ struct MEGA_API FSNode;
 
 extern CodeCounter::ScopeStats g_compareUtfTimings;
 
+// Set on threads comparing names in parallel with the sync thread:
+// g_compareUtfTimings is not thread safe, so they are not timed.
+extern thread_local bool g_skipCompareUtfTimings;
+
 class MEGA_API LocalPath
 {
 #ifdef WIN32
@@ -192,6 +197,7 @@ class MEGA_API LocalPath
     friend void AddHiddenFileAttribute(LocalPath& path);
     friend class GfxProviderFreeImage;
     friend struct FileSystemAccess;
+    friend struct NotificationDeque;
 
     friend int compareUtf(const string&, bool unescaping1, const string&, bool unescaping2, bool caseInsensitive);
     friend int compareUtf(const string&, bool unescaping1, const LocalPath&, bool unescaping2, bool caseInsensitive);
@@ -693,6 +699,10 @@ struct MEGA_API FileAccess
     // mtime of a file opened for reading
     m_time_t mtime = 0;
 
+    // platform specific status change time of a file opened for reading (0 if unknown)
+    // only meaningful for comparing with earlier values from the same platform
+    m_time_t ctime = 0;
+
     // local filesystem record id (survives renames & moves)
     handle fsid = 0;
     bool fsidvalid = false;
@@ -743,6 +753,18 @@ struct MEGA_API FileAccess
     // absolute position read to byte buffer
     bool frawread(byte *, unsigned, m_off_t, bool caller_opened, FSLogging);
 
+    // read count pieces of len bytes, at ascending offsets, one after another into dst.
+    // Pieces close together are fetched with a single read, and the OS is told about all the
+    // ranges up front so it can fetch them concurrently (useful for network filesystems and disks)
+    bool frawreadmany(byte* dst, unsigned len, const m_off_t* offsets, unsigned count, bool caller_opened, FSLogging);
+
+    // max bytes read at once to serve several pieces of frawreadmany()
+    static const unsigned MAX_COALESCED_READ = 64 * 1024;
+
+    // pieces are only read together if that reads at most twice the bytes they need,
+    // or no more than this (about what reading even one of them costs)
+    static const unsigned MIN_COALESCED_READ = 4 * 1024;
+
     // After a successful nonblocking fopen(), call openf() to really open the file (by localname)
     // (this is a lazy-type approach in case we don't actually need to open the file after finding out type/size/mtime).
     // If the size or mtime changed, it will fail.
@@ -790,6 +812,7 @@ protected:
 
     // system-specific raw read/open/close to be provided by platform implementation.   fopen / openf / fread etc are implemented by calling these.
     virtual bool sysread(byte *, unsigned, m_off_t) = 0;
+    virtual void sysprefetch(m_off_t, unsigned) {}   // hint that a range will be read soon
     virtual bool sysstat(m_time_t*, m_off_t*, FSLogging) = 0;
     virtual bool sysopen(bool async, FSLogging) = 0;
     virtual void sysclose() = 0;
@@ -841,25 +864,67 @@ struct Notification
     LocalPath path;
     LocalNode* localnode = nullptr;
 
+    // How many raw notifications this one stands for, once identical ones are coalesced
+    unsigned repeats = 1;
+
     Notification() {}
     Notification(dstime ts, ScanRequirement sr, const LocalPath& p, LocalNode* ln)
         : timestamp(ts), scanRequirement(sr), path(p), localnode(ln)
         {}
 };
 
-struct NotificationDeque : ThreadSafeDeque<Notification>
+// Coalesces notifications as they are queued, so that bursts (checkouts, package installs)
+// reach the sync thread as one entry per distinct (localnode, path, requirement):
+// - a notification identical to one still queued just bumps that one's repeat count
+// - a folder scan (FOLDER_NEEDS_SELF_SCAN or FOLDER_NEEDS_SCAN_RECURSIVE) at or below a queued
+//   FOLDER_NEEDS_SCAN_RECURSIVE of the same localnode is dropped, as that scan will visit it anyway.
+//   NEEDS_PARENT_SCAN notifications are always kept: for a file, they also get it fingerprinted
+//   again, which a folder scan does not do.
+struct MEGA_API NotificationDeque : ThreadSafeDeque<Notification>
 {
-    void replaceLocalNodePointers(LocalNode* check, LocalNode* newvalue)
+    struct Stats
     {
-        std::lock_guard<std::mutex> g(m);
-        for (auto& n : mNotifications)
-        {
-            if (n.localnode == check)
-            {
-                n.localnode = newvalue;
-            }
-        }
-    }
+        // notifications offered by the platform layer
+        uint64_t raw = 0;
+
+        // of those, how many were folded into a queued duplicate or recursive scan
+        uint64_t repeats = 0;
+        uint64_t subsumed = 0;
+
+        uint64_t delivered() const { return raw - repeats - subsumed; }
+    };
+
+    void pushBack(Notification&& n);
+
+    // Takes everything queued in one go, so the sync thread locks once per batch.
+    // (the only way notifications leave the queue, so the coalescing index stays in step)
+    void popAll(std::deque<Notification>& batch);
+
+    void replaceLocalNodePointers(LocalNode* check, LocalNode* newvalue);
+
+    Stats stats();
+
+private:
+    // Keys point into the queued notifications themselves, which deque keeps
+    // in place as we only ever add or remove at the ends.
+    struct Key
+    {
+        const Notification* n;
+        bool operator==(const Key& k) const;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const;
+    };
+
+    std::unordered_map<Key, Notification*, KeyHash> mPending;
+    std::vector<Notification*> mPendingRecursive;
+    Stats mStats;
+
+    void index(Notification& n);
+    void unindex(const Notification& n);
+    Notification* subsumedBy(const Notification& n) const;
 };
 
 // filesystem change notification, highly coupled to Syncs and LocalNodes.
@@ -895,6 +960,9 @@ public:
     DirNotify(const LocalPath& rootPath);
     virtual ~DirNotify() {}
 
+    // log what it took to start monitoring the sync (called once its initial scan is done)
+    virtual void logWatchStats() const {}
+
     bool empty();
 };
 #endif
@@ -1029,12 +1097,16 @@ struct MEGA_API FileSystemAccess : public EventTrigger
     virtual bool initFilesystemNotificationSystem();
 #endif // ENABLE_SYNC
 
+    // Fingerprints of changed files not in known are looked up in (and
+    // stored to) fingerprintCache, if supplied, under filesystem.
     virtual ScanResult directoryScan(const LocalPath& path,
                                      handle expectedFsid,
                                      map<LocalPath, FSNode>& known,
                                      std::vector<FSNode>& results,
                                      bool followSymLinks,
-                                     unsigned& nFingerprinted) = 0;
+                                     unsigned& nFingerprinted,
+                                     FingerprintCache* fingerprintCache,
+                                     const string& filesystem) = 0;
 
     // Retrieve the FSID of the item at the specified path.
     // UNDEF is returned if we cannot determine the item's FSID.
@@ -1113,6 +1185,45 @@ int platformCompareUtf(const string&, bool unescape1, const LocalPath&, bool une
 int platformCompareUtf(const LocalPath&, bool unescape1, const string&, bool unescape2);
 int platformCompareUtf(const LocalPath&, bool unescape1, const LocalPath&, bool unescape2);
 
+// Precomputed sort class of a node name, cached on CloudNode/LocalNode/FSNode.
+// Names made of ASCII only (and without escapes) order exactly as compareUtf()
+// would order them when compared with compareAscii(), which needs no decoding.
+// For any other name isAscii() is false and callers use compareUtf().
+// Every LocalNode carries one of these, so it is kept to a single byte.
+class MEGA_API NameSortKey
+{
+public:
+    // Computes the key if it isn't known yet.
+    // Call reset() first if the name itself changed.
+    void update(const string& name)
+    {
+        if (mKind == UNSET)
+        {
+            compute(name);
+        }
+    }
+
+    void reset()
+    {
+        mKind = UNSET;
+    }
+
+    bool isAscii() const
+    {
+        return mKind == ASCII;
+    }
+
+    // Only for names whose keys are isAscii().
+    static int compareAscii(const string& lhs, const string& rhs, bool caseInsensitive);
+
+private:
+    void compute(const string& name);
+
+    enum Kind : uint8_t { UNSET, ASCII, OTHER };
+
+    Kind mKind = UNSET;
+};
+
 struct MEGA_API FSNode
 {
     // A structure convenient for containing just the attributes of one item from the filesystem
@@ -1169,6 +1280,9 @@ struct MEGA_API FSNode
     // Use this in asserts() to check if race conditions may be occurring
     static bool debugConfirmOnDiskFingerprintOrLogWhy(FileSystemAccess& fsAccess, const LocalPath& path, const FileFingerprint& ff);
 
+    // Sort key for toName_of_localname(), filled in by the sync when ordering rows.
+    NameSortKey sortKey;
+
     const string& toName_of_localname(const FileSystemAccess& fsaccess)
     {
         // Although FSNode wouldn't naturally have a utf8 and normalized version of localname,
@@ -1199,7 +1313,10 @@ public:
             bool followSymlinks,
             LocalPath targetPath,
             handle expectedFsid,
-            map<LocalPath, FSNode>&& priorScanChildren);
+            map<LocalPath, FSNode>&& priorScanChildren,
+            shared_ptr<FingerprintCache> fingerprintCache,
+            string filesystem,
+            handle owner = UNDEF);
 
         MEGA_DISABLE_COPY_MOVE(ScanRequest);
 
@@ -1247,16 +1364,71 @@ public:
         // fsid that the target path should still referene
         handle mExpectedFsid;
 
+        // Where fingerprints of files not in mKnown may be found.
+        // The filesystem also identifies the device for fair queuing.
+        shared_ptr<FingerprintCache> mFingerprintCache;
+        const string mFilesystem;
+
+        // Who asked for the scan (the sync's backup id), for fair queuing and metrics.
+        const handle mOwner;
+
     }; // ScanRequest
 
     // For convenience.
     using RequestPtr = std::shared_ptr<ScanRequest>;
 
     // Issue a scan for the given target.
-    RequestPtr queueScan(LocalPath targetPath, handle expectedFsid, bool followSymlinks, map<LocalPath, FSNode>&& priorScanChildren, shared_ptr<Waiter> waiter);
+    RequestPtr queueScan(LocalPath targetPath, handle expectedFsid, bool followSymlinks, map<LocalPath, FSNode>&& priorScanChildren, shared_ptr<Waiter> waiter,
+                         shared_ptr<FingerprintCache> fingerprintCache = nullptr, string filesystem = string(), handle owner = UNDEF);
+
+    // Pending scan requests. Owners (syncs) take turns, so that a huge initial scan
+    // does not hold up the scans of small syncs, and only so many scans run at
+    // once against the same device.
+    class PendingQueue
+    {
+    public:
+        explicit PendingQueue(unsigned scansPerDevice);
+
+        void push(RequestPtr request);
+
+        // The next request of the next owner whose device has capacity, if any.
+        RequestPtr pop();
+
+        // A request returned by pop() has been processed.
+        void done(const RequestPtr& request);
+
+        bool empty() const;
+
+        // Removes and returns every pending request, regardless of device capacity.
+        std::vector<RequestPtr> takeAll();
+
+    private:
+        unsigned mScansPerDevice;
+        map<handle, std::deque<RequestPtr>> mByOwner;
+        std::deque<handle> mOwnerTurns;
+        map<string, unsigned> mInProgress;
+    };
+
+    // Scan throughput of one owner since its first scan request.
+    struct Metrics
+    {
+        uint64_t foldersScanned = 0;
+        uint64_t filesFingerprinted = 0;
+        std::chrono::milliseconds scanTime{0};
+    };
+
+    static Metrics metrics(handle owner);
+
+    // The owner is gone (its sync was unloaded): drop its metrics. Scans of
+    // its still in flight are no longer counted.
+    static void forgetMetrics(handle owner);
+
+    // Pool size and scans allowed in parallel on one device, applied when the
+    // shared worker is (re)started. Defaults depend on the number of cores.
+    static void setPoolSize(unsigned threads, unsigned scansPerDevice);
 
     // Track performance (debug only)
-    static CodeCounter::ScopeStats syncScanTime;
+    static string scanTimeReport(bool reset);
 
 private:
        // Convenience.
@@ -1266,7 +1438,7 @@ private:
     class Worker
     {
     public:
-        Worker(size_t numThreads = 1);
+        Worker(size_t numThreads, unsigned scansPerDevice);
 
         ~Worker();
 
@@ -1280,13 +1452,13 @@ private:
         void loop();
 
         // Processes a scan request.
-        ScanResult scan(ScanRequestPtr request, unsigned& nFingerprinted);
-
-        // Filesystem access.
-        std::unique_ptr<FileSystemAccess> mFsAccess;
+        ScanResult scan(FileSystemAccess& fsAccess, ScanRequestPtr request, unsigned& nFingerprinted);
 
         // Pending scan requests.
-        std::deque<ScanRequestPtr> mPending;
+        PendingQueue mPending;
+
+        // Set when the threads should exit.
+        bool mTerminating = false;
 
         // Guards access to the above.
         std::mutex mPendingLock;
@@ -1305,6 +1477,15 @@ private:
     // Synchronizes access to the above.
     static std::mutex mWorkerLock;
 
+    // Configuration for the next worker.
+    static unsigned mPoolThreads;
+    static unsigned mScansPerDevice;
+
+    // Per owner metrics, the scan time of all of them (debug only), and their guard.
+    static map<handle, Metrics> mMetrics;
+    static CodeCounter::ScopeStats syncScanTime;
+    static std::mutex mMetricsLock;
+
 }; // ScanService
 
 // True if type denotes a network filesystem.
@@ -152,7 +152,6 @@ class MEGA_API GfxProc
     std::mutex mutex;
     THREAD_CLASS thread;
     bool threadstarted = false;
-    SymmCipher mCheckEventsKey;
     GfxJobQueue requests;
     GfxJobQueue responses;
     std::unique_ptr<IGfxProvider>  mGfxProvider;
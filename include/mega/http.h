@@ -326,6 +326,64 @@ struct MEGA_API HttpIO : public EventTrigger
 };
 
 // outgoing HTTP request
+// Size-class pool for the large buffers carrying transfer data: HttpReq receive
+// buffers and RaidBufferManager::FilePiece buffers.  Released buffers are kept for
+// reuse by later requests and transfers (up to a configurable amount of idle
+// memory) instead of going back to the heap, which fragments it over time.
+class MEGA_API TransferBufferPool
+{
+public:
+    // smaller buffers are allocated exactly and never kept idle
+    static const size_t MIN_POOLED_SIZE = 64 * 1024;
+
+    static const size_t DEFAULT_MAX_IDLE_BYTES = 128 * 1024 * 1024;
+
+    struct Usage
+    {
+        size_t inUseBytes = 0;
+        size_t peakInUseBytes = 0;
+        size_t idleBytes = 0;
+        size_t peakIdleBytes = 0;
+        uint64_t heapAllocations = 0;
+        uint64_t reuses = 0;
+    };
+
+    // the pool shared by all clients in the process (intentionally leaked, so
+    // it outlives any client or transfer released during static teardown)
+    static TransferBufferPool& instance();
+
+    // get a buffer of at least len bytes.  capacity receives its real size, which
+    // must be passed back to release()
+    byte* allocate(size_t len, size_t& capacity);
+
+    // give back a buffer obtained from allocate() (null is ignored)
+    void release(byte* buf, size_t capacity);
+
+    // maximum bytes of idle buffers kept for reuse.  0 frees buffers as soon as they are released
+    void setMaxIdleBytes(size_t bytes);
+
+    Usage usage() const;
+
+    // size actually allocated for a request of len bytes
+    static size_t capacityFor(size_t len);
+
+    TransferBufferPool() = default;
+    ~TransferBufferPool();
+
+    MEGA_DISABLE_COPY_MOVE(TransferBufferPool)
+
+private:
+    // free idle buffers, largest first, until no more than maxIdle bytes remain (lock held)
+    void trimIdle(size_t maxIdle);
+
+    mutable std::mutex mMutex;
+    std::map<size_t, std::vector<byte*>> mIdle;
+    size_t mMaxIdleBytes = DEFAULT_MAX_IDLE_BYTES;
+    Usage mUsage;
+};
+
+std::ostream& operator<<(std::ostream&, const TransferBufferPool::Usage&);
+
 struct MEGA_API HttpReq
 {
     std::atomic<reqstatus_t> status;
@@ -361,6 +419,9 @@ struct MEGA_API HttpReq
     byte* buf;
     m_off_t buflen, bufpos, notifiedbufpos;
 
+    // real size of buf, as obtained from TransferBufferPool
+    size_t bufcapacity;
+
     // When did a post() start
     std::chrono::steady_clock::time_point postStartTime;
 
@@ -411,13 +472,14 @@ struct MEGA_API HttpReq
         size_t start;
         size_t end;
 
-        http_buf_t(byte* b, size_t s, size_t e);  // takes ownership of the byte*, which must have been allocated with new[]
+        http_buf_t(byte* b, size_t s, size_t e, size_t capacity);  // takes ownership of the byte*, which must have been obtained from TransferBufferPool
         ~http_buf_t();
         void swap(http_buf_t& other);
         bool isNull() const;
 
     private:
         byte* buf;
+        size_t capacity;
     };
 
     // give up ownership of the buffer for client to use.  The caller is the new owner of the http_buf_t, and the HttpReq no longer has the buffer or any info about it.
@@ -498,6 +560,11 @@ public:
 
     bool encrypt(m_off_t pos, m_off_t npos, string& urlSuffix);
 
+protected:
+    // true if the buffers from nextbuffer() stay valid across calls, so several chunks can be
+    // requested up front and encrypted together
+    virtual bool buffersStayValid() const { return false; }
+
 private:
     SymmCipher* key;
     chunkmac_map* macs;
@@ -512,6 +579,7 @@ class MEGA_API EncryptBufferByChunks : public EncryptByChunks
     byte *chunkstart;
 
     byte* nextbuffer(unsigned bufsize) override;
+    bool buffersStayValid() const override { return true; }
 
 public:
     EncryptBufferByChunks(byte* b, SymmCipher* k, chunkmac_map* m, uint64_t iv);
@@ -430,6 +430,9 @@ private:
     // maps base64 node handles to pairs of source user handle and share key
     map<string, pair<handle, string>> mPendingInShares;
 
+    // maps contacts to the key shared with them, and the public keys (theirs and ours) it was derived from
+    map<handle, pair<string, string>> mSymmetricKeys;
+
     // warnings as stored as a key-value map
     map<string, string> mWarnings;
 
@@ -469,6 +472,12 @@ private:
 
     std::string computeSymmetricKey(handle user);
 
+    // derives the keys shared with each of users in one go, on worker threads, so that
+    // the computeSymmetricKey() calls that follow for them are served from mSymmetricKeys
+    void precomputeSymmetricKeys(const set<handle>& users);
+
+    static std::string deriveSymmetricKey(const unsigned char* privKey, const std::string& pubKey);
+
     // validates data in `km`: ie. downgrade attack, tampered keys...
     bool isValidKeysContainer(const KeyManager& km);
 
@@ -878,8 +887,12 @@ public:
     void putFileAttributes(handle h, fatype t, const std::string& encryptedAttributes, int tag);
 
     // attach file attribute to upload or node handle
+    // (a null cipher means the data was already encrypted with encryptfa())
     bool putfa(NodeOrUploadHandle, fatype, SymmCipher*, int tag, std::unique_ptr<string>);
 
+    // pad and CBC-encrypt file attribute data for putfa(), can be called from any thread
+    static bool encryptfa(SymmCipher*, string*);
+
     // move as many as possible from pendingfa to activefa
     void activatefa();
 
@@ -1629,6 +1642,16 @@ public:
     void enabletransferresumption(const char *loggedoutid = NULL);
     void disabletransferresumption(const char *loggedoutid = NULL);
 
+    // load the fingerprint cache of the logged in account or folder link
+    // (without a session the cache is kept in memory only)
+    void openFingerprintCache();
+
+    // write out pending fingerprints and release the table, or delete it
+    void closeFingerprintCache(bool remove);
+
+    // table name of the account's (or folder link's) fingerprint cache, empty if not logged in
+    string fingerprintCacheName() const;
+
     // application callbacks
     struct MegaApp* app;
 
@@ -1667,6 +1690,12 @@ public:
     // during processing of request responses, transfer table updates can be wrapped up in a single begin/commit
     TransferDbCommitter* mTctableRequestCommitter = nullptr;
 
+    // fingerprints of local files, shared by syncs, backups and folder uploads
+    // persisted per session in its own table, and written out periodically in batches
+    shared_ptr<FingerprintCache> mFingerprintCache = std::make_shared<FingerprintCache>();
+    dstime nextFingerprintCacheFlushDs = 0;
+    static constexpr dstime FINGERPRINT_CACHE_FLUSH_DS = 100;
+
     // status cache table for logged in user. For data pertaining status which requires immediate commits
     unique_ptr<DbTable> statusTable;
 
@@ -1724,7 +1753,7 @@ public:
 
     // record type indicator for sctable
     // allways add new ones at the end of the enum, otherwise it will mess up the db!
-    enum { CACHEDSCSN, CACHEDNODE, CACHEDUSER, CACHEDLOCALNODE, CACHEDPCR, CACHEDTRANSFER, CACHEDFILE, CACHEDCHAT, CACHEDSET, CACHEDSETELEMENT, CACHEDDBSTATE, CACHEDALERT } sctablerectype;
+    enum { CACHEDSCSN, CACHEDNODE, CACHEDUSER, CACHEDLOCALNODE, CACHEDPCR, CACHEDTRANSFER, CACHEDFILE, CACHEDCHAT, CACHEDSET, CACHEDSETELEMENT, CACHEDDBSTATE, CACHEDALERT, CACHEDTRANSFERMACS } sctablerectype;
 
     void persistAlert(UserAlert::Base* a);
 
@@ -1911,6 +1940,10 @@ public:
     // update transfer in the persistent cache
     void transfercacheadd(Transfer*, TransferDbCommitter*);
 
+    // persist transfer progress: only the chunk MACs changed since the last record are written,
+    // with the full transfer record rewritten every Transfer::MAX_CHUNKMAC_DELTAS updates
+    void transfercacheaddprogress(Transfer*, TransferDbCommitter*);
+
     // remove a transfer from the persistent cache
     void transfercachedel(Transfer*, TransferDbCommitter* committer);
 
@@ -2043,6 +2076,9 @@ public:
     // client-server request double-buffering
     RequestDispatcher reqs;
 
+    // merges the putnodes of completed uploads into the same folder
+    PutnodesCoalescer putnodesCoalescer;
+
     // returns if the current pendingcs includes a fetch nodes command
     bool isFetchingNodesPendingCS();
 
@@ -2099,6 +2135,16 @@ public:
     void setkey(SymmCipher*, const char*);
     bool decryptkey(const char*, byte*, int, SymmCipher*, int, handle);
 
+    // RSA-decrypts the keys addressed to us by the given nodes on worker threads, so the
+    // decryptkey() calls that follow for them are served from mPredecryptedKeys
+    void predecryptnodekeys(const sharedNode_vector& nodes);
+
+    // RSA-encrypted keys (as base64) and the key material they decrypt to
+    std::unordered_map<string, string> mPredecryptedKeys;
+
+    // don't bother with worker threads for fewer RSA keys than this
+    static constexpr size_t MIN_PREDECRYPT_KEYS = 16;
+
     void handleauth(handle, byte*);
 
     bool procsc();
@@ -2271,6 +2317,10 @@ public:
     SymmCipher *getRecycledTemporaryNodeCipher(const string *key);
     SymmCipher *getRecycledTemporaryNodeCipher(const byte *key);
 
+    // as above, but for share keys: kept apart from the node keys they decrypt, so that
+    // consecutive nodes of the same share reuse its expanded key schedule
+    SymmCipher *getRecycledTemporaryShareCipher(const byte *key);
+
     // request a link to recover account
     void getrecoverylink(const char *email, bool hasMasterkey);
 
@@ -2383,6 +2433,7 @@ public:
 #ifdef ENABLE_SYNC
         CodeCounter::ScopeStats recursiveSyncTime = { "recursiveSync" };
         CodeCounter::ScopeStats computeSyncTripletsTime = { "computeSyncTriplets" };
+        CodeCounter::ScopeStats precomputeChildRowsTime = { "precomputeChildRows" };
         CodeCounter::ScopeStats inferSyncTripletsTime = { "inferSyncTriplets" };
         CodeCounter::ScopeStats syncItem = { "syncItem" };
         CodeCounter::ScopeStats syncItemCheckMove = { "syncItemCheckMove" };
@@ -2398,6 +2449,8 @@ public:
 #endif
         uint64_t transferStarts = 0, transferFinishes = 0;
         uint64_t transferTempErrors = 0, transferFails = 0;
+        uint64_t uploadPutnodesCommands = 0, uploadPutnodesNodes = 0;
+        uint64_t transferRecordsFull = 0, transferRecordsProgress = 0, transferRecordsProgressBytes = 0;
         uint64_t prepwaitImmediate = 0, prepwaitZero = 0, prepwaitHttpio = 0, prepwaitFsaccess = 0, nonzeroWait = 0;
         CodeCounter::DurationSum csRequestWaitTime;
         CodeCounter::DurationSum transfersActiveTime;
@@ -2494,6 +2547,9 @@ private:
     // Since it's quite expensive to create a SymmCipher, this is provided to use for quick operation - just set the key and use.
     SymmCipher tmptransfercipher;
 
+    // See getRecycledTemporaryShareCipher().
+    SymmCipher tmpsharecipher;
+
     error changePasswordV1(User* u, const char* password, const char* pin);
     error changePasswordV2(const char* password, const char* pin);
     void fillCypheredAccountDataV2(const char* password, vector<byte>& clientRandomValue, vector<byte>& encmasterkey,
@@ -70,6 +70,9 @@ struct CloudNode
     nodetype_t parentType = TYPE_UNKNOWN;
     FileFingerprint fingerprint;
 
+    // Sort key for name, filled in by the sync when ordering rows.
+    NameSortKey sortKey;
+
     CloudNode() {}
     CloudNode(const Node& n);
 
@@ -583,6 +586,78 @@ struct SyncPath;
 
 struct MEGA_API LocalNode;
 
+// Truncated SHA-256 of a serialized LocalNode (see Sync::statecacheRecordDigest()).
+using StateCacheDigest = std::array<byte, 16>;
+
+// Slab allocator holding the LocalNodes of one Sync.
+// Nodes are carved out of large aligned blocks, so they carry no per-allocation
+// heap header and sit close together in memory.  Freed slots are reused by the next
+// node created.  Each block starts with a pointer back to its arena, so a node can be
+// freed after it has moved to another Sync.  Blocks go back to the system when the
+// arena is destroyed, which happens once its Sync has released it and its last node is gone.
+// Thread safe: nodes of one sync may be created and freed from several threads.
+class MEGA_API LocalNodeArena
+{
+public:
+    static constexpr size_t BLOCK_SIZE = 256 * 1024;
+
+    // totalBytes is kept up to date with the memory reserved by this arena.
+    explicit LocalNodeArena(std::atomic<uint64_t>& totalBytes);
+
+    MEGA_DISABLE_COPY_MOVE(LocalNodeArena)
+
+    void* allocate(size_t size);
+    static void deallocate(void* p);
+
+    // Drop the owning Sync's reference.  The arena is destroyed once it holds no nodes.
+    void release();
+
+    struct Releaser
+    {
+        void operator()(LocalNodeArena* arena) const { arena->release(); }
+    };
+
+    struct Usage
+    {
+        size_t nodes = 0;
+        size_t slotSize = 0;
+        size_t reservedBytes = 0;
+    };
+
+    Usage usage() const;
+
+private:
+    ~LocalNodeArena();
+
+    struct Block
+    {
+        LocalNodeArena* arena;
+        Block* next;
+    };
+
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    void addBlock();
+
+    // Guards everything below.
+    mutable std::mutex mMutex;
+
+    std::atomic<uint64_t>& mTotalBytes;
+    Block* mBlocks = nullptr;
+    FreeSlot* mFreeSlots = nullptr;
+
+    // Part of the newest block that has never been handed out.
+    char* mUnused = nullptr;
+    char* mUnusedEnd = nullptr;
+
+    size_t mBlockCount = 0;
+    size_t mNodes = 0;
+    bool mReleased = false;
+};
+
 struct MEGA_API LocalNodeCore
   : public Cacheable
 {
@@ -606,9 +681,6 @@ struct MEGA_API LocalNodeCore
     // null means either the entry has no shortname or it's the same as the (normal) longname
     std::unique_ptr<LocalPath> slocalname = nullptr;
 
-    // whether this node knew its shortname (otherwise it was loaded from an old db)
-    bool slocalname_in_db = false;
-
     // related cloud node, if any
     NodeHandle syncedCloudNodeHandle;
 
@@ -622,6 +694,10 @@ struct MEGA_API LocalNodeCore
     // This is so users can, for example, change uppercase/lowercase and have that synchronized.
     bool namesSynchronized = false;
 
+    // whether this node knew its shortname (otherwise it was loaded from an old db)
+    // (kept beside the other small fields so it doesn't need padding of its own)
+    bool slocalname_in_db = false;
+
 }; // LocalNodeCore
 
 struct MEGA_API LocalNode
@@ -636,6 +712,13 @@ struct MEGA_API LocalNode
     // as escapes/case may be involved.
     string toName_of_localname;
 
+    // Sort key for toName_of_localname, computed on demand by the sync.
+    // Reset whenever toName_of_localname changes.
+    NameSortKey sortKey;
+
+    // digest of the record last written to the state cache, all zero if unknown
+    StateCacheDigest statecacheDigest{};
+
     // parent linkage
     LocalNode* parent = nullptr;
 
@@ -643,12 +726,18 @@ struct MEGA_API LocalNode
     localnode_map children;
 
     unique_ptr<LocalPath> cloneShortname() const;
-    localnode_map schildren;
+
+    // children by shortname, only allocated while some child has a distinct shortname
+    unique_ptr<localnode_map> schildren;
 
     // The last scan of the folder (for folders).
     // Removed again when the folder is fully synced.
     std::unique_ptr<vector<FSNode>> lastFolderScan;
 
+    // Bumped whenever lastFolderScan is replaced, cleared or extended, so that
+    // rows computed from it earlier can tell (a new scan may reuse its address).
+    uint32_t folderScanGeneration = 0;
+
     // If we can regenerate the filsystem data at this node, no need to store it, save some RAM
     void clearRegeneratableFolderScan(SyncPath& fullPath, vector<SyncRow>& childRows);
 
@@ -873,6 +962,9 @@ struct MEGA_API LocalNode
     // True if this subtree requires syncing.
     bool syncRequired() const;
 
+    // True if recursiveSync() needs to visit this node, or its parent needs to hear from it.
+    bool flaggedForSync() const;
+
     // Pass any TREE_ACTION_SUBTREE flags on to child nodes, so we can clear the flag at this level
     void propagateAnySubtreeFlags();
 
@@ -905,6 +997,7 @@ struct MEGA_API LocalNode
 
     // return child node by name   (TODO: could this be ambiguous, especially with case insensitive filesystems)
     LocalNode* childbyname(LocalPath*);
+    LocalNode* childbyshortname(const LocalPath&) const;
 
     LocalNode* findChildWithSyncedNodeHandle(NodeHandle h);
 
@@ -934,6 +1027,11 @@ struct MEGA_API LocalNode
     LocalNode(Sync*);
     void init(nodetype_t, LocalNode*, const LocalPath&, std::unique_ptr<LocalPath>);
 
+    // LocalNodes live in their Sync's arena, so are created with new (sync) LocalNode(&sync)
+    static void* operator new(size_t size, Sync& sync);
+    static void operator delete(void* p, Sync& sync);
+    static void operator delete(void* p);
+
     bool serialize(string*) const override;
     static unique_ptr<LocalNode> unserialize(Sync& sync, const string& source, uint32_t& parentID);
 
@@ -117,7 +117,9 @@ public:
                              map<LocalPath, FSNode>& known,
                              std::vector<FSNode>& results,
                              bool followSymLinks,
-                             unsigned& nFingerprinted) override;
+                             unsigned& nFingerprinted,
+                             FingerprintCache* fingerprintCache,
+                             const string& filesystem) override;
 
 #ifdef ENABLE_SYNC
     bool fsStableIDs(const LocalPath& path) const override;
@@ -167,6 +169,7 @@ public:
     bool ftruncate(m_off_t size) override;
 
     bool sysread(byte *, unsigned, m_off_t) override;
+    void sysprefetch(m_off_t, unsigned) override;
     bool sysstat(m_time_t*, m_off_t*, FSLogging) override;
     bool sysopen(bool async, FSLogging) override;
     void sysclose() override;
@@ -196,6 +199,8 @@ private:
 
 #define FSACCESS_CLASS LinuxFileSystemAccess
 
+class LinuxDirNotify;
+
 class LinuxFileSystemAccess
   : public PosixFileSystemAccess
 {
@@ -226,6 +231,26 @@ private:
     // Tracks which nodes are associated with what inotify handle.
     WatchMap mWatches;
 
+#ifdef USE_FANOTIFY
+    // read fanotify events and queue them for processing
+    void checkFanotifyEvents(int& result);
+
+    // inode of the directory an event's handle refers to (UNDEF if it's gone)
+    handle fanotifyDirectory(LinuxDirNotify& notifier, ::file_handle& fh);
+
+    // Fanotify descriptor, if we may monitor whole filesystems (needs CAP_SYS_ADMIN).
+    int mFanotifyFd = -EINVAL;
+
+    // Tracks which nodes of fanotify-monitored syncs are associated with what directory inode.
+    WatchMap mFanotifyWatches;
+
+    // Directory inodes by filesystem id and handle, so most events need no system call.
+    std::unordered_map<string, handle> mFanotifyHandles;
+
+    // How many notifiers rely on each marked filesystem.
+    map<uint64_t, unsigned> mFanotifyMarks;
+#endif // USE_FANOTIFY
+
 #endif // ENABLE_SYNC
 }; // LinuxFileSystemAccess
 
@@ -250,12 +275,36 @@ public:
 
     void removeWatch(WatchMapIterator entry);
 
+    void logWatchStats() const override;
+
 private:
+    friend class LinuxFileSystemAccess;
+
     // The LFSA that we are associated with.
     LinuxFileSystemAccess& mOwner;
 
     // Our position in our owner's mNotifiers list.
     list<DirNotify*>::iterator mNotifiersIt;
+
+    // Folders watched so far, and the time it took.
+    size_t mWatchesAdded = 0;
+    std::chrono::steady_clock::duration mWatchTime{};
+
+#ifdef USE_FANOTIFY
+    // Start receiving the events of the filesystem containing the sync.
+    bool markFilesystem(const LocalPath& rootPath);
+
+    bool usesFanotify() const
+    {
+        return mRootFd >= 0;
+    }
+
+    // Open on the sync root while its filesystem is marked, to resolve handles on it.
+    int mRootFd = -1;
+
+    // The filesystem id fanotify reports events with.
+    uint64_t mFilesystemId = 0;
+#endif // USE_FANOTIFY
 }; // LinuxDirNotify
 
 #endif // ENABLE_SYNC
@@ -111,6 +111,14 @@
     #include <sys/inotify.h>
 #endif
 
+#if defined(ENABLE_FANOTIFY) && defined(__linux__)
+    #include <sys/fanotify.h>
+    // filesystem marks reporting directory handles and names need Linux 5.9 headers
+    #if defined(USE_INOTIFY) && defined(FAN_REPORT_DFID_NAME)
+        #define USE_FANOTIFY 1
+    #endif
+#endif
+
 #include <sys/select.h>
 
 #include <curl/curl.h>
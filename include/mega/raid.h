@@ -142,6 +142,18 @@ namespace mega {
         // returns how far we are through the file on average, including uncombined data
         m_off_t progress() const;
 
+        // buffer allocations and data copies made on the way from the http buffers to the output
+        struct BufferStats
+        {
+            uint64_t buffersAdopted = 0;    // http buffers taken over without copying
+            uint64_t buffersAllocated = 0;  // output buffers allocated to combine raid parts
+            uint64_t bytesAllocated = 0;
+            uint64_t bytesCopied = 0;       // bytes copied into output buffers (raid only)
+            uint64_t bytesRecopied = 0;     // of those, bytes held over and copied a second time
+        };
+
+        const BufferStats& bufferStats() const;
+
         RaidBufferManager();
         ~RaidBufferManager();
 
@@ -206,6 +218,8 @@ namespace mega {
         // For test hooks, disable avoid small requests when we need a lower speed and trigger 404/403/timeout errors
         bool mDisableAvoidSmallLastRequest;
 
+        BufferStats mBufferStats;
+
         // take raid input part buffers and combine to form the asyncoutputbuffers
         void combineRaidParts(unsigned connectionNum);
         FilePiece* combineRaidParts(size_t partslen, size_t bufflen, m_off_t filepos, FilePiece& prevleftoverchunk);
@@ -23,6 +23,7 @@
 #define MEGA_SYNC_H 1
 
 #include <future>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "db.h"
@@ -218,6 +219,11 @@ struct PerSyncStats
     int32_t numUploads = 0;
     int32_t numDownloads = 0;
 
+    // Scan throughput, accumulated by the ScanService
+    uint64_t foldersScanned = 0;
+    uint64_t filesFingerprinted = 0;
+    uint64_t scanMilliseconds = 0;
+
     bool operator==(const PerSyncStats&);
     bool operator!=(const PerSyncStats&);
 };
@@ -420,6 +426,83 @@ public:
     MegaClient* client() const { return mClient; }
 };
 
+// Compact copy of a sync's state cache, written when the sync shuts down cleanly, so the
+// next start can map one file and decrypt it in one go instead of reading and decrypting
+// the database row by row.  The records are the ones the database holds, encrypted and
+// authenticated as a whole with the sync key.  A snapshot is only trusted while the
+// database file is exactly as it was when the snapshot was written, and is removed once read.
+class StateCacheSnapshot
+{
+public:
+    // Identifies the state of the database file.  Invalid if the file is missing,
+    // or if SQLite still has changes for it in the write-ahead log.
+    struct Origin
+    {
+        m_off_t dbSize = -1;
+        m_time_t dbMtime = 0;
+
+        bool valid() const { return dbSize >= 0; }
+        bool operator==(const Origin& other) const { return dbSize == other.dbSize && dbMtime == other.dbMtime; }
+        bool operator!=(const Origin& other) const { return !(*this == other); }
+    };
+
+    static Origin originOf(FileSystemAccess& fsAccess, const LocalPath& dbPath);
+
+    // the snapshot of a database lives next to it
+    static LocalPath pathFor(const LocalPath& dbPath);
+
+    class Writer
+    {
+    public:
+        // Records go to a temporary file, which commit() renames to path.
+        Writer(FileSystemAccess& fsAccess, const LocalPath& path, SymmCipher& key, PrnGen& rng, const Origin& origin, uint32_t nextid);
+
+        MEGA_DISABLE_COPY_MOVE(Writer)
+
+        // removes the temporary file unless committed
+        ~Writer();
+
+        // crc is the statecacheRecordCrc() of the record
+        bool add(uint32_t dbid, uint32_t crc, const string& record);
+        bool commit();
+
+        // bytes written so far, including the header once committed
+        m_off_t size() const { return mPos; }
+
+    private:
+        bool flush();
+
+        FileSystemAccess& mFsAccess;
+        SymmCipher& mKey;
+        LocalPath mPath;
+        LocalPath mTmpPath;
+        unique_ptr<FileAccess> mFile;
+        string mPlain;
+        string mCipher;
+        m_off_t mPos;
+        byte mIv[12];
+        bool mFailed = false;
+        bool mCommitted = false;
+    };
+
+    // Map, authenticate and decrypt the snapshot at path.  Fails if there is none, or if it
+    // does not describe the database in the state given by expected.
+    bool load(const LocalPath& path, SymmCipher& key, const Origin& expected);
+
+    // next record, in the order they were written
+    bool next(uint32_t& dbid, uint32_t& crc, string& record);
+
+    // the database's DbTable::nextid when the snapshot was written
+    uint32_t nextid() const { return mNextid; }
+
+    static const unsigned HEADER_SIZE = 52;  // magic, version, reserved, payload size, IV and tag
+
+private:
+    string mPayload;
+    CacheableReader mReader{mPayload};
+    uint32_t mNextid = 0;
+};
+
 class MEGA_API Sync
 {
 public:
@@ -439,6 +522,13 @@ public:
     // track how recent the last received fs noticiation was
     dstime lastFSNotificationTime = 0;
 
+    // where this sync's LocalNodes are allocated (declared ahead of localroot so it's constructed first)
+    unique_ptr<LocalNodeArena, LocalNodeArena::Releaser> mLocalNodeArena;
+    LocalNodeArena& localNodeArena() { return *mLocalNodeArena; }
+
+    // Log how much memory this sync's LocalNodes take
+    void reportLocalNodeMemory() const;
+
     // root of local filesystem tree, holding the sync's root folder.  Never null except briefly in the destructor (to ensure efficient db usage)
     unique_ptr<LocalNode> localroot;
 
@@ -470,6 +560,13 @@ public:
     // Caches all synchronized LocalNode
     void cachenodes();
 
+    // checksum of a serialized LocalNode, stored with it in state cache snapshots
+    static uint32_t statecacheRecordCrc(const string& record);
+
+    // identifies a serialized LocalNode, so we can tell whether it changed since we wrote it
+    // without keeping a copy of it
+    static StateCacheDigest statecacheRecordDigest(const string& record);
+
     // change state, signal to application
     void changestate(SyncError newSyncError, bool newEnableFlag, bool notifyApp, bool keepSyncDb);
 
@@ -494,6 +591,28 @@ public:
         vector<FSNode>& fsNodes,
         vector<SyncRow>& inferredRows) const;
 
+    // Child rows of a folder, computed before recursiveSync() visits it,
+    // together with the vectors that the rows point into.
+    struct PrecomputedChildRows
+    {
+        // State the rows were computed from.
+        uint64_t localTreeEpoch = 0;
+        bool wasSynced = false;
+        uint32_t folderScanGeneration = 0;
+
+        vector<SyncRow> childRows;
+        vector<FSNode> fsInferredChildren;
+        vector<FSNode> fsChildren;
+        vector<CloudNode> cloudChildren;
+    };
+
+    // Folders with fewer rows than this in total are not worth handing to other threads.
+    static constexpr size_t PRECOMPUTE_CHILD_ROWS_MIN = 2048;
+
+    // Computes, in parallel, the child rows of those folders among rows[begin, end)
+    // that recursiveSync() is going to visit without rescanning.
+    void precomputeChildRows(vector<SyncRow>& rows, size_t begin, size_t end, map<LocalNode*, PrecomputedChildRows>& results);
+
     struct PerFolderLogSummaryCounts
     {
         // in order to not swamp the logs, but still be able to diagnose.
@@ -504,7 +623,17 @@ public:
         bool report(string&);
     };
 
-    bool recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedCloudNode, bool belowRemovedFsNode, unsigned depth);
+    bool recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedCloudNode, bool belowRemovedFsNode, unsigned depth, PrecomputedChildRows* precomputed = nullptr);
+
+    // Orders two LocalNodes (with up to date sort keys) the way computeSyncTriplets() orders their rows.
+    int compareChildNames(const LocalNode& lhs, const LocalNode& rhs) const;
+
+    // Rows for just the flagged children of a folder that has nothing to do itself, inferred like
+    // inferRegeneratableTriplets() does.  False if they can't be, or the folder has no index entry.
+    bool inferFlaggedChildRows(const SyncRow& row, vector<CloudNode>& cloudNodes, vector<FSNode>& fsNodes, vector<SyncRow>& rows);
+
+    // Removes the children of a node that has just become excluded.
+    void dropExcludedContent(LocalNode& node);
     bool syncItem_checkMoves(SyncRow& row, SyncRow& parentRow, SyncPath& fullPath, bool belowRemovedCloudNode, bool belowRemovedFsNode);
     bool syncItem_checkFilenameClashes(SyncRow& row, SyncRow& parentRow, SyncPath& fullPath);
     bool syncItem_checkBackupCloudNameClash(SyncRow& row, SyncRow& parentRow, SyncPath& fullPath);
@@ -569,11 +698,37 @@ public:
     // state cache table
     unique_ptr<DbTable> statecachetable;
 
+    // all state cache changes are written through this, once the table is open
+    unique_ptr<DbTableAsyncWriter> mStateCacheWriter;
+
+    // close (or delete) the state cache once changes already queued are written.
+    // Call cachenodes() first to include LocalNodes still waiting in insertq.
+    void closeStateCache(bool removeDatabase);
+
+    // state caches with fewer LocalNodes than this are not snapshotted on shutdown
+    static const size_t STATECACHE_SNAPSHOT_MIN_NODES = 20000;
+
     // move file or folder to localdebris
     bool movetolocaldebris(const LocalPath& localpath);
     bool movetolocaldebrisSubfolder(const LocalPath& localpath, const LocalPath& targetFolder, bool logFailReason, bool& failedDueToTargetExists);
 
 private:
+    // log state cache write volume once an hour (or now, if forced)
+    void reportStateCacheWrites(bool force);
+
+    // write a snapshot of the LocalNodes stored in the (just closed) state cache
+    void writeStateCacheSnapshot(uint32_t nextid);
+
+    // load the snapshot's nodes into tmap, if it matches the database
+    bool readStateCacheSnapshot(const StateCacheSnapshot::Origin& dbOrigin, idlocalnode_map& tmap, unsigned& numLocalNodes);
+
+    // where the state cache database is (empty if the sync has none)
+    LocalPath mStateCacheDbPath;
+
+    DbTableAsyncWriter::Stats mStateCacheReported;
+    uint64_t mStateCacheUnchangedSkipped = 0;
+    std::chrono::steady_clock::time_point mStateCacheReportStart = std::chrono::steady_clock::now();
+
     string mLastDailyDateTimeDebrisName;
     unsigned mLastDailyDateTimeDebrisCounter = 0;
     bool mScanningWasComplete{};
@@ -593,6 +748,35 @@ public:
     // How deep is this sync's cloud root?
     unsigned mCurrentRootDepth = 0;
 
+    // Incremented whenever LocalNodes are added, removed, moved or get new scanned fsids,
+    // so that precomputed child rows can tell whether they are still current.
+    uint64_t mLocalTreeEpoch = 0;
+
+    // Index of the way down to flagged LocalNodes: for a folder, those of its children that are
+    // flagged for sync or lead to such nodes (plus perhaps some that no longer do, they are pruned
+    // when the folder is visited).  With it recursiveSync() goes straight through folders that
+    // have nothing to do themselves, so its cost follows the changes rather than the tree size.
+    std::unordered_map<const LocalNode*, std::unordered_set<LocalNode*>> mFlaggedChildren;
+
+    // Records the way down to a node whose flags were raised.
+    void noteFlagged(LocalNode& node);
+
+    // Removes a node from its parent's entry.
+    void unlinkFlagged(LocalNode& node);
+
+    // Removes a node from its parent's entry and drops its own.
+    void forgetFlagged(LocalNode& node);
+
+    // Drops the entries of a node and of the nodes recorded below it.
+    void forgetFlaggedBelow(const LocalNode& node);
+
+    // Takes over a node's entry when it moves here from another sync.
+    void adoptFlagged(Sync& from, const LocalNode& node);
+
+    // Folders recursiveSync() evaluated row by row, and folders it only passed through.
+    std::atomic<uint64_t> mFoldersEvaluated{0};
+    std::atomic<uint64_t> mFoldersPassedThrough{0};
+
     Sync(UnifiedSync&, const string&, const LocalPath&, bool, const string& logname, SyncError& e);
     ~Sync();
 
@@ -640,7 +824,7 @@ public:
     shared_ptr<SyncThreadsafeState> threadSafeState;
 
 protected :
-    void readstatecache();
+    void readstatecache(const StateCacheSnapshot::Origin& dbOrigin);
 
 private:
     LocalPath mLocalPath;
@@ -1495,12 +1679,32 @@ public:
     // total number of LocalNode objects (only updated by syncs thread)
     std::atomic<int32_t> totalLocalNodes{0};
 
+    // bytes reserved by the LocalNode arenas of all syncs (only updated by syncs thread)
+    std::atomic<uint64_t> totalLocalNodeBytes{0};
+
     // backup rework implies certain restrictions that can be skipped
     // by setting this flag
     bool mBackupRestrictionsEnabled = true;
 
     std::atomic<int> completedPassCount{0};
 
+    // What each pass checks about a sync's root folder before syncing it.
+    struct RootProbe
+    {
+        bool opened = false;
+        nodetype_t type = TYPE_UNKNOWN;
+        handle fsid = UNDEF;
+        fsfp_t fingerprint;
+    };
+
+    static RootProbe probeRoot(FileSystemAccess& fsAccess, const LocalPath& path, FSLogging logging);
+
+    // Probing only touches the filesystem, so from ROOT_PROBE_PARALLEL_MIN roots on they are probed
+    // in parallel: a pass then waits for the slowest mount rather than for all of them in turn.
+    // Fewer are probed on the calling thread, as starting threads on every pass would cost more.
+    static constexpr size_t ROOT_PROBE_PARALLEL_MIN = 4;
+    static vector<RootProbe> probeRoots(FileSystemAccess& fsAccess, const vector<pair<LocalPath, FSLogging>>& roots);
+
 private:
 
     // functions for internal use on-thread only
@@ -1739,6 +1943,10 @@ private:
     // used to asynchronously perform scans.
     unique_ptr<ScanService> mScanService;
 
+    // writes the state caches of all our syncs; started when the first one opens its cache
+    shared_ptr<DbTableWriterThread> mStateCacheWriterThread;
+    shared_ptr<DbTableWriterThread> stateCacheWriterThread();
+
     // Separate key to avoid threading issues
     SymmCipher syncKey;
 
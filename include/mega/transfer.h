@@ -89,7 +89,81 @@ public:
 };
 #endif
 
+// Merges the putnodes of uploads that complete close together and target the
+// same parent folder into a single multi-node putnodes.  Each node's result
+// is fanned back out to the completion (or app callback, by tag) of the
+// upload that produced it, exactly as if it had been sent on its own.
+class MEGA_API PutnodesCoalescer
+{
+public:
+    // default time a batch may wait for further completions before being sent
+    static const dstime DEFAULT_WINDOW_DS = 2;
+
+    // upper bound of new nodes in a single putnodes command
+    static const size_t MAX_BATCH_NODES = 1000;
+
+    explicit PutnodesCoalescer(MegaClient& client);
+
+    // queue the new node of a completed upload
+    // (sent immediately if coalescing is disabled or the batch is full)
+    void add(NodeHandle target,
+             VersioningOption vo,
+             putsource_t source,
+             bool canChangeVault,
+             NewNode&& newnode,
+             int tag,
+             CommandPutNodes::Completion&& completion);
+
+    // send the batches whose window has elapsed (all of them if force is set)
+    void flush(bool force);
+
+    // bring forward the next wakeup to the earliest batch deadline
+    void update(dstime* nds) const;
+
+    // drop pending batches without sending them, failing each upload's
+    // putnodes with API_EINCOMPLETE (local logout)
+    void clear();
+
+    bool empty() const;
+
+    // 0 disables coalescing: every upload gets its own putnodes
+    void setWindow(dstime ds);
+
+private:
+    struct Entry
+    {
+        int tag;
+        CommandPutNodes::Completion completion;
+    };
+
+    struct Batch
+    {
+        dstime deadline = NEVER;
+        vector<NewNode> nodes;
+        vector<Entry> entries;
+    };
+
+    using BatchKey = std::tuple<NodeHandle, VersioningOption, putsource_t, bool>;
+
+    void send(const BatchKey& key, Batch&& batch);
+
+    MegaClient& mClient;
+    map<BatchKey, Batch> mBatches;
+    dstime mWindow = DEFAULT_WINDOW_DS;
+};
+
 // pending/active up/download ordered by file fingerprint (size - mtime - sparse CRC)
+// Transfer resume progress record: only the chunk MACs that changed since the previous record.
+// Applied on top of the transfer's full record (CACHEDTRANSFER) when loading the cache.
+struct MEGA_API TransferChunkmacDelta : public Cacheable
+{
+    uint32_t transferDbid = 0;
+    string macs;
+
+    bool serialize(string*) const override;
+    static bool unserialize(const string&, TransferChunkmacDelta&);
+};
+
 struct MEGA_API Transfer : public FileFingerprint
 {
     // PUT or GET
@@ -134,6 +208,13 @@ struct MEGA_API Transfer : public FileFingerprint
 
     chunkmac_map chunkmacs;
 
+    // the progress records written since the full transfer record (chunkmacs tracks what changed
+    // since the last one), so progress can be persisted without rewriting the whole record
+    vector<uint32_t> chunkmacDeltaDbids;
+
+    // after this many progress records, the next one rewrites the full transfer record instead
+    static const size_t MAX_CHUNKMAC_DELTAS = 64;
+
     // upload handle for file attribute attachment (only set if file attribute queued)
     UploadHandle uploadhandle;
 
@@ -45,6 +45,54 @@ public:
     inline operator FileAccess* () { return fa.get(); }
 };
 
+// Upload chunks being read and encrypted while all connections of a slot are busy, in file order.
+// A connection that becomes free takes the front one instead of starting its own read,
+// so it can post straight away rather than waiting on the disk and the cipher.
+class MEGA_API UploadReadAheadQueue
+{
+public:
+    struct Chunk
+    {
+        std::shared_ptr<HttpReqXfer> req;
+        AsyncIOContext* asyncIO = nullptr;  // the read, until the chunk is handed to encryption
+        m_off_t size = 0;
+    };
+
+    using EncryptFunction = std::function<void(const std::shared_ptr<HttpReqXfer>&, m_off_t pos, m_off_t npos)>;
+
+    UploadReadAheadQueue(size_t maxChunks, m_off_t maxBytes);
+
+    // reads still in progress are waited for and discarded
+    ~UploadReadAheadQueue();
+
+    // whether a further chunk of this size fits the budget (a single chunk always does)
+    bool hasRoomFor(m_off_t size) const;
+
+    void push(Chunk&& chunk);
+
+    // hand the chunks whose read completed to encrypt().  A failed read is discarded along with
+    // every chunk queued behind it, and its position returned (-1 if none failed), so the slot
+    // can rewind to it and have a connection read it again as its own
+    m_off_t advance(const EncryptFunction& encrypt);
+
+    // remove the earliest chunk.  Its read is still in chunk.asyncIO if not encrypted yet
+    bool take(Chunk& chunk);
+
+    // discard every chunk, waiting for (and cancelling) reads in progress
+    void clear();
+
+    size_t size() const;
+    m_off_t bufferedBytes() const;
+
+    MEGA_DISABLE_COPY_MOVE(UploadReadAheadQueue)
+
+private:
+    std::deque<Chunk> mChunks;
+    size_t mMaxChunks;
+    m_off_t mMaxBytes;
+    m_off_t mBufferedBytes = 0;
+};
+
 namespace stats
 {
 // Transfer stats
@@ -105,6 +153,10 @@ struct MEGA_API TransferSlot
     // maximum gap between chunks for uploads
     static const m_off_t MAX_GAP_SIZE;
 
+    // memory budget and max number of upload chunks read and encrypted ahead of the connections
+    static const m_off_t MAX_UPLOAD_READAHEAD_SIZE;
+    static const size_t MAX_UPLOAD_READAHEAD_CHUNKS;
+
     m_off_t maxRequestSize;
 
     m_off_t progressreported;
@@ -212,6 +264,23 @@ private:
 
     // returns true if connection haven't received data recently (set incrementErrors) or if slower than other connections (reset incrementErrors)
     bool testForSlowRaidConnection(unsigned connectionNum, bool& incrementErrors);
+
+    // upload chunks read and encrypted ahead of the connections
+    UploadReadAheadQueue mUploadReadAhead;
+
+    // start reading further chunks, within the read-ahead budget and MAX_GAP_SIZE of the earliest
+    // chunk the connections hold
+    void fillUploadReadAhead(MegaClient* client);
+
+    // send read-ahead chunks whose read finished to encryption.  Returns true if a read failed,
+    // in which case the transfer position was rewound to it
+    bool advanceUploadReadAhead(MegaClient* client);
+
+    // give the earliest read-ahead chunk to this connection, if any
+    bool takeUploadReadAhead(int connectionNum);
+
+    // encrypt an upload chunk already read into req->out on a worker thread, leaving it REQ_PREPARED
+    void encryptUploadChunk(MegaClient* client, const std::shared_ptr<HttpReqXfer>& req, m_off_t pos, m_off_t npos);
 };
 
 } // namespace
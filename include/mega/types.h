@@ -568,7 +568,8 @@ typedef multimap<uint32_t, LocalNode*> idlocalnode_map;
 #ifdef USE_INOTIFY
 
 using WatchEntry = pair<LocalNode*, handle>;
-using WatchMap = multimap<int, WatchEntry>;
+// keyed by inotify watch descriptor, or by directory inode where whole filesystems are monitored
+using WatchMap = multimap<int64_t, WatchEntry>;
 using WatchMapIterator = WatchMap::iterator;
 
 #endif // USE_INOTIFY
@@ -900,8 +901,19 @@ namespace CodeCounter
             }
             return s;
         }
+
+        // for blocks timed elsewhere, eg. on another thread (the caller serializes access)
+        inline void record(high_resolution_clock::duration d)
+        {
+            ++starts;
+            ++finishes;
+            ++count;
+            timeSpent += d;
+            if (d > longest) longest = d;
+        }
 #else
         ScopeStats(std::string s) {}
+        inline void record(high_resolution_clock::duration) {}
 #endif
     };
 
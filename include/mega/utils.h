@@ -544,12 +544,26 @@ class chunkmac_map
 
     m_off_t progresscontiguous = 0;
 
+    // entries changed since markPersisted(), so a progress record only has to look at those.
+    // mDirtyAll is set when the change can't be expressed entry by entry (eg. after clear())
+    set<m_off_t> mDirty;
+    bool mDirtyAll = true;
 
 public:
     int64_t macsmac(SymmCipher *cipher);
     int64_t macsmac_gaps(SymmCipher *cipher, size_t g1, size_t g2, size_t g3, size_t g4);
     void serialize(string& d) const;
     bool unserialize(const char*& ptr, const char* end);
+
+    // For incremental resume records: serialize only the entries that are new or changed since
+    // markPersisted().  Entries dropped by the macsmac consolidation are implied by
+    // macsmacSoFarPos.  Returns false if the change can't be expressed that way (eg. after clear()).
+    bool serializeDelta(string& d) const;
+    bool unserializeDelta(const char*& ptr, const char* end);
+
+    // the current state has been written out, in full or as a delta
+    void markPersisted();
+
     void calcprogress(m_off_t size, m_off_t& chunkpos, m_off_t& completedprogress, m_off_t* sumOfPartialChunks = nullptr);
     m_off_t nextUnprocessedPosFrom(m_off_t pos);
     m_off_t expandUnprocessedPiece(m_off_t pos, m_off_t npos, m_off_t fileSize, m_off_t maxReqSize);
@@ -563,6 +577,9 @@ public:
     void debugLogOuputMacs();
 
     void ctr_encrypt(m_off_t chunkid, SymmCipher *cipher, byte *chunkstart, unsigned chunksize, m_off_t startpos, int64_t ctriv, bool finishesChunk);
+
+    // encrypt several whole chunks at once (lane pos is the chunk id), their MACs computed side by side
+    void ctr_encrypt_chunks(SymmCipher *cipher, SymmCipher::CtrLane* chunks, unsigned count, int64_t ctriv, bool finishesChunks);
     void ctr_decrypt(m_off_t chunkid, SymmCipher *cipher, byte *chunkstart, unsigned chunksize, m_off_t startpos, int64_t ctriv, bool finishesChunk);
 
     size_t size() const
@@ -574,11 +591,15 @@ public:
         mMacMap.clear();
         macsmacSoFarPos = -1;
         progresscontiguous = 0;
+        mDirty.clear();
+        mDirtyAll = true;
     }
     void swap(chunkmac_map& other) {
         mMacMap.swap(other.mMacMap);
         std::swap(macsmacSoFarPos, other.macsmacSoFarPos);
         std::swap(progresscontiguous, other.progresscontiguous);
+        mDirty.swap(other.mDirty);
+        std::swap(mDirtyAll, other.mDirtyAll);
     }
 };
 
@@ -659,10 +680,17 @@ struct FileAccess;
 struct InputStreamAccess;
 class SymmCipher;
 
-std::pair<bool, int64_t> generateMetaMac(SymmCipher &cipher, FileAccess &ifAccess, const int64_t iv);
+// Files of at least METAMAC_PARALLEL_MIN_SIZE are read sequentially in large blocks by the calling
+// thread while up to maxThreads worker threads compute the chunk MACs (0: one per core, at most 8)
+constexpr m_off_t METAMAC_PARALLEL_MIN_SIZE = 32 * 1024 * 1024;
+std::pair<bool, int64_t> generateMetaMac(SymmCipher &cipher, FileAccess &ifAccess, const int64_t iv, unsigned maxThreads = 0);
 
 std::pair<bool, int64_t> generateMetaMac(SymmCipher &cipher, InputStreamAccess &isAccess, const int64_t iv);
 
+// Calls f(i) for every i in [0, count), spread over up to maxThreads threads (0: one per core, at
+// most 8). The calling thread takes part, so all calls are made even if no thread can be started.
+void parallelFor(size_t count, unsigned maxThreads, const std::function<void(size_t)>& f);
+
 bool CompareLocalFileMetaMacWithNodeKey(FileAccess* fa, const std::string& nodeKey, int type);
 
 bool CompareLocalFileMetaMacWithNode(FileAccess* fa, Node* node);
@@ -91,7 +91,8 @@ public:
     static void emptydirlocal(const LocalPath&, dev_t = 0);
 
     ScanResult directoryScan(const LocalPath& path, handle expectedFsid,
-        map<LocalPath, FSNode>& known, std::vector<FSNode>& results, bool followSymlinks, unsigned& nFingerprinted) override;
+        map<LocalPath, FSNode>& known, std::vector<FSNode>& results, bool followSymlinks, unsigned& nFingerprinted,
+        FingerprintCache* fingerprintCache, const string& filesystem) override;
 
     WinFileSystemAccess();
     ~WinFileSystemAccess();
@@ -7164,6 +7164,21 @@ public:
     */
     virtual int getDownloadCount() const = 0;
 
+  /** @brief Indicates how many folders have been scanned for this sync since the app started
+    */
+    virtual long long getScannedFolderCount() const = 0;
+
+  /** @brief Indicates how many files have been fingerprinted while scanning this sync
+    */
+    virtual long long getFingerprintedFileCount() const = 0;
+
+  /** @brief Indicates the time, in milliseconds, spent scanning folders of this sync
+    *
+    * Together with getScannedFolderCount and getFingerprintedFileCount this gives
+    * the scan throughput (folders/s and files fingerprinted/s) of the sync.
+    */
+    virtual long long getScanTime() const = 0;
+
   /** @brief Make a copy of this object
     * You take ownership of the result.
     */
@@ -16337,6 +16352,21 @@ class MegaApi
          */
         void setUploadMethod(int method);
 
+        /**
+         * @brief Set the maximum memory kept for reuse by released transfer buffers
+         *
+         * Buffers carrying transfer data are pooled by size, so later transfers reuse them
+         * instead of allocating and freeing large blocks continuously. This limits the memory
+         * that idle pooled buffers may keep. Buffers released beyond it go back to the heap,
+         * and idle buffers above a lowered limit are freed straight away.
+         *
+         * The pool is shared by all MegaApi instances in the process.
+         * The default value is 128 MB. A value <= 0 disables pooling.
+         *
+         * @param bytes Maximum bytes of idle transfer buffers
+         */
+        void setMaxIdleTransferBufferBytes(long long bytes);
+
         /**
          * @brief Set the maximum download speed in bytes per second
          *
@@ -17138,6 +17168,16 @@ class MegaApi
          */
         long long getNumLocalNodes();
 
+        /**
+         * @brief Get the memory reserved for the local nodes of all syncs, in bytes
+         *
+         * Divided by getNumLocalNodes this gives the average cost of each synced file or folder,
+         * which helps size the memory needed for very large syncs.
+         *
+         * @return Bytes reserved for local nodes
+         */
+        long long getLocalNodeMemory();
+
         /**
          * @brief
          * Query the sync engine to find out what is causing sync stalls
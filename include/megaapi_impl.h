@@ -358,6 +358,10 @@ protected:
     enum scanFolder_result { scanFolder_succeeded, scanFolder_cancelled, scanFolder_failed };
     scanFolder_result scanFolder(Tree& tree, LocalPath& localPath, uint32_t& foldercount, uint32_t& filecount);
 
+    // Fingerprints of files already seen by an earlier upload or sync are taken from here.
+    shared_ptr<FingerprintCache> mFingerprintCache;
+    string mFilesystem;
+
     // Gathers up enough (but not too many) newnode records that are all descendants of a single folder
     // and can be created in a single operation.
     // Called from the main thread just before we send the next set of folder creation commands.
@@ -1498,6 +1502,9 @@ public:
     int getFileCount() const override { return stats.numFiles; }
     int getUploadCount() const override { return stats.numUploads; }
     int getDownloadCount() const override { return stats.numDownloads; }
+    long long getScannedFolderCount() const override { return static_cast<long long>(stats.foldersScanned); }
+    long long getFingerprintedFileCount() const override { return static_cast<long long>(stats.filesFingerprinted); }
+    long long getScanTime() const override { return static_cast<long long>(stats.scanMilliseconds); }
     MegaSyncStatsPrivate *copy() const override { return new MegaSyncStatsPrivate(*this); }
 };
 
@@ -3329,6 +3336,7 @@ class MegaApiImpl : public MegaApp
         void setMaxConnections(int direction, int connections, MegaRequestListener* listener = NULL);
         void setDownloadMethod(int method);
         void setUploadMethod(int method);
+        void setMaxIdleTransferBufferBytes(long long bytes);
         bool setMaxDownloadSpeed(m_off_t bpslimit);
         bool setMaxUploadSpeed(m_off_t bpslimit);
         int getMaxDownloadSpeed();
@@ -3476,6 +3484,7 @@ class MegaApiImpl : public MegaApp
         void setLegacyExclusionUpperSizeLimit(unsigned long long limit);
         MegaError* exportLegacyExclusionRules(const char* absolutePath);
         long long getNumLocalNodes();
+        long long getLocalNodeMemory();
         int isNodeSyncable(MegaNode *megaNode);
         MegaError *isNodeSyncableWithError(MegaNode* node);
         bool isScanning();
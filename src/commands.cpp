@@ -1238,7 +1238,7 @@ CommandPutNodes::CommandPutNodes(MegaClient* client,
 }
 
 // add new nodes and handle->node handle mapping
-void CommandPutNodes::removePendingDBRecordsAndTempFiles()
+void CommandPutNodes::removePendingDBRecordsAndTempFiles(MegaClient* client, int tag)
 {
     pendingdbid_map::iterator it = client->pendingtcids.find(tag);
     if (it != client->pendingtcids.end())
@@ -1282,7 +1282,7 @@ void CommandPutNodes::performAppCallback(Error e,
 
 bool CommandPutNodes::procresult(Result r, JSON& json)
 {
-    removePendingDBRecordsAndTempFiles();
+    removePendingDBRecordsAndTempFiles(client, tag);
 
     if (r.wasErrorOrOK())
     {
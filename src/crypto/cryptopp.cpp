@@ -21,6 +21,18 @@
 
 #include "mega.h"
 
+#include <cryptopp/cpu.h>
+
+#if defined(ENABLE_HW_CRC32) && (CRYPTOPP_BOOL_X86 || CRYPTOPP_BOOL_X64)
+#define MEGA_HW_CRC32 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define MEGA_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#else
+#define MEGA_TARGET_PCLMUL
+#endif
+#endif
+
 namespace mega {
 #ifndef htobe64
 #define htobe64(x) (((uint64_t)htonl((uint32_t)((x) >> 32))) | (((uint64_t)htonl((uint32_t)x)) << 32))
@@ -65,27 +77,111 @@ byte SymmCipher::zeroiv[BLOCKSIZE] = {};
 
 void SymmCipher::setkey(const byte* newkey, int type)
 {
-    memcpy(key, newkey, KEYLENGTH);
+    byte k[KEYLENGTH];
+
+    memcpy(k, newkey, KEYLENGTH);
 
     if (!type)
     {
-        xorblock(newkey + KEYLENGTH, key);
+        xorblock(newkey + KEYLENGTH, k);
+    }
+
+    // same key as before: whatever was expanded for it still applies
+    if (mKeySet && !mForeignKeyedModes && !memcmp(k, key, KEYLENGTH))
+    {
+        return;
     }
 
+    memcpy(key, k, KEYLENGTH);
+
+    // ECB is keyed straight away: it is cheap to expand and ciphers shared
+    // read-only across threads use it concurrently (the other modes keep
+    // per-call state, so they are never shared)
     aesecb_e.SetKey(key, KEYLENGTH);
     aesecb_d.SetKey(key, KEYLENGTH);
 
-    aescbc_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aescbc_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    mKeySet = true;
+    mUnkeyedModes = MODE_ALL & ~(MODE_ECB_E | MODE_ECB_D);
+    mForeignKeyedModes = 0;
+}
+
+SymmCipher* SymmCipher::threadLocalCipher(const byte* newkey, int type)
+{
+    struct Slot
+    {
+        SymmCipher cipher;
+        uint64_t lastUsed = 0;
+    };
+
+    // allocated on demand: most threads never need more than a couple of keys
+    thread_local std::vector<std::unique_ptr<Slot>> slots;
+    thread_local uint64_t useCounter = 0;
+
+    byte k[KEYLENGTH];
+    memcpy(k, newkey, KEYLENGTH);
+
+    if (!type)
+    {
+        xorblock(newkey + KEYLENGTH, k);
+    }
+
+    Slot* slot = nullptr;
+    for (auto& s : slots)
+    {
+        if (!memcmp(s->cipher.key, k, KEYLENGTH))
+        {
+            slot = s.get();
+            break;
+        }
+    }
+
+    if (!slot)
+    {
+        if (slots.size() < THREAD_CIPHER_CACHE_SIZE)
+        {
+            slots.push_back(std::make_unique<Slot>());
+            slot = slots.back().get();
+        }
+        else
+        {
+            slot = std::min_element(slots.begin(), slots.end(),
+                                    [](const std::unique_ptr<Slot>& a, const std::unique_ptr<Slot>& b)
+                                    {
+                                        return a->lastUsed < b->lastUsed;
+                                    })->get();
+        }
+    }
+
+    // no-op if the slot already holds this key, unless modes were keyed externally
+    slot->cipher.setkey(k);
+    slot->lastUsed = ++useCounter;
+    return &slot->cipher;
+}
 
-    aesccm8_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aesccm8_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+SymmCipher* SymmCipher::threadLocalCipher(const std::string& key)
+{
+    if (key.size() == FILENODEKEYLENGTH || key.size() == FOLDERNODEKEYLENGTH)
+    {
+        return threadLocalCipher((const byte*)key.data(), (key.size() == FOLDERNODEKEYLENGTH) ? FOLDERNODE : FILENODE);
+    }
+    return nullptr;
+}
+
+void SymmCipher::expandKeys(unsigned modes)
+{
+    if (modes & MODE_CBC_E) aescbc_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    if (modes & MODE_CBC_D) aescbc_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
 
-    aesccm16_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aesccm16_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    if (modes & MODE_CCM8_E) aesccm8_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    if (modes & MODE_CCM8_D) aesccm8_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
 
-    aesgcm_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
-    aesgcm_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    if (modes & MODE_CCM16_E) aesccm16_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    if (modes & MODE_CCM16_D) aesccm16_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+
+    if (modes & MODE_GCM_E) aesgcm_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+    if (modes & MODE_GCM_D) aesgcm_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+
+    mUnkeyedModes &= ~modes;
 }
 
 bool SymmCipher::setkey(const string* key)
@@ -104,6 +200,7 @@ bool SymmCipher::cbc_encrypt_with_key(const std::string& plain, std::string& cip
 {
     try
     {
+        foreignKeyed(MODE_CBC_E);
         aescbc_e.SetKeyWithIV(key, keylen, iv ? iv: zeroiv);
         StringSource ss(plain, true, new StreamTransformationFilter(aescbc_e, new StringSink(cipher)));
         return true;
@@ -119,6 +216,7 @@ bool SymmCipher::cbc_decrypt_with_key(const std::string& cipher, std::string& pl
 {
     try
     {
+        foreignKeyed(MODE_CBC_D);
         aescbc_d.SetKeyWithIV(key, keylen, iv ? iv: zeroiv);
         StringSource ss(cipher, true, new StreamTransformationFilter(aescbc_d, new StringSink(plain)));
         return true;
@@ -134,6 +232,7 @@ bool SymmCipher::cbc_encrypt(byte* data, size_t len, const byte* iv)
 {
     try
     {
+        keyModes(MODE_CBC_E);
         aescbc_e.Resynchronize(iv ? iv : zeroiv);
         aescbc_e.ProcessData(data, data, len);
         return true;
@@ -149,6 +248,7 @@ bool SymmCipher::cbc_decrypt(byte* data, size_t len, const byte* iv)
 {
     try
     {
+        keyModes(MODE_CBC_D);
         aescbc_d.Resynchronize(iv ? iv : zeroiv);
         aescbc_d.ProcessData(data, data, len);
         return true;
@@ -173,6 +273,7 @@ bool SymmCipher::cbc_encrypt_pkcs_padding(const string *data, const byte *iv, st
     try
     {
         // Update IV.
+        keyModes(MODE_CBC_E);
         aescbc_e.Resynchronize(iv ? iv : zeroiv);
 
         // Create sink.
@@ -213,6 +314,7 @@ bool SymmCipher::cbc_decrypt_pkcs_padding(const std::string* data, const byte* i
         using Transformation = StreamTransformationFilter;
 
         // Update IV.
+        keyModes(MODE_CBC_D);
         aescbc_d.Resynchronize(iv ? iv : zeroiv);
 
         // Create sink.
@@ -257,6 +359,7 @@ bool SymmCipher::cbc_decrypt_pkcs_padding(const byte* data,
         using Transformation = StreamTransformationFilter;
 
         // Update IV.
+        keyModes(MODE_CBC_D);
         aescbc_d.Resynchronize(iv ? iv : zeroiv);
 
         // Create sink.
@@ -307,6 +410,7 @@ bool SymmCipher::ccm_encrypt(const string *data, const byte *iv, unsigned ivlen,
     {
         if (taglen == 16)
         {
+            keyModes(MODE_CCM16_E);
             aesccm16_e.Resynchronize(iv, ivlen);
             aesccm16_e.SpecifyDataLengths(0, data->size(), 0);
             StringSource ss(*data, true, new AuthenticatedEncryptionFilter(aesccm16_e, new StringSink(*result)));
@@ -314,6 +418,7 @@ bool SymmCipher::ccm_encrypt(const string *data, const byte *iv, unsigned ivlen,
         }
         else if (taglen == 8)
         {
+            keyModes(MODE_CCM8_E);
             aesccm8_e.Resynchronize(iv, ivlen);
             aesccm8_e.SpecifyDataLengths(0, data->size(), 0);
             StringSource ss(*data, true, new AuthenticatedEncryptionFilter(aesccm8_e, new StringSink(*result)));
@@ -339,6 +444,7 @@ bool SymmCipher::ccm_decrypt(const string *data, const byte *iv, unsigned ivlen,
     {
         if (taglen == 16)
         {
+            keyModes(MODE_CCM16_D);
             aesccm16_d.Resynchronize(iv, ivlen);
             aesccm16_d.SpecifyDataLengths(0, data->size() - taglen, 0);
             StringSource ss(*data, true, new AuthenticatedDecryptionFilter(aesccm16_d, new StringSink(*result)));
@@ -346,6 +452,7 @@ bool SymmCipher::ccm_decrypt(const string *data, const byte *iv, unsigned ivlen,
         }
         else if (taglen == 8)
         {
+            keyModes(MODE_CCM8_D);
             aesccm8_d.Resynchronize(iv, ivlen);
             aesccm8_d.SpecifyDataLengths(0, data->size() - taglen, 0);
             StringSource ss(*data, true, new AuthenticatedDecryptionFilter(aesccm8_d, new StringSink(*result)));
@@ -370,6 +477,7 @@ bool SymmCipher::gcm_encrypt(const string *data, const byte *iv, unsigned ivlen,
 
     try
     {
+        keyModes(MODE_GCM_E);
         aesgcm_e.Resynchronize(iv, ivlen);
         StringSource ss(*data, true, new AuthenticatedEncryptionFilter(aesgcm_e, new StringSink(*result), false, taglen));
     }
@@ -414,11 +522,13 @@ bool SymmCipher::gcm_encrypt(const byte* data, const size_t datasize, const byte
         if (!key || !keylen)
         {
             // resynchronizes with the provided IV
+            keyModes(MODE_GCM_E);
             aesgcm_e.Resynchronize(iv, static_cast<int>(ivlen));
         }
         else
         {
             // resynchronizes with the provided Key and IV
+            foreignKeyed(MODE_GCM_E);
             aesgcm_e.SetKeyWithIV(key, keylen, iv, ivlen);
         }
 
@@ -458,6 +568,7 @@ bool SymmCipher::gcm_decrypt(const string *data, const byte *iv, unsigned ivlen,
 
     try
     {
+        keyModes(MODE_GCM_D);
         aesgcm_d.Resynchronize(iv, ivlen);
         StringSource ss(*data, true, new AuthenticatedDecryptionFilter(aesgcm_d, new StringSink(*result), taglen));
     }
@@ -488,11 +599,13 @@ bool SymmCipher::gcm_decrypt(const byte* data, const size_t datalen, const byte*
         if (!key || !keylength)
         {
             // resynchronizes with provided IV
+            keyModes(MODE_GCM_D);
             aesgcm_d.Resynchronize(iv, static_cast<int>(ivlen));
         }
         else
         {
             // resynchronizes with the provided Key and IV
+            foreignKeyed(MODE_GCM_D);
             aesgcm_d.SetKeyWithIV(key, keylength, iv, ivlen);
         }
 
@@ -566,6 +679,185 @@ bool SymmCipher::gcm_decrypt_with_key(const byte* data, const size_t datalen, co
                        key, keylength, tag, taglen, iv, ivlen, result, resultSize);
 }
 
+bool SymmCipher::gcm_encrypt_buffer(const byte* in, byte* out, size_t len, const byte* iv, unsigned ivlen, byte* tag, unsigned taglen)
+{
+    try
+    {
+        keyModes(MODE_GCM_E);
+        aesgcm_e.EncryptAndAuthenticate(out, tag, taglen, iv, int(ivlen), nullptr, 0, in, len);
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-GCM encryption: " << e.GetWhat();
+        return false;
+    }
+    return true;
+}
+
+bool SymmCipher::gcm_decrypt_buffer(const byte* in, byte* out, size_t len, const byte* iv, unsigned ivlen, const byte* tag, unsigned taglen)
+{
+    try
+    {
+        keyModes(MODE_GCM_D);
+        if (aesgcm_d.DecryptAndVerify(out, tag, taglen, iv, int(ivlen), nullptr, 0, in, len))
+        {
+            return true;
+        }
+        LOG_err << "Failed AES-GCM decryption: integrity check failure";
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-GCM decryption: " << e.GetWhat();
+    }
+    return false;
+}
+
+bool SymmCipher::ccm_encrypt_buffer(const byte* in, byte* out, size_t len, const byte* iv, unsigned ivlen, byte* tag, unsigned taglen)
+{
+    try
+    {
+        if (taglen == 16)
+        {
+            keyModes(MODE_CCM16_E);
+            aesccm16_e.EncryptAndAuthenticate(out, tag, taglen, iv, int(ivlen), nullptr, 0, in, len);
+            return true;
+        }
+        else if (taglen == 8)
+        {
+            keyModes(MODE_CCM8_E);
+            aesccm8_e.EncryptAndAuthenticate(out, tag, taglen, iv, int(ivlen), nullptr, 0, in, len);
+            return true;
+        }
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-CCM encryption: " << e.GetWhat();
+    }
+    return false;
+}
+
+bool SymmCipher::ccm_decrypt_buffer(const byte* in, byte* out, size_t len, const byte* iv, unsigned ivlen, const byte* tag, unsigned taglen)
+{
+    try
+    {
+        bool verified = false;
+        if (taglen == 16)
+        {
+            keyModes(MODE_CCM16_D);
+            verified = aesccm16_d.DecryptAndVerify(out, tag, taglen, iv, int(ivlen), nullptr, 0, in, len);
+        }
+        else if (taglen == 8)
+        {
+            keyModes(MODE_CCM8_D);
+            verified = aesccm8_d.DecryptAndVerify(out, tag, taglen, iv, int(ivlen), nullptr, 0, in, len);
+        }
+        else
+        {
+            return false;
+        }
+
+        if (verified)
+        {
+            return true;
+        }
+        LOG_err << "Failed AES-CCM decryption: integrity check failure";
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-CCM decryption: " << e.GetWhat();
+    }
+    return false;
+}
+
+bool SymmCipher::gcm_encrypt_init(const byte* iv, unsigned ivlen)
+{
+    try
+    {
+        keyModes(MODE_GCM_E);
+        aesgcm_e.Resynchronize(iv, int(ivlen));
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-GCM encryption: " << e.GetWhat();
+        return false;
+    }
+    return true;
+}
+
+bool SymmCipher::gcm_encrypt_update(const byte* in, byte* out, size_t len)
+{
+    try
+    {
+        aesgcm_e.ProcessData(out, in, len);
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-GCM encryption: " << e.GetWhat();
+        return false;
+    }
+    return true;
+}
+
+bool SymmCipher::gcm_encrypt_final(byte* tag, unsigned taglen)
+{
+    try
+    {
+        aesgcm_e.TruncatedFinal(tag, taglen);
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-GCM encryption: " << e.GetWhat();
+        return false;
+    }
+    return true;
+}
+
+bool SymmCipher::gcm_decrypt_init(const byte* iv, unsigned ivlen)
+{
+    try
+    {
+        keyModes(MODE_GCM_D);
+        aesgcm_d.Resynchronize(iv, int(ivlen));
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-GCM decryption: " << e.GetWhat();
+        return false;
+    }
+    return true;
+}
+
+bool SymmCipher::gcm_decrypt_update(const byte* in, byte* out, size_t len)
+{
+    try
+    {
+        aesgcm_d.ProcessData(out, in, len);
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-GCM decryption: " << e.GetWhat();
+        return false;
+    }
+    return true;
+}
+
+bool SymmCipher::gcm_decrypt_final(const byte* tag, unsigned taglen)
+{
+    try
+    {
+        if (aesgcm_d.TruncatedVerify(tag, taglen))
+        {
+            return true;
+        }
+        LOG_err << "Failed AES-GCM decryption: integrity check failure";
+    }
+    catch (CryptoPP::Exception const& e)
+    {
+        LOG_err << "Failed AES-GCM decryption: " << e.GetWhat();
+    }
+    return false;
+}
+
 void SymmCipher::serializekeyforjs(string *d)
 {
     char invertedkey[BLOCKSIZE];
@@ -687,7 +979,7 @@ void SymmCipher::ctr_crypt(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv,
 {
     assert(!(pos & (KEYLENGTH - 1)));
 
-    byte ctr[BLOCKSIZE], tmp[BLOCKSIZE];
+    byte ctr[CTR_BATCH_BLOCKS * BLOCKSIZE], keystream[CTR_BATCH_BLOCKS * BLOCKSIZE];
 
     MemAccess::set<int64_t>(ctr,ctriv);
     setint64(pos / BLOCKSIZE, ctr + sizeof ctriv);
@@ -700,41 +992,114 @@ void SymmCipher::ctr_crypt(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv,
 
     while ((int)len > 0)
     {
-        if (encrypt)
+        // the keystream for several blocks is generated in one call; the MAC still goes block by block
+        unsigned blocks = std::min<unsigned>(CTR_BATCH_BLOCKS, (len + BLOCKSIZE - 1) / BLOCKSIZE);
+        for (unsigned b = 1; b < blocks; b++)
         {
-            if(mac)
-            {
-                xorblock(data, mac);
-                ecb_encrypt(mac);
-            }
-
-            ecb_encrypt(ctr, tmp);
-            xorblock(tmp, data);
+            memcpy(ctr + b * BLOCKSIZE, ctr + (b - 1) * BLOCKSIZE, BLOCKSIZE);
+            incblock(ctr + b * BLOCKSIZE);
         }
-        else
-        {
-            ecb_encrypt(ctr, tmp);
-            xorblock(tmp, data);
+        ecb_encrypt(ctr, keystream, blocks * BLOCKSIZE);
 
-            if (mac)
+        for (unsigned b = 0; b < blocks; b++)
+        {
+            if (encrypt)
             {
-                if (len >= (unsigned)BLOCKSIZE)
+                if(mac)
                 {
                     xorblock(data, mac);
+                    ecb_encrypt(mac);
                 }
-                else
+
+                xorblock(keystream + b * BLOCKSIZE, data);
+            }
+            else
+            {
+                xorblock(keystream + b * BLOCKSIZE, data);
+
+                if (mac)
                 {
-                    xorblock(data, mac, len);
+                    if (len >= (unsigned)BLOCKSIZE)
+                    {
+                        xorblock(data, mac);
+                    }
+                    else
+                    {
+                        xorblock(data, mac, len);
+                    }
+
+                    ecb_encrypt(mac);
                 }
+            }
 
-                ecb_encrypt(mac);
+            len -= BLOCKSIZE;
+            data += BLOCKSIZE;
+        }
+
+        memcpy(ctr, ctr + (blocks - 1) * BLOCKSIZE, BLOCKSIZE);
+        incblock(ctr);
+    }
+}
+
+void SymmCipher::ctr_encrypt_lanes(const CtrLane* lanes, unsigned count, ctr_iv ctriv)
+{
+    assert(count <= MAX_CTR_LANES);
+
+    // per step: the MAC state of each active lane, followed by its counter block
+    byte work[2 * MAX_CTR_LANES * BLOCKSIZE];
+    byte macs[MAX_CTR_LANES * BLOCKSIZE];
+    unsigned blocks[MAX_CTR_LANES];
+    unsigned maxblocks = 0;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        assert(!(lanes[i].pos & (KEYLENGTH - 1)));
+
+        MemAccess::set<int64_t>(macs + i * BLOCKSIZE, ctriv);
+        memcpy(macs + i * BLOCKSIZE + sizeof ctriv, macs + i * BLOCKSIZE, sizeof ctriv);
+
+        blocks[i] = (lanes[i].len + BLOCKSIZE - 1) / BLOCKSIZE;
+        maxblocks = std::max(maxblocks, blocks[i]);
+    }
+
+    unsigned active[MAX_CTR_LANES];
+    for (unsigned b = 0; b < maxblocks; b++)
+    {
+        unsigned n = 0;
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (b < blocks[i])
+            {
+                active[n++] = i;
             }
         }
 
-        len -= BLOCKSIZE;
-        data += BLOCKSIZE;
+        for (unsigned k = 0; k < n; k++)
+        {
+            unsigned i = active[k];
+            byte* mac = work + k * BLOCKSIZE;
+            byte* ctr = work + (n + k) * BLOCKSIZE;
 
-        incblock(ctr);
+            memcpy(mac, macs + i * BLOCKSIZE, BLOCKSIZE);
+            xorblock(lanes[i].data + size_t(b) * BLOCKSIZE, mac);
+
+            MemAccess::set<int64_t>(ctr, ctriv);
+            setint64(lanes[i].pos / BLOCKSIZE + b, ctr + sizeof ctriv);
+        }
+
+        ecb_encrypt(work, nullptr, 2 * n * BLOCKSIZE);
+
+        for (unsigned k = 0; k < n; k++)
+        {
+            unsigned i = active[k];
+            memcpy(macs + i * BLOCKSIZE, work + k * BLOCKSIZE, BLOCKSIZE);
+            xorblock(work + (n + k) * BLOCKSIZE, lanes[i].data + size_t(b) * BLOCKSIZE);
+        }
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        memcpy(lanes[i].mac, macs + i * BLOCKSIZE, BLOCKSIZE);
     }
 }
 
@@ -1126,13 +1491,170 @@ void HashSHA256::get(std::string *retStr)
     hash.Final((byte*)retStr->data());
 }
 
+namespace {
+
+std::atomic<bool> crc32AccelerationEnabled{true};
+
+#ifdef MEGA_HW_CRC32
+// byte at a time CRC32 (reflected polynomial 0xEDB88320) for the bytes the folding below leaves over
+uint32_t crc32Bytewise(uint32_t crc, const byte* data, size_t len)
+{
+    static const auto table = []()
+    {
+        std::array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+            {
+                c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    while (len--)
+    {
+        crc = table[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// CRC32 of len bytes (len >= 64 and a multiple of 16) by folding 64 bytes at a time with carry-less
+// multiplication and a final Barrett reduction, as in Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction". The constants are those for the bit-reflected polynomial.
+MEGA_TARGET_PCLMUL uint32_t crc32Folded(uint32_t crc, const byte* buf, size_t len)
+{
+    alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+    buf += 64;
+    len -= 64;
+
+    // fold four 128-bit lanes in parallel
+    while (len >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    // fold the lanes into one
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // remaining 16 byte blocks
+    while (len >= 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf))), x5);
+        buf += 16;
+        len -= 16;
+    }
+
+    // 128 to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+#endif
+
+} // namespace
+
+HashCRC32::HashCRC32()
+    : mAccelerated(accelerated() && crc32AccelerationEnabled)
+{
+}
+
+bool HashCRC32::accelerated()
+{
+#ifdef MEGA_HW_CRC32
+    static const bool supported = CryptoPP::HasCLMUL() && CryptoPP::HasSSE41();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+void HashCRC32::setAccelerationEnabled(bool enabled)
+{
+    crc32AccelerationEnabled = enabled;
+}
+
 void HashCRC32::add(const byte* data, unsigned len)
 {
+#ifdef MEGA_HW_CRC32
+    if (mAccelerated)
+    {
+        size_t folded = len >= 64 ? (len & ~15u) : 0;
+        if (folded)
+        {
+            mCrc = crc32Folded(mCrc, data, folded);
+        }
+        mCrc = crc32Bytewise(mCrc, data + folded, len - folded);
+        return;
+    }
+#endif
     hash.Update(data, len);
 }
 
 void HashCRC32::get(byte* out)
 {
+    if (mAccelerated)
+    {
+        // same layout as CryptoPP::CRC32::Final(): the final value in native byte order
+        uint32_t crc = mCrc ^ 0xFFFFFFFF;
+        memcpy(out, &crc, sizeof(crc));
+        mCrc = 0xFFFFFFFF;
+        return;
+    }
     hash.Final(out);
 }
 
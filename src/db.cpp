@@ -132,6 +132,231 @@ void DbTable::checkCommitter(DBTableTransactionCommitter*)
     assert(mTransactionCommitter);
 }
 
+DbTableWriterThread::DbTableWriterThread()
+{
+    mThread = std::thread([this]() { loop(); });
+}
+
+DbTableWriterThread::~DbTableWriterThread()
+{
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+        assert(mScheduled.empty());
+        mTerminating = true;
+    }
+
+    mCondition.notify_all();
+    mThread.join();
+}
+
+void DbTableWriterThread::schedule(DbTableAsyncWriter& writer)
+{
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+        mScheduled.push_back(&writer);
+    }
+
+    mCondition.notify_all();
+}
+
+void DbTableWriterThread::loop()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    for (;;)
+    {
+        mCondition.wait(lock, [this]() { return mTerminating || !mScheduled.empty(); });
+
+        if (mScheduled.empty())
+        {
+            return;
+        }
+
+        auto writer = mScheduled.front();
+        mScheduled.pop_front();
+
+        lock.unlock();
+        writer->writePending();
+        lock.lock();
+    }
+}
+
+DbTableAsyncWriter::DbTableAsyncWriter(unique_ptr<DbTable>& table, shared_ptr<DbTableWriterThread> thread)
+  : mTable(table)
+  , mNextid(table ? table->nextid : 0)
+  , mThread(std::move(thread))
+{
+    assert(mThread);
+}
+
+DbTableAsyncWriter::~DbTableAsyncWriter()
+{
+    // the worker must be done with us before we go
+    drain();
+
+    if (mTable)
+    {
+        mTable->nextid = mNextid;
+    }
+}
+
+void DbTableAsyncWriter::put(uint32_t id, string&& data)
+{
+    auto result = mQueued.insert_or_assign(id, std::move(data));
+    mQueuedCoalesced += !result.second;
+}
+
+void DbTableAsyncWriter::put(uint32_t type, Cacheable& record, string&& data, SymmCipher* key)
+{
+    // As DbTable::put() does, but numbering from our own nextid: the table is the worker's.
+    if (!PaddedCBC::encrypt(mTable->rng, &data, key))
+    {
+        LOG_err << "Failed to CBC encrypt data";
+    }
+
+    if (!record.dbid)
+    {
+        uint32_t previousNextid = mNextid;
+        record.dbid = (mNextid += DbTable::IDSPACING) | type;
+        if (mNextid < previousNextid)
+        {
+            LOG_err << "Overflow at nextid " << type;
+            if (mTable->mDBErrorCallBack)
+            {
+                mTable->mDBErrorCallBack(DBError::DB_ERROR_INDEX_OVERFLOW);
+            }
+            assert(mNextid >= previousNextid);
+        }
+    }
+
+    put(record.dbid, std::move(data));
+}
+
+void DbTableAsyncWriter::del(uint32_t id)
+{
+    auto result = mQueued.insert_or_assign(id, std::nullopt);
+    mQueuedCoalesced += !result.second;
+}
+
+void DbTableAsyncWriter::flush()
+{
+    if (mQueued.empty())
+    {
+        return;
+    }
+
+    bool schedule = false;
+
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+
+        mStats.changesCoalesced += mQueuedCoalesced;
+
+        if (!mScheduled)
+        {
+            mScheduled = true;
+            schedule = true;
+        }
+
+        if (mPending.empty())
+        {
+            mPending.swap(mQueued);
+        }
+        else
+        {
+            // The worker is still busy with an earlier batch: newer changes win.
+            for (auto& change : mQueued)
+            {
+                auto result = mPending.insert_or_assign(change.first, std::move(change.second));
+                mStats.changesCoalesced += !result.second;
+            }
+            mQueued.clear();
+        }
+    }
+
+    mQueuedCoalesced = 0;
+
+    if (schedule)
+    {
+        mThread->schedule(*this);
+    }
+}
+
+void DbTableAsyncWriter::drain()
+{
+    flush();
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock, [this]() { return !mScheduled; });
+}
+
+auto DbTableAsyncWriter::stats() const -> Stats
+{
+    std::lock_guard<std::mutex> guard(mMutex);
+    return mStats;
+}
+
+void DbTableAsyncWriter::writePending()
+{
+    Batch batch;
+
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+        batch.swap(mPending);
+    }
+
+    write(batch);
+
+    std::lock_guard<std::mutex> guard(mMutex);
+
+    if (!mPending.empty())
+    {
+        // flushed again while we were writing: go to the back of the line
+        // so other tables get their turn
+        mThread->schedule(*this);
+        return;
+    }
+
+    // drain() (and so our destructor) may return as soon as we let go of the mutex
+    mScheduled = false;
+    mCondition.notify_all();
+}
+
+void DbTableAsyncWriter::write(Batch& batch)
+{
+    if (!mTable)
+    {
+        return;
+    }
+
+    Stats written;
+
+    {
+        DBTableTransactionCommitter committer(mTable);
+
+        for (auto& change : batch)
+        {
+            if (change.second)
+            {
+                written.bytesWritten += change.second->size();
+                ++written.recordsWritten;
+                mTable->put(change.first, &*change.second);
+            }
+            else
+            {
+                ++written.recordsDeleted;
+                mTable->del(change.first);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(mMutex);
+    mStats.bytesWritten += written.bytesWritten;
+    mStats.recordsWritten += written.recordsWritten;
+    mStats.recordsDeleted += written.recordsDeleted;
+    ++mStats.batches;
+}
+
 const int DbAccess::LEGACY_DB_VERSION = 13;
 const int DbAccess::DB_VERSION = DbAccess::LEGACY_DB_VERSION + 1;
 const int DbAccess::LAST_DB_VERSION_WITHOUT_NOD = 12;
@@ -423,17 +423,33 @@ void File::sendPutnodesOfUpload(MegaClient* client, UploadHandle fileAttrMatchHa
             }
         }
 
-        client->reqs.add(new CommandPutNodes(client,
-                                             th,
-                                             NULL,
-                                             mVersioningOption,
-                                             std::move(newnodes),
-                                             tag,
-                                             source,
-                                             nullptr,
-                                             std::move(completion),
-                                             canChangeVault,
-                                             {})); // customerIpPort
+        if (syncxfer)
+        {
+            // sync uploads go out straight away, so they stay ordered with the moves
+            // and deletions the sync sends afterwards for the same tree
+            client->reqs.add(new CommandPutNodes(client,
+                                                 th,
+                                                 NULL,
+                                                 mVersioningOption,
+                                                 std::move(newnodes),
+                                                 tag,
+                                                 source,
+                                                 nullptr,
+                                                 std::move(completion),
+                                                 canChangeVault,
+                                                 {})); // customerIpPort
+        }
+        else
+        {
+            // uploads finishing together into the same folder share a single putnodes
+            client->putnodesCoalescer.add(th,
+                                          mVersioningOption,
+                                          source,
+                                          canChangeVault,
+                                          std::move(newnodes.front()),
+                                          tag,
+                                          std::move(completion));
+        }
     }
 }
 
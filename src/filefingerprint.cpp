@@ -19,6 +19,9 @@
  * program.
  */
 
+#include <algorithm>
+
+#include "mega/db.h"
 #include "mega/filesystem.h"
 #include "mega/serialize64.h"
 #include "mega/base64.h"
@@ -189,26 +192,27 @@ bool FileFingerprint::genfingerprint(FileAccess* fa, bool ignoremtime)
     {
         // large file: sparse coverage, four sparse CRC32s
         HashCRC32 crc32;
-        byte block[4 * sizeof crc];
-        const unsigned blocks = MAXFULL / unsigned(sizeof block * crc.size());
+        const unsigned blocksize = 4 * sizeof crc;
+        const unsigned blocks = MAXFULL / unsigned(blocksize * crc.size());
 
-        for (unsigned i = 0; i < crc.size(); i++)
+        // all the sparse blocks are requested together, one after another into buf
+        byte buf[MAXFULL];
+        m_off_t offsets[MAXFULL / blocksize];
+        for (unsigned n = 0; n < crc.size() * blocks; n++)
         {
-            for (unsigned j = 0; j < blocks; j++)
-            {
-                if (!fa->frawread(block, sizeof block,
-                                  (size - sizeof block)
-                                  * (i * blocks + j)
-                                  / (crc.size() * blocks - 1), true, FSLogging::logOnError))
-                {
-                    size = -1;
-                    fa->closef();
-                    return true;
-                }
+            offsets[n] = (size - blocksize) * n / (crc.size() * blocks - 1);
+        }
 
-                crc32.add(block, sizeof block);
-            }
+        if (!fa->frawreadmany(buf, blocksize, offsets, unsigned(crc.size() * blocks), true, FSLogging::logOnError))
+        {
+            size = -1;
+            fa->closef();
+            return true;
+        }
 
+        for (unsigned i = 0; i < crc.size(); i++)
+        {
+            crc32.add(buf + i * blocks * blocksize, blocks * blocksize);
             crc32.get((byte*)&crcval);
             newcrc[i] = htonl(crcval);
         }
@@ -425,5 +429,314 @@ bool FileFingerprintCmp::operator()(const FileFingerprint &a, const FileFingerpr
      return operator()(&a, &b);
 }
 
+FingerprintCache::FingerprintCache() = default;
+
+FingerprintCache::~FingerprintCache() = default;
+
+string FingerprintCache::filesystemKey(const fsfp_t& fsfp)
+{
+    // The legacy fingerprint alone isn't persistent on every filesystem.
+    if (!fsfp.uuid().empty())
+    {
+        return fsfp.uuid();
+    }
+
+    return fsfp ? std::to_string(fsfp.fingerprint()) : string();
+}
+
+bool FingerprintCache::lookup(const string& filesystem,
+                              handle fsid,
+                              m_off_t size,
+                              m_time_t mtime,
+                              m_time_t ctime,
+                              FileFingerprint& fingerprint)
+{
+    if (filesystem.empty() || fsid == UNDEF)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(mMutex);
+
+    auto it = mEntries.find(Key{filesystem, fsid});
+
+    if (it == mEntries.end()
+        || it->second.fingerprint.size != size
+        || it->second.fingerprint.mtime != mtime
+        || it->second.ctime != ctime)
+    {
+        ++mMisses;
+        return false;
+    }
+
+    // Age is only tracked to the day so that hits rarely need rewriting.
+    auto today = m_time() / 86400;
+    if (it->second.lastUsed != today)
+    {
+        it->second.lastUsed = today;
+        if (!it->second.dirty)
+        {
+            it->second.dirty = true;
+            ++mDirty;
+        }
+    }
+
+    fingerprint = it->second.fingerprint;
+    ++mHits;
+    return true;
+}
+
+void FingerprintCache::store(const string& filesystem,
+                             handle fsid,
+                             m_time_t ctime,
+                             const FileFingerprint& fingerprint)
+{
+    if (filesystem.empty() || fsid == UNDEF || !fingerprint.isvalid)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(mMutex);
+
+    auto& entry = mEntries[Key{filesystem, fsid}];
+
+    entry.key = Key{filesystem, fsid};
+    entry.ctime = ctime;
+    entry.lastUsed = m_time() / 86400;
+    entry.fingerprint = fingerprint;
+
+    if (!entry.dirty)
+    {
+        entry.dirty = true;
+        ++mDirty;
+    }
+}
+
+void FingerprintCache::attach(unique_ptr<DbTable> table, const SymmCipher& key)
+{
+    std::lock_guard<std::mutex> guard(mMutex);
+
+    mTable = std::move(table);
+    mKey = std::make_unique<SymmCipher>(key);
+
+    if (!mTable)
+    {
+        return;
+    }
+
+    uint32_t id;
+    string data;
+    size_t loaded = 0;
+
+    mTable->rewind();
+
+    while (mTable->next(&id, &data, mKey.get()))
+    {
+        Entry entry;
+
+        if (!Entry::unserialize(data, entry))
+        {
+            LOG_err << "Failed - fingerprint cache record read error";
+            mDeleted.push_back(id);
+            continue;
+        }
+
+        entry.dbid = id;
+
+        // Entries computed this session are more recent than what's on disk.
+        auto result = mEntries.emplace(entry.key, entry);
+        if (!result.second)
+        {
+            if (!result.first->second.dbid)
+            {
+                result.first->second.dbid = id;
+            }
+            else
+            {
+                mDeleted.push_back(id);
+            }
+            continue;
+        }
+
+        ++loaded;
+    }
+
+    LOG_debug << "Fingerprint cache loaded " << loaded << " entries";
+}
+
+void FingerprintCache::flush()
+{
+    vector<Entry> written;
+    vector<uint32_t> deleted;
+
+    // take what has to be written, so lookups and stores carry on meanwhile
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+
+        if (!mTable || (!mDirty && mDeleted.empty() && mEntries.size() <= MAX_ENTRIES))
+        {
+            return;
+        }
+
+        trim();
+
+        written.reserve(mDirty);
+        for (auto& i : mEntries)
+        {
+            if (i.second.dirty)
+            {
+                written.push_back(i.second);
+                i.second.dirty = false;
+            }
+        }
+
+        deleted.swap(mDeleted);
+        mDirty = 0;
+    }
+
+    // only this thread uses mTable and mKey
+    {
+        DBTableTransactionCommitter committer(mTable);
+
+        for (auto id : deleted)
+        {
+            mTable->del(id);
+        }
+
+        for (auto& entry : written)
+        {
+            mTable->checkCommitter(&committer);
+            mTable->put(0, &entry, mKey.get());
+        }
+    }
+
+    // remember the ids of new records, unless their entry went away meanwhile
+    std::lock_guard<std::mutex> guard(mMutex);
+
+    for (auto& entry : written)
+    {
+        auto it = mEntries.find(entry.key);
+        if (it == mEntries.end())
+        {
+            mDeleted.push_back(entry.dbid);
+        }
+        else if (!it->second.dbid)
+        {
+            it->second.dbid = entry.dbid;
+        }
+    }
+
+    LOG_verbose << "Fingerprint cache flushed " << written.size() << " entries, removed "
+                << deleted.size() << " (hits: " << mHits << ", misses: " << mMisses << ")";
+}
+
+void FingerprintCache::detach(bool remove)
+{
+    if (!remove)
+    {
+        flush();
+    }
+
+    std::lock_guard<std::mutex> guard(mMutex);
+
+    if (remove && mTable)
+    {
+        mTable->remove();
+    }
+
+    mTable.reset();
+    mKey.reset();
+    mEntries.clear();
+    mDeleted.clear();
+    mDirty = 0;
+}
+
+bool FingerprintCache::hasPendingWrites() const
+{
+    std::lock_guard<std::mutex> guard(mMutex);
+    return mDirty || !mDeleted.empty();
+}
+
+bool FingerprintCache::attached() const
+{
+    std::lock_guard<std::mutex> guard(mMutex);
+    return mTable != nullptr;
+}
+
+size_t FingerprintCache::size() const
+{
+    std::lock_guard<std::mutex> guard(mMutex);
+    return mEntries.size();
+}
+
+void FingerprintCache::trim()
+{
+    if (mEntries.size() <= MAX_ENTRIES)
+    {
+        return;
+    }
+
+    // Find the most recent day we'd still have to drop entries from.
+    vector<m_time_t> ages;
+    ages.reserve(mEntries.size());
+
+    for (auto& i : mEntries)
+    {
+        ages.push_back(i.second.lastUsed);
+    }
+
+    auto excess = mEntries.size() - MAX_ENTRIES;
+    std::nth_element(ages.begin(), ages.begin() + (excess - 1), ages.end());
+    auto cutoff = ages[excess - 1];
+
+    for (auto i = mEntries.begin(); i != mEntries.end() && excess; )
+    {
+        if (i->second.lastUsed > cutoff)
+        {
+            ++i;
+            continue;
+        }
+
+        if (i->second.dbid)
+        {
+            mDeleted.push_back(i->second.dbid);
+        }
+
+        if (i->second.dirty)
+        {
+            --mDirty;
+        }
+
+        i = mEntries.erase(i);
+        --excess;
+    }
+}
+
+bool FingerprintCache::Entry::serialize(string* d) const
+{
+    CacheableWriter w(*d);
+
+    w.serializestring(key.filesystem);
+    w.serializehandle(key.fsid);
+    w.serializei64(ctime);
+    w.serializei64(lastUsed);
+    fingerprint.serialize(d);
+    w.serializeexpansionflags();
+
+    return true;
+}
+
+bool FingerprintCache::Entry::unserialize(const string& d, Entry& entry)
+{
+    CacheableReader r(d);
+    unsigned char expansions[8];
+
+    return r.unserializestring(entry.key.filesystem)
+           && r.unserializehandle(entry.key.fsid)
+           && r.unserializei64(entry.ctime)
+           && r.unserializei64(entry.lastUsed)
+           && r.unserializefingerprint(entry.fingerprint)
+           && r.unserializeexpansionflags(expansions, 0);
+}
 
 } // mega
@@ -44,6 +44,7 @@ std::atomic<int> FileSystemAccess::mMinimumDirectoryPermissions{0700};
 std::atomic<int> FileSystemAccess::mMinimumFilePermissions{0600};
 
 CodeCounter::ScopeStats g_compareUtfTimings("compareUtfTimings");
+thread_local bool g_skipCompareUtfTimings = false;
 
 FSLogging FSLogging::noLogging(eNoLogging);
 FSLogging FSLogging::logOnError(eLogOnError);
@@ -129,7 +130,8 @@ int compareUtf(UnicodeCodepointIterator<CharT> first1, bool unescaping1,
                UnicodeCodepointIterator<CharU> first2, bool unescaping2,
                UnaryOperation transform)
 {
-    CodeCounter::ScopeTimer rst(g_compareUtfTimings);
+    std::optional<CodeCounter::ScopeTimer> rst;
+    if (!g_skipCompareUtfTimings) rst.emplace(g_compareUtfTimings);
 
 #ifdef _WIN32
     first1 = skipPrefix(first1);
@@ -391,6 +393,54 @@ int compareUtf(const LocalPath& s1, bool unescaping1, const LocalPath& s2, bool
         caseInsensitive ? Utils::toUpper: detail::identity);
 }
 
+void NameSortKey::compute(const string& name)
+{
+    for (unsigned char c : name)
+    {
+        // Escapes may decode to anything, and on Windows a leading
+        // backslash may be skipped as a path prefix: leave those to compareUtf.
+        if (c >= 0x80 || c == detail::escapeChar
+#ifdef _WIN32
+            || c == '\\'
+#endif // _WIN32
+            )
+        {
+            mKind = OTHER;
+            return;
+        }
+    }
+
+    mKind = ASCII;
+}
+
+int NameSortKey::compareAscii(const string& lhs, const string& rhs, bool caseInsensitive)
+{
+    if (!caseInsensitive)
+    {
+        return lhs.compare(rhs);
+    }
+
+    // Same folding as Utils::toUpper for the ASCII range.
+    auto fold = [](unsigned char c) {
+        return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : int(c);
+    };
+
+    auto n = std::min(lhs.size(), rhs.size());
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (lhs[i] != rhs[i])
+        {
+            auto d = fold(static_cast<unsigned char>(lhs[i])) - fold(static_cast<unsigned char>(rhs[i]));
+            if (d)
+            {
+                return d;
+            }
+        }
+    }
+
+    return lhs.size() < rhs.size() ? -1 : lhs.size() > rhs.size();
+}
+
 RemotePath::RemotePath(const string& path)
   : mPath(path)
 {
@@ -1384,6 +1434,75 @@ bool FileAccess::frawread(byte* dst, unsigned len, m_off_t pos, bool caller_open
     return r;
 }
 
+bool FileAccess::frawreadmany(byte* dst, unsigned len, const m_off_t* offsets, unsigned count, bool caller_opened, FSLogging fsl)
+{
+    if (!caller_opened && !openf(fsl))
+    {
+        return false;
+    }
+
+    // runs of pieces [first, last] served by one read
+    std::vector<std::pair<unsigned, unsigned>> spans;
+    for (unsigned i = 0; i < count; )
+    {
+        unsigned j = i;
+        while (j + 1 < count && offsets[j + 1] >= offsets[j])
+        {
+            // don't read much more than was asked for just to save a syscall
+            m_off_t spanlen = offsets[j + 1] + len - offsets[i];
+            m_off_t requested = m_off_t(j + 2 - i) * len;
+            if (spanlen > MAX_COALESCED_READ
+                || (spanlen > MIN_COALESCED_READ && spanlen > 2 * requested))
+            {
+                break;
+            }
+            ++j;
+        }
+        spans.emplace_back(i, j);
+        i = j + 1;
+    }
+
+    if (spans.size() > 1)
+    {
+        for (auto& span : spans)
+        {
+            sysprefetch(offsets[span.first], unsigned(offsets[span.second] + len - offsets[span.first]));
+        }
+    }
+
+    bool r = true;
+    std::vector<byte> spanbuf;
+    for (auto& span : spans)
+    {
+        m_off_t spanpos = offsets[span.first];
+        if (span.first == span.second)
+        {
+            r = sysread(dst + size_t(span.first) * len, len, spanpos);
+        }
+        else
+        {
+            spanbuf.resize(size_t(offsets[span.second] + len - spanpos));
+            r = sysread(spanbuf.data(), unsigned(spanbuf.size()), spanpos);
+            for (unsigned k = span.first; r && k <= span.second; k++)
+            {
+                memcpy(dst + size_t(k) * len, spanbuf.data() + (offsets[k] - spanpos), len);
+            }
+        }
+
+        if (!r)
+        {
+            break;
+        }
+    }
+
+    if (!caller_opened)
+    {
+        closef();
+    }
+
+    return r;
+}
+
 AsyncIOContext::~AsyncIOContext()
 {
     finish();
@@ -2032,6 +2151,137 @@ bool Notification::invalidated() const
 {
     return localnode == (LocalNode*)~0;
 }
+
+bool NotificationDeque::Key::operator==(const Key& k) const
+{
+    return n->localnode == k.n->localnode
+        && n->scanRequirement == k.n->scanRequirement
+        && n->path.localpath == k.n->path.localpath;
+}
+
+size_t NotificationDeque::KeyHash::operator()(const Key& k) const
+{
+    size_t h = std::hash<LocalPath::string_type>()(k.n->path.localpath);
+    h ^= std::hash<LocalNode*>()(k.n->localnode) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h ^ static_cast<size_t>(k.n->scanRequirement);
+}
+
+void NotificationDeque::index(Notification& n)
+{
+    mPending.emplace(Key{&n}, &n);
+
+    if (n.scanRequirement == Notification::FOLDER_NEEDS_SCAN_RECURSIVE)
+    {
+        mPendingRecursive.push_back(&n);
+    }
+}
+
+void NotificationDeque::unindex(const Notification& n)
+{
+    auto i = mPending.find(Key{&n});
+    if (i != mPending.end() && i->second == &n)
+    {
+        mPending.erase(i);
+    }
+
+    if (n.scanRequirement == Notification::FOLDER_NEEDS_SCAN_RECURSIVE)
+    {
+        auto j = std::find(mPendingRecursive.begin(), mPendingRecursive.end(), &n);
+        if (j != mPendingRecursive.end())
+        {
+            mPendingRecursive.erase(j);
+        }
+    }
+}
+
+Notification* NotificationDeque::subsumedBy(const Notification& n) const
+{
+    // A parent scan may be for a file, which must also be fingerprinted again:
+    // a recursive scan alone would not do that.
+    if (n.scanRequirement == Notification::NEEDS_PARENT_SCAN)
+    {
+        return nullptr;
+    }
+
+    const auto& path = n.path.localpath;
+
+    for (auto* r : mPendingRecursive)
+    {
+        if (r->localnode != n.localnode) continue;
+
+        const auto& base = r->path.localpath;
+
+        if (path.size() == base.size())
+        {
+            if (path == base)
+            {
+                return r;
+            }
+        }
+        else if (path.size() > base.size()
+                 && !path.compare(0, base.size(), base)
+                 && (base.empty()
+                     || base.back() == LocalPath::localPathSeparator
+                     || path[base.size()] == LocalPath::localPathSeparator))
+        {
+            return r;
+        }
+    }
+
+    return nullptr;
+}
+
+void NotificationDeque::pushBack(Notification&& n)
+{
+    std::lock_guard<std::mutex> g(m);
+    mStats.raw += n.repeats;
+
+    auto i = mPending.find(Key{&n});
+    if (i != mPending.end())
+    {
+        i->second->repeats += n.repeats;
+        mStats.repeats += n.repeats;
+        return;
+    }
+
+    if (!mPendingRecursive.empty() && subsumedBy(n))
+    {
+        mStats.subsumed += n.repeats;
+        return;
+    }
+
+    mNotifications.push_back(std::move(n));
+    index(mNotifications.back());
+}
+
+void NotificationDeque::popAll(std::deque<Notification>& batch)
+{
+    std::lock_guard<std::mutex> g(m);
+    mPending.clear();
+    mPendingRecursive.clear();
+    batch.clear();
+    batch.swap(mNotifications);
+}
+
+void NotificationDeque::replaceLocalNodePointers(LocalNode* check, LocalNode* newvalue)
+{
+    std::lock_guard<std::mutex> g(m);
+    for (auto& n : mNotifications)
+    {
+        if (n.localnode == check)
+        {
+            // Keyed on the old pointer, so stop coalescing into it.
+            unindex(n);
+            n.localnode = newvalue;
+        }
+    }
+}
+
+auto NotificationDeque::stats() -> Stats
+{
+    std::lock_guard<std::mutex> g(m);
+    return mStats;
+}
 #endif
 
 LocalPath FileNameGenerator::suffixWithN(FileAccess* fa, const LocalPath& localname)
@@ -2392,6 +2642,11 @@ bool isNetworkFilesystem(FileSystemType type)
 std::atomic<size_t> ScanService::mNumServices(0);
 std::unique_ptr<ScanService::Worker> ScanService::mWorker;
 std::mutex ScanService::mWorkerLock;
+unsigned ScanService::mPoolThreads = 0;
+unsigned ScanService::mScansPerDevice = 0;
+map<handle, ScanService::Metrics> ScanService::mMetrics;
+CodeCounter::ScopeStats ScanService::syncScanTime = { "folderScan" };
+std::mutex ScanService::mMetricsLock;
 
 ScanService::ScanService()
 {
@@ -2401,10 +2656,50 @@ ScanService::ScanService()
 
     if (++mNumServices == 1)
     {
-        mWorker.reset(new Worker());
+        // scanning is mostly waiting for the disk, so a few threads help even on small machines,
+        // while too many parallel scans of one disk just make it seek
+        unsigned threads = mPoolThreads;
+        if (!threads)
+        {
+            threads = std::clamp(std::thread::hardware_concurrency() / 2, 2u, 8u);
+        }
+        unsigned scansPerDevice = mScansPerDevice ? mScansPerDevice : 2;
+
+        mWorker.reset(new Worker(threads, scansPerDevice));
     }
 }
 
+void ScanService::setPoolSize(unsigned threads, unsigned scansPerDevice)
+{
+    std::lock_guard<std::mutex> lock(mWorkerLock);
+    mPoolThreads = threads;
+    mScansPerDevice = scansPerDevice;
+}
+
+auto ScanService::metrics(handle owner) -> Metrics
+{
+    std::lock_guard<std::mutex> lock(mMetricsLock);
+    auto it = mMetrics.find(owner);
+    return it != mMetrics.end() ? it->second : Metrics();
+}
+
+void ScanService::forgetMetrics(handle owner)
+{
+    std::lock_guard<std::mutex> lock(mMetricsLock);
+    mMetrics.erase(owner);
+}
+
+string ScanService::scanTimeReport(bool reset)
+{
+    // scans run on the pool's threads, which record their times under this lock
+    std::lock_guard<std::mutex> lock(mMetricsLock);
+#ifdef MEGA_MEASURE_CODE
+    return syncScanTime.report(reset);
+#else
+    return string();
+#endif
+}
+
 ScanService::~ScanService()
 {
     if (--mNumServices == 0)
@@ -2414,10 +2709,18 @@ ScanService::~ScanService()
     }
 }
 
-auto ScanService::queueScan(LocalPath targetPath, handle expectedFsid, bool followSymlinks, map<LocalPath, FSNode>&& priorScanChildren, shared_ptr<Waiter> waiter) -> RequestPtr
+auto ScanService::queueScan(LocalPath targetPath, handle expectedFsid, bool followSymlinks, map<LocalPath, FSNode>&& priorScanChildren, shared_ptr<Waiter> waiter,
+                            shared_ptr<FingerprintCache> fingerprintCache, string filesystem, handle owner) -> RequestPtr
 {
     // Create a request to represent the scan.
-    auto request = std::make_shared<ScanRequest>(std::move(waiter), followSymlinks, targetPath, expectedFsid, std::move(priorScanChildren));
+    auto request = std::make_shared<ScanRequest>(std::move(waiter), followSymlinks, targetPath, expectedFsid, std::move(priorScanChildren),
+                                                 std::move(fingerprintCache), std::move(filesystem), owner);
+
+    {
+        // The owner's metrics exist from its first request until forgetMetrics().
+        std::lock_guard<std::mutex> lock(mMetricsLock);
+        mMetrics[owner];
+    }
 
     // Queue request for processing.
     mWorker->queue(request);
@@ -2429,7 +2732,10 @@ ScanService::ScanRequest::ScanRequest(shared_ptr<Waiter> waiter,
     bool followSymLinks,
     LocalPath targetPath,
     handle expectedFsid,
-    map<LocalPath, FSNode>&& priorScanChildren)
+    map<LocalPath, FSNode>&& priorScanChildren,
+    shared_ptr<FingerprintCache> fingerprintCache,
+    string filesystem,
+    handle owner)
     : mWaiter(waiter)
     , mScanResult(SCAN_INPROGRESS)
     , mFollowSymLinks(followSymLinks)
@@ -2437,12 +2743,93 @@ ScanService::ScanRequest::ScanRequest(shared_ptr<Waiter> waiter,
     , mResults()
     , mTargetPath(std::move(targetPath))
     , mExpectedFsid(expectedFsid)
+    , mFingerprintCache(std::move(fingerprintCache))
+    , mFilesystem(std::move(filesystem))
+    , mOwner(owner)
+{
+}
+
+ScanService::PendingQueue::PendingQueue(unsigned scansPerDevice)
+    : mScansPerDevice(std::max(scansPerDevice, 1u))
+{
+}
+
+void ScanService::PendingQueue::push(RequestPtr request)
 {
+    auto& queue = mByOwner[request->mOwner];
+    if (queue.empty())
+    {
+        mOwnerTurns.push_back(request->mOwner);
+    }
+    queue.push_back(std::move(request));
+}
+
+auto ScanService::PendingQueue::pop() -> RequestPtr
+{
+    for (auto turn = mOwnerTurns.begin(); turn != mOwnerTurns.end(); ++turn)
+    {
+        auto& queue = mByOwner[*turn];
+        assert(!queue.empty());
+
+        // an owner's requests are served in order, so only its first one is a candidate
+        unsigned& inProgress = mInProgress[queue.front()->mFilesystem];
+        if (inProgress >= mScansPerDevice)
+        {
+            continue;
+        }
+
+        RequestPtr request = std::move(queue.front());
+        queue.pop_front();
+        ++inProgress;
+
+        // this owner's turn is over, it goes to the back of the line if it has more to do
+        handle owner = *turn;
+        mOwnerTurns.erase(turn);
+        if (queue.empty())
+        {
+            mByOwner.erase(owner);
+        }
+        else
+        {
+            mOwnerTurns.push_back(owner);
+        }
+        return request;
+    }
+    return nullptr;
+}
+
+void ScanService::PendingQueue::done(const RequestPtr& request)
+{
+    auto it = mInProgress.find(request->mFilesystem);
+    assert(it != mInProgress.end() && it->second > 0);
+    if (it != mInProgress.end() && !--it->second)
+    {
+        mInProgress.erase(it);
+    }
+}
+
+bool ScanService::PendingQueue::empty() const
+{
+    return mOwnerTurns.empty();
 }
 
-ScanService::Worker::Worker(size_t numThreads)
-    : mFsAccess(new FSACCESS_CLASS())
-    , mPending()
+auto ScanService::PendingQueue::takeAll() -> std::vector<RequestPtr>
+{
+    std::vector<RequestPtr> requests;
+    for (auto owner : mOwnerTurns)
+    {
+        for (auto& request : mByOwner[owner])
+        {
+            requests.emplace_back(std::move(request));
+        }
+    }
+    mByOwner.clear();
+    mOwnerTurns.clear();
+    return requests;
+}
+
+ScanService::Worker::Worker(size_t numThreads, unsigned scansPerDevice)
+    : mPending(scansPerDevice)
     , mPendingLock()
     , mPendingNotifier()
     , mThreads()
@@ -2473,10 +2860,12 @@ ScanService::Worker::~Worker()
 {
     LOG_debug << "Stopping ScanService worker...";
 
-    // Queue the 'terminate' sentinel.
+    // Tell the threads to exit, taking back any requests they haven't started.
+    std::vector<ScanRequestPtr> cancelled;
     {
         std::unique_lock<std::mutex> lock(mPendingLock);
-        mPending.emplace_back();
+        mTerminating = true;
+        cancelled = mPending.takeAll();
     }
 
     // Wake any sleeping threads.
@@ -2490,6 +2879,15 @@ ScanService::Worker::~Worker()
         thread.join();
     }
 
+    // Complete the cancelled requests so that nobody waits on them forever.
+    // Like a scan that found the folder replaced, they just have to be asked for again.
+    for (auto& request : cancelled)
+    {
+        LOG_verbose << "Directory scan cancelled: " << request->mTargetPath;
+        request->mScanResult = SCAN_FSID_MISMATCH;
+        request->mWaiter->notify();
+    }
+
     LOG_debug << "ScanService worker stopped.";
 }
 
@@ -2498,7 +2896,7 @@ void ScanService::Worker::queue(ScanRequestPtr request)
     // Queue the request.
     {
         std::unique_lock<std::mutex> lock(mPendingLock);
-        mPending.emplace_back(std::move(request));
+        mPending.push(std::move(request));
     }
 
     // Tell the lucky thread it has something to do.
@@ -2507,29 +2905,23 @@ void ScanService::Worker::queue(ScanRequestPtr request)
 
 void ScanService::Worker::loop()
 {
-    // We're ready when we have some work to do.
-    auto ready = [this]() { return !mPending.empty(); };
+    // Each thread has its own filesystem access.
+    std::unique_ptr<FileSystemAccess> fsAccess(new FSACCESS_CLASS());
 
     for ( ; ; )
     {
         ScanRequestPtr request;
 
         {
-            // Wait for something to do.
+            // Wait for something we can do: requests may be pending only for busy devices.
             std::unique_lock<std::mutex> lock(mPendingLock);
-            mPendingNotifier.wait(lock, ready);
-
-            assert(ready()); // condition variable should have taken care of this
+            mPendingNotifier.wait(lock, [&]() { return mTerminating || (request = mPending.pop()); });
 
             // Are we being told to terminate?
-            if (!mPending.front())
+            if (mTerminating)
             {
-                // Bail, don't deque the sentinel.
                 return;
             }
-
-            request = std::move(mPending.front());
-            mPending.pop_front();
         }
 
         LOG_verbose << "Directory scan begins: " << request->mTargetPath;
@@ -2538,9 +2930,30 @@ void ScanService::Worker::loop()
 
         // Process the request.
         unsigned nFingerprinted = 0;
-        auto result = scan(request, nFingerprinted);
+        auto result = scan(*fsAccess, request, nFingerprinted);
         auto scanEnd = high_resolution_clock::now();
 
+        {
+            // The device can take another scan.
+            std::unique_lock<std::mutex> lock(mPendingLock);
+            mPending.done(request);
+        }
+        mPendingNotifier.notify_all();
+
+        {
+            std::lock_guard<std::mutex> lock(mMetricsLock);
+            syncScanTime.record(scanEnd - scanStart);
+
+            auto it = mMetrics.find(request->mOwner);
+            if (it != mMetrics.end())
+            {
+                auto& metrics = it->second;
+                metrics.foldersScanned += result == SCAN_SUCCESS;
+                metrics.filesFingerprinted += nFingerprinted;
+                metrics.scanTime += duration_cast<milliseconds>(scanEnd - scanStart);
+            }
+        }
+
         if (result == SCAN_SUCCESS)
         {
             LOG_verbose << "Directory scan complete for: " << request->mTargetPath
@@ -2558,20 +2971,17 @@ void ScanService::Worker::loop()
     }
 }
 
-// Really we only have one worker despite the vector of threads - maybe we should just have one
-// regardless of multiple clients too - there is only one filesystem after all (but not singleton!!)
-CodeCounter::ScopeStats ScanService::syncScanTime = { "folderScan" };
-
-auto ScanService::Worker::scan(ScanRequestPtr request, unsigned& nFingerprinted) -> ScanResult
+// One worker (a pool of threads) is shared by all clients, since they share the disks.
+auto ScanService::Worker::scan(FileSystemAccess& fsAccess, ScanRequestPtr request, unsigned& nFingerprinted) -> ScanResult
 {
-    CodeCounter::ScopeTimer rst(syncScanTime);
-
-    auto result = mFsAccess->directoryScan(request->mTargetPath,
+    auto result = fsAccess.directoryScan(request->mTargetPath,
         request->mExpectedFsid,
         request->mKnown,
         request->mResults,
         request->mFollowSymLinks,
-        nFingerprinted);
+        nFingerprinted,
+        request->mFingerprintCache.get(),
+        request->mFilesystem);
 
     // No need to keep this data around anymore.
     request->mKnown.clear();
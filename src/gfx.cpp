@@ -155,6 +155,13 @@ void GfxProc::loop()
             for (auto& image : images)
             {
                 string* jpeg = image.empty() ? nullptr : new string(std::move(image));
+
+                // encrypt here rather than on the client thread
+                if (jpeg && !MegaClient::encryptfa(SymmCipher::threadLocalCipher(job->key), jpeg))
+                {
+                    delete jpeg;
+                    jpeg = nullptr;
+                }
                 job->images.push_back(jpeg);
             }
 
@@ -199,8 +206,8 @@ int GfxProc::checkevents(Waiter *)
                 // Now we upload those to the file attribute servers
                 // The file attribute will either be added to an existing node
                 // or added to the eventual putnodes if this was started as part of an upload transfer
-                mCheckEventsKey.setkey(job->key);
-                if (!client->putfa(job->h, job->imagetypes[i], &mCheckEventsKey, 0, std::unique_ptr<string>(job->images[i])))
+                // already encrypted by the gfx thread
+                if (!client->putfa(job->h, job->imagetypes[i], nullptr, 0, std::unique_ptr<string>(job->images[i])))
                 {
                     continue; // no needexec for this one
                 }
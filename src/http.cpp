@@ -398,6 +398,127 @@ void HttpReq::disconnect()
     }
 }
 
+TransferBufferPool& TransferBufferPool::instance()
+{
+    // never destroyed: buffers may still be released by transfers and clients
+    // torn down after static destructors have run
+    static TransferBufferPool* pool = new TransferBufferPool;
+    return *pool;
+}
+
+TransferBufferPool::~TransferBufferPool()
+{
+    trimIdle(0);
+}
+
+size_t TransferBufferPool::capacityFor(size_t len)
+{
+    if (len < MIN_POOLED_SIZE)
+    {
+        return len;
+    }
+
+    // four size classes per power of two, so at most 25% is wasted
+    size_t p = MIN_POOLED_SIZE;
+    while (p <= len / 2)
+    {
+        p *= 2;
+    }
+    size_t step = p / 4;
+    return (len + step - 1) / step * step;
+}
+
+byte* TransferBufferPool::allocate(size_t len, size_t& capacity)
+{
+    capacity = capacityFor(len);
+    if (!capacity)
+    {
+        return nullptr;
+    }
+
+    byte* b = nullptr;
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+
+        auto it = mIdle.find(capacity);
+        if (it != mIdle.end() && !it->second.empty())
+        {
+            b = it->second.back();
+            it->second.pop_back();
+            mUsage.idleBytes -= capacity;
+            ++mUsage.reuses;
+        }
+        else
+        {
+            ++mUsage.heapAllocations;
+        }
+
+        mUsage.inUseBytes += capacity;
+        mUsage.peakInUseBytes = std::max(mUsage.peakInUseBytes, mUsage.inUseBytes);
+    }
+
+    return b ? b : new byte[capacity];
+}
+
+void TransferBufferPool::release(byte* buf, size_t capacity)
+{
+    if (!buf)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> g(mMutex);
+
+        assert(mUsage.inUseBytes >= capacity);
+        mUsage.inUseBytes -= capacity;
+
+        if (capacity >= MIN_POOLED_SIZE && mUsage.idleBytes + capacity <= mMaxIdleBytes)
+        {
+            mIdle[capacity].push_back(buf);
+            mUsage.idleBytes += capacity;
+            mUsage.peakIdleBytes = std::max(mUsage.peakIdleBytes, mUsage.idleBytes);
+            return;
+        }
+    }
+
+    delete[] buf;
+}
+
+void TransferBufferPool::setMaxIdleBytes(size_t bytes)
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    mMaxIdleBytes = bytes;
+    trimIdle(bytes);
+}
+
+TransferBufferPool::Usage TransferBufferPool::usage() const
+{
+    std::lock_guard<std::mutex> g(mMutex);
+    return mUsage;
+}
+
+void TransferBufferPool::trimIdle(size_t maxIdle)
+{
+    for (auto it = mIdle.rbegin(); it != mIdle.rend() && mUsage.idleBytes > maxIdle; ++it)
+    {
+        auto& buffers = it->second;
+        while (!buffers.empty() && mUsage.idleBytes > maxIdle)
+        {
+            delete[] buffers.back();
+            buffers.pop_back();
+            mUsage.idleBytes -= it->first;
+        }
+    }
+}
+
+std::ostream& operator<<(std::ostream& s, const TransferBufferPool::Usage& u)
+{
+    return s << "in use " << u.inUseBytes << " (peak " << u.peakInUseBytes << ")"
+             << ", idle " << u.idleBytes << " (peak " << u.peakIdleBytes << ")"
+             << ", heap allocations " << u.heapAllocations << ", reuses " << u.reuses;
+}
+
 HttpReq::HttpReq(bool b)
 {
     LOG_verbose << "[HttpReq::HttpReq] CONSTRUCTOR CALL [this = " << this << "]";
@@ -411,6 +532,7 @@ HttpReq::HttpReq(bool b)
     timeoutms = 0;
     type = REQ_JSON;
     buflen = 0;
+    bufcapacity = 0;
     protect = false;
     minspeed = false;
     mChunked = false;
@@ -426,7 +548,7 @@ HttpReq::~HttpReq()
         httpio->cancel(this);
     }
 
-    delete[] buf;
+    TransferBufferPool::instance().release(buf, bufcapacity);
 }
 
 void HttpReq::init()
@@ -497,14 +619,14 @@ void HttpReq::put(void* data, unsigned len, bool purge)
 }
 
 
-HttpReq::http_buf_t::http_buf_t(byte* b, size_t s, size_t e)
-    : start(s), end(e), buf(b)
+HttpReq::http_buf_t::http_buf_t(byte* b, size_t s, size_t e, size_t c)
+    : start(s), end(e), buf(b), capacity(c)
 {
 }
 
 HttpReq::http_buf_t::~http_buf_t()
 {
-    delete[] buf;
+    TransferBufferPool::instance().release(buf, capacity);
 }
 
 void HttpReq::http_buf_t::swap(http_buf_t& other)
@@ -512,6 +634,7 @@ void HttpReq::http_buf_t::swap(http_buf_t& other)
     byte* tb = buf; buf = other.buf; other.buf = tb;
     size_t ts = start; start = other.start; other.start = ts;
     size_t te = end; end = other.end; other.end = te;
+    size_t tc = capacity; capacity = other.capacity; other.capacity = tc;
 }
 
 bool HttpReq::http_buf_t::isNull() const
@@ -533,10 +656,11 @@ size_t HttpReq::http_buf_t::datalen() const
 // give up ownership of the buffer for client to use.
 struct HttpReq::http_buf_t* HttpReq::release_buf()
 {
-    HttpReq::http_buf_t* result = new HttpReq::http_buf_t(buf, inpurge, (size_t)bufpos);
+    HttpReq::http_buf_t* result = new HttpReq::http_buf_t(buf, inpurge, (size_t)bufpos, bufcapacity);
     buf = NULL;
     inpurge = 0;
     buflen = 0;
+    bufcapacity = 0;
     bufpos = 0;
     outpos = 0;
     notifiedbufpos = 0;
@@ -654,21 +778,20 @@ void HttpReqDL::prepare(const char* tempurl, SymmCipher* /*key*/,
     size = (unsigned)(npos - pos);
     buffer_released = false;
 
-    if (!buf || buflen != size)
+    size_t paddedsize = (size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE;
+    if (!buf || bufcapacity < paddedsize)
     {
         // (re)allocate buffer
-        if (buf)
-        {
-            delete[] buf;
-            buf = NULL;
-        }
+        TransferBufferPool::instance().release(buf, bufcapacity);
+        buf = NULL;
+        bufcapacity = 0;
 
         if (size)
         {
-            buf = new byte[(size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE];
+            buf = TransferBufferPool::instance().allocate(paddedsize, bufcapacity);
         }
-        buflen = size;
     }
+    buflen = size;
 }
 
 
@@ -729,22 +852,37 @@ bool EncryptByChunks::encrypt(m_off_t pos, m_off_t npos, string& urlSuffix)
     m_off_t finalpos = npos;
     m_off_t endpos = ChunkedHash::chunkceil(startpos, finalpos);
     m_off_t chunksize = endpos - startpos;
+
+    // independent chunks have their MACs computed side by side, when the buffers allow it
+    SymmCipher::CtrLane chunks[SymmCipher::MAX_CTR_LANES];
+    unsigned maxchunks = buffersStayValid() ? SymmCipher::MAX_CTR_LANES : 1;
+    unsigned numchunks = 0;
+
     while (chunksize)
     {
         buf = nextbuffer(unsigned(chunksize));
         if (!buf) return false;
 
-        // The chunk is fully encrypted but finished==false for now,
-        // we only set finished after confirmation of the chunk uploading.
-        macs->ctr_encrypt(startpos, key, buf, unsigned(chunksize), startpos, ctriv, false);
-
-        LOG_debug << "Encrypted chunk: " << startpos << " - " << endpos << "   Size: " << chunksize;
-
-        updateCRC(buf, unsigned(chunksize), unsigned(startpos - pos));
+        chunks[numchunks++] = { buf, unsigned(chunksize), startpos, nullptr };
 
         startpos = endpos;
         endpos = ChunkedHash::chunkceil(startpos, finalpos);
         chunksize = endpos - startpos;
+
+        if (numchunks == maxchunks || !chunksize)
+        {
+            // The chunks are fully encrypted but finished==false for now,
+            // we only set finished after confirmation of the chunk uploading.
+            macs->ctr_encrypt_chunks(key, chunks, numchunks, ctriv, false);
+
+            for (unsigned i = 0; i < numchunks; i++)
+            {
+                LOG_debug << "Encrypted chunk: " << chunks[i].pos << " - " << chunks[i].pos + chunks[i].len << "   Size: " << chunks[i].len;
+
+                updateCRC(chunks[i].data, chunks[i].len, unsigned(chunks[i].pos - pos));
+            }
+            numchunks = 0;
+        }
     }
     assert(endpos == finalpos);
     buf = nextbuffer(0);   // last call in case caller does buffer post-processing (such as write to file as we go)
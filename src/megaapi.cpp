@@ -3509,6 +3509,11 @@ void MegaApi::setUploadMethod(int method)
     pImpl->setUploadMethod(method);
 }
 
+void MegaApi::setMaxIdleTransferBufferBytes(long long bytes)
+{
+    pImpl->setMaxIdleTransferBufferBytes(bytes);
+}
+
 int MegaApi::getMaxDownloadSpeed()
 {
     return pImpl->getMaxDownloadSpeed();
@@ -3834,6 +3839,11 @@ long long MegaApi::getNumLocalNodes()
     return pImpl->getNumLocalNodes();
 }
 
+long long MegaApi::getLocalNodeMemory()
+{
+    return pImpl->getLocalNodeMemory();
+}
+
 void MegaApi::getMegaSyncStallList(MegaRequestListener* listener)
 {
     pImpl->getMegaSyncStallList(listener);
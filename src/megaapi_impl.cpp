@@ -1302,15 +1302,15 @@ char *MegaBackgroundMediaUploadPrivate::encryptFile(const char* inputFilepath, i
                 std::unique_ptr<FileAccess> faout(api->fsAccess->newfileaccess());
                 if (faout->fopen(localencryptedfilename, false, true, FSLogging::logOnError))
                 {
-                    SymmCipher cipher;
-                    cipher.setkey(filekey);
+                    // runs on the app's thread, so it must not borrow the client's ciphers
+                    SymmCipher* cipher = SymmCipher::threadLocalCipher(filekey);
                     uint64_t ctriv = MemAccess::get<uint64_t>((const char*)filekey + SymmCipher::KEYLENGTH);
 
-                    EncryptFilePieceByChunks ef(fain.get(), startPos, faout.get(), 0, &cipher, &chunkmacs, ctriv);
+                    EncryptFilePieceByChunks ef(fain.get(), startPos, faout.get(), 0, cipher, &chunkmacs, ctriv);
                     string urlSuffix;
                     if (ef.encrypt(startPos, endPos, urlSuffix))
                     {
-                        ((int64_t*)filekey)[3] = chunkmacs.macsmac(&cipher);
+                        ((int64_t*)filekey)[3] = chunkmacs.macsmac(cipher);
                         return MegaApi::strdup(urlSuffix.c_str());
                     }
                 }
@@ -9246,6 +9246,12 @@ void MegaApiImpl::setUploadMethod(int method)
     }
 }
 
+void MegaApiImpl::setMaxIdleTransferBufferBytes(long long bytes)
+{
+    // the pool is process-wide and has its own lock
+    TransferBufferPool::instance().setMaxIdleBytes(bytes > 0 ? static_cast<size_t>(bytes) : 0);
+}
+
 bool MegaApiImpl::setMaxDownloadSpeed(m_off_t bpslimit)
 {
     SdkMutexGuard g(sdkMutex);
@@ -10077,6 +10083,11 @@ long long MegaApiImpl::getNumLocalNodes()
     return client->syncs.totalLocalNodes;
 }
 
+long long MegaApiImpl::getLocalNodeMemory()
+{
+    return static_cast<long long>(client->syncs.totalLocalNodeBytes.load());
+}
+
 #endif
 
 void MegaApiImpl::moveOrRemoveDeconfiguredBackupNodes(MegaHandle deconfiguredBackupRoot, MegaHandle backupDestination, MegaRequestListener* listener)
@@ -29717,6 +29728,9 @@ void MegaFolderUploadController::start(MegaNode*)
     // it's mandatory to notify stage change from MegaApiImpl's thread to avoid deadlocks and other issues
     notifyStage(MegaTransfer::STAGE_SCAN);
 
+    mFingerprintCache = megaapiThreadClient()->mFingerprintCache;
+    mFilesystem = FingerprintCache::filesystemKey(fsaccess->fsFingerprint(path));
+
     mWorkerThread = std::thread ([this, path]() {
         // recurse all subfolders on disk, building up tree structure to match
         // not yet existing folders get a temporary upload id instead of a handle
@@ -29901,9 +29915,11 @@ MegaFolderUploadController::scanFolder_result MegaFolderUploadController::scanFo
             // Do the fingerprinting for uploads on the scan thread, so we don't lock the main mutex for so long
             FileFingerprint fp;
             auto fa = fsaccess->newfileaccess();
-            if (fa->fopen(localPath, true, false, FSLogging::logOnError))
+            if (fa->fopen(localPath, true, false, FSLogging::logOnError)
+                && !mFingerprintCache->lookup(mFilesystem, fa->fsidvalid ? fa->fsid : UNDEF, fa->size, fa->mtime, fa->ctime, fp))
             {
                 fp.genfingerprint(fa.get());
+                mFingerprintCache->store(mFilesystem, fa->fsidvalid ? fa->fsid : UNDEF, fa->ctime, fp);
             }
 
             // if we couldn't get the fingerprint, !isvalid and we'll fail the transfer
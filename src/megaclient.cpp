@@ -353,6 +353,17 @@ bool MegaClient::decryptkey(const char* sk, byte* tk, int tl, SymmCipher* sc, in
             return false;
         }
 
+        if (!mPredecryptedKeys.empty())
+        {
+            auto it = mPredecryptedKeys.find(string(sk, size_t(ptr - sk)));
+            if (it != mPredecryptedKeys.end() && it->second.size() >= size_t(tl))
+            {
+                memcpy(tk, it->second.data(), size_t(tl));
+                mPredecryptedKeys.erase(it);
+                return true;
+            }
+        }
+
         byte* buf = new byte[sl];
 
         sl = Base64::atob(sk, buf, sl);
@@ -1779,6 +1790,7 @@ MegaClient::MegaClient(MegaApp* a, shared_ptr<Waiter> w, HttpIO* h, DbAccess* d,
     , syncs(*this)
 #endif
    , reqs(rng)
+   , putnodesCoalescer(*this)
    , mKeyManager(*this)
    , mClientType(clientType)
    , mJourneyId(fsaccess, dbaccess ? dbaccess->rootPath() : LocalPath())
@@ -2638,6 +2650,9 @@ void MegaClient::exec()
                 }
             }
 
+            // completed uploads whose coalescing window elapsed go out with this request
+            putnodesCoalescer.flush(false);
+
             if (btcs.armed())
             {
                 if (reqs.readyToSend())
@@ -3078,6 +3093,13 @@ void MegaClient::exec()
             nextDispatchTransfersDs = transferCount ? Waiter::ds + 1 : 0;
         }
 
+        // write out fingerprints computed by scans, a batch at a time
+        if (nextFingerprintCacheFlushDs <= Waiter::ds && mFingerprintCache->hasPendingWrites())
+        {
+            mFingerprintCache->flush();
+            nextFingerprintCacheFlushDs = Waiter::ds + FINGERPRINT_CACHE_FLUSH_DS;
+        }
+
 #ifndef EMSCRIPTEN
         assert(!asyncfopens);
 #endif
@@ -3335,6 +3357,9 @@ int MegaClient::preparewait()
         if (!pendingcs)
         {
             btcs.update(&nds);
+
+            // send coalesced putnodes when their window elapses
+            putnodesCoalescer.update(&nds);
         }
 
         // retry failed server-client requests
@@ -4632,6 +4657,7 @@ void MegaClient::locallogout(bool removecaches, bool keepSyncsConfigFile)
     }
 
     closetc();
+    closeFingerprintCache(false);
 
     freeq(GET);  // freeq after closetc due to optimizations
     freeq(PUT);
@@ -4644,6 +4670,7 @@ void MegaClient::locallogout(bool removecaches, bool keepSyncsConfigFile)
     mNodeManager.reset();
 
     reqs.clear();
+    putnodesCoalescer.clear();
 
     delete pendingcs;
     pendingcs = NULL;
@@ -4755,6 +4782,7 @@ void MegaClient::removeCaches()
         statusTable.reset();
     }
 
+    closeFingerprintCache(true);
     disabletransferresumption();
 }
 
@@ -4955,6 +4983,7 @@ bool MegaClient::procsc()
                             }
 
                             enabletransferresumption();
+                            openFingerprintCache();
                             app->fetchnodes_result(API_OK);
                             app->notify_dbcommit();
                             fetchnodesAlreadyCompletedThisSession = true;
@@ -5862,10 +5891,7 @@ void MegaClient::pendingattrstring(UploadHandle h, string* fa)
     }
 }
 
-// Upload file attribute data to fa servers. node handle can be UNDEF if we are giving fa handle back to the app
-// Used for attaching file attribute to a Node, or prepping for Node creation after upload, or getting fa handle for app.
-// FIXME: to avoid unnecessary roundtrips to the attribute servers, also cache locally
-bool MegaClient::putfa(NodeOrUploadHandle th, fatype t, SymmCipher* key, int tag, std::unique_ptr<string> data)
+bool MegaClient::encryptfa(SymmCipher* key, string* data)
 {
     // CBC-encrypt attribute data (padded to next multiple of BLOCKSIZE)
     data->resize((data->size() + SymmCipher::BLOCKSIZE - 1) & -SymmCipher::BLOCKSIZE);
@@ -5874,6 +5900,18 @@ bool MegaClient::putfa(NodeOrUploadHandle th, fatype t, SymmCipher* key, int tag
         LOG_err << "Failed to CBC encrypt Node attribute data.";
         return false;
     }
+    return true;
+}
+
+// Upload file attribute data to fa servers. node handle can be UNDEF if we are giving fa handle back to the app
+// Used for attaching file attribute to a Node, or prepping for Node creation after upload, or getting fa handle for app.
+// FIXME: to avoid unnecessary roundtrips to the attribute servers, also cache locally
+bool MegaClient::putfa(NodeOrUploadHandle th, fatype t, SymmCipher* key, int tag, std::unique_ptr<string> data)
+{
+    if (key && !encryptfa(key, data.get()))
+    {
+        return false;
+    }
 
     queuedfa.emplace_back(new HttpReqFA(th, t, usehttps, tag, std::move(data), true, this));
     LOG_debug << "File attribute added to queue - " << th << " : " << queuedfa.size() << " queued, " << activefa.size() << " active";
@@ -9651,6 +9689,12 @@ SymmCipher *MegaClient::getRecycledTemporaryNodeCipher(const byte *key)
     return &tmpnodecipher;
 }
 
+SymmCipher *MegaClient::getRecycledTemporaryShareCipher(const byte *key)
+{
+    tmpsharecipher.setkey(key);
+    return &tmpsharecipher;
+}
+
 // compute generic string hash
 void MegaClient::stringhash(const char* s, byte* hash, SymmCipher* cipher)
 {
@@ -10602,6 +10646,75 @@ int MegaClient::procphelement(JSON *j)
         return 0;
 }
 
+void MegaClient::predecryptnodekeys(const sharedNode_vector& nodes)
+{
+    if (loggedIntoFolder() || ISUNDEF(me))
+    {
+        return;
+    }
+
+    // node keys addressed to us are stored as <user handle>:<key>
+    string mark = toHandle(me) + ":";
+    vector<string> rsaKeys;
+
+    for (auto& n : nodes)
+    {
+        if (n->keyApplied())
+        {
+            continue;
+        }
+
+        const string& keydata = n->nodekeyUnchecked();
+
+        for (size_t p = 0; (p = keydata.find(mark, p)) != string::npos; p += mark.size())
+        {
+            if (p && keydata[p - 1] != '/')
+            {
+                continue;
+            }
+
+            auto start = p + mark.size();
+            auto end = keydata.find('/', start);
+            auto len = (end == string::npos ? keydata.size() : end) - start;
+
+            // same test as decryptkey(): anything longer than a symmetric key is RSA
+            if (len > 4 * FILENODEKEYLENGTH / 3 + 1 && len / 4 * 3 + 3 <= 4096)
+            {
+                rsaKeys.emplace_back(keydata, start, len);
+            }
+            break;
+        }
+    }
+
+    if (rsaKeys.size() < MIN_PREDECRYPT_KEYS)
+    {
+        return;
+    }
+
+    vector<string> decrypted(rsaKeys.size());
+
+    parallelFor(rsaKeys.size(), 0, [this, &rsaKeys, &decrypted](size_t i)
+    {
+        string buf = Base64::atob(rsaKeys[i]);
+        string key(FILENODEKEYLENGTH, '\0');
+
+        if (asymkey.decrypt((const byte*)buf.data(), buf.size(), (byte*)key.data(), key.size()))
+        {
+            decrypted[i] = std::move(key);
+        }
+    });
+
+    for (size_t i = rsaKeys.size(); i--; )
+    {
+        if (!decrypted[i].empty())
+        {
+            mPredecryptedKeys[std::move(rsaKeys[i])] = std::move(decrypted[i]);
+        }
+    }
+
+    LOG_debug << "Decrypted " << mPredecryptedKeys.size() << " RSA node keys in parallel";
+}
+
 void MegaClient::applykeys()
 {
     CodeCounter::ScopeTimer ccst(performanceStats.applyKeys);
@@ -12853,9 +12966,45 @@ void MegaClient::transfercacheadd(Transfer *transfer, TransferDbCommitter* commi
         if (committer) committer->addTransferCount += 1;
         tctable->checkCommitter(committer);
         tctable->put(MegaClient::CACHEDTRANSFER, transfer, &tckey);
+        ++performanceStats.transferRecordsFull;
+
+        // the full record supersedes any progress records
+        for (uint32_t id : transfer->chunkmacDeltaDbids)
+        {
+            tctable->del(id);
+        }
+        transfer->chunkmacDeltaDbids.clear();
+        transfer->chunkmacs.markPersisted();
     }
 }
 
+void MegaClient::transfercacheaddprogress(Transfer *transfer, TransferDbCommitter* committer)
+{
+    if (!tctable || transfer->skipserialization)
+    {
+        return;
+    }
+
+    TransferChunkmacDelta delta;
+    if (!transfer->dbid
+        || transfer->chunkmacDeltaDbids.size() >= Transfer::MAX_CHUNKMAC_DELTAS
+        || !transfer->chunkmacs.serializeDelta(delta.macs))
+    {
+        return transfercacheadd(transfer, committer);
+    }
+
+    delta.transferDbid = transfer->dbid;
+
+    if (committer) committer->addTransferCount += 1;
+    tctable->checkCommitter(committer);
+    tctable->put(MegaClient::CACHEDTRANSFERMACS, &delta, &tckey);
+    ++performanceStats.transferRecordsProgress;
+    performanceStats.transferRecordsProgressBytes += delta.macs.size();
+
+    transfer->chunkmacDeltaDbids.push_back(delta.dbid);
+    transfer->chunkmacs.markPersisted();
+}
+
 void MegaClient::transfercachedel(Transfer *transfer, TransferDbCommitter* committer)
 {
     if (tctable && transfer->dbid)
@@ -12863,6 +13012,12 @@ void MegaClient::transfercachedel(Transfer *transfer, TransferDbCommitter* commi
         if (committer) committer->removeTransferCount += 1;
         tctable->checkCommitter(committer);
         tctable->del(transfer->dbid);
+
+        for (uint32_t id : transfer->chunkmacDeltaDbids)
+        {
+            tctable->del(id);
+        }
+        transfer->chunkmacDeltaDbids.clear();
     }
 }
 
@@ -14631,6 +14786,66 @@ void MegaClient::closetc(bool remove)
     tctable.reset();
 }
 
+string MegaClient::fingerprintCacheName() const
+{
+    // named after the account rather than the session, so that the fingerprints
+    // outlive a logout and are found again by the next login to the same account.
+    // Without a login there's nothing to persist: a logged out cache would be
+    // shared by any later account
+    if (loggedIntoFolder())
+    {
+        return "fingerprints_" + string(Base64Str<NODEHANDLE>(mFolderLink.mPublicHandle));
+    }
+
+    if (ISUNDEF(me))
+    {
+        return string();
+    }
+
+    return "fingerprints_" + string(Base64Str<USERHANDLE>(me));
+}
+
+void MegaClient::openFingerprintCache()
+{
+    if (!dbaccess || mFingerprintCache->attached())
+    {
+        return;
+    }
+
+    string dbname = fingerprintCacheName();
+    if (dbname.empty())
+    {
+        return;
+    }
+
+    mFingerprintCache->attach(unique_ptr<DbTable>(dbaccess->open(rng, *fsaccess, dbname, DB_OPEN_FLAG_RECYCLE | DB_OPEN_FLAG_TRANSACTED, [this](DBError error)
+    {
+        handleDbError(error);
+    })), key);
+}
+
+void MegaClient::closeFingerprintCache(bool remove)
+{
+    if (remove && dbaccess && !mFingerprintCache->attached())
+    {
+        // not loaded this session, but it may be on disk from an earlier one
+        string dbname = fingerprintCacheName();
+        if (!dbname.empty())
+        {
+            unique_ptr<DbTable> table(dbaccess->open(rng, *fsaccess, dbname, DB_OPEN_FLAG_RECYCLE | DB_OPEN_FLAG_TRANSACTED, [this](DBError error)
+            {
+                handleDbError(error);
+            }));
+            if (table)
+            {
+                table->remove();
+            }
+        }
+    }
+
+    mFingerprintCache->detach(remove);
+}
+
 void MegaClient::enabletransferresumption(const char *loggedoutid)
 {
     if (!dbaccess || tctable)
@@ -14679,6 +14894,7 @@ void MegaClient::enabletransferresumption(const char *loggedoutid)
     Transfer* t;
     size_t cachedTransfersLoaded = 0;
     size_t cachedFilesLoaded = 0;
+    std::map<uint32_t, TransferChunkmacDelta> cachedChunkmacDeltas;
 
     LOG_info << "Loading transfers from local cache";
     tctable->rewind();
@@ -14709,8 +14925,55 @@ void MegaClient::enabletransferresumption(const char *loggedoutid)
                     cachedfilesdbids.push_back(id);
                     cachedFilesLoaded += 1;
                     break;
+                case CACHEDTRANSFERMACS:
+                    if (!TransferChunkmacDelta::unserialize(data, cachedChunkmacDeltas[id]))
+                    {
+                        cachedChunkmacDeltas.erase(id);
+                        tctable->del(id);
+                        LOG_err << "Failed - transfer progress record read error";
+                    }
+                    break;
             }
         }
+
+        // progress records apply on top of their transfer's full record, oldest first
+        if (!cachedChunkmacDeltas.empty())
+        {
+            std::map<uint32_t, Transfer*> cachedTransfersByDbid;
+            for (auto& m : multi_cachedtransfers)
+            {
+                for (auto& it : m)
+                {
+                    cachedTransfersByDbid[it.second->dbid] = it.second;
+                }
+            }
+
+            for (auto& d : cachedChunkmacDeltas)
+            {
+                auto it = cachedTransfersByDbid.find(d.second.transferDbid);
+                const char* ptr = d.second.macs.data();
+                const char* end = ptr + d.second.macs.size();
+
+                if (it == cachedTransfersByDbid.end())
+                {
+                    tctable->del(d.first);
+                    LOG_warn << "Discarding transfer progress record of unknown transfer";
+                }
+                else if (!it->second->chunkmacs.unserializeDelta(ptr, end))
+                {
+                    tctable->del(d.first);
+                    LOG_err << "Failed - transfer progress record could not be applied";
+                }
+                else
+                {
+                    Transfer* t = it->second;
+                    t->chunkmacDeltaDbids.push_back(d.first);
+                    t->chunkmacs.markPersisted();
+                    t->chunkmacs.calcprogress(t->size, t->pos, t->progresscompleted);
+                }
+            }
+            LOG_debug << "Cached transfer progress records loaded: " << cachedChunkmacDeltas.size();
+        }
     }
     LOG_debug << "Cached transfers loaded: " << cachedTransfersLoaded;
     LOG_debug << "Cached files loaded: " << cachedFilesLoaded;
@@ -14955,6 +15218,7 @@ void MegaClient::fetchnodes(bool nocache, bool loadSyncs, bool forceLoadFromServ
             }
 
             enabletransferresumption();
+            openFingerprintCache();
 
 #ifdef ENABLE_SYNC
             if (loadSyncs)
@@ -18979,8 +19243,9 @@ std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Wai
 #ifdef ENABLE_SYNC
         << recursiveSyncTime.report(reset) << "\n"
         << computeSyncTripletsTime.report(reset) << "\n"
+        << precomputeChildRowsTime.report(reset) << "\n"
         << computeSyncSequencesStats.report(reset) << "\n"
-        << ScanService::syncScanTime.report(reset) << "\n"
+        << ScanService::scanTimeReport(reset) << "\n"
         << inferSyncTripletsTime.report(reset) << "\n"
         << g_compareUtfTimings.report(reset) << "\n"
         << syncItem.report(reset) << "\n"
@@ -18997,6 +19262,9 @@ std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Wai
 #endif
         << " cs Request waiting time: " << csRequestWaitTime.report(reset) << "\n"
         << " cs requests sent/received: " << reqs.csRequestsSent << "/" << reqs.csRequestsCompleted << " batches: " << reqs.csBatchesSent << "/" << reqs.csBatchesReceived << "\n"
+        << " upload putnodes commands/nodes: " << uploadPutnodesCommands << "/" << uploadPutnodesNodes << "\n"
+        << " transfer records full/progress: " << transferRecordsFull << "/" << transferRecordsProgress << " progress bytes: " << transferRecordsProgressBytes << "\n"
+        << " transfer buffer pool: " << TransferBufferPool::instance().usage() << "\n"
         << " transfers active time: " << transfersActiveTime.report(reset) << "\n"
         << " transfer starts/finishes: " << transferStarts << " " << transferFinishes << "\n"
         << " transfer temperror/fails: " << transferTempErrors << " " << transferFails << "\n"
@@ -19022,6 +19290,7 @@ std::string MegaClient::PerformanceStats::report(bool reset, HttpIO* httpio, Wai
     if (reset)
     {
         transferStarts = transferFinishes = transferTempErrors = transferFails = 0;
+        transferRecordsFull = transferRecordsProgress = transferRecordsProgressBytes = 0;
         prepwaitImmediate = prepwaitZero = prepwaitHttpio = prepwaitFsaccess = nonzeroWait = 0;
     }
     return s.str();
@@ -21320,12 +21589,20 @@ bool KeyManager::fromKeysContainer(const string &data)
 
         if (data.size() > 2 + IV_LEN)
         {
-            const string keysCiphered((const char*)(data.data() + 2 + IV_LEN), (size_t)(data.size() - 2 - IV_LEN));
-            const string iv((const char*)data.data() + 2, IV_LEN);
+            const byte* iv = reinterpret_cast<const byte*>(data.data()) + 2;
+            const byte* keysCiphered = iv + IV_LEN;
+            size_t keysCipheredLen = data.size() - 2 - IV_LEN;
 
-            // Decrypt ^!keys attribute
+            // Decrypt ^!keys attribute straight into the plain text buffer
             string keysPlain;
-            if (!mKey.gcm_decrypt(&keysCiphered, (byte*)data.data() + 2, IV_LEN, 16, &keysPlain))
+            if (keysCipheredLen < 16)
+            {
+                LOG_err << "Failed to GCM decrypt ^!keys. Too short.";
+                return false;
+            }
+            keysPlain.resize(keysCipheredLen - 16);
+            if (!mKey.gcm_decrypt_buffer(keysCiphered, reinterpret_cast<byte*>(keysPlain.data()), keysPlain.size(),
+                                         iv, IV_LEN, keysCiphered + keysPlain.size(), 16))
             {
                 LOG_err << "Failed to GCM decrypt ^!keys.";
                 return false;
@@ -21456,23 +21733,27 @@ string KeyManager::toKeysContainer()
     // when the putua() from updateAttribute() success.
     //++mGeneration;
 
-    const string iv = mClient.rng.genstring(IV_LEN);
-    const string keysPlain = serialize();
+    // header, IV, serialized keys (encrypted in place) and tag
+    string container = serialize();
+    size_t keysLen = container.size();
+    container.insert(0, 2 + IV_LEN, '\0');
+    container.resize(2 + IV_LEN + keysLen + 16);
+
+    byte* header = reinterpret_cast<byte*>(container.data());
+    byte* iv = header + 2;
+    byte* keys = iv + IV_LEN;
+    header[0] = 20;
+    header[1] = 0;
+    mClient.rng.genblock(iv, IV_LEN);
 
-    string keysCiphered;
-    if (!mKey.gcm_encrypt(&keysPlain, (byte*)iv.data(), IV_LEN, 16, &keysCiphered))
+    if (!mKey.gcm_encrypt_buffer(keys, keys, keysLen, iv, IV_LEN, keys + keysLen, 16))
     {
         LOG_err << "Failed to encrypt keys attribute.";
         assert(false);
         return string();
     }
 
-#ifndef NDEBUG
-    byte header[2] = {20, 0};
-    assert(string({20, 0}) == string((const char*)header, sizeof(header)));
-#endif
-
-    return string({20, 0}) + iv + keysCiphered;
+    return container;
 }
 
 string KeyManager::tagHeader(const byte tag, size_t len) const
@@ -21761,6 +22042,24 @@ bool KeyManager::promotePendingShares()
     bool newshares = false;
     std::vector<std::string> keysToDelete;
 
+    // accounts with many pending shares would otherwise run one key agreement per share
+    set<handle> users;
+    for (const auto& it : mPendingOutShares)
+    {
+        for (const auto& uid : it.second)
+        {
+            if (User *u = mClient.finduser(uid.c_str(), 0))
+            {
+                users.insert(u->userhandle);
+            }
+        }
+    }
+    for (const auto& it : mPendingInShares)
+    {
+        users.insert(it.second.first);
+    }
+    precomputeSymmetricKeys(users);
+
     for (const auto& it : mPendingOutShares)
     {
         handle nodehandle = it.first;
@@ -21971,6 +22270,7 @@ void KeyManager::reset()
     mPendingInShares.clear();
     mPendingOutShares.clear();
     mShareKeys.clear();
+    mSymmetricKeys.clear();
 }
 
 string KeyManager::toString() const
@@ -22747,8 +23047,80 @@ string KeyManager::computeSymmetricKey(handle user)
         return std::string();
     }
 
+    string derivedFrom = attribute->value();
+    derivedFrom.append((const char*)mClient.chatkey->getPubKey(), ECDH::PUBLIC_KEY_LENGTH);
+
+    auto it = mSymmetricKeys.find(user);
+    if (it != mSymmetricKeys.end() && it->second.first == derivedFrom)
+    {
+        return it->second.second;
+    }
+
+    std::string sharedKey = deriveSymmetricKey(mClient.chatkey->getPrivKey(), attribute->value());
+    if (sharedKey.size())
+    {
+        mSymmetricKeys[user] = std::make_pair(std::move(derivedFrom), sharedKey);
+    }
+    return sharedKey;
+}
+
+void KeyManager::precomputeSymmetricKeys(const set<handle>& users)
+{
+    if (!mClient.chatkey)
+    {
+        return;
+    }
+
+    string ourPubKey((const char*)mClient.chatkey->getPubKey(), ECDH::PUBLIC_KEY_LENGTH);
+    vector<pair<handle, string>> pending;
+
+    for (handle user : users)
+    {
+        if (verificationRequired(user))
+        {
+            continue;
+        }
+
+        User *u = mClient.finduser(user, 0);
+        const UserAttribute* attribute = u ? u->getAttribute(ATTR_CU25519_PUBK) : nullptr;
+        if (!attribute || !attribute->isValid())
+        {
+            continue;   // computeSymmetricKey() reports it
+        }
+
+        auto it = mSymmetricKeys.find(user);
+        if (it == mSymmetricKeys.end() || it->second.first != attribute->value() + ourPubKey)
+        {
+            pending.emplace_back(user, attribute->value());
+        }
+    }
+
+    if (pending.size() < 2)
+    {
+        return;
+    }
+
+    vector<string> keys(pending.size());
+    const unsigned char* privKey = mClient.chatkey->getPrivKey();
+
+    parallelFor(pending.size(), 0, [&pending, &keys, privKey](size_t i)
+    {
+        keys[i] = deriveSymmetricKey(privKey, pending[i].second);
+    });
+
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+        if (keys[i].size())
+        {
+            mSymmetricKeys[pending[i].first] = std::make_pair(pending[i].second + ourPubKey, std::move(keys[i]));
+        }
+    }
+}
+
+string KeyManager::deriveSymmetricKey(const unsigned char* privKey, const std::string& pubKey)
+{
     std::string sharedSecret;
-    ECDH ecdh(mClient.chatkey->getPrivKey(), attribute->value());
+    ECDH ecdh(privKey, pubKey);
     if (!ecdh.computeSymmetricKey(sharedSecret))
     {
         return std::string();
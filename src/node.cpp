@@ -35,6 +35,12 @@
 #include "mega/transferslot.h"
 #include "megafs.h"
 
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
 namespace mega {
 
 const vector<string> Node::attributesToCopyIntoPreviousVersions{
@@ -1170,7 +1176,11 @@ bool Node::applykey()
                 if (client->mKeyManager.generation())
                 {
                     std::string key = client->mKeyManager.getShareKey(h);
-                    if (key.size())
+                    if (key.size() == SymmCipher::KEYLENGTH)
+                    {
+                        sc = client->getRecycledTemporaryShareCipher((const byte*)key.data());
+                    }
+                    else if (key.size())
                     {
                         sc = client->getRecycledTemporaryNodeCipher(&key);
                     }
@@ -1194,7 +1204,7 @@ bool Node::applykey()
                     }
                     else
                     {
-                        sc = client->getRecycledTemporaryNodeCipher(it->second.data());
+                        sc = client->getRecycledTemporaryShareCipher(it->second.data());
                     }
                 }
 
@@ -1908,10 +1918,22 @@ void LocalNode::setnameparent(LocalNode* newparent, const LocalPath& newlocalpat
 
     bool parentChange = newparent != parent;
     bool localnameChange = newlocalpath != localname;
+
+    ++sync->mLocalTreeEpoch;
+    if (newparent && newparent->sync != sync)
+    {
+        ++newparent->sync->mLocalTreeEpoch;
+    }
     bool shortnameChange = (newshortname && !slocalname) ||
                            (slocalname && !newshortname) ||
                            (newshortname && slocalname && *newshortname != *slocalname);
 
+    if (parent && parentChange && !sync->mDestructorRunning)
+    {
+        // the old parent no longer leads here
+        sync->unlinkFlagged(*this);
+    }
+
     if (parent)
     {
         if (parentChange || localnameChange)
@@ -1928,10 +1950,14 @@ void LocalNode::setnameparent(LocalNode* newparent, const LocalPath& newlocalpat
             parentChange || shortnameChange))
         {
             // remove existing child linkage for slocalname
-            auto it = parent->schildren.find(*slocalname);
-            if (it != parent->schildren.end() && it->second == this)
+            if (auto& schildren = parent->schildren)
             {
-                parent->schildren.erase(it);
+                auto it = schildren->find(*slocalname);
+                if (it != schildren->end() && it->second == this)
+                {
+                    schildren->erase(it);
+                    if (schildren->empty()) schildren.reset();
+                }
             }
         }
     }
@@ -1950,6 +1976,7 @@ void LocalNode::setnameparent(LocalNode* newparent, const LocalPath& newlocalpat
         // set new name
         localname = newlocalpath;
         toName_of_localname = localname.toName(*sync->syncs.fsaccess);
+        sortKey.reset();
     }
 
     if (shortnameChange)
@@ -1986,7 +2013,14 @@ void LocalNode::setnameparent(LocalNode* newparent, const LocalPath& newlocalpat
     {
         // it's quite possible that the new folder still has an older LocalNode with clashing shortname, that represents a file/folder since moved, but which we don't know about yet.
         // just assign the new one, we forget the old reference.  The other LocalNode will not remove this one since the LocalNode* will not match.
-        parent->schildren[*slocalname] = this;
+        if (!parent->schildren) parent->schildren.reset(new localnode_map);
+        (*parent->schildren)[*slocalname] = this;
+    }
+
+    // the new parent does, if there is anything to do here
+    if (parent && parentChange && !parent->sync->mDestructorRunning && flaggedForSync())
+    {
+        parent->sync->noteFlagged(*this);
     }
 
     // reset treestate
@@ -1999,8 +2033,6 @@ void LocalNode::setnameparent(LocalNode* newparent, const LocalPath& newlocalpat
 
     if (oldsync)
     {
-        DBTableTransactionCommitter committer(oldsync->statecachetable);
-
         // prepare localnodes for a sync change or/and a copy operation
         LocalTreeProcMove tp(parent->sync);
         sync->syncs.proclocaltree(this, &tp);
@@ -2054,6 +2086,178 @@ void LocalNode::bumpnagleds()
     nagleds = Waiter::ds + 11;
 }
 
+namespace {
+
+// Every slot is big enough for a LocalNode (or a free list link) and keeps the nodes aligned.
+constexpr size_t LOCALNODE_SLOT_SIZE =
+    (sizeof(LocalNode) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+// The block header is padded the same way so the first slot is aligned too.
+constexpr size_t LOCALNODE_BLOCK_HEADER_SIZE = alignof(std::max_align_t) * 2;
+
+void* allocateArenaBlock()
+{
+    // aligned operator new is not available on all the platforms we build for
+#ifdef _WIN32
+    void* block = _aligned_malloc(LocalNodeArena::BLOCK_SIZE, LocalNodeArena::BLOCK_SIZE);
+#else
+    void* block = nullptr;
+    if (posix_memalign(&block, LocalNodeArena::BLOCK_SIZE, LocalNodeArena::BLOCK_SIZE))
+    {
+        block = nullptr;
+    }
+#endif
+    if (!block)
+    {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void freeArenaBlock(void* block)
+{
+#ifdef _WIN32
+    _aligned_free(block);
+#else
+    free(block);
+#endif
+}
+
+} // namespace
+
+LocalNodeArena::LocalNodeArena(std::atomic<uint64_t>& totalBytes)
+  : mTotalBytes(totalBytes)
+{
+    static_assert(sizeof(Block) <= LOCALNODE_BLOCK_HEADER_SIZE, "LocalNodeArena block header too small");
+    static_assert(LOCALNODE_BLOCK_HEADER_SIZE + LOCALNODE_SLOT_SIZE <= BLOCK_SIZE, "LocalNodeArena blocks too small");
+}
+
+LocalNodeArena::~LocalNodeArena()
+{
+    assert(!mNodes);
+
+    while (mBlocks)
+    {
+        auto next = mBlocks->next;
+        freeArenaBlock(mBlocks);
+        mBlocks = next;
+    }
+
+    mTotalBytes -= mBlockCount * BLOCK_SIZE;
+}
+
+void LocalNodeArena::addBlock()
+{
+    auto block = static_cast<Block*>(allocateArenaBlock());
+    block->arena = this;
+    block->next = mBlocks;
+    mBlocks = block;
+    ++mBlockCount;
+    mTotalBytes += BLOCK_SIZE;
+
+    mUnused = reinterpret_cast<char*>(block) + LOCALNODE_BLOCK_HEADER_SIZE;
+    mUnusedEnd = reinterpret_cast<char*>(block) + BLOCK_SIZE;
+}
+
+void* LocalNodeArena::allocate(size_t size)
+{
+    assert(size <= LOCALNODE_SLOT_SIZE);
+
+    std::lock_guard<std::mutex> guard(mMutex);
+    assert(!mReleased);
+
+    ++mNodes;
+
+    if (auto slot = mFreeSlots)
+    {
+        mFreeSlots = slot->next;
+        return slot;
+    }
+
+    if (mUnusedEnd - mUnused < static_cast<ptrdiff_t>(LOCALNODE_SLOT_SIZE))
+    {
+        addBlock();
+    }
+
+    auto slot = mUnused;
+    mUnused += LOCALNODE_SLOT_SIZE;
+    return slot;
+}
+
+void LocalNodeArena::deallocate(void* p)
+{
+    if (!p) return;
+
+    auto block = reinterpret_cast<Block*>(reinterpret_cast<uintptr_t>(p) & ~uintptr_t(BLOCK_SIZE - 1));
+    auto arena = block->arena;
+
+    bool last;
+
+    {
+        std::lock_guard<std::mutex> guard(arena->mMutex);
+
+        auto slot = static_cast<FreeSlot*>(p);
+        slot->next = arena->mFreeSlots;
+        arena->mFreeSlots = slot;
+
+        assert(arena->mNodes);
+        last = !--arena->mNodes && arena->mReleased;
+    }
+
+    // released and empty: nothing else can reach the arena any more
+    if (last)
+    {
+        delete arena;
+    }
+}
+
+void LocalNodeArena::release()
+{
+    size_t nodes;
+
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+        mReleased = true;
+        nodes = mNodes;
+    }
+
+    if (!nodes)
+    {
+        delete this;
+    }
+    else
+    {
+        // Some nodes moved to another sync, we go when they do.
+        LOG_debug << "LocalNode arena outlives its sync, holding " << nodes << " nodes";
+    }
+}
+
+auto LocalNodeArena::usage() const -> Usage
+{
+    std::lock_guard<std::mutex> guard(mMutex);
+
+    Usage u;
+    u.nodes = mNodes;
+    u.slotSize = LOCALNODE_SLOT_SIZE;
+    u.reservedBytes = mBlockCount * BLOCK_SIZE;
+    return u;
+}
+
+void* LocalNode::operator new(size_t size, Sync& sync)
+{
+    return sync.localNodeArena().allocate(size);
+}
+
+void LocalNode::operator delete(void* p, Sync&)
+{
+    LocalNodeArena::deallocate(p);
+}
+
+void LocalNode::operator delete(void* p)
+{
+    LocalNodeArena::deallocate(p);
+}
+
 LocalNode::LocalNode(Sync* csync)
 : sync(csync)
 , scanAgain(TREE_RESOLVED)
@@ -2138,6 +2342,7 @@ void LocalNode::init(nodetype_t ctype, LocalNode* cparent, const LocalPath& cful
     {
         localname = cfullpath;
         toName_of_localname = localname.toName(*sync->syncs.fsaccess);
+        sortKey.reset();
         slocalname.reset(shortname && *shortname != localname ? shortname.release() : nullptr);
 
         mExclusionState = ES_INCLUDED;
@@ -2233,6 +2438,7 @@ void LocalNode::setScanAgain(bool doParent, bool doHere, bool doBelow, dstime de
     {
         p->scanAgain = std::max<TreeState>(p->scanAgain, TREE_DESCENDANT_FLAGGED);
     }
+    sync->noteFlagged(*this);
 
     // for scanning, we only need to set the parent once
     if (parent && doParent)
@@ -2253,6 +2459,7 @@ void LocalNode::setCheckMovesAgain(bool doParent, bool doHere, bool doBelow)
     {
         p->checkMovesAgain = std::max<TreeState>(p->checkMovesAgain, TREE_DESCENDANT_FLAGGED);
     }
+    sync->noteFlagged(*this);
 
     parentSetCheckMovesAgain = parentSetCheckMovesAgain || doParent;
 }
@@ -2274,6 +2481,7 @@ void LocalNode::setSyncAgain(bool doParent, bool doHere, bool doBelow)
 
         p->syncAgain = std::max<TreeState>(p->syncAgain, TREE_DESCENDANT_FLAGGED);
     }
+    sync->noteFlagged(*this);
 }
 
 void LocalNode::setContainsConflicts(bool doParent, bool doHere, bool doBelow)
@@ -2290,6 +2498,7 @@ void LocalNode::setContainsConflicts(bool doParent, bool doHere, bool doBelow)
     }
 
     parentSetContainsConflicts = parentSetContainsConflicts || doParent;
+    sync->noteFlagged(*this);
 }
 
 void LocalNode::initiateScanBlocked(bool folderBlocked, bool containsFingerprintBlocked)
@@ -2374,6 +2583,13 @@ bool LocalNode::scanRequired() const
     return scanAgain != TREE_RESOLVED;
 }
 
+bool LocalNode::flaggedForSync() const
+{
+    return scanRequired() || mightHaveMoves() || syncRequired() ||
+           parentSetScanAgain || parentSetCheckMovesAgain ||
+           parentSetSyncAgain || parentSetContainsConflicts;
+}
+
 void LocalNode::clearRegeneratableFolderScan(SyncPath& fullPath, vector<SyncRow>& childRows)
 {
     if (lastFolderScan &&
@@ -2410,6 +2626,7 @@ void LocalNode::clearRegeneratableFolderScan(SyncPath& fullPath, vector<SyncRow>
             // LocalNodes are now consistent with the last scan.
             LOG_debug << sync->syncname << "Clearing regeneratable folder scan records (" << lastFolderScan->size() << ") at " << fullPath.localPath;
             lastFolderScan.reset();
+            ++folderScanGeneration;
         }
     }
 }
@@ -2541,7 +2758,9 @@ bool LocalNode::processBackgroundFolderScan(SyncRow& row, SyncPath& fullPath)
             }
 
             ourScanRequest = sync->syncs.mScanService->queueScan(fullPath.localPath,
-                row.fsNode->fsid, false, move(priorScanChildren), sync->syncs.waiter);
+                row.fsNode->fsid, false, move(priorScanChildren), sync->syncs.waiter,
+                sync->syncs.mClient.mFingerprintCache, FingerprintCache::filesystemKey(sync->fsfp()),
+                sync->getConfig().mBackupId);
 
             rare().scanRequest = ourScanRequest;
             *availableScanSlot = ourScanRequest;
@@ -2579,6 +2798,7 @@ bool LocalNode::processBackgroundFolderScan(SyncRow& row, SyncPath& fullPath)
 
             // Scan results are out of date but may still be useful.
             lastFolderScan.reset(new vector<FSNode>(ourScanRequest->resultNodes()));
+            ++folderScanGeneration;
 
             // Mark this directory as requiring another scan.
             setScanAgain(false, true, false, 10);
@@ -2586,6 +2806,7 @@ bool LocalNode::processBackgroundFolderScan(SyncRow& row, SyncPath& fullPath)
         else if (SCAN_SUCCESS == ourScanRequest->completionResult())
         {
             lastFolderScan.reset(new vector<FSNode>(ourScanRequest->resultNodes()));
+            ++folderScanGeneration;
 
             for (auto& i : *lastFolderScan)
             {
@@ -2803,6 +3024,7 @@ void LocalNode::setScannedFsid(handle newfsid, fsid_localnode_map& fsidnodes, co
 
     fsid_asScanned = newfsid;
     fsidScannedReused = false;
+    ++sync->mLocalTreeEpoch;
 
     scannedFingerprint = scanfp;
 
@@ -2860,6 +3082,11 @@ LocalNode::~LocalNode()
         sync->statecachedel(this);
     }
 
+    if (!sync->mDestructorRunning)
+    {
+        sync->forgetFlagged(*this);
+    }
+
     if (neverScanned)
     {
         neverScanned = 0;
@@ -3034,14 +3261,29 @@ string LocalNode::debugGetParentList()
 // locate child by localname or slocalname
 LocalNode* LocalNode::childbyname(LocalPath* localname)
 {
-    localnode_map::iterator it;
-
-    if (!localname || ((it = children.find(*localname)) == children.end() && (it = schildren.find(*localname)) == schildren.end()))
+    if (!localname)
     {
         return NULL;
     }
 
-    return it->second;
+    auto it = children.find(*localname);
+    if (it != children.end())
+    {
+        return it->second;
+    }
+
+    return childbyshortname(*localname);
+}
+
+LocalNode* LocalNode::childbyshortname(const LocalPath& shortname) const
+{
+    if (!schildren)
+    {
+        return nullptr;
+    }
+
+    auto it = schildren->find(shortname);
+    return it != schildren->end() ? it->second : nullptr;
 }
 
 LocalNode* LocalNode::findChildWithSyncedNodeHandle(NodeHandle h)
@@ -3413,7 +3655,7 @@ bool LocalNodeCore::read(const string& source, uint32_t& parentID)
 
 unique_ptr<LocalNode> LocalNode::unserialize(Sync& sync, const string& source, uint32_t& parentID)
 {
-    auto node = std::make_unique<LocalNode>(&sync);
+    auto node = unique_ptr<LocalNode>(new (sync) LocalNode(&sync));
 
     if (!node->read(source, parentID))
         return nullptr;
@@ -1379,13 +1379,26 @@ void NodeManager::applyKeys_internal(uint32_t appliedKeys)
 
     if (mNodes.size() > appliedKeys)
     {
+        sharedNode_vector nodes;
+        nodes.reserve(mNodes.size());
+
         for (auto& it : mNodes)
         {
             if (shared_ptr<Node> node = it.second.getNodeInRam(false))
             {
-               node->applykey();
+                nodes.push_back(std::move(node));
             }
         }
+
+        // do any RSA work up front, in parallel, rather than one key at a time below
+        mClient.predecryptnodekeys(nodes);
+
+        for (auto& node : nodes)
+        {
+            node->applykey();
+        }
+
+        mClient.mPredecryptedKeys.clear();
     }
 }
 
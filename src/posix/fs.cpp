@@ -525,6 +525,14 @@ bool PosixFileAccess::sysread(byte* dst, unsigned len, m_off_t pos)
 #endif
 }
 
+void PosixFileAccess::sysprefetch(m_off_t pos, unsigned len)
+{
+#ifdef POSIX_FADV_WILLNEED
+    // starts reading the range in the background, so scattered reads overlap
+    posix_fadvise(fd, pos, len, POSIX_FADV_WILLNEED);
+#endif
+}
+
 void PosixFileAccess::fclose()
 {
 #ifndef HAVE_FDOPENDIR
@@ -678,6 +686,7 @@ bool PosixFileAccess::fopen(const LocalPath& f, bool read, bool write, FSLogging
 
             size = 0;
             mtime = statbuf.st_mtime;
+            ctime = statbuf.st_ctime;
             type = FOLDERNODE;
             fsid = (handle)statbuf.st_ino;
             fsidvalid = true;
@@ -761,6 +770,7 @@ bool PosixFileAccess::fopen(const LocalPath& f, bool read, bool write, FSLogging
             type = S_ISDIR(statbuf.st_mode) ? FOLDERNODE : FILENODE;
             size = (type == FILENODE || mIsSymLink) ? statbuf.st_size : 0;
             mtime = statbuf.st_mtime;
+            ctime = statbuf.st_ctime;
             // in the future we might want to add LINKNODE to type and set it here using S_ISLNK
             fsid = (handle)statbuf.st_ino;
             fsidvalid = true;
@@ -816,8 +826,28 @@ PosixFileSystemAccess::PosixFileSystemAccess()
 #ifdef __linux__
 #ifdef ENABLE_SYNC
 
+#ifdef USE_FANOTIFY
+// What we ask fanotify for: the events inotify watches are added with.
+static const uint64_t FANOTIFY_EVENTS =
+  FAN_ATTRIB | FAN_CLOSE_WRITE | FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR;
+
+// Bound on the directory handles remembered between fanotify events.
+static const size_t FANOTIFY_HANDLE_CACHE_SIZE = 1 << 16;
+#endif // USE_FANOTIFY
+
 bool LinuxFileSystemAccess::initFilesystemNotificationSystem()
 {
+#ifdef USE_FANOTIFY
+    // Only permitted with CAP_SYS_ADMIN.  Without it, syncs add inotify watches as usual.
+    mFanotifyFd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY);
+
+    if (mFanotifyFd < 0)
+    {
+        mFanotifyFd = -errno;
+        LOG_debug << "fanotify is not available, using inotify: " << -mFanotifyFd;
+    }
+#endif // USE_FANOTIFY
+
     mNotifyFd = inotify_init1(IN_NONBLOCK);
 
     if (mNotifyFd < 0)
@@ -838,6 +868,11 @@ LinuxFileSystemAccess::~LinuxFileSystemAccess()
     if (mNotifyFd >= 0)
         close(mNotifyFd);
 
+#ifdef USE_FANOTIFY
+    if (mFanotifyFd >= 0)
+        close(mFanotifyFd);
+#endif // USE_FANOTIFY
+
 #endif // ENABLE_SYNC
 }
 
@@ -878,11 +913,21 @@ void LinuxFileSystemAccess::addevents(Waiter* waiter, int flags)
 {
 #ifdef ENABLE_SYNC
 
+    auto w = static_cast<PosixWaiter*>(waiter);
+
+#ifdef USE_FANOTIFY
+    if (mFanotifyFd >= 0)
+    {
+        MEGA_FD_SET(mFanotifyFd, &w->rfds);
+        MEGA_FD_SET(mFanotifyFd, &w->ignorefds);
+
+        w->bumpmaxfd(mFanotifyFd);
+    }
+#endif // USE_FANOTIFY
+
     if (mNotifyFd < 0)
         return;
 
-    auto w = static_cast<PosixWaiter*>(waiter);
-
     MEGA_FD_SET(mNotifyFd, &w->rfds);
     MEGA_FD_SET(mNotifyFd, &w->ignorefds);
 
@@ -898,6 +943,11 @@ int LinuxFileSystemAccess::checkevents(Waiter* waiter)
 
 #ifdef ENABLE_SYNC
 
+#ifdef USE_FANOTIFY
+    if (mFanotifyFd >= 0 && MEGA_FD_ISSET(mFanotifyFd, &static_cast<PosixWaiter*>(waiter)->rfds))
+        checkFanotifyEvents(result);
+#endif // USE_FANOTIFY
+
     if (mNotifyFd < 0)
         return result;
 
@@ -918,7 +968,7 @@ int LinuxFileSystemAccess::checkevents(Waiter* waiter)
     WatchMapIterator it;
     string localpath;
 
-    auto notifyAll = [&](int handle, const string& name)
+    auto notifyAll = [&](int64_t handle, const string& name)
     {
         // Loop over and notify all associated nodes.
         auto associated = mWatches.equal_range(handle);
@@ -1007,6 +1057,155 @@ int LinuxFileSystemAccess::checkevents(Waiter* waiter)
     return result;
 }
 
+#if defined(ENABLE_SYNC) && defined(USE_FANOTIFY)
+
+// read all pending fanotify events and queue them for processing
+void LinuxFileSystemAccess::checkFanotifyEvents(int& result)
+{
+    alignas(fanotify_event_metadata) char buf[16 * 1024];
+    ssize_t length;
+
+    while ((length = read(mFanotifyFd, buf, sizeof buf)) > 0)
+    {
+        auto* event = reinterpret_cast<fanotify_event_metadata*>(buf);
+
+        for (; FAN_EVENT_OK(event, length); event = FAN_EVENT_NEXT(event, length))
+        {
+            if (event->vers != FANOTIFY_METADATA_VERSION)
+            {
+                LOG_err << "Unexpected fanotify metadata version: " << static_cast<int>(event->vers);
+                return;
+            }
+
+            if ((event->mask & FAN_Q_OVERFLOW))
+            {
+                LOG_err << "fanotify FAN_Q_OVERFLOW";
+
+                // Called so that related syncs perform a rescan.
+                for (auto* notifier : mNotifiers)
+                {
+                    if (static_cast<LinuxDirNotify*>(notifier)->usesFanotify())
+                        ++notifier->mErrorCount;
+                }
+                continue;
+            }
+
+            // Events identify the directory by handle, and the entry in it by name.
+            auto* info = reinterpret_cast<fanotify_event_info_fid*>(event + 1);
+            auto* end = reinterpret_cast<char*>(event) + event->event_len;
+
+            if (reinterpret_cast<char*>(info + 1) > end
+                || (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME
+                    && info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID))
+            {
+                continue;
+            }
+
+            auto* fh = reinterpret_cast<file_handle*>(info->handle);
+            string name;
+
+            if (info->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+            {
+                name = reinterpret_cast<const char*>(fh->f_handle + fh->handle_bytes);
+
+                // reported for events on the directory itself
+                if (name == ".")
+                    name.clear();
+            }
+
+            uint64_t filesystemId;
+            memcpy(&filesystemId, &info->fsid, sizeof(filesystemId));
+
+            // Any of our notifiers on that filesystem can resolve the handle.
+            LinuxDirNotify* marked = nullptr;
+
+            for (auto* notifier : mNotifiers)
+            {
+                auto* linuxNotifier = static_cast<LinuxDirNotify*>(notifier);
+
+                if (linuxNotifier->usesFanotify() && linuxNotifier->mFilesystemId == filesystemId)
+                {
+                    marked = linuxNotifier;
+                    break;
+                }
+            }
+
+            if (!marked)
+                continue;
+
+            auto inode = fanotifyDirectory(*marked, *fh);
+
+            if (inode == UNDEF)
+                continue;
+
+            // Loop over and notify all associated nodes.
+            auto associated = mFanotifyWatches.equal_range(static_cast<int64_t>(inode));
+
+            for (auto i = associated.first; i != associated.second; ++i)
+            {
+                auto& node = *i->second.first;
+                auto& notifier = static_cast<LinuxDirNotify&>(*node.sync->dirnotify);
+
+                // Inode numbers are only unique within a filesystem.
+                if (notifier.mFilesystemId != filesystemId)
+                    continue;
+
+                LOG_debug << "Filesystem notification:"
+                    << " Root: "
+                    << node.localname
+                    << " Path: "
+                    << name;
+
+                notifier.notify(notifier.fsEventq,
+                                &node,
+                                Notification::NEEDS_PARENT_SCAN,
+                                LocalPath::fromPlatformEncodedRelative(name));
+
+                // As with inotify, rescan a directory whose permissions changed.
+                if ((event->mask & (FAN_ATTRIB | FAN_ONDIR)) == (FAN_ATTRIB | FAN_ONDIR))
+                    notifier.notify(notifier.fsEventq,
+                                    &node,
+                                    Notification::FOLDER_NEEDS_SELF_SCAN,
+                                    LocalPath::fromPlatformEncodedRelative(name));
+
+                result |= Waiter::NEEDEXEC;
+            }
+        }
+    }
+}
+
+handle LinuxFileSystemAccess::fanotifyDirectory(LinuxDirNotify& notifier, ::file_handle& fh)
+{
+    string key(reinterpret_cast<const char*>(&notifier.mFilesystemId), sizeof(notifier.mFilesystemId));
+    key.append(reinterpret_cast<const char*>(&fh), sizeof(fh) + fh.handle_bytes);
+
+    auto cached = mFanotifyHandles.find(key);
+
+    if (cached != mFanotifyHandles.end())
+        return cached->second;
+
+    auto fd = open_by_handle_at(notifier.mRootFd, &fh, O_PATH);
+
+    // The directory is gone (ESTALE), and its parent is told about that.
+    if (fd < 0)
+        return UNDEF;
+
+    struct stat statbuf;
+    auto failed = fstat(fd, &statbuf);
+
+    close(fd);
+
+    if (failed)
+        return UNDEF;
+
+    if (mFanotifyHandles.size() >= FANOTIFY_HANDLE_CACHE_SIZE)
+        mFanotifyHandles.clear();
+
+    return mFanotifyHandles[key] = (handle)statbuf.st_ino;
+}
+
+#endif // ENABLE_SYNC && USE_FANOTIFY
+
 #endif //  __linux__
 
 
@@ -1642,14 +1841,102 @@ LinuxDirNotify::LinuxDirNotify(LinuxFileSystemAccess& owner,
     // Did our owner initialize correctly?
     if (owner.mNotifyFd >= 0)
         setFailed(0, "");
+
+#ifdef USE_FANOTIFY
+    // One mark covers the whole filesystem, so no watch needs adding per folder.
+    if (owner.mFanotifyFd >= 0 && markFilesystem(rootPath))
+        setFailed(0, "");
+#endif // USE_FANOTIFY
 }
 
 LinuxDirNotify::~LinuxDirNotify()
 {
+#ifdef USE_FANOTIFY
+    if (usesFanotify())
+    {
+        auto mark = mOwner.mFanotifyMarks.find(mFilesystemId);
+        assert(mark != mOwner.mFanotifyMarks.end());
+
+        // Last sync on this filesystem?
+        if (mark != mOwner.mFanotifyMarks.end() && !--mark->second)
+        {
+            if (fanotify_mark(mOwner.mFanotifyFd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, mRootFd, nullptr))
+            {
+                LOG_verbose << "fanotify_mark removal for " << localbasepath
+                            << " error no: " << errno;
+            }
+
+            mOwner.mFanotifyMarks.erase(mark);
+        }
+
+        close(mRootFd);
+    }
+#endif // USE_FANOTIFY
+
     // Remove ourselves from our owner's list of notiifers.
     mOwner.mNotifiers.erase(mNotifiersIt);
 }
 
+void LinuxDirNotify::logWatchStats() const
+{
+#ifdef USE_FANOTIFY
+    auto method = usesFanotify() ? "fanotify" : "inotify";
+#else
+    auto method = "inotify";
+#endif // USE_FANOTIFY
+
+    LOG_debug << "Filesystem monitoring of " << localbasepath << " using " << method << ": "
+              << mWatchesAdded << " folders watched in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(mWatchTime).count() << " ms";
+}
+
+#ifdef USE_FANOTIFY
+
+bool LinuxDirNotify::markFilesystem(const LocalPath& rootPath)
+{
+    auto fd = open(rootPath.localpath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct statfs statbuf;
+
+    if (fd < 0 || fstatfs(fd, &statbuf))
+    {
+        LOG_warn << "Unable to open sync root for fanotify: " << rootPath << ": " << errno;
+
+        if (fd >= 0)
+            close(fd);
+
+        return false;
+    }
+
+    uint64_t filesystemId;
+    static_assert(sizeof(statbuf.f_fsid) == sizeof(filesystemId), "Unexpected filesystem id size");
+    memcpy(&filesystemId, &statbuf.f_fsid, sizeof(filesystemId));
+
+    auto& users = mOwner.mFanotifyMarks[filesystemId];
+
+    // Filesystems that can't encode file handles (some network and FUSE ones) can't be marked.
+    if (!users && fanotify_mark(mOwner.mFanotifyFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, fd, nullptr))
+    {
+        auto error = errno;
+
+        LOG_warn << "Unable to monitor " << rootPath << " with fanotify, using inotify: " << error;
+
+        mOwner.mFanotifyMarks.erase(filesystemId);
+        close(fd);
+
+        return false;
+    }
+
+    ++users;
+    mRootFd = fd;
+    mFilesystemId = filesystemId;
+
+    LOG_debug << "Monitoring the filesystem of " << rootPath << " with fanotify";
+
+    return true;
+}
+
+#endif // USE_FANOTIFY
+
 #if defined(USE_INOTIFY)
 
 AddWatchResult LinuxDirNotify::addWatch(LocalNode& node,
@@ -1661,6 +1948,48 @@ AddWatchResult LinuxDirNotify::addWatch(LocalNode& node,
 
     assert(node.type == FOLDERNODE);
 
+    auto started = std::chrono::steady_clock::now();
+    auto accountTime = makeScopedDestructor([&]() {
+        mWatchTime += std::chrono::steady_clock::now() - started;
+    });
+
+#ifdef USE_FANOTIFY
+    if (usesFanotify())
+    {
+        auto& directories = mOwner.mFanotifyWatches;
+
+        // Events come for the whole filesystem, we just need to recognize this directory's.
+        auto inode = fsid;
+
+        // The sync root is watched before it's scanned.
+        if (inode == UNDEF)
+        {
+            struct stat statbuf;
+
+            if (stat(path.localpath.c_str(), &statbuf))
+            {
+                LOG_warn << "Unable to monitor path for filesystem notifications: "
+                    << path.localpath.c_str()
+                    << ": Error: "
+                    << errno;
+
+                return make_pair(directories.end(), WR_FAILURE);
+            }
+
+            inode = (handle)statbuf.st_ino;
+        }
+
+        auto entry =
+            directories.emplace(piecewise_construct,
+                forward_as_tuple(static_cast<int64_t>(inode)),
+                forward_as_tuple(&node, fsid));
+
+        ++mWatchesAdded;
+
+        return make_pair(entry, WR_SUCCESS);
+    }
+#endif // USE_FANOTIFY
+
     // Convenience.
     auto& watches = mOwner.mWatches;
 
@@ -1684,6 +2013,8 @@ AddWatchResult LinuxDirNotify::addWatch(LocalNode& node,
                 forward_as_tuple(handle),
                 forward_as_tuple(&node, fsid));
 
+        ++mWatchesAdded;
+
         return make_pair(entry, WR_SUCCESS);
     }
 
@@ -1702,6 +2033,15 @@ AddWatchResult LinuxDirNotify::addWatch(LocalNode& node,
 
 void LinuxDirNotify::removeWatch(WatchMapIterator entry)
 {
+#ifdef USE_FANOTIFY
+    if (usesFanotify())
+    {
+        // Nothing to tell the kernel.
+        mOwner.mFanotifyWatches.erase(entry);
+        return;
+    }
+#endif // USE_FANOTIFY
+
     LOG_verbose << "removeWatch for handle: " << entry->first;
     auto& watches = mOwner.mWatches;
 
@@ -1726,7 +2066,7 @@ void LinuxDirNotify::removeWatch(WatchMapIterator entry)
         return;
     }
 
-    auto const removedResult = inotify_rm_watch(mOwner.mNotifyFd, handle);
+    auto const removedResult = inotify_rm_watch(mOwner.mNotifyFd, static_cast<int>(handle));
 
     if (removedResult)
     {
@@ -1820,7 +2160,9 @@ ScanResult PosixFileSystemAccess::directoryScan(const LocalPath& targetPath,
                                                 map<LocalPath, FSNode>& known,
                                                 std::vector<FSNode>& results,
                                                 bool followSymLinks,
-                                                unsigned& nFingerprinted)
+                                                unsigned& nFingerprinted,
+                                                FingerprintCache* fingerprintCache,
+                                                const string& filesystem)
 {
     // Scan path should always be absolute.
     assert(targetPath.isAbsolute());
@@ -2028,6 +2370,18 @@ ScanResult PosixFileSystemAccess::directoryScan(const LocalPath& targetPath,
             continue;
         }
 
+        // Did anyone fingerprint this file in an earlier session?
+        if (fingerprintCache
+            && fingerprintCache->lookup(filesystem,
+                                        result.fsid,
+                                        result.fingerprint.size,
+                                        result.fingerprint.mtime,
+                                        metadata.st_ctime,
+                                        result.fingerprint))
+        {
+            continue;
+        }
+
         // Try and open the file for reading.
         UnixStreamAccess isAccess(path.localpath.c_str(),
                                   result.fingerprint.size);
@@ -2048,6 +2402,14 @@ ScanResult PosixFileSystemAccess::directoryScan(const LocalPath& targetPath,
           &isAccess, result.fingerprint.mtime);
 
         ++nFingerprinted;
+
+        if (fingerprintCache)
+        {
+            fingerprintCache->store(filesystem,
+                                    result.fsid,
+                                    metadata.st_ctime,
+                                    result.fingerprint);
+        }
     }
 
     // We're done iterating the directory.
@@ -109,20 +109,25 @@ FaultyServers g_faultyServers;
 
 RaidBufferManager::FilePiece::FilePiece()
     : pos(0)
-    , buf(NULL, 0, 0)
+    , buf(NULL, 0, 0, 0)
 {
 }
 
 RaidBufferManager::FilePiece::FilePiece(m_off_t p, size_t len)
     : pos(p)
-    , buf(new byte[len + std::min<size_t>(SymmCipher::BLOCKSIZE, RAIDSECTOR)], 0, len)   // SymmCipher::ctr_crypt requirement: decryption: data must be padded to BLOCKSIZE.  Also make sure we can xor up to RAIDSECTOR more for convenience
+    , buf(NULL, 0, 0, 0)
 {
+    // SymmCipher::ctr_crypt requirement: decryption: data must be padded to BLOCKSIZE.  Also make sure we can xor up to RAIDSECTOR more for convenience
+    size_t capacity;
+    byte* b = TransferBufferPool::instance().allocate(len + std::min<size_t>(SymmCipher::BLOCKSIZE, RAIDSECTOR), capacity);
+    HttpReq::http_buf_t pooled(b, 0, len, capacity);
+    buf.swap(pooled);
 }
 
 
 RaidBufferManager::FilePiece::FilePiece(m_off_t p, HttpReq::http_buf_t* b) // taking ownership
     : pos(p)
-    , buf(NULL, 0, 0)
+    , buf(NULL, 0, 0, 0)
 {
     buf.swap(*b);  // take its buffer and copy other members
     delete b;  // client no longer owns it so we must delete.  Similar to move semantics where we would just assign
@@ -309,6 +314,11 @@ void RaidBufferManager::submitBuffer(unsigned connectionNum, FilePiece* piece)
             raidHttpGetErrorCount[connectionNum] = 0;
         }
 
+        if (!piece->buf.isNull())
+        {
+            ++mBufferStats.buffersAdopted;
+        }
+
         std::deque<FilePiece*>& connectionpieces = raidinputparts[connectionNum];
         m_off_t contiguouspos = connectionpieces.empty() ? raidpartspos : connectionpieces.back()->pos + connectionpieces.back()->buf.datalen();
 
@@ -321,6 +331,8 @@ void RaidBufferManager::submitBuffer(unsigned connectionNum, FilePiece* piece)
     }
     else
     {
+        // the http buffer is decrypted in place and written out as is
+        ++mBufferStats.buffersAdopted;
         finalize(*piece);
         assert(asyncoutputbuffers.find(connectionNum) == asyncoutputbuffers.end() || !asyncoutputbuffers[connectionNum]);
         asyncoutputbuffers[connectionNum].reset(piece);
@@ -421,7 +433,7 @@ std::pair<m_off_t, m_off_t> RaidBufferManager::nextNPosForConnection(unsigned co
         }
         if (unusedRaidConnection == connectionNum && npos > curpos)
         {
-            submitBuffer(connectionNum, new RaidBufferManager::FilePiece(curpos, new HttpReq::http_buf_t(NULL, 0, size_t(npos - curpos))));
+            submitBuffer(connectionNum, new RaidBufferManager::FilePiece(curpos, new HttpReq::http_buf_t(NULL, 0, size_t(npos - curpos), 0)));
             transferPos(connectionNum) = npos;
             newInputBufferSupplied = true;
         }
@@ -507,6 +519,15 @@ void RaidBufferManager::combineRaidParts(unsigned connectionNum)
     {
         m_off_t macchunkpos = calcOutputChunkPos(newdatafilepos + partslen * EFFECTIVE_RAIDPARTS);
 
+        if (!processToEnd && macchunkpos > newdatafilepos)
+        {
+            // only combine the raid lines needed to reach the mac chunk boundary. The rest stays in
+            // the input parts rather than being copied out to leftoverchunk and then copied again
+            // into the next output buffer. What is held over is then less than one raid line.
+            m_off_t neededlines = (macchunkpos - newdatafilepos + RAIDLINE - 1) / RAIDLINE;
+            partslen = std::min<size_t>(partslen, static_cast<size_t>(neededlines) * RAIDSECTOR);
+        }
+
         size_t buflen = static_cast<size_t>(processToEnd ? sumdatalen : partslen * EFFECTIVE_RAIDPARTS);
         LOG_debug << "Combining raid parts -> partslen = " << partslen << ", buflen = " << buflen << ", outputfilepos = " << outputfilepos << ", leftoverchunk = " << leftoverchunk.buf.datalen();
         FilePiece* outputrec = combineRaidParts(partslen, buflen, outputfilepos, leftoverchunk);  // includes a bit of extra space for non-full sectors if we are at the end of the file
@@ -532,6 +553,9 @@ void RaidBufferManager::combineRaidParts(unsigned connectionNum)
             FilePiece newleftover(outputfilepos - excessdata, excessdata);
             leftoverchunk.swap(newleftover);
             memcpy(leftoverchunk.buf.datastart(), outputrec->buf.datastart() + outputrec->buf.datalen() - excessdata, excessdata);
+            ++mBufferStats.buffersAllocated;
+            mBufferStats.bytesAllocated += excessdata;
+            mBufferStats.bytesRecopied += excessdata;
             outputrec->buf.end -= excessdata;
             outputfilepos -= excessdata;
             assert(raidpartspos * EFFECTIVE_RAIDPARTS == outputfilepos + m_off_t(leftoverchunk.buf.datalen()));
@@ -573,6 +597,10 @@ RaidBufferManager::FilePiece* RaidBufferManager::combineRaidParts(size_t partsle
 
     // add a bit of extra space and copy prev chunk to the front
     FilePiece* result = new FilePiece(filepos, bufflen + prevleftoverchunk.buf.datalen());
+    ++mBufferStats.buffersAllocated;
+    mBufferStats.bytesAllocated += bufflen + prevleftoverchunk.buf.datalen();
+    mBufferStats.bytesCopied += bufflen;
+
     if (prevleftoverchunk.buf.datalen() > 0)
     {
         memcpy(result->buf.datastart(), prevleftoverchunk.buf.datastart(), prevleftoverchunk.buf.datalen());
@@ -851,6 +879,11 @@ unsigned RaidBufferManager::getUnusedRaidConnection() const
     return unusedRaidConnection;
 }
 
+const RaidBufferManager::BufferStats& RaidBufferManager::bufferStats() const
+{
+    return mBufferStats;
+}
+
 m_off_t RaidBufferManager::progress() const
 {
     assert(isRaid());
@@ -22,12 +22,14 @@
 #include <memory>
 #include <type_traits>
 #include <future>
+#include <optional>
 
 #include "mega.h"
 
 #ifdef ENABLE_SYNC
 #include "mega/base64.h"
 #include "mega/heartbeats.h"
+#include "mega/mega_csv.h"
 #include "mega/megaapp.h"
 #include "mega/megaclient.h"
 #include "mega/scoped_helpers.h"
@@ -53,6 +55,11 @@ const std::chrono::milliseconds Syncs::TIME_WINDOW_FOR_SYNC_VERBOSE_TIMED{1000};
 #define SYNC_verbose_timed if (syncs.mDetailedSyncLogging) SYNCS_verbose_timed
 #define SYNCS_verbose_timed LOG_verbose_timed(Syncs::MIN_DELAY_BETWEEN_SYNC_VERBOSE_TIMED, Syncs::TIME_WINDOW_FOR_SYNC_VERBOSE_TIMED)
 
+// Set while a thread (possibly the sync thread itself) computes child rows in Sync::precomputeChildRows().
+// Those computations only read the LocalNode tree, which the sync thread leaves alone meanwhile,
+// and are timed as a whole rather than one by one (the CodeCounter stats are not thread safe).
+static thread_local bool precomputingChildRows = false;
+
 bool PerSyncStats::operator==(const PerSyncStats& other)
 {
     return  scanning == other.scanning &&
@@ -60,7 +67,10 @@ bool PerSyncStats::operator==(const PerSyncStats& other)
             numFiles == other.numFiles &&
             numFolders == other.numFolders &&
             numUploads == other.numUploads &&
-            numDownloads == other.numDownloads;
+            numDownloads == other.numDownloads &&
+            foldersScanned == other.foldersScanned &&
+            filesFingerprinted == other.filesFingerprinted &&
+            scanMilliseconds == other.scanMilliseconds;
 }
 
 bool PerSyncStats::operator!=(const PerSyncStats& other)
@@ -559,12 +569,233 @@ string SyncConfig::getSyncDbStateCacheName(handle fsid, NodeHandle nh, handle us
     return dbname;
 }
 
+namespace {
+
+const char STATECACHE_SNAPSHOT_MAGIC[] = "MEGASCSN";
+const uint32_t STATECACHE_SNAPSHOT_VERSION = 1;
+const unsigned STATECACHE_SNAPSHOT_TAGLEN = 16;
+
+// plain text gathered before being encrypted and written
+const size_t STATECACHE_SNAPSHOT_BUFFER = 1024 * 1024;
+
+LocalPath withSuffix(const LocalPath& path, const char* suffix)
+{
+    LocalPath result = path;
+    result.append(LocalPath::fromRelativePath(suffix));
+    return result;
+}
+
+} // namespace
+
+StateCacheSnapshot::Origin StateCacheSnapshot::originOf(FileSystemAccess& fsAccess, const LocalPath& dbPath)
+{
+    Origin origin;
+
+    auto fa = fsAccess.newfileaccess(false);
+
+    // changes still in the write-ahead log are not reflected in the database file
+    if (fa->fopen(withSuffix(dbPath, "-wal"), FSLogging::noLogging) && fa->size > 0)
+    {
+        return origin;
+    }
+
+    if (fa->fopen(dbPath, FSLogging::noLogging) && fa->type == FILENODE)
+    {
+        origin.dbSize = fa->size;
+        origin.dbMtime = fa->mtime;
+    }
+
+    return origin;
+}
+
+LocalPath StateCacheSnapshot::pathFor(const LocalPath& dbPath)
+{
+    return withSuffix(dbPath, ".snapshot");
+}
+
+StateCacheSnapshot::Writer::Writer(FileSystemAccess& fsAccess, const LocalPath& path, SymmCipher& key, PrnGen& rng, const Origin& origin, uint32_t nextid)
+  : mFsAccess(fsAccess)
+  , mKey(key)
+  , mPath(path)
+  , mTmpPath(withSuffix(path, ".tmp"))
+  , mFile(fsAccess.newfileaccess(false))
+  , mPos(HEADER_SIZE)
+{
+    rng.genblock(mIv, sizeof(mIv));
+
+    mFailed = !mFile->fopen(mTmpPath, false, true, FSLogging::logOnError)
+           || !mFile->ftruncate()
+           || !mKey.gcm_encrypt_init(mIv, sizeof(mIv));
+
+    mPlain.reserve(STATECACHE_SNAPSHOT_BUFFER + 4096);
+
+    CacheableWriter w(mPlain);
+    w.serializei64(origin.dbSize);
+    w.serializei64(origin.dbMtime);
+    w.serializeu32(nextid);
+}
+
+StateCacheSnapshot::Writer::~Writer()
+{
+    if (!mCommitted)
+    {
+        mFile.reset();
+        mFsAccess.unlinklocal(mTmpPath);
+    }
+}
+
+bool StateCacheSnapshot::Writer::add(uint32_t dbid, uint32_t crc, const string& record)
+{
+    CacheableWriter w(mPlain);
+    w.serializeu32(dbid);
+    w.serializeu32(crc);
+    w.serializestring_u32(record);
+
+    return mPlain.size() < STATECACHE_SNAPSHOT_BUFFER || flush();
+}
+
+bool StateCacheSnapshot::Writer::flush()
+{
+    if (mFailed || mPlain.empty())
+    {
+        return !mFailed;
+    }
+
+    mCipher.resize(mPlain.size());
+
+    mFailed = !mKey.gcm_encrypt_update(reinterpret_cast<const byte*>(mPlain.data()), reinterpret_cast<byte*>(&mCipher[0]), mPlain.size())
+           || !mFile->fwrite(reinterpret_cast<const byte*>(mCipher.data()), static_cast<unsigned>(mCipher.size()), mPos);
+
+    mPos += static_cast<m_off_t>(mPlain.size());
+    mPlain.clear();
+
+    return !mFailed;
+}
+
+bool StateCacheSnapshot::Writer::commit()
+{
+    byte tag[STATECACHE_SNAPSHOT_TAGLEN];
+
+    if (!flush() || !mKey.gcm_encrypt_final(tag, sizeof(tag)))
+    {
+        return false;
+    }
+
+    string header;
+    CacheableWriter w(header);
+    w.serializebinary((byte*)STATECACHE_SNAPSHOT_MAGIC, 8);
+    w.serializeu32(STATECACHE_SNAPSHOT_VERSION);
+    w.serializeu32(0);
+    w.serializeu64(static_cast<uint64_t>(mPos - HEADER_SIZE));
+    w.serializebinary(mIv, sizeof(mIv));
+    w.serializebinary(tag, sizeof(tag));
+    assert(header.size() == HEADER_SIZE);
+
+    if (!mFile->fwrite(reinterpret_cast<const byte*>(header.data()), HEADER_SIZE, 0))
+    {
+        return false;
+    }
+
+    mFile.reset();
+
+    if (!mFsAccess.renamelocal(mTmpPath, mPath, true))
+    {
+        LOG_warn << "Could not move the state cache snapshot into place: " << mPath;
+        return false;
+    }
+
+    mCommitted = true;
+    return true;
+}
+
+bool StateCacheSnapshot::load(const LocalPath& path, SymmCipher& key, const Origin& expected)
+{
+    std::error_code error;
+    auto map = mio::make_mmap_source(path.asPlatformEncoded(false), error);
+
+    if (error || map.size() < HEADER_SIZE)
+    {
+        return false;
+    }
+
+    string header(map.data(), HEADER_SIZE);
+    CacheableReader r(header);
+
+    byte magic[8];
+    uint32_t version = 0;
+    uint32_t reserved = 0;
+    uint64_t payloadSize = 0;
+    byte iv[12];
+    byte tag[STATECACHE_SNAPSHOT_TAGLEN];
+
+    if (!r.unserializebinary(magic, sizeof(magic))
+        || memcmp(magic, STATECACHE_SNAPSHOT_MAGIC, sizeof(magic))
+        || !r.unserializeu32(version)
+        || version != STATECACHE_SNAPSHOT_VERSION
+        || !r.unserializeu32(reserved)
+        || !r.unserializeu64(payloadSize)
+        || payloadSize != map.size() - HEADER_SIZE
+        || !r.unserializebinary(iv, sizeof(iv))
+        || !r.unserializebinary(tag, sizeof(tag)))
+    {
+        LOG_warn << "State cache snapshot has an unexpected format: " << path;
+        return false;
+    }
+
+    mPayload.resize(static_cast<size_t>(payloadSize));
+
+    // Decrypt straight from the mapping, a piece at a time, as the writer encrypted it.
+    auto in = reinterpret_cast<const byte*>(map.data()) + HEADER_SIZE;
+    auto out = reinterpret_cast<byte*>(&mPayload[0]);
+    bool decrypted = key.gcm_decrypt_init(iv, sizeof(iv));
+
+    for (size_t pos = 0; decrypted && pos < mPayload.size(); pos += STATECACHE_SNAPSHOT_BUFFER)
+    {
+        auto len = std::min<size_t>(STATECACHE_SNAPSHOT_BUFFER, mPayload.size() - pos);
+        decrypted = key.gcm_decrypt_update(in + pos, out + pos, len);
+    }
+
+    if (!decrypted || !key.gcm_decrypt_final(tag, sizeof(tag)))
+    {
+        LOG_warn << "State cache snapshot failed authentication: " << path;
+        mPayload.clear();
+        return false;
+    }
+
+    CacheableReader payload(mPayload);
+
+    Origin origin;
+    if (!payload.unserializei64(origin.dbSize)
+        || !payload.unserializei64(origin.dbMtime)
+        || !payload.unserializeu32(mNextid)
+        || origin != expected)
+    {
+        LOG_debug << "State cache snapshot is for a different database state: " << path;
+        mPayload.clear();
+        return false;
+    }
+
+    mReader = payload;
+    return true;
+}
+
+bool StateCacheSnapshot::next(uint32_t& dbid, uint32_t& crc, string& record)
+{
+    record.clear();
+
+    return mReader.hasdataleft()
+        && mReader.unserializeu32(dbid)
+        && mReader.unserializeu32(crc)
+        && mReader.unserializestring_u32(record);
+}
+
 // new Syncs are automatically inserted into the session's syncs list
 // and a full read of the subtree is initiated
 Sync::Sync(UnifiedSync& us, const string& cdebris,
            const LocalPath& clocaldebris, bool cinshare,
            const string& logname, SyncError& e)
 : syncs(us.syncs)
+, mLocalNodeArena(new LocalNodeArena(us.syncs.totalLocalNodeBytes))
 , localroot(nullptr)
 , mUnifiedSync(us)
 , syncscanbt(us.syncs.rng)
@@ -575,7 +806,7 @@ Sync::Sync(UnifiedSync& us, const string& cdebris,
     assert(cdebris.empty() || clocaldebris.empty());
     assert(!cdebris.empty() || !clocaldebris.empty());
 
-    localroot.reset(new LocalNode(this));
+    localroot.reset(new (*this) LocalNode(this));
 
     const SyncConfig& config = us.mConfig;
 
@@ -702,6 +933,7 @@ Sync::Sync(UnifiedSync& us, const string& cdebris,
 
     // load LocalNodes from cache (only for internal syncs)
     // We are using SQLite in the no-mutex mode, so only access a database from a single thread.
+    // (Once loaded, all writes happen on mStateCacheWriter's thread.)
     if (shouldHaveDatabase())
     {
         string dbname = config.getSyncDbStateCacheName(fas->fsid, config.mRemoteNode, syncs.mClient.me);
@@ -709,10 +941,25 @@ Sync::Sync(UnifiedSync& us, const string& cdebris,
         // Check if the database exists on disk.
         us.mConfig.mDatabaseExists = syncs.mClient.dbaccess->probe(*syncs.fsaccess, dbname);
 
+        // Note the database's state before opening it, to know whether its snapshot still matches.
+        mStateCacheDbPath = syncs.mClient.dbaccess->databasePath(*syncs.fsaccess, dbname, DbAccess::DB_VERSION);
+        auto dbOrigin = StateCacheSnapshot::originOf(*syncs.fsaccess, mStateCacheDbPath);
+
         // Note, we opened dbaccess in thread-safe mode
             statecachetable.reset(syncs.mClient.dbaccess->open(syncs.rng, *syncs.fsaccess, dbname, DB_OPEN_FLAG_RECYCLE |  DB_OPEN_FLAG_TRANSACTED, [this](DBError error)
             {
-                syncs.mClient.handleDbError(error);
+                if (syncs.onSyncThread())
+                {
+                    syncs.mClient.handleDbError(error);
+                }
+                else
+                {
+                    // reported by the state cache writer's thread
+                    syncs.queueClient([error](MegaClient& mc, TransferDbCommitter&)
+                    {
+                        mc.handleDbError(error);
+                    }, true);
+                }
             }));
 
         // Did the call above create the database?
@@ -721,7 +968,11 @@ Sync::Sync(UnifiedSync& us, const string& cdebris,
         // Don't bother trying to read the cache if we couldn't open the database.
         if (us.mConfig.mDatabaseExists)
         {
-            readstatecache();
+            readstatecache(dbOrigin);
+        }
+        else if (statecachetable)
+        {
+            mStateCacheWriter.reset(new DbTableAsyncWriter(statecachetable, syncs.stateCacheWriterThread()));
         }
     }
     us.mConfig.mRunState = SyncRunState::Run;
@@ -748,7 +999,8 @@ Sync::~Sync()
     tmpfa.reset();
 
     // Deleting localnodes after this will not remove them from the db.
-    statecachetable.reset();
+    // (changes already handed to the writer are still written)
+    closeStateCache(false);
 
     // This will recursively delete all LocalNodes in the sync.
     // If they have transfers associated, the SyncUpload_inClient and SyncDownload_inClient will have their wasRequesterAbandoned flag set true
@@ -758,6 +1010,16 @@ Sync::~Sync()
     --syncs.mNumSyncsActive;
 }
 
+void Sync::reportLocalNodeMemory() const
+{
+    auto usage = mLocalNodeArena->usage();
+
+    LOG_debug << "LocalNode memory for " << syncname << ": "
+              << usage.nodes << " nodes of " << usage.slotSize << " bytes, "
+              << usage.reservedBytes << " bytes reserved ("
+              << (usage.nodes ? usage.reservedBytes / usage.nodes : 0) << " per node)";
+}
+
 bool Sync::isBackup() const
 {
     assert(syncs.onSyncThread());
@@ -858,7 +1120,6 @@ void Sync::addstatecachechildren(uint32_t parent_dbid, idlocalnode_map* tmap, Lo
             statecacheadd(l);
             if (insertq.size() > 50000)
             {
-                DBTableTransactionCommitter committer(statecachetable);
                 cachenodes();  // periodically output updated nodes with shortname updates, so people who restart megasync still make progress towards a fast startup
             }
         }
@@ -870,7 +1131,7 @@ void Sync::addstatecachechildren(uint32_t parent_dbid, idlocalnode_map* tmap, Lo
     }
 }
 
-void Sync::readstatecache()
+void Sync::readstatecache(const StateCacheSnapshot::Origin& dbOrigin)
 {
     assert(syncs.onSyncThread());
 
@@ -880,26 +1141,38 @@ void Sync::readstatecache()
 
     LOG_debug << syncname << "Sync " << toHandle(getConfig().mBackupId) << " about to load from db";
 
-    statecachetable->rewind();
+    auto loadStart = std::chrono::steady_clock::now();
     unsigned numLocalNodes = 0;
 
     // bulk-load cached nodes into tmap
     assert(!SymmCipher::isZeroKey(syncs.syncKey.key, sizeof(syncs.syncKey.key)));
-    while (statecachetable->next(&cid, &cachedata, &syncs.syncKey))
+    bool fromSnapshot = readStateCacheSnapshot(dbOrigin, tmap, numLocalNodes);
+
+    if (!fromSnapshot)
     {
-        uint32_t parentID = 0;
+        statecachetable->rewind();
 
-        if (auto l = LocalNode::unserialize(*this, cachedata, parentID))
+        while (statecachetable->next(&cid, &cachedata, &syncs.syncKey))
         {
-            l->dbid = cid;
-            tmap.emplace(parentID, l.release());
-            numLocalNodes += 1;
+            uint32_t parentID = 0;
+
+            if (auto l = LocalNode::unserialize(*this, cachedata, parentID))
+            {
+                l->dbid = cid;
+                l->statecacheDigest = statecacheRecordDigest(cachedata);
+                tmap.emplace(parentID, l.release());
+                numLocalNodes += 1;
+            }
         }
     }
 
+    // From here on the writer owns the table, record ids included.
+    mStateCacheWriter.reset(new DbTableAsyncWriter(statecachetable, syncs.stateCacheWriterThread()));
+
+    auto treeStart = std::chrono::steady_clock::now();
+
     // recursively build LocalNode tree
     {
-        DBTableTransactionCommitter committer(statecachetable);
         LocalPath pathBuffer = localroot->localname; // don't let localname be appended during recurse
         addstatecachechildren(0, &tmap, pathBuffer, localroot.get(), 100);
 
@@ -915,7 +1188,15 @@ void Sync::readstatecache()
     }
     cachenodes();
 
-    LOG_debug << syncname << "Sync " << toHandle(getConfig().mBackupId) << " loaded from db with " << numLocalNodes << " sync nodes";
+    auto treeEnd = std::chrono::steady_clock::now();
+    using std::chrono::duration_cast;
+    using std::chrono::milliseconds;
+
+    LOG_debug << syncname << "Sync " << toHandle(getConfig().mBackupId) << " loaded from "
+              << (fromSnapshot ? "snapshot" : "db") << " with " << numLocalNodes << " sync nodes in "
+              << duration_cast<milliseconds>(treeEnd - loadStart).count() << " ms ("
+              << duration_cast<milliseconds>(treeStart - loadStart).count() << " ms reading, "
+              << duration_cast<milliseconds>(treeEnd - treeStart).count() << " ms building the tree)";
 
     localroot->setScanAgain(false, true, true, 0);
 }
@@ -941,9 +1222,9 @@ void Sync::statecachedel(LocalNode* l)
         return;
     }
 
-    if (l->dbid && statecachetable)
+    if (l->dbid)
     {
-        statecachetable->del(l->dbid);
+        mStateCacheWriter->del(l->dbid);
     }
     l->dbid = 0;
 
@@ -972,6 +1253,39 @@ void Sync::statecacheadd(LocalNode* l)
     assert(l->parent);
 }
 
+uint32_t Sync::statecacheRecordCrc(const string& record)
+{
+    HashCRC32 hash;
+    hash.add(reinterpret_cast<const byte*>(record.data()), static_cast<unsigned>(record.size()));
+
+    uint32_t crc = 0;
+    hash.get(reinterpret_cast<byte*>(&crc));
+
+    // 0 is reserved for "unknown"
+    return crc ? crc : 1;
+}
+
+StateCacheDigest Sync::statecacheRecordDigest(const string& record)
+{
+    HashSHA256 hash;
+    hash.add(reinterpret_cast<const byte*>(record.data()), static_cast<unsigned>(record.size()));
+
+    string full;
+    hash.get(&full);
+
+    StateCacheDigest digest;
+    assert(full.size() >= digest.size());
+    std::copy_n(full.begin(), digest.size(), digest.begin());
+
+    // all zero is reserved for "unknown"
+    if (digest == StateCacheDigest{})
+    {
+        digest[0] = 1;
+    }
+
+    return digest;
+}
+
 void Sync::cachenodes()
 {
     assert(syncs.onSyncThread());
@@ -987,26 +1301,43 @@ void Sync::cachenodes()
     {
         LOG_debug << syncname << "Saving LocalNode database with " << insertq.size() << " additions";
 
-        DBTableTransactionCommitter committer(statecachetable);
-
         // additions - we iterate until completion or until we get stuck
         bool added;
+        string data;
 
         do {
             added = false;
 
             for (set<LocalNode*>::iterator it = insertq.begin(); it != insertq.end(); )
             {
-                assert((*it)->type >= 0);
-                assert((*it)->sync == this);
-                assert((*it)->parent->parent || (*it)->parent == localroot.get());
-                if ((*it)->parent->dbid || (*it)->parent == localroot.get())
+                LocalNode* l = *it;
+                assert(l->type >= 0);
+                assert(l->sync == this);
+                assert(l->parent->parent || l->parent == localroot.get());
+                if (l->parent->dbid || l->parent == localroot.get())
                 {
                     // add once we know the parent dbid so that the parent/child structure is correct in db
-                    assert(!SymmCipher::isZeroKey(syncs.syncKey.key, sizeof(syncs.syncKey.key)));
-                    statecachetable->put(MegaClient::CACHEDLOCALNODE, *it, &syncs.syncKey);
                     insertq.erase(it++);
                     added = true;
+
+                    data.clear();
+                    if (!l->serialize(&data))
+                    {
+                        LOG_warn << "Serialization failed: " << MegaClient::CACHEDLOCALNODE;
+                        continue;
+                    }
+
+                    // Many changes to a LocalNode don't touch what we store for it.
+                    auto digest = statecacheRecordDigest(data);
+                    if (l->dbid && l->statecacheDigest == digest)
+                    {
+                        ++mStateCacheUnchangedSkipped;
+                        continue;
+                    }
+
+                    assert(!SymmCipher::isZeroKey(syncs.syncKey.key, sizeof(syncs.syncKey.key)));
+                    l->statecacheDigest = digest;
+                    mStateCacheWriter->put(MegaClient::CACHEDLOCALNODE, *l, std::move(data), &syncs.syncKey);
                 }
                 else it++;
             }
@@ -1018,6 +1349,172 @@ void Sync::cachenodes()
             assert(false);
         }
     }
+
+    mStateCacheWriter->flush();
+    reportStateCacheWrites(false);
+}
+
+void Sync::closeStateCache(bool removeDatabase)
+{
+    assert(syncs.onSyncThread());
+
+    if (!statecachetable)
+    {
+        return;
+    }
+
+    // finish writing whatever was already queued
+    mStateCacheWriter->drain();
+    reportStateCacheWrites(true);
+    auto nextid = mStateCacheWriter->nextid();
+    mStateCacheWriter.reset();
+
+    if (removeDatabase)
+    {
+        statecachetable->remove();
+    }
+    statecachetable.reset();
+
+    // A snapshot must hold exactly what the database does, so skip it if changes are still pending.
+    if (!removeDatabase
+        && insertq.empty()
+        && mLocalNodeArena->usage().nodes >= STATECACHE_SNAPSHOT_MIN_NODES)
+    {
+        writeStateCacheSnapshot(nextid);
+    }
+}
+
+void Sync::writeStateCacheSnapshot(uint32_t nextid)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    auto origin = StateCacheSnapshot::originOf(*syncs.fsaccess, mStateCacheDbPath);
+    if (!origin.valid())
+    {
+        LOG_debug << syncname << "State cache not fully checkpointed, skipping its snapshot";
+        return;
+    }
+
+    StateCacheSnapshot::Writer writer(*syncs.fsaccess, StateCacheSnapshot::pathFor(mStateCacheDbPath), syncs.syncKey, syncs.rng, origin, nextid);
+
+    string data;
+    size_t numRecords = 0;
+    vector<LocalNode*> folders(1, localroot.get());
+
+    while (!folders.empty())
+    {
+        LocalNode* folder = folders.back();
+        folders.pop_back();
+
+        for (auto& child : folder->children)
+        {
+            LocalNode* l = child.second;
+
+            // not in the database, and so neither are any of its children
+            if (!l->dbid)
+            {
+                continue;
+            }
+
+            data.clear();
+            if (!l->serialize(&data))
+            {
+                LOG_warn << syncname << "Could not write state cache snapshot";
+                return;
+            }
+
+            // The snapshot must hold what the database holds, not a change that never made it there.
+            if (statecacheRecordDigest(data) != l->statecacheDigest)
+            {
+                LOG_warn << syncname << "State cache out of date at " << l->getLocalPath() << ", skipping its snapshot";
+                return;
+            }
+
+            if (!writer.add(l->dbid, statecacheRecordCrc(data), data))
+            {
+                LOG_warn << syncname << "Could not write state cache snapshot";
+                return;
+            }
+
+            numRecords += 1;
+            folders.push_back(l);
+        }
+    }
+
+    if (!writer.commit())
+    {
+        LOG_warn << syncname << "Could not write state cache snapshot";
+        return;
+    }
+
+    LOG_debug << syncname << "Wrote state cache snapshot with " << numRecords << " records ("
+              << writer.size() << " bytes) in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms";
+}
+
+bool Sync::readStateCacheSnapshot(const StateCacheSnapshot::Origin& dbOrigin, idlocalnode_map& tmap, unsigned& numLocalNodes)
+{
+    auto path = StateCacheSnapshot::pathFor(mStateCacheDbPath);
+
+    StateCacheSnapshot snapshot;
+    bool loaded = dbOrigin.valid() && snapshot.load(path, syncs.syncKey, dbOrigin);
+
+    // The snapshot no longer matches once we write to the database, so it's only ever used once.
+    syncs.fsaccess->unlinklocal(path);
+
+    if (!loaded)
+    {
+        return false;
+    }
+
+    uint32_t dbid;
+    uint32_t crc;
+    string record;
+
+    while (snapshot.next(dbid, crc, record))
+    {
+        uint32_t parentID = 0;
+
+        if (auto l = LocalNode::unserialize(*this, record, parentID))
+        {
+            l->dbid = dbid;
+            l->statecacheDigest = statecacheRecordDigest(record);
+            tmap.emplace(parentID, l.release());
+            numLocalNodes += 1;
+        }
+    }
+
+    // we never read the table, so tell it which ids are taken
+    if (statecachetable->nextid < snapshot.nextid())
+    {
+        statecachetable->nextid = snapshot.nextid();
+    }
+
+    return true;
+}
+
+void Sync::reportStateCacheWrites(bool force)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (!force && now - mStateCacheReportStart < std::chrono::hours(1))
+    {
+        return;
+    }
+
+    auto stats = mStateCacheWriter->stats();
+    auto minutes = std::chrono::duration_cast<std::chrono::minutes>(now - mStateCacheReportStart).count();
+
+    LOG_debug << syncname << "State cache writes over the last " << minutes << " minutes: "
+              << stats.bytesWritten - mStateCacheReported.bytesWritten << " bytes in "
+              << stats.recordsWritten - mStateCacheReported.recordsWritten << " records and "
+              << stats.batches - mStateCacheReported.batches << " transactions, "
+              << stats.recordsDeleted - mStateCacheReported.recordsDeleted << " deletes, "
+              << stats.changesCoalesced - mStateCacheReported.changesCoalesced << " changes coalesced, "
+              << mStateCacheUnchangedSkipped << " unchanged records skipped";
+
+    mStateCacheReported = stats;
+    mStateCacheUnchangedSkipped = 0;
+    mStateCacheReportStart = now;
 }
 
 void Sync::changestate(SyncError newSyncError, bool newEnableFlag, bool notifyApp, bool keepSyncDb)
@@ -1043,8 +1540,7 @@ void UnifiedSync::changeState(SyncError newSyncError, bool newEnableFlag, bool n
             mSync->cachenodes();
 
             // remove the LocalNode database files on sync disablement (historic behaviour; sync re-enable with LocalNode state from non-matching SCSN is not supported (yet))
-            mSync->statecachetable->remove();
-            mSync->statecachetable.reset();
+            mSync->closeStateCache(true);
         }
         else
         {
@@ -1067,6 +1563,7 @@ void UnifiedSync::changeState(SyncError newSyncError, bool newEnableFlag, bool n
 
                 LOG_debug << "Deleting sync database at: " << dbPath;
                 syncs.fsaccess->unlinklocal(dbPath);
+                syncs.fsaccess->unlinklocal(StateCacheSnapshot::pathFor(dbPath));
             }
         }
         mConfig.mDatabaseExists = false;
@@ -1077,7 +1574,7 @@ void UnifiedSync::changeState(SyncError newSyncError, bool newEnableFlag, bool n
         // if we are keeping the db and unloading the sync,
         // prevent any more changes to it from this point
         mSync->cachenodes();
-        mSync->statecachetable.reset();
+        mSync->closeStateCache(false);
     }
 
     mConfig.mError = newSyncError;
@@ -1140,9 +1637,9 @@ LocalNode* Sync::localnodebypath(LocalNode* l, const LocalPath& localpath, Local
             *parent = l;
         }
 
-        localnode_map::iterator it;
-        if ((it = l->children.find(component)) == l->children.end()
-            && (it = l->schildren.find(component)) == l->schildren.end())
+        auto it = l->children.find(component);
+        auto next = it != l->children.end() ? it->second : l->childbyshortname(component);
+        if (!next)
         {
             // no full match: store residual path, return NULL with the
             // matching component LocalNode in parent
@@ -1159,7 +1656,7 @@ LocalNode* Sync::localnodebypath(LocalNode* l, const LocalPath& localpath, Local
             return NULL;
         }
 
-        l = it->second;
+        l = next;
     }
 
     // full match: no residual path, return corresponding LocalNode
@@ -3257,7 +3754,7 @@ bool Sync::checkCloudPathForMovesRenames(SyncRow& row, SyncRow& parentRow, SyncP
             // Therefore move them to an unattached locallnode which will delete them on function exit
 
             //row.syncNode->deleteChildren();
-            childrenToDeleteOnFunctionExit.reset(new LocalNode(this));
+            childrenToDeleteOnFunctionExit.reset(new (*this) LocalNode(this));
             while (!row.syncNode->children.empty())
             {
                 auto* child = row.syncNode->children.begin()->second;
@@ -3435,13 +3932,20 @@ dstime Sync::procscanq()
         return NEVER;
     }
 
+    std::deque<Notification> batch;
+    queue.popAll(batch);
+
+    auto stats = queue.stats();
+
     LOG_verbose << syncname << "Marking sync tree with filesystem notifications: "
-                << queue.size();
+                << batch.size()
+                << " (so far raw: " << stats.raw
+                << " repeats: " << stats.repeats
+                << " subsumed: " << stats.subsumed << ")";
 
-    Notification notification;
     dstime delay = NEVER;
 
-    while (queue.popFront(notification))
+    for (auto& notification : batch)
     {
         lastFSNotificationTime = syncs.waiter->ds;
 
@@ -3551,13 +4055,15 @@ dstime Sync::procscanq()
             if (nearest->scanDelayUntil >= syncs.waiter->ds)
             {
                 // self-caused notifications shouldn't cause extra waiting
-                --nearest->expectedSelfNotificationCount;
+                auto selfCaused = std::min(nearest->expectedSelfNotificationCount, notification.repeats);
+                nearest->expectedSelfNotificationCount -= selfCaused;
 
                 SYNC_verbose << "Skipping self-notification (remaining: "
                     << nearest->expectedSelfNotificationCount << ") at: "
                     << nearest->getLocalPath();
 
-                continue;
+                // any coalesced repeats beyond what we caused ourselves still need a scan
+                if (notification.repeats == selfCaused) continue;
             }
             else
             {
@@ -5734,6 +6240,18 @@ SyncConfigIOContext* Syncs::syncConfigIOContext()
     return mSyncConfigIOContext.get();
 }
 
+shared_ptr<DbTableWriterThread> Syncs::stateCacheWriterThread()
+{
+    assert(onSyncThread());
+
+    if (!mStateCacheWriterThread)
+    {
+        mStateCacheWriterThread = std::make_shared<DbTableWriterThread>();
+    }
+
+    return mStateCacheWriterThread;
+}
+
 template<typename... Arguments, typename... Parameters>
 bool Syncs::defer(bool (SyncController::*predicate)(Parameters...) const,
                   Arguments&&... arguments) const
@@ -6499,6 +7017,8 @@ bool Syncs::unloadSyncByBackupID(handle id, bool newEnabledFlag, SyncConfig& con
             // we don't call sync_removed back since the sync is not deleted
             // we don't unregister from the backup/sync heartbeats as the sync can be resumed later
 
+            ScanService::forgetMetrics(id);
+
             lock_guard<std::recursive_mutex> guard(mSyncVecMutex);
             mSyncVec.erase(mSyncVec.begin() + i);
             return true;
@@ -6580,11 +7100,7 @@ void Syncs::locallogout_inThread(bool removecaches, bool keepSyncsConfigFile, bo
     {
         if (Sync* sync = mSyncVec[i]->mSync.get())
         {
-            if (sync->statecachetable)
-            {
-                if (removecaches) sync->statecachetable->remove();
-                sync->statecachetable.reset();
-            }
+            sync->closeStateCache(removecaches);
         }
     }
 
@@ -7120,7 +7636,7 @@ bool SyncRow::isNoName() const
 
 void Sync::combineTripletSet(vector<SyncRow>::iterator a, vector<SyncRow>::iterator b) const
 {
-    assert(syncs.onSyncThread());
+    assert(syncs.onSyncThread() || precomputingChildRows);
 
 //#ifdef DEBUG
 //    // log before case
@@ -7286,9 +7802,10 @@ void Sync::combineTripletSet(vector<SyncRow>::iterator a, vector<SyncRow>::itera
 
 auto Sync::computeSyncTriplets(vector<CloudNode>& cloudNodes, const LocalNode& syncParent, vector<FSNode>& fsNodes) const -> vector<SyncRow>
 {
-    assert(syncs.onSyncThread());
+    assert(syncs.onSyncThread() || precomputingChildRows);
 
-    CodeCounter::ScopeTimer rst(syncs.mClient.performanceStats.computeSyncTripletsTime);
+    std::optional<CodeCounter::ScopeTimer> rst;
+    if (!precomputingChildRows) rst.emplace(syncs.mClient.performanceStats.computeSyncTripletsTime);
 
     vector<SyncRow> triplets;
     triplets.reserve(cloudNodes.size() + syncParent.children.size() + fsNodes.size());
@@ -7297,13 +7814,43 @@ auto Sync::computeSyncTriplets(vector<CloudNode>& cloudNodes, const LocalNode& s
     for (auto& sn : syncParent.children) triplets.emplace_back(nullptr, sn.second, nullptr);
     for (auto& fsn : fsNodes)            triplets.emplace_back(nullptr, nullptr, &fsn);
 
-    auto tripletCompare = [this](const SyncRow& lhs, const SyncRow& rhs) -> int {
+    // Work out each name's sort key once, rather than per comparison.
+    // LocalNodes keep theirs from one pass to the next.
+    // Each LocalNode has a single parent, so precomputing threads never share one.
+    for (auto& cn : cloudNodes)          cn.sortKey.update(cn.name);
+    for (auto& sn : syncParent.children) sn.second->sortKey.update(sn.second->toName_of_localname);
+    for (auto& fsn : fsNodes)            fsn.sortKey.update(fsn.toName_of_localname(*syncs.fsaccess));
+
+    auto asciiName = [this](const SyncRow& row) -> const string* {
+        if (row.cloudNode)
+        {
+            return row.cloudNode->sortKey.isAscii() ? &row.cloudNode->name : nullptr;
+        }
+        else if (row.syncNode)
+        {
+            return row.syncNode->sortKey.isAscii() ? &row.syncNode->toName_of_localname : nullptr;
+        }
+        else
+        {
+            return row.fsNode->sortKey.isAscii() ? &row.fsNode->toName_of_localname(*syncs.fsaccess) : nullptr;
+        }
+    };
+
+    auto tripletCompare = [this, &asciiName](const SyncRow& lhs, const SyncRow& rhs) -> int {
         // Sanity.
         assert(!lhs.fsNode || !lhs.fsNode->localname.empty());
         assert(!rhs.fsNode || !rhs.fsNode->localname.empty());
         assert(!lhs.syncNode || !lhs.syncNode->localname.empty());
         assert(!rhs.syncNode || !rhs.syncNode->localname.empty());
 
+        // The common case: plain ASCII names on both sides compare byte-wise.
+        auto lhsAscii = asciiName(lhs);
+        auto rhsAscii = lhsAscii ? asciiName(rhs) : nullptr;
+        if (lhsAscii && rhsAscii)
+        {
+            return NameSortKey::compareAscii(*lhsAscii, *rhsAscii, mCaseInsensitive);
+        }
+
         // Although it would be great to efficiently compare cloud names in utf8 directly against filesystem names
         // in utf16, without any conversions or copied and manipulated strings, unfortunately we have
         // a few obstacles to that.  Mainly, that the utf8 encoding can differ - especially on Mac
@@ -7334,7 +7881,7 @@ auto Sync::computeSyncTriplets(vector<CloudNode>& cloudNodes, const LocalNode& s
             }
             else if (rhs.syncNode)
             {
-                return compareUtf(lhs.syncNode->toName_of_localname, false, rhs.syncNode->toName_of_localname, false, mCaseInsensitive);
+                return compareChildNames(*lhs.syncNode, *rhs.syncNode);
             }
             else // rhs.fsNode
             {
@@ -7359,7 +7906,7 @@ auto Sync::computeSyncTriplets(vector<CloudNode>& cloudNodes, const LocalNode& s
     };
 
     std::sort(triplets.begin(), triplets.end(),
-           [=](const SyncRow& lhs, const SyncRow& rhs)
+           [&tripletCompare](const SyncRow& lhs, const SyncRow& rhs)
            { return tripletCompare(lhs, rhs) < 0; });
 
     auto currSet = triplets.begin();
@@ -7388,9 +7935,10 @@ auto Sync::computeSyncTriplets(vector<CloudNode>& cloudNodes, const LocalNode& s
 
 bool Sync::inferRegeneratableTriplets(vector<CloudNode>& cloudChildren, const LocalNode& syncParent, vector<FSNode>& inferredFsNodes, vector<SyncRow>& inferredRows) const
 {
-    assert(syncs.onSyncThread());
+    assert(syncs.onSyncThread() || precomputingChildRows);
 
-    CodeCounter::ScopeTimer rst(syncs.mClient.performanceStats.inferSyncTripletsTime);
+    std::optional<CodeCounter::ScopeTimer> rst;
+    if (!precomputingChildRows) rst.emplace(syncs.mClient.performanceStats.inferSyncTripletsTime);
 
     if (cloudChildren.size() != syncParent.children.size()) return false;
 
@@ -7480,7 +8028,225 @@ static IndexPairVector computeSyncSequences(vector<SyncRow>& children)
     return sequences;
 }
 
-bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedCloudNode, bool belowRemovedFsNode, unsigned depth)
+void Sync::noteFlagged(LocalNode& node)
+{
+    if (mDestructorRunning) return;
+
+    // Record each step up to the root, until we reach one that is known already.
+    for (auto* child = &node; child->parent; child = child->parent)
+    {
+        if (!mFlaggedChildren[child->parent].insert(child).second)
+        {
+            break;
+        }
+    }
+}
+
+void Sync::unlinkFlagged(LocalNode& node)
+{
+    if (!node.parent) return;
+
+    auto it = mFlaggedChildren.find(node.parent);
+    if (it != mFlaggedChildren.end())
+    {
+        it->second.erase(&node);
+    }
+}
+
+void Sync::forgetFlagged(LocalNode& node)
+{
+    unlinkFlagged(node);
+    mFlaggedChildren.erase(&node);
+}
+
+void Sync::forgetFlaggedBelow(const LocalNode& node)
+{
+    auto it = mFlaggedChildren.find(&node);
+    if (it == mFlaggedChildren.end()) return;
+
+    auto children = std::move(it->second);
+    mFlaggedChildren.erase(it);
+
+    for (auto* child : children)
+    {
+        forgetFlaggedBelow(*child);
+    }
+}
+
+void Sync::adoptFlagged(Sync& from, const LocalNode& node)
+{
+    auto it = from.mFlaggedChildren.find(&node);
+    if (it == from.mFlaggedChildren.end()) return;
+
+    mFlaggedChildren[&node].insert(it->second.begin(), it->second.end());
+    from.mFlaggedChildren.erase(it);
+}
+
+int Sync::compareChildNames(const LocalNode& lhs, const LocalNode& rhs) const
+{
+    if (lhs.sortKey.isAscii() && rhs.sortKey.isAscii())
+    {
+        return NameSortKey::compareAscii(lhs.toName_of_localname, rhs.toName_of_localname, mCaseInsensitive);
+    }
+    return compareUtf(lhs.toName_of_localname, false, rhs.toName_of_localname, false, mCaseInsensitive);
+}
+
+bool Sync::inferFlaggedChildRows(const SyncRow& row, vector<CloudNode>& cloudNodes, vector<FSNode>& fsNodes, vector<SyncRow>& rows)
+{
+    assert(syncs.onSyncThread());
+
+    // Unmatched scan data means this folder still has work of its own.
+    if (!row.cloudNode || row.syncNode->lastFolderScan) return false;
+
+    // While scans are pending, subtree flags are handed down to children
+    // as folders are visited, without going through noteFlagged().
+    if (localroot->scanAgain != TREE_RESOLVED) return false;
+
+    auto it = mFlaggedChildren.find(row.syncNode);
+    if (it == mFlaggedChildren.end()) return false;
+
+    // Visit them in the order the full row loop would.
+    vector<LocalNode*> children(it->second.begin(), it->second.end());
+    for (auto* child : children)
+    {
+        child->sortKey.update(child->toName_of_localname);
+    }
+    std::sort(children.begin(), children.end(),
+              [this](const LocalNode* a, const LocalNode* b) { return compareChildNames(*a, *b) < 0; });
+
+    // The rows point into these, so they must not reallocate.
+    cloudNodes.reserve(children.size());
+    fsNodes.reserve(children.size());
+    rows.reserve(children.size());
+
+    for (auto* child : children)
+    {
+        assert(child->parent == row.syncNode);
+
+        CloudNode cloudNode;
+
+        if (child->fsid_asScanned == UNDEF ||
+            (!child->scannedFingerprint.isvalid && child->type == FILENODE) ||
+            !syncs.lookupCloudNode(child->syncedCloudNodeHandle, cloudNode, nullptr, nullptr, nullptr, nullptr, nullptr, Syncs::EXACT_VERSION) ||
+            cloudNode.parentHandle != row.cloudNode->handle)
+        {
+            // Not matched up as synced yet, the full row loop has to work this out.
+            rows.clear();
+            fsNodes.clear();
+            cloudNodes.clear();
+            return false;
+        }
+
+        cloudNodes.push_back(std::move(cloudNode));
+        fsNodes.push_back(child->getScannedFSDetails());
+        rows.emplace_back(&cloudNodes.back(), child, &fsNodes.back());
+    }
+
+    return true;
+}
+
+void Sync::dropExcludedContent(LocalNode& s)
+{
+    if (!s.children.empty())
+    {
+        // We keep the immediately excluded node (parent folder is not excluded), but remove anything below it
+        LOG_debug << syncname << "Removing " << s.children.size() << " child LocalNodes from excluded " << s.getLocalPath();
+        vector<LocalNode*> cs;
+        cs.reserve(s.children.size());
+        for (auto& i : s.children)
+        {
+            cs.push_back(i.second);
+        }
+        // this technique might seem a bit roundabout, but deletion will cause these to
+        // remove themselves from s.children. // we can't have that happening while we iterate that map.
+        for (auto p : cs)
+        {
+            // deletion this way includes statecachedel
+            delete p;
+        }
+    }
+    if (s.transferSP)
+    {
+        s.resetTransfer(nullptr);
+    }
+    s.checkTreestate(true);
+}
+
+void Sync::precomputeChildRows(vector<SyncRow>& rows, size_t begin, size_t end, map<LocalNode*, PrecomputedChildRows>& results)
+{
+    assert(syncs.onSyncThread());
+
+    // Pick the folders recursiveSync() will visit with the data it has already: no rescan, no moves
+    // in or out, nothing removed.  Anything else is left to recursiveSync() to work out as usual.
+    vector<SyncRow*> candidates;
+    size_t totalRows = 0;
+
+    for (auto i = begin; i != end; ++i)
+    {
+        auto& row = rows[i];
+        auto* s = row.syncNode;
+
+        if (!s || s->type == FILENODE || !row.fsNode ||
+            row.suppressRecursion ||
+            row.recurseBelowRemovedCloudNode || row.recurseBelowRemovedFsNode ||
+            s->fsid_asScanned != row.fsNode->fsid ||
+            s->exclusionState() == ES_EXCLUDED ||
+            !s->rareRO().unlinkHere.expired() || s->rareRO().moveToHere ||
+            s->scanAgain >= TREE_ACTION_HERE ||
+            !(s->scanRequired() || s->mightHaveMoves() || s->syncRequired()))
+        {
+            continue;
+        }
+
+        // Decide from local data whether this is worth it, before any cloud lookup:
+        // a folder being synced has about as many cloud children as LocalNodes.
+        totalRows += 2 * s->children.size() + (s->lastFolderScan ? s->lastFolderScan->size() : 0);
+        candidates.push_back(&row);
+    }
+
+    if (candidates.size() < 2 || totalRows < PRECOMPUTE_CHILD_ROWS_MIN)
+    {
+        return;
+    }
+
+    vector<pair<SyncRow*, PrecomputedChildRows*>> work;
+    work.reserve(candidates.size());
+
+    for (auto* row : candidates)
+    {
+        auto* s = row->syncNode;
+        auto& result = results[s];
+        result.localTreeEpoch = mLocalTreeEpoch;
+        result.wasSynced = s->syncAgain < TREE_ACTION_HERE && s->checkMovesAgain < TREE_ACTION_HERE;
+        result.folderScanGeneration = s->folderScanGeneration;
+
+        // The cloud lookups hold the node tree lock, so those stay on this thread.
+        if (row->cloudNode)
+        {
+            syncs.lookupCloudChildren(row->cloudNode->handle, result.cloudChildren);
+        }
+
+        work.emplace_back(row, &result);
+    }
+
+    CodeCounter::ScopeTimer rst(syncs.mClient.performanceStats.precomputeChildRowsTime);
+
+    // Folders are handed out one at a time, so threads finishing small ones move on to the next.
+    parallelFor(work.size(), 0, [&work, this](size_t i)
+    {
+        precomputingChildRows = true;
+        g_skipCompareUtfTimings = true;
+
+        auto& result = *work[i].second;
+        work[i].first->inferOrCalculateChildSyncRows(result.wasSynced, result.childRows, result.fsInferredChildren,
+                                                     result.fsChildren, result.cloudChildren, false, syncs.localnodeByScannedFsid);
+
+        precomputingChildRows = false;
+        g_skipCompareUtfTimings = false;
+    });
+}
+
+bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedCloudNode, bool belowRemovedFsNode, unsigned depth, PrecomputedChildRows* precomputed)
 {
     assert(syncs.onSyncThread());
 
@@ -7549,6 +8315,7 @@ bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedClou
         syncHere = row.syncNode->parent ? row.syncNode->parent->scanAgain < TREE_ACTION_HERE : true;
         recurseHere = false;  // If we need to scan, we need the folder to exist first - revisit later
         row.syncNode->lastFolderScan.reset();
+        ++row.syncNode->folderScanGeneration;
         belowRemovedFsNode = true; // this flag will prevent us reconstructing from scannedFingerprint etc
     }
     else
@@ -7598,10 +8365,96 @@ bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedClou
     auto originalCheckMovesAgain = row.syncNode->checkMovesAgain;
     auto originalConflicsFlag = row.syncNode->conflicts;
 
+    auto restoreFlagsForEarlyExit = [&]()
+    {
+        // restore flags to at least what they were, for when we revisit on next full recurse
+        row.syncNode->scanAgain = std::max<TreeState>(row.syncNode->scanAgain, originalScanAgain);
+        row.syncNode->syncAgain = std::max<TreeState>(row.syncNode->syncAgain, originalSyncAgain);
+        row.syncNode->checkMovesAgain = std::max<TreeState>(row.syncNode->checkMovesAgain, originalCheckMovesAgain);
+        row.syncNode->conflicts = std::max<TreeState>(row.syncNode->conflicts, originalConflicsFlag);
+
+        LOG_debug << syncname
+            << "recursiveSync early exit due to pending outside request with "
+            << row.syncNode->scanAgain  << "-"
+            << row.syncNode->checkMovesAgain << "-"
+            << row.syncNode->syncAgain << " ("
+            << row.syncNode->conflicts << ") at "
+            << fullPath.syncPath;
+    };
+
     bool earlyExit = false;
 
-    if (syncHere || recurseHere)
+    // Rows of the flagged children only, when this folder itself is known to be in sync.
+    vector<SyncRow> flaggedRows;
+    vector<CloudNode> flaggedCloudChildren;
+    vector<FSNode> flaggedFsChildren;
+
+    bool passThrough = !syncHere && recurseHere &&
+                       !belowRemovedCloudNode && !belowRemovedFsNode &&
+                       inferFlaggedChildRows(row, flaggedCloudChildren, flaggedFsChildren, flaggedRows);
+
+    if (passThrough)
     {
+        // Nothing to do at this level: go straight to the children that have something to do,
+        // the same way the row loop below would when it's not syncing here.
+        ++mFoldersPassedThrough;
+
+        row.syncNode->checkMovesAgain = TREE_RESOLVED;
+
+        for (auto& childRow : flaggedRows)
+        {
+            // in case of sync failing while we recurse
+            if (getConfig().mError) return false;
+
+            if (syncs.mSyncFlags->earlyRecurseExitRequested)
+            {
+                restoreFlagsForEarlyExit();
+                return false;
+            }
+
+            childRow.rowSiblings = &flaggedRows;
+            auto* s = childRow.syncNode;
+
+            s->recomputeExclusionState();
+            if (s->exclusionState() == ES_EXCLUDED)
+            {
+                dropExcludedContent(*s);
+                continue;
+            }
+
+            auto syncPathRestore = makeScopedSyncPathRestorer(fullPath);
+
+            if (!fullPath.appendRowNames(childRow, mFilesystemType) ||
+                localdebris.isContainingPathOf(fullPath.localPath))
+            {
+                continue;
+            }
+
+            s->reassignUnstableFsidsOnceOnly(childRow.fsNode);
+
+            if (s->type == FILENODE)
+            {
+                s->checkTreestate(true);
+            }
+            else if (s->rareRO().unlinkHere.expired() && !s->rareRO().moveToHere)
+            {
+                auto result = s->watch(fullPath.localPath, childRow.fsNode->fsid);
+
+                // Any fatal errors while adding the watch?
+                if (result == WR_FATAL)
+                    changestate(UNABLE_TO_ADD_WATCH, false, true, true);
+
+                if (!recursiveSync(childRow, fullPath, false, false, depth+1))
+                {
+                    earlyExit = true;
+                }
+            }
+        }
+    }
+    else if (syncHere || recurseHere)
+    {
+        ++mFoldersEvaluated;
+
         // Reset these flags before we evaluate each subnode.
         // They could be set again during that processing,
         // And additionally we double check with each child node after, in case we had reason to skip it.
@@ -7618,12 +8471,28 @@ bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedClou
         vector<FSNode> fsChildren;
         vector<CloudNode> cloudChildren;
 
-        if (row.cloudNode)
+        if (precomputed &&
+            precomputed->localTreeEpoch == mLocalTreeEpoch &&
+            precomputed->wasSynced == wasSynced &&
+            precomputed->folderScanGeneration == row.syncNode->folderScanGeneration &&
+            !belowRemovedFsNode)
         {
-            syncs.lookupCloudChildren(row.cloudNode->handle, cloudChildren);
+            // Nothing moved or was rescanned since these were computed: use them.
+            // Moving the vectors keeps the rows' pointers into them valid.
+            childRows = std::move(precomputed->childRows);
+            fsInferredChildren = std::move(precomputed->fsInferredChildren);
+            fsChildren = std::move(precomputed->fsChildren);
+            cloudChildren = std::move(precomputed->cloudChildren);
         }
+        else
+        {
+            if (row.cloudNode)
+            {
+                syncs.lookupCloudChildren(row.cloudNode->handle, cloudChildren);
+            }
 
-        row.inferOrCalculateChildSyncRows(wasSynced, childRows, fsInferredChildren, fsChildren, cloudChildren, belowRemovedFsNode, syncs.localnodeByScannedFsid);
+            row.inferOrCalculateChildSyncRows(wasSynced, childRows, fsInferredChildren, fsChildren, cloudChildren, belowRemovedFsNode, syncs.localnodeByScannedFsid);
+        }
 
         bool anyNameConflicts = false;
 
@@ -7705,9 +8574,19 @@ bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedClou
 
         for (auto& sequence : sequences)
         {
+            // Child rows of the subfolders we are about to recurse into, computed in parallel.
+            map<LocalNode*, PrecomputedChildRows> precomputedChildRows;
+
             // The main three steps: moves, node itself, recurse
             for (unsigned step = 0; step < 3; ++step)
             {
+                if (step == 2 && recurseHere &&
+                    !belowRemovedCloudNode && !belowRemovedFsNode &&
+                    !syncs.mSyncFlags->earlyRecurseExitRequested)
+                {
+                    precomputeChildRows(childRows, sequence.first, sequence.second, precomputedChildRows);
+                }
+
                 if (step == 2 &&
                     sequence.second == sequences.back().second &&
                     !belowRemovedCloudNode && !belowRemovedFsNode)
@@ -7729,20 +8608,7 @@ bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedClou
 
                     if (syncs.mSyncFlags->earlyRecurseExitRequested)
                     {
-                        // restore flags to at least what they were, for when we revisit on next full recurse
-                        row.syncNode->scanAgain = std::max<TreeState>(row.syncNode->scanAgain, originalScanAgain);
-                        row.syncNode->syncAgain = std::max<TreeState>(row.syncNode->syncAgain, originalSyncAgain);
-                        row.syncNode->checkMovesAgain = std::max<TreeState>(row.syncNode->checkMovesAgain, originalCheckMovesAgain);
-                        row.syncNode->conflicts = std::max<TreeState>(row.syncNode->conflicts, originalConflicsFlag);
-
-                        LOG_debug << syncname
-                            << "recursiveSync early exit due to pending outside request with "
-                            << row.syncNode->scanAgain  << "-"
-                            << row.syncNode->checkMovesAgain << "-"
-                            << row.syncNode->syncAgain << " ("
-                            << row.syncNode->conflicts << ") at "
-                            << fullPath.syncPath;
-
+                        restoreFlagsForEarlyExit();
                         return false;
                     }
 
@@ -7783,29 +8649,7 @@ bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedClou
 
                         if (s->exclusionState() == ES_EXCLUDED)
                         {
-                            if (!s->children.empty())
-                            {
-                                // We keep the immediately excluded node (parent folder is not excluded), but remove anything below it
-                                LOG_debug << syncname << "Removing " << s->children.size() << " child LocalNodes from excluded " << s->getLocalPath();
-                                vector<LocalNode*> cs;
-                                cs.reserve(s->children.size());
-                                for (auto& i : s->children)
-                                {
-                                    cs.push_back(i.second);
-                                }
-                                // this technique might seem a bit roundabout, but deletion will cause these to
-                                // remove themselves from s->children. // we can't have that happening while we iterate that map.
-                                for (auto p : cs)
-                                {
-                                    // deletion this way includes statecachedel
-                                    delete p;
-                                }
-                            }
-                            if (s->transferSP)
-                            {
-                                s->resetTransfer(nullptr);
-                            }
-                            s->checkTreestate(true);
+                            dropExcludedContent(*s);
                             continue;
                         }
                     }
@@ -7928,7 +8772,10 @@ bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedClou
                                     changestate(UNABLE_TO_ADD_WATCH, false, true, true);
                             }
 
-                            if (!recursiveSync(childRow, fullPath, belowRemovedCloudNode || childRow.recurseBelowRemovedCloudNode, belowRemovedFsNode || childRow.recurseBelowRemovedFsNode, depth+1))
+                            auto it = precomputedChildRows.find(childRow.syncNode);
+                            auto* childPrecomputed = it != precomputedChildRows.end() ? &it->second : nullptr;
+
+                            if (!recursiveSync(childRow, fullPath, belowRemovedCloudNode || childRow.recurseBelowRemovedCloudNode, belowRemovedFsNode || childRow.recurseBelowRemovedFsNode, depth+1, childPrecomputed))
                             {
                                 earlyExit = true;
                             }
@@ -7981,6 +8828,7 @@ bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedClou
                     scan->push_back(move(ptr));
                 }
                 row.fsAddedSiblings.clear();
+                ++row.syncNode->folderScanGeneration;
             }
         }
     }
@@ -7989,29 +8837,77 @@ bool Sync::recursiveSync(SyncRow& row, SyncPath& fullPath, bool belowRemovedClou
     // Flags for this row could have been set during calls to the node
     // If we skipped a child node this time (or if not), the set-parent
     // flags let us know if future actions are needed at this level
-    for (auto& child : row.syncNode->children)
+    // When passing through, only the indexed children can have flags set.
+    std::unordered_set<LocalNode*> stillFlagged;
+
+    auto updateFromChild = [&](LocalNode& child)
     {
-        assert(child.first == child.second->localname);
+        if (child.exclusionState() == ES_EXCLUDED)
+        {
+            return;
+        }
 
-        if (child.second->exclusionState() == ES_EXCLUDED)
+        if (child.type > FILENODE)
         {
-            continue;
+            row.syncNode->scanAgain = updateTreestateFromChild(row.syncNode->scanAgain, child.scanAgain);
+            row.syncNode->syncAgain = updateTreestateFromChild(row.syncNode->syncAgain, child.syncAgain);
         }
+        row.syncNode->checkMovesAgain = updateTreestateFromChild(row.syncNode->checkMovesAgain, child.checkMovesAgain);
+        row.syncNode->conflicts = updateTreestateFromChild(row.syncNode->conflicts, child.conflicts);
 
-        if (child.second->type > FILENODE)
+        if (child.parentSetScanAgain) row.syncNode->setScanAgain(false, true, false, 0);
+        if (child.parentSetCheckMovesAgain) row.syncNode->setCheckMovesAgain(false, true, false);
+        if (child.parentSetSyncAgain) row.syncNode->setSyncAgain(false, true, false);
+        if (child.parentSetContainsConflicts) row.syncNode->setContainsConflicts(false, true, false);
+
+        child.parentSetScanAgain = false;  // we should only use this one once
+
+        if (child.flaggedForSync())
         {
-            row.syncNode->scanAgain = updateTreestateFromChild(row.syncNode->scanAgain, child.second->scanAgain);
-            row.syncNode->syncAgain = updateTreestateFromChild(row.syncNode->syncAgain, child.second->syncAgain);
+            stillFlagged.insert(&child);
         }
-        row.syncNode->checkMovesAgain = updateTreestateFromChild(row.syncNode->checkMovesAgain, child.second->checkMovesAgain);
-        row.syncNode->conflicts = updateTreestateFromChild(row.syncNode->conflicts, child.second->conflicts);
+    };
 
-        if (child.second->parentSetScanAgain) row.syncNode->setScanAgain(false, true, false, 0);
-        if (child.second->parentSetCheckMovesAgain) row.syncNode->setCheckMovesAgain(false, true, false);
-        if (child.second->parentSetSyncAgain) row.syncNode->setSyncAgain(false, true, false);
-        if (child.second->parentSetContainsConflicts) row.syncNode->setContainsConflicts(false, true, false);
+    if (passThrough)
+    {
+        auto it = mFlaggedChildren.find(row.syncNode);
+        if (it != mFlaggedChildren.end())
+        {
+            vector<LocalNode*> indexed(it->second.begin(), it->second.end());
+            for (auto* child : indexed)
+            {
+                updateFromChild(*child);
+            }
+        }
+    }
+    else
+    {
+        for (auto& child : row.syncNode->children)
+        {
+            assert(child.first == child.second->localname);
+            updateFromChild(*child.second);
+        }
+    }
 
-        child.second->parentSetScanAgain = false;  // we should only use this one once
+    // Keep the index to just the children that still lead somewhere.
+    {
+        auto& entry = mFlaggedChildren[row.syncNode];
+        for (auto* child : entry)
+        {
+            if (!stillFlagged.count(child))
+            {
+                forgetFlaggedBelow(*child);
+            }
+        }
+
+        if (stillFlagged.empty())
+        {
+            mFlaggedChildren.erase(row.syncNode);
+        }
+        else
+        {
+            entry = std::move(stillFlagged);
+        }
     }
 
     // keep sync overlay icons up to date as we recurse (including the sync root node)
@@ -9472,7 +10368,7 @@ bool Sync::makeSyncNode_fromFS(SyncRow& row, SyncRow& parentRow, SyncPath& fullP
     LOG_debug << syncname << "Creating LocalNode from FS with fsid " << toHandle(row.fsNode->fsid) << " at: " << fullPath.localPath << logTriplet(row, fullPath);
 
     assert(row.syncNode == nullptr);
-    row.syncNode = new LocalNode(this);
+    row.syncNode = new (*this) LocalNode(this);
 
     row.syncNode->init(row.fsNode->type, parentRow.syncNode, fullPath.localPath, row.fsNode->cloneShortname());
     row.syncNode->setScannedFsid(row.fsNode->fsid, syncs.localnodeByScannedFsid, row.fsNode->localname, row.fsNode->fingerprint);
@@ -9509,7 +10405,7 @@ bool Sync::resolve_makeSyncNode_fromCloud(SyncRow& row, SyncRow& parentRow, Sync
     SYNC_verbose << syncname << "Creating LocalNode from Cloud at: " << fullPath.cloudPath << logTriplet(row, fullPath);
 
     assert(row.syncNode == nullptr);
-    row.syncNode = new LocalNode(this);
+    row.syncNode = new (*this) LocalNode(this);
 
     if (row.cloudNode->type == FILENODE)
     {
@@ -12227,6 +13123,34 @@ void SyncConfigIOContext::serialize(const SyncConfig& config,
 }
 
 
+auto Syncs::probeRoot(FileSystemAccess& fsAccess, const LocalPath& path, FSLogging logging) -> RootProbe
+{
+    RootProbe probe;
+
+    auto fa = fsAccess.newfileaccess();
+    if (fa->fopen(path, true, false, logging, nullptr, true))
+    {
+        probe.opened = true;
+        probe.type = fa->type;
+        probe.fsid = fa->fsid;
+        probe.fingerprint = fsAccess.fsFingerprint(path);
+    }
+
+    return probe;
+}
+
+auto Syncs::probeRoots(FileSystemAccess& fsAccess, const vector<pair<LocalPath, FSLogging>>& roots) -> vector<RootProbe>
+{
+    vector<RootProbe> probes(roots.size());
+
+    parallelFor(roots.size(), roots.size() < ROOT_PROBE_PARALLEL_MIN ? 1 : 0, [&](size_t i)
+    {
+        probes[i] = probeRoot(fsAccess, roots[i].first, roots[i].second);
+    });
+
+    return probes;
+}
+
 void Syncs::syncLoop()
 {
     syncThreadId = std::this_thread::get_id();
@@ -12326,6 +13250,44 @@ void Syncs::syncLoop()
             continue;
         }
 
+        // Probe the roots of all running syncs, and of those waiting for their path to come back, at once.
+        std::map<handle, RootProbe> rootProbes;
+        {
+            vector<handle> ids;
+            vector<pair<LocalPath, FSLogging>> roots;
+            for (auto& us : mSyncVec)
+            {
+                if (Sync* sync = us->mSync.get())
+                {
+                    if (us->mConfig.mError == NO_SYNC_ERROR)
+                    {
+                        ids.push_back(us->mConfig.mBackupId);
+                        roots.emplace_back(sync->localroot->localname, FSLogging::logOnError);
+                    }
+                }
+                else if (us->mConfig.mRunState == SyncRunState::Suspend &&
+                         (us->mConfig.mError == LOCAL_PATH_UNAVAILABLE ||
+                          us->mConfig.mError == LOCAL_PATH_TEMPORARY_UNAVAILABLE))
+                {
+                    ids.push_back(us->mConfig.mBackupId);
+                    roots.emplace_back(us->mConfig.mLocalPath, FSLogging::logExceptFileNotFound);
+                }
+            }
+
+            auto probes = probeRoots(*fsaccess, roots);
+            for (size_t i = 0; i < ids.size(); ++i)
+            {
+                rootProbes.emplace(ids[i], std::move(probes[i]));
+            }
+        }
+
+        // Syncs started or resumed during this pass were not probed above.
+        auto rootProbe = [&rootProbes, this](UnifiedSync& us, const LocalPath& path, FSLogging logging)
+        {
+            auto i = rootProbes.find(us.mConfig.mBackupId);
+            return i != rootProbes.end() ? i->second : probeRoot(*fsaccess, path, logging);
+        };
+
         // verify filesystem fingerprints, disable deviating syncs
         // (this covers mountovers, some device removals and some failures)
         for (auto& us : mSyncVec)
@@ -12362,19 +13324,19 @@ void Syncs::syncLoop()
                     continue;
                 }
 
-                auto fa = fsaccess->newfileaccess();
-                if (fa->fopen(sync->localroot->localname, true, false, FSLogging::logOnError, nullptr, true))
+                auto probe = rootProbe(*us, sync->localroot->localname, FSLogging::logOnError);
+                if (probe.opened)
                 {
-                    if (fa->type != FOLDERNODE)
+                    if (probe.type != FOLDERNODE)
                     {
                         LOG_err << "Sync local root folder is not a folder: " << sync->localroot->localname;
                         sync->changestate(INVALID_LOCAL_TYPE, false, true, true);
                         continue;
                     }
-                    else if (fa->fsid != sync->localroot->fsid_lastSynced)
+                    else if (probe.fsid != sync->localroot->fsid_lastSynced)
                     {
                         LOG_err << "Sync local root folder fsid has changed for " << sync->localroot->localname << ": "
-                                << fa->fsid << " was: " << sync->localroot->fsid_lastSynced;
+                                << probe.fsid << " was: " << sync->localroot->fsid_lastSynced;
                         sync->changestate(MISMATCH_OF_ROOT_FSID, false, true, true);
                         continue;
                     }
@@ -12392,7 +13354,7 @@ void Syncs::syncLoop()
 
                 if (expectedFsfp)
                 {
-                    auto computedFsfp = fsaccess->fsFingerprint(sync->localroot->localname);
+                    auto& computedFsfp = probe.fingerprint;
                     if (computedFsfp && computedFsfp != expectedFsfp)
                     {
                         LOG_err << "Local filesystem mismatch. Previous: "
@@ -12435,13 +13397,13 @@ void Syncs::syncLoop()
                 // then we can auto-restart it, if the path becomes available (eg, network drive was
                 // slow to mount, user plugged in USB, etc)
 
-                auto computedFsfp = fsaccess->fsFingerprint(us->mConfig.mLocalPath);
+                auto probe = rootProbe(*us, us->mConfig.mLocalPath, FSLogging::logExceptFileNotFound);
+                auto& computedFsfp = probe.fingerprint;
                 auto expectedFsfp = us->mConfig.mFilesystemFingerprint;
 
-                auto fa = fsaccess->newfileaccess();
-                if (fa->fopen(us->mConfig.mLocalPath, true, false, FSLogging::logExceptFileNotFound, nullptr, true))
+                if (probe.opened)
                 {
-                    if (fa->type != FOLDERNODE)
+                    if (probe.type != FOLDERNODE)
                     {
                         LOG_err << "Sync path is available again but is not a folder: " << us->mConfig.mLocalPath;
                     }
@@ -12593,6 +13555,9 @@ void Syncs::syncLoop()
                         delete debrisNode; // cleans up its own entries in parent maps
                     }
 
+                    // Syncs are recursed one after another on this thread: they share the move
+                    // detection maps, stall state and client queue that recursiveSync updates.
+
                     // pathBuffer will have leafnames appended as we recurse
                     SyncPath pathBuffer(*this, sync->localroot->localname, sync->cloudRootPath);
 
@@ -12603,8 +13568,6 @@ void Syncs::syncLoop()
                         // later we can make this lock much finer-grained
                         std::lock_guard<std::timed_mutex> g(mLocalNodeChangeMutex);
 
-                        DBTableTransactionCommitter committer(sync->statecachetable);
-
                         if (!sync->recursiveSync(row, pathBuffer, false, false, 0))
                         {
                             earlyExit = true;
@@ -12631,6 +13594,12 @@ void Syncs::syncLoop()
                 {
                     LOG_debug << "Finished initial sync scan at " << sync->localroot->getLocalPath();
                     us->mConfig.mFinishedInitialScanning = true;
+                    sync->reportLocalNodeMemory();
+
+                    if (sync->dirnotify)
+                    {
+                        sync->dirnotify->logWatchStats();
+                    }
                 }
 
                 // send stats to the app, per sync
@@ -12642,6 +13611,10 @@ void Syncs::syncLoop()
                 SyncTransferCounts stc = sync->threadSafeState->transferCounts();
                 counts.numUploads = stc.mUploads.mPending;
                 counts.numDownloads = stc.mDownloads.mPending;
+                auto scanMetrics = ScanService::metrics(us->mConfig.mBackupId);
+                counts.foldersScanned = scanMetrics.foldersScanned;
+                counts.filesFingerprinted = scanMetrics.filesFingerprinted;
+                counts.scanMilliseconds = static_cast<uint64_t>(scanMetrics.scanTime.count());
                 if (us->lastReportedDisplayStats != counts)
                 {
                     mClient.app->syncupdate_stats(us->mConfig.mBackupId, counts);
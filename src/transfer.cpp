@@ -267,6 +267,24 @@ bool Transfer::serialize(string *d) const
     return true;
 }
 
+bool TransferChunkmacDelta::serialize(string* d) const
+{
+    CacheableWriter w(*d);
+    w.serializeu32(transferDbid);
+    w.serializestring(macs);
+    w.serializeexpansionflags();
+    return true;
+}
+
+bool TransferChunkmacDelta::unserialize(const string& d, TransferChunkmacDelta& delta)
+{
+    unsigned char expansionflags[8] = { 0 };
+    CacheableReader r(d);
+    return r.unserializeu32(delta.transferDbid)
+        && r.unserializestring(delta.macs)
+        && r.unserializeexpansionflags(expansionflags, 0);
+}
+
 Transfer *Transfer::unserialize(MegaClient *client, string *d, transfer_multimap* multi_transfers)
 {
     CacheableReader r(*d);
@@ -348,6 +366,7 @@ Transfer *Transfer::unserialize(MegaClient *client, string *d, transfer_multimap
     }
 
     t->chunkmacs.calcprogress(t->size, t->pos, t->progresscompleted);
+    t->chunkmacs.markPersisted();
 
     multi_transfers[type].insert(pair<FileFingerprint*, Transfer*>(t.get(), t.get()));
     return t.release();
@@ -2491,4 +2510,198 @@ bool TransferList::isReady(Transfer *transfer)
             && transfer->bt.armed());
 }
 
+PutnodesCoalescer::PutnodesCoalescer(MegaClient& client):
+    mClient(client)
+{
+}
+
+void PutnodesCoalescer::add(NodeHandle target,
+                            VersioningOption vo,
+                            putsource_t source,
+                            bool canChangeVault,
+                            NewNode&& newnode,
+                            int tag,
+                            CommandPutNodes::Completion&& completion)
+{
+    BatchKey key(target, vo, source, canChangeVault);
+    Batch& batch = mBatches[key];
+
+    if (batch.entries.empty())
+    {
+        batch.deadline = Waiter::ds + mWindow;
+    }
+
+    batch.nodes.emplace_back(std::move(newnode));
+    batch.entries.push_back(Entry{tag, std::move(completion)});
+
+    if (!mWindow || batch.nodes.size() >= MAX_BATCH_NODES)
+    {
+        auto it = mBatches.find(key);
+        Batch full = std::move(it->second);
+        mBatches.erase(it);
+        send(key, std::move(full));
+    }
+}
+
+void PutnodesCoalescer::flush(bool force)
+{
+    for (auto it = mBatches.begin(); it != mBatches.end(); )
+    {
+        if (force || it->second.deadline <= Waiter::ds)
+        {
+            BatchKey key = it->first;
+            Batch batch = std::move(it->second);
+            it = mBatches.erase(it);
+            send(key, std::move(batch));
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void PutnodesCoalescer::update(dstime* nds) const
+{
+    for (auto& b : mBatches)
+    {
+        if (b.second.deadline < *nds)
+        {
+            *nds = b.second.deadline;
+        }
+    }
+}
+
+void PutnodesCoalescer::clear()
+{
+    auto batches = std::move(mBatches);
+    mBatches.clear();
+
+    for (auto& b : batches)
+    {
+        Batch& batch = b.second;
+        NodeHandle target = std::get<0>(b.first);
+
+        for (size_t i = 0; i < batch.entries.size(); ++i)
+        {
+            Entry& entry = batch.entries[i];
+
+            vector<NewNode> single(1);
+            single.front() = std::move(batch.nodes[i]);
+
+            LOG_debug << "Failing the held back putnodes of upload " << entry.tag << " into " << target;
+
+            mClient.restag = entry.tag;
+            if (entry.completion)
+            {
+                entry.completion(API_EINCOMPLETE, NODE_HANDLE, single, false, entry.tag, {});
+            }
+            else
+            {
+                mClient.app->putnodes_result(API_EINCOMPLETE, NODE_HANDLE, single, false, entry.tag, {});
+            }
+        }
+    }
+}
+
+bool PutnodesCoalescer::empty() const
+{
+    return mBatches.empty();
+}
+
+void PutnodesCoalescer::setWindow(dstime ds)
+{
+    mWindow = ds;
+
+    if (!mWindow)
+    {
+        flush(true);
+    }
+}
+
+void PutnodesCoalescer::send(const BatchKey& key, Batch&& batch)
+{
+    assert(!batch.nodes.empty() && batch.nodes.size() == batch.entries.size());
+
+    ++mClient.performanceStats.uploadPutnodesCommands;
+    mClient.performanceStats.uploadPutnodesNodes += batch.nodes.size();
+
+    NodeHandle target = std::get<0>(key);
+    VersioningOption vo = std::get<1>(key);
+    putsource_t source = std::get<2>(key);
+    bool canChangeVault = std::get<3>(key);
+
+    if (batch.entries.size() == 1)
+    {
+        // nothing to merge with, send it exactly as File would have
+        mClient.reqs.add(new CommandPutNodes(&mClient,
+                                             target,
+                                             nullptr,
+                                             vo,
+                                             std::move(batch.nodes),
+                                             batch.entries.front().tag,
+                                             source,
+                                             nullptr,
+                                             std::move(batch.entries.front().completion),
+                                             canChangeVault,
+                                             {}));
+        return;
+    }
+
+    LOG_debug << "Coalescing the putnodes of " << batch.entries.size() << " uploads into " << target;
+
+    auto entries = std::make_shared<vector<Entry>>(std::move(batch.entries));
+    int firstTag = entries->front().tag;
+    MegaClient* client = &mClient;
+
+    auto fanOut = [client, entries](const Error& e,
+                                    targettype_t t,
+                                    vector<NewNode>& nn,
+                                    bool targetOverride,
+                                    int,
+                                    const map<string, string>& fileHandles)
+    {
+        assert(nn.size() == entries->size());
+
+        for (size_t i = 0; i < entries->size() && i < nn.size(); ++i)
+        {
+            Entry& entry = (*entries)[i];
+
+            // the command only cleaned up after the first upload
+            CommandPutNodes::removePendingDBRecordsAndTempFiles(client, entry.tag);
+
+            Error nodeError = API_OK;
+            if (!nn[i].added)
+            {
+                nodeError = nn[i].mError ? Error(nn[i].mError) : (e ? e : Error(API_EINTERNAL));
+            }
+
+            vector<NewNode> single(1);
+            single.front() = std::move(nn[i]);
+
+            client->restag = entry.tag;
+            if (entry.completion)
+            {
+                entry.completion(nodeError, t, single, targetOverride, entry.tag, fileHandles);
+            }
+            else
+            {
+                client->app->putnodes_result(nodeError, t, single, targetOverride, entry.tag, fileHandles);
+            }
+        }
+    };
+
+    mClient.reqs.add(new CommandPutNodes(&mClient,
+                                         target,
+                                         nullptr,
+                                         vo,
+                                         std::move(batch.nodes),
+                                         firstTag,
+                                         source,
+                                         nullptr,
+                                         std::move(fanOut),
+                                         canChangeVault,
+                                         {}));
+}
+
 } // namespace
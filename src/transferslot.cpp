@@ -102,10 +102,13 @@ const m_off_t TransferSlot::MAX_REQ_SIZE_NEW_RAID = 2 * 1024 * 1024; // 2 MB for
 const m_off_t TransferSlot::UPPER_FILESIZE_LIMIT_FOR_SMALLER_CHUNKS = 25 * 1024 * 1024; // 25 MB
 const m_off_t TransferSlot::MIN_FILESIZE_FOR_MULTIPLE_CONNECTIONS = 131072 + 1; // 128 KB + 1 -> legacy value
 const m_off_t TransferSlot::MAX_GAP_SIZE = 256 * 1024 * 1024; // 256 MB
+const m_off_t TransferSlot::MAX_UPLOAD_READAHEAD_SIZE = 64 * 1024 * 1024; // 64 MB
+const size_t TransferSlot::MAX_UPLOAD_READAHEAD_CHUNKS = 4;
 
 TransferSlot::TransferSlot(Transfer* ctransfer)
     : fa(ctransfer->client->fsaccess->newfileaccess(), ctransfer)
     , retrybt(ctransfer->client->rng, ctransfer->client->transferSlotsBackoff)
+    , mUploadReadAhead(MAX_UPLOAD_READAHEAD_CHUNKS, MAX_UPLOAD_READAHEAD_SIZE)
 {
     starttime = 0;
     lastprogressreport = 0;
@@ -202,6 +205,15 @@ TransferSlot::~TransferSlot()
 {
     LOG_verbose << "[TransferSlot::~TransferSlot] BEGIN [cloudRaid = " << (void*)(cloudRaid.get()) << "]";
     LOG_verbose << "Deleting TransferSlot";
+
+    if (transfer->type == GET)
+    {
+        const auto& bs = transferbuf.bufferStats();
+        LOG_debug << "Download buffers: adopted " << bs.buffersAdopted
+                  << ", allocated " << bs.buffersAllocated << " (" << bs.bytesAllocated << " bytes)"
+                  << ", bytes copied " << bs.bytesCopied << " (recopied " << bs.bytesRecopied << ")"
+                  << " for " << transfer->size << " bytes file";
+    }
     if (transfer->type == GET && !transfer->finished
             && transfer->progresscompleted != transfer->size
             && !transfer->asyncopencontext)
@@ -364,6 +376,9 @@ TransferSlot::~TransferSlot()
         transfer->client->asyncfopens--;
     }
 
+    // before fa goes away
+    mUploadReadAhead.clear();
+
     while (connections--)
     {
         delete asyncIO[connections];
@@ -866,7 +881,7 @@ void TransferSlot::doio(MegaClient* client, TransferDbCommitter& committer)
 
                         errorcount = 0;
                         transfer->failcount = 0;
-                        client->transfercacheadd(transfer, &committer);
+                        client->transfercacheaddprogress(transfer, &committer);
                         reqs[i]->status = REQ_READY;
 
                         DEBUG_TEST_HOOK_UPLOADCHUNK_SUCCEEDED(transfer, committer);  // this will return if the hook returns false
@@ -1031,7 +1046,7 @@ void TransferSlot::doio(MegaClient* client, TransferDbCommitter& committer)
                                 return;
                             }
 
-                            client->transfercacheadd(transfer, &committer);
+                            client->transfercacheaddprogress(transfer, &committer);
                             reqs[i]->status = REQ_READY;
                         }
                     }
@@ -1046,30 +1061,9 @@ void TransferSlot::doio(MegaClient* client, TransferDbCommitter& committer)
                             if (transfer->type == PUT)
                             {
                                 LOG_verbose << "Conn " << i << " : Async read succeeded (size: " << asyncIO[i]->dataBufferLen << ")";
-                                m_off_t npos = asyncIO[i]->posOfBuffer + asyncIO[i]->dataBufferLen;
-                                string finaltempurl = transferbuf.tempURL(i);
-                                if (client->usealtupport && !memcmp(finaltempurl.c_str(), "http:", 5))
-                                {
-                                    size_t index = finaltempurl.find("/", 8);
-                                    if(index != string::npos && finaltempurl.find(":", 8) == string::npos)
-                                    {
-                                        finaltempurl.insert(index, ":8080");
-                                    }
-                                }
-
-                                auto pos = asyncIO[i]->posOfBuffer;
-                                auto req = reqs[i];    // shared_ptr so no object is deleted out from under the worker
-                                auto transferkey = transfer->transferkey;
-                                auto ctriv = transfer->ctriv;
-                                req->pos = pos;
-                                req->status = REQ_ENCRYPTING;
-
-                                client->mAsyncQueue.push([req, transferkey, ctriv, finaltempurl, pos, npos](SymmCipher& sc)
-                                    {
-                                        sc.setkey(transferkey.data());
-                                        req->prepare(finaltempurl.c_str(), &sc, ctriv, pos, npos);
-                                        req->status = REQ_PREPARED;
-                                    }, true);   // discardable - if the transfer or client are being destroyed, we won't be sending that data.
+                                m_off_t pos = asyncIO[i]->posOfBuffer;
+                                m_off_t npos = pos + asyncIO[i]->dataBufferLen;
+                                encryptUploadChunk(client, reqs[i], pos, npos);
                             }
                             else
                             {
@@ -1085,7 +1079,7 @@ void TransferSlot::doio(MegaClient* client, TransferDbCommitter& committer)
                                     return;
                                 }
 
-                                client->transfercacheadd(transfer, &committer);
+                                client->transfercacheaddprogress(transfer, &committer);
                                 reqs[i]->status = REQ_READY;
 
                                 if (client->orderdownloadedchunks && !transferbuf.isRaid())
@@ -1150,7 +1144,11 @@ void TransferSlot::doio(MegaClient* client, TransferDbCommitter& committer)
 
         if (!failure)
         {
-            if (!reqs[i] || (reqs[i]->status == REQ_READY))
+            if ((!reqs[i] || reqs[i]->status == REQ_READY) && transfer->type == PUT && takeUploadReadAhead(i))
+            {
+                LOG_verbose << "Conn " << i << " : Continuing with read-ahead chunk at " << reqs[i]->pos;
+            }
+            else if (!reqs[i] || (reqs[i]->status == REQ_READY))
             {
                 bool newInputBufferSupplied = false;
                 bool pauseConnectionInputForRaid = false;
@@ -1261,6 +1259,20 @@ void TransferSlot::doio(MegaClient* client, TransferDbCommitter& committer)
         }
     }
 
+    if (transfer->type == PUT && !failure && !backoff && fa->asyncavailable() && !transferbuf.isRaid())
+    {
+        if (advanceUploadReadAhead(client))
+        {
+            // retry shortly, as for a connection's own failed read
+            lasterror = API_EREAD;
+            backoff = 2;
+        }
+        else
+        {
+            fillUploadReadAhead(client);
+        }
+    }
+
     if (transfer->type == PUT)
     {
         // Get the number of reqs in flight and the position of the earliest for...
@@ -1521,6 +1533,215 @@ m_off_t TransferSlot::updatecontiguousprogress()
 }
 
 
+void TransferSlot::encryptUploadChunk(MegaClient* client, const std::shared_ptr<HttpReqXfer>& httpReq, m_off_t pos, m_off_t npos)
+{
+    string finaltempurl = transferbuf.tempURL(0);
+    if (client->usealtupport && !memcmp(finaltempurl.c_str(), "http:", 5))
+    {
+        size_t index = finaltempurl.find("/", 8);
+        if(index != string::npos && finaltempurl.find(":", 8) == string::npos)
+        {
+            finaltempurl.insert(index, ":8080");
+        }
+    }
+
+    auto req = httpReq;    // shared_ptr so no object is deleted out from under the worker
+    auto transferkey = transfer->transferkey;
+    auto ctriv = transfer->ctriv;
+    req->pos = pos;
+    req->status = REQ_ENCRYPTING;
+
+    client->mAsyncQueue.push([req, transferkey, ctriv, finaltempurl, pos, npos](SymmCipher& sc)
+        {
+            sc.setkey(transferkey.data());
+            req->prepare(finaltempurl.c_str(), &sc, ctriv, pos, npos);
+            req->status = REQ_PREPARED;
+        }, true);   // discardable - if the transfer or client are being destroyed, we won't be sending that data.
+}
+
+void TransferSlot::fillUploadReadAhead(MegaClient* client)
+{
+    // Uploads are not raid: all connections share one URL and one position (transferPos(0) is
+    // transfer->pos), so reading ahead for connection 0 is reading ahead for whichever takes it.
+
+    // while any connection is free it reads its own chunk, as usual
+    m_off_t earliestPos = transfer->size;
+    for (int i = connections; i--; )
+    {
+        if (!reqs[i] || reqs[i]->status == REQ_READY)
+        {
+            return;
+        }
+        earliestPos = std::min(earliestPos, asyncIO[i] ? asyncIO[i]->posOfBuffer : reqs[i]->pos);
+    }
+
+    while (mUploadReadAhead.hasRoomFor(0))
+    {
+        bool newInputBufferSupplied = false;
+        bool pauseConnectionInputForRaid = false;
+        std::pair<m_off_t, m_off_t> posrange = transferbuf.nextNPosForConnection(0, maxRequestSize, connections, newInputBufferSupplied, pauseConnectionInputForRaid, client->httpio->uploadSpeed);
+
+        if (posrange.second <= posrange.first)
+        {
+            break;  // the rest of the file is already read or in flight
+        }
+
+        unsigned size = (unsigned)(posrange.second - posrange.first);
+        if (!mUploadReadAhead.hasRoomFor(size))
+        {
+            break;
+        }
+
+        if (earliestPos + MAX_GAP_SIZE < posrange.second)
+        {
+            break;  // the connection taking it would only have to wait for the earliest to complete
+        }
+
+        UploadReadAheadQueue::Chunk ra;
+        ra.req = std::make_shared<HttpReqUL>();
+        ra.req->logname = client->clientname + "U" + std::to_string(++client->transferHttpCounter) + " ";
+        ra.asyncIO = fa->asyncfread(ra.req->out, size, (-(int)size) & (SymmCipher::BLOCKSIZE - 1), posrange.first, FSLogging::logOnError);
+        ra.req->status = REQ_ASYNCIO;
+        ra.size = size;
+
+        LOG_verbose << "Reading ahead upload chunk " << posrange.first << " to " << posrange.second << " (" << mUploadReadAhead.size() + 1 << " ahead)";
+
+        transferbuf.transferPos(0) = std::max<m_off_t>(transferbuf.transferPos(0), posrange.second);
+        mUploadReadAhead.push(std::move(ra));
+    }
+}
+
+bool TransferSlot::advanceUploadReadAhead(MegaClient* client)
+{
+    m_off_t failedPos = mUploadReadAhead.advance([this, client](const std::shared_ptr<HttpReqXfer>& req, m_off_t pos, m_off_t npos)
+    {
+        encryptUploadChunk(client, req, pos, npos);
+    });
+
+    if (failedPos < 0)
+    {
+        return false;
+    }
+
+    // Nothing from there on is held by a connection, so the next free one reads it again
+    // through its own path, with its own retry and failure handling.
+    LOG_warn << "Upload read-ahead failed at " << failedPos << ", rewinding from " << transferbuf.transferPos(0);
+    transferbuf.transferPos(0) = failedPos;
+    return true;
+}
+
+bool TransferSlot::takeUploadReadAhead(int connectionNum)
+{
+    // a connection with a failed read keeps retrying that read
+    UploadReadAheadQueue::Chunk ra;
+    if (asyncIO[connectionNum] || !mUploadReadAhead.take(ra))
+    {
+        return false;
+    }
+
+    reqs[connectionNum] = ra.req;
+    asyncIO[connectionNum] = ra.asyncIO;
+    if (ra.asyncIO)
+    {
+        // not encrypted yet, make sure pos is known before the read completes
+        reqs[connectionNum]->pos = ra.asyncIO->posOfBuffer;
+    }
+    return true;
+}
+
+UploadReadAheadQueue::UploadReadAheadQueue(size_t maxChunks, m_off_t maxBytes)
+    : mMaxChunks(maxChunks)
+    , mMaxBytes(maxBytes)
+{
+}
+
+UploadReadAheadQueue::~UploadReadAheadQueue()
+{
+    clear();
+}
+
+bool UploadReadAheadQueue::hasRoomFor(m_off_t size) const
+{
+    if (mChunks.size() >= mMaxChunks)
+    {
+        return false;
+    }
+
+    return !mBufferedBytes || mBufferedBytes + size <= mMaxBytes;
+}
+
+void UploadReadAheadQueue::push(Chunk&& chunk)
+{
+    mBufferedBytes += chunk.size;
+    mChunks.push_back(std::move(chunk));
+}
+
+m_off_t UploadReadAheadQueue::advance(const EncryptFunction& encrypt)
+{
+    for (auto it = mChunks.begin(); it != mChunks.end(); ++it)
+    {
+        auto& ra = *it;
+        if (!ra.asyncIO || !ra.asyncIO->finished)
+        {
+            continue;
+        }
+
+        if (ra.asyncIO->failed)
+        {
+            m_off_t failedPos = ra.asyncIO->posOfBuffer;
+            for (auto discard = it; discard != mChunks.end(); ++discard)
+            {
+                delete discard->asyncIO;
+                mBufferedBytes -= discard->size;
+            }
+            mChunks.erase(it, mChunks.end());
+            return failedPos;
+        }
+
+        m_off_t pos = ra.asyncIO->posOfBuffer;
+        m_off_t npos = pos + ra.asyncIO->dataBufferLen;
+        delete ra.asyncIO;
+        ra.asyncIO = nullptr;
+
+        encrypt(ra.req, pos, npos);
+    }
+
+    return -1;
+}
+
+bool UploadReadAheadQueue::take(Chunk& chunk)
+{
+    if (mChunks.empty())
+    {
+        return false;
+    }
+
+    chunk = std::move(mChunks.front());
+    mChunks.pop_front();
+    mBufferedBytes -= chunk.size;
+    return true;
+}
+
+void UploadReadAheadQueue::clear()
+{
+    for (auto& ra : mChunks)
+    {
+        delete ra.asyncIO;
+    }
+    mChunks.clear();
+    mBufferedBytes = 0;
+}
+
+size_t UploadReadAheadQueue::size() const
+{
+    return mChunks.size();
+}
+
+m_off_t UploadReadAheadQueue::bufferedBytes() const
+{
+    return mBufferedBytes;
+}
+
 void TransferSlot::prepareRequest(const std::shared_ptr<HttpReqXfer>& httpReq, const string& tempURL, m_off_t pos, m_off_t npos)
 {
     string finaltempURL = tempURL;
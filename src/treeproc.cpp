@@ -152,6 +152,7 @@ void LocalTreeProcMove::proc(FileSystemAccess&, LocalNode* localnode)
     if (newsync != localnode->sync)
     {
         localnode->sync->statecachedel(localnode);
+        newsync->adoptFlagged(*localnode->sync, *localnode);
         localnode->sync = newsync;
         newsync->statecacheadd(localnode);
     }
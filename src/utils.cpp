@@ -439,6 +439,7 @@ bool chunkmac_map::unserialize(const char*& ptr, const char* end)
 
         memcpy(&(mMacMap[pos]), ptr, sizeof(ChunkMAC));
         ptr += sizeof(ChunkMAC);
+        mDirtyAll = true;
 
         if (mMacMap[pos].isMacsmacSoFar())
         {
@@ -453,6 +454,79 @@ bool chunkmac_map::unserialize(const char*& ptr, const char* end)
     return true;
 }
 
+bool chunkmac_map::serializeDelta(string& d) const
+{
+    if (mDirtyAll)
+    {
+        return false;
+    }
+
+    string entries;
+    uint32_t count = 0;
+    for (m_off_t pos : mDirty)
+    {
+        // entries folded into the macsmac since are implied by macsmacSoFarPos
+        auto it = mMacMap.find(pos);
+        if (it != mMacMap.end())
+        {
+            entries.append((char*)&it->first, sizeof(it->first));
+            entries.append((char*)&it->second, sizeof(it->second));
+            ++count;
+        }
+    }
+
+    d.append((char*)&macsmacSoFarPos, sizeof(macsmacSoFarPos));
+    d.append((char*)&count, sizeof(count));
+    d.append(entries);
+    return true;
+}
+
+void chunkmac_map::markPersisted()
+{
+    mDirty.clear();
+    mDirtyAll = false;
+}
+
+bool chunkmac_map::unserializeDelta(const char*& ptr, const char* end)
+{
+    m_off_t soFarPos;
+    uint32_t count;
+    if (ptr + sizeof(soFarPos) + sizeof(count) > end)
+    {
+        return false;
+    }
+
+    soFarPos = MemAccess::get<m_off_t>(ptr);
+    count = MemAccess::get<uint32_t>(ptr + sizeof(soFarPos));
+
+    if (soFarPos < macsmacSoFarPos
+        || size_t(end - ptr) < sizeof(soFarPos) + sizeof(count) + size_t(count) * (sizeof(m_off_t) + sizeof(ChunkMAC)))
+    {
+        return false;
+    }
+
+    ptr += sizeof(soFarPos) + sizeof(count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        m_off_t pos = MemAccess::get<m_off_t>(ptr);
+        ptr += sizeof(m_off_t);
+
+        memcpy(&(mMacMap[pos]), ptr, sizeof(ChunkMAC));
+        ptr += sizeof(ChunkMAC);
+        mDirty.insert(pos);
+    }
+
+    // the entries consolidated into the macsmac so far are gone
+    if (soFarPos >= 0)
+    {
+        mMacMap.erase(mMacMap.begin(), mMacMap.lower_bound(soFarPos));
+        assert(!mMacMap.empty() && mMacMap.begin()->second.isMacsmacSoFar());
+    }
+    macsmacSoFarPos = soFarPos;
+    return true;
+}
+
 void chunkmac_map::calcprogress(m_off_t size, m_off_t& chunkpos, m_off_t& progresscompleted, m_off_t* sumOfPartialChunks)
 {
     chunkpos = 0;
@@ -566,18 +640,44 @@ void chunkmac_map::ctr_encrypt(m_off_t chunkid, SymmCipher *cipher, byte *chunks
 
     // encrypt is always done on whole chunks
     auto& chunk = mMacMap[chunkid];
+    mDirty.insert(chunkid);
     cipher->ctr_crypt(chunkstart, unsigned(chunksize), startpos, ctriv, chunk.mac, true, true);
     chunk.offset = 0;
     chunk.finished = finishesChunk;  // when encrypting for uploads, only set finished after confirmation of the chunk uploading.
 }
 
 
+void chunkmac_map::ctr_encrypt_chunks(SymmCipher *cipher, SymmCipher::CtrLane* chunks, unsigned count, int64_t ctriv, bool finishesChunks)
+{
+    if (count == 1)
+    {
+        return ctr_encrypt(chunks[0].pos, cipher, chunks[0].data, chunks[0].len, chunks[0].pos, ctriv, finishesChunks);
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        assert(chunks[i].pos > macsmacSoFarPos);
+        chunks[i].mac = mMacMap[chunks[i].pos].mac;
+    }
+
+    cipher->ctr_encrypt_lanes(chunks, count, ctriv);
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        auto& chunk = mMacMap[chunks[i].pos];
+        chunk.offset = 0;
+        chunk.finished = finishesChunks;
+        mDirty.insert(chunks[i].pos);
+    }
+}
+
 void chunkmac_map::ctr_decrypt(m_off_t chunkid, SymmCipher *cipher, byte *chunkstart, unsigned chunksize, m_off_t startpos, int64_t ctriv, bool finishesChunk)
 {
     assert(chunkid > macsmacSoFarPos);
     assert(startpos >= chunkid);
     assert(startpos + chunksize <= ChunkedHash::chunkceil(chunkid));
     ChunkMAC& chunk = mMacMap[chunkid];
+    mDirty.insert(chunkid);
 
     cipher->ctr_crypt(chunkstart, chunksize, startpos, ctriv, chunk.mac, false, chunk.notStarted());
 
@@ -603,6 +703,7 @@ void chunkmac_map::finishedUploadChunks(chunkmac_map& macs)
 
         m.second.finished = true;
         mMacMap[m.first] = m.second;
+        mDirty.insert(m.first);
         LOG_verbose << "Upload chunk completed: " << m.first;
     }
 }
@@ -645,6 +746,7 @@ void chunkmac_map::updateMacsmacProgress(SymmCipher *cipher)
             memcpy(next.mac, calcSoFar.mac, sizeof(next.mac));
 
             macsmacSoFarPos = it->first;
+            mDirty.insert(it->first);
             next.offset = unsigned(-1);
             assert(next.isMacsmacSoFar());
             mMacMap.erase(mMacMap.begin());
@@ -661,12 +763,15 @@ void chunkmac_map::updateMacsmacProgress(SymmCipher *cipher)
             first.offset = unsigned(-1);
             assert(first.isMacsmacSoFar());
             macsmacSoFarPos = 0;
+            mDirty.insert(0);
         }
         updated = true;
     }
 
     if (updated)
     {
+        // positions folded into the macsmac need no record of their own
+        mDirty.erase(mDirty.begin(), mDirty.lower_bound(macsmacSoFarPos));
         LOG_verbose << "Macsmac calculation advanced to " << mMacMap.begin()->first;
     }
 }
@@ -677,6 +782,7 @@ void chunkmac_map::copyEntriesTo(chunkmac_map& other)
     {
         assert(e.first > macsmacSoFarPos);
         other.mMacMap[e.first] = e.second;
+        other.mDirty.insert(e.first);
     }
 }
 
@@ -684,6 +790,7 @@ void chunkmac_map::copyEntryTo(m_off_t pos, chunkmac_map& other)
 {
     assert(pos > macsmacSoFarPos);
     mMacMap[pos] = other.mMacMap[pos];
+    mDirty.insert(pos);
 }
 
 void chunkmac_map::debugLogOuputMacs()
@@ -1306,39 +1413,39 @@ string * TLVstore::tlvRecordsToContainer(PrnGen &rng, SymmCipher *key, encryptio
         return NULL;
     }
 
-    // serialize the TLV records
-    std::unique_ptr<string> container(tlvRecordsToContainer());
+    // serialize the TLV records and lay out the container around them:
+    // encryption setting, IV, records (encrypted in place) and auth. tag
+    std::unique_ptr<string> result(tlvRecordsToContainer());
+    size_t datalen = result->size();
+    result->insert(0, 1 + ivlen, '\0');
+    result->resize(1 + ivlen + datalen + taglen);
 
-    // generate IV array
-    std::vector<byte> iv(ivlen);
-    rng.genblock(iv.data(), ivlen);
+    byte* header = reinterpret_cast<byte*>(result->data());
+    byte* iv = header + 1;
+    byte* data = iv + ivlen;
+    byte* tag = data + datalen;
 
-    string cipherText;
+    header[0] = static_cast<byte>(encSetting);
+    rng.genblock(iv, ivlen);
 
     // encrypt the bytes using the specified mode
 
     if (encMode == AES_MODE_CCM)   // CCM or GCM_BROKEN (same than CCM)
     {
-        if (!key->ccm_encrypt(container.get(), iv.data(), ivlen, taglen, &cipherText))
+        if (!key->ccm_encrypt_buffer(data, data, datalen, iv, ivlen, tag, taglen))
         {
             return nullptr;
         }
     }
     else if (encMode == AES_MODE_GCM)   // then use GCM
     {
-        if (!key->gcm_encrypt(container.get(), iv.data(), ivlen, taglen, &cipherText))
+        if (!key->gcm_encrypt_buffer(data, data, datalen, iv, ivlen, tag, taglen))
         {
             return nullptr;
         }
     }
 
-    string *result = new string;
-    result->resize(1);
-    result->at(0) = static_cast<char>(encSetting);
-    result->append((char*) iv.data(), ivlen);
-    result->append((char*) cipherText.data(), cipherText.length()); // includes auth. tag
-
-    return result;
+    return result.release();
 }
 
 string* TLVstore::tlvRecordsToContainer()
@@ -1572,28 +1679,28 @@ TLVstore * TLVstore::containerToTLVrecords(const string *data, SymmCipher *key)
         return NULL;
     }
 
-    byte *iv = new byte[ivlen];
-    memcpy(iv, &(data->data()[offset]), ivlen);
+    const byte* iv = reinterpret_cast<const byte*>(data->data()) + offset;
     offset += ivlen;
 
     unsigned cipherTextLen = unsigned(data->length() - offset);
-    string cipherText = data->substr(offset, cipherTextLen);
-
     unsigned clearTextLen = cipherTextLen - taglen;
-    string clearText;
+    const byte* cipherText = reinterpret_cast<const byte*>(data->data()) + offset;
+    const byte* tag = cipherText + clearTextLen;
+
+    // decrypt straight into the plain text buffer
+    string clearText(clearTextLen, '\0');
+    byte* clearTextBuf = reinterpret_cast<byte*>(clearText.data());
 
     bool decrypted = false;
     if (encMode == AES_MODE_CCM)   // CCM or GCM_BROKEN (same than CCM)
     {
-       decrypted = key->ccm_decrypt(&cipherText, iv, ivlen, taglen, &clearText);
+       decrypted = key->ccm_decrypt_buffer(cipherText, clearTextBuf, clearTextLen, iv, ivlen, tag, taglen);
     }
     else if (encMode == AES_MODE_GCM)  // GCM
     {
-       decrypted = key->gcm_decrypt(&cipherText, iv, ivlen, taglen, &clearText);
+       decrypted = key->gcm_decrypt_buffer(cipherText, clearTextBuf, clearTextLen, iv, ivlen, tag, taglen);
     }
 
-    delete [] iv;
-
     if (!decrypted)  // the decryption has failed (probably due to authentication)
     {
         return NULL;
@@ -2562,8 +2669,183 @@ std::string CacheableStatus::typeToStr(CacheableStatus::Type type)
     }
 }
 
-std::pair<bool, int64_t> generateMetaMac(SymmCipher &cipher, FileAccess &ifAccess, const int64_t iv)
+static std::pair<bool, int64_t> generateMetaMacParallel(SymmCipher &cipher, FileAccess &ifAccess, const int64_t iv, unsigned numThreads)
+{
+    // blocks end on chunk boundaries so each one is MACed independently
+    static const m_off_t BLOCK_SIZE = 8 << 20;
+
+    struct Block
+    {
+        m_off_t pos;
+        unsigned len;
+        std::unique_ptr<byte[]> data;
+    };
+
+    const m_off_t size = ifAccess.size;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<Block> pending;
+    size_t blocksInMemory = 0;
+    bool allRead = false;
+    chunkmac_map chunkMacs;
+
+    auto macBlocks = [&]()
+    {
+        SymmCipher threadCipher(cipher);
+        for (;;)
+        {
+            Block block;
+            {
+                std::unique_lock<std::mutex> g(m);
+                cv.wait(g, [&]() { return !pending.empty() || allRead; });
+                if (pending.empty()) return;
+                block = std::move(pending.front());
+                pending.pop_front();
+            }
+
+            chunkmac_map blockMacs;
+            SymmCipher::CtrLane chunks[SymmCipher::MAX_CTR_LANES];
+            unsigned numChunks = 0;
+            for (m_off_t pos = block.pos; pos < block.pos + block.len; )
+            {
+                m_off_t endpos = ChunkedHash::chunkceil(pos, size);
+                chunks[numChunks++] = { block.data.get() + (pos - block.pos), unsigned(endpos - pos), pos, nullptr };
+                pos = endpos;
+
+                if (numChunks == SymmCipher::MAX_CTR_LANES || pos == block.pos + block.len)
+                {
+                    blockMacs.ctr_encrypt_chunks(&threadCipher, chunks, numChunks, iv, true);
+                    numChunks = 0;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> g(m);
+                blockMacs.copyEntriesTo(chunkMacs);
+                --blocksInMemory;
+            }
+            cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = numThreads; i--; )
+    {
+        try
+        {
+            threads.emplace_back(macBlocks);
+        }
+        catch (std::system_error& e)
+        {
+            LOG_warn << "Failed to start meta MAC thread: " << e.what();
+            break;
+        }
+    }
+
+    if (threads.empty())
+    {
+        FileInputStream isAccess(&ifAccess);
+        return generateMetaMac(cipher, isAccess, iv);
+    }
+
+    bool readOk = true;
+    for (m_off_t pos = 0; pos < size && readOk; )
+    {
+        m_off_t endpos = pos;
+        while (endpos < size && endpos - pos < BLOCK_SIZE)
+        {
+            endpos = ChunkedHash::chunkceil(endpos, size);
+        }
+
+        {
+            // bound the memory used by blocks read ahead of the workers
+            std::unique_lock<std::mutex> g(m);
+            cv.wait(g, [&]() { return blocksInMemory <= threads.size(); });
+        }
+
+        Block block{pos, unsigned(endpos - pos), std::make_unique<byte[]>(size_t(endpos - pos) + SymmCipher::BLOCKSIZE)};
+        memset(block.data.get() + block.len, 0, SymmCipher::BLOCKSIZE);
+        readOk = ifAccess.frawread(block.data.get(), block.len, pos, true, FSLogging::logOnError);
+        pos = endpos;
+
+        if (readOk)
+        {
+            {
+                std::lock_guard<std::mutex> g(m);
+                pending.push_back(std::move(block));
+                ++blocksInMemory;
+            }
+            cv.notify_all();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> g(m);
+        allRead = true;
+        if (!readOk)
+        {
+            pending.clear();   // not worth MACing, the result is discarded
+        }
+    }
+    cv.notify_all();   // the workers drain whatever is still pending before they exit
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    if (!readOk)
+    {
+        return std::make_pair(false, 0l);
+    }
+    return std::make_pair(true, chunkMacs.macsmac(&cipher));
+}
+
+void parallelFor(size_t count, unsigned maxThreads, const std::function<void(size_t)>& f)
 {
+    unsigned numThreads = maxThreads ? maxThreads : std::min(std::thread::hardware_concurrency(), 8u);
+    numThreads = unsigned(std::min<size_t>(std::max(numThreads, 1u), count));
+
+    std::atomic<size_t> next{0};
+    auto work = [&]()
+    {
+        for (size_t i; (i = next++) < count; )
+        {
+            f(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < numThreads; ++i)
+    {
+        try
+        {
+            threads.emplace_back(work);
+        }
+        catch (std::system_error& e)
+        {
+            LOG_warn << "Failed to start worker thread: " << e.what();
+            break;
+        }
+    }
+
+    work();
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+}
+
+std::pair<bool, int64_t> generateMetaMac(SymmCipher &cipher, FileAccess &ifAccess, const int64_t iv, unsigned maxThreads)
+{
+    unsigned numThreads = maxThreads ? maxThreads : std::min(std::thread::hardware_concurrency(), 8u);
+
+    if (ifAccess.size >= METAMAC_PARALLEL_MIN_SIZE && numThreads > 1)
+    {
+        return generateMetaMacParallel(cipher, ifAccess, iv, numThreads);
+    }
+
     FileInputStream isAccess(&ifAccess);
 
     return generateMetaMac(cipher, isAccess, iv);
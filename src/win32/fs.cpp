@@ -870,6 +870,12 @@ bool WinFileAccess::fopen_impl(const LocalPath& namePath, bool read, bool write,
     if (!write)
     {
         size = ((m_off_t)fad.nFileSizeHigh << 32) + (m_off_t)fad.nFileSizeLow;
+
+        // same units as the ChangeTime reported by directoryScan()
+        FILE_BASIC_INFO basicInfo;
+        ctime = GetFileInformationByHandleEx(hFile, FileBasicInfo, &basicInfo, sizeof(basicInfo))
+              ? (m_time_t)basicInfo.ChangeTime.QuadPart
+              : 0;
     }
 
     return true;
@@ -1921,7 +1927,8 @@ bool  WinFileSystemAccess::checkForSymlink(const LocalPath& lp)
     return false;
 }
 
-ScanResult WinFileSystemAccess::directoryScan(const LocalPath& path, handle expectedFsid, map<LocalPath, FSNode>& known, std::vector<FSNode>& results, bool followSymLinks, unsigned& nFingerprinted)
+ScanResult WinFileSystemAccess::directoryScan(const LocalPath& path, handle expectedFsid, map<LocalPath, FSNode>& known, std::vector<FSNode>& results, bool followSymLinks, unsigned& nFingerprinted,
+                                              FingerprintCache* fingerprintCache, const string& filesystem)
 {
     assert(path.isAbsolute());
     assert(!followSymLinks && "Symlinks are not supported on Windows!");
@@ -2067,6 +2074,16 @@ ScanResult WinFileSystemAccess::directoryScan(const LocalPath& path, handle expe
                         result.fingerprint = std::move(it->second.fingerprint);
                         known.erase(it);
                     }
+                    else if (fingerprintCache
+                             && fingerprintCache->lookup(filesystem,
+                                                         result.fsid,
+                                                         result.fingerprint.size,
+                                                         result.fingerprint.mtime,
+                                                         (m_time_t)info->ChangeTime.QuadPart,
+                                                         result.fingerprint))
+                    {
+                        // fingerprinted in an earlier session and unchanged since
+                    }
                     else
                     {
                         LocalPath p = path;
@@ -2076,6 +2093,11 @@ ScanResult WinFileSystemAccess::directoryScan(const LocalPath& path, handle expe
                         {
                             result.fingerprint.genfingerprint(fa.get());
                             nFingerprinted += 1;
+
+                            if (fingerprintCache)
+                            {
+                                fingerprintCache->store(filesystem, result.fsid, (m_time_t)info->ChangeTime.QuadPart, result.fingerprint);
+                            }
                         }
                         else
                         {
@@ -0,0 +1,539 @@
+/**
+ * @file crypto_benchmark.cpp
+ * @brief Throughput and latency of the SDK's cryptographic primitives
+ *
+ * (c) 2013 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+// Usage: crypto_benchmark [--json <file>] [--min-time-ms <ms>] [--filter <substring>]
+//
+// Every primitive is run repeatedly over each buffer size until --min-time-ms
+// has elapsed. Results are printed as a table and, with --json, written as a
+// JSON document that can be diffed between builds ("crc32_accelerated" tells
+// whether HashCRC32 used carry-less multiplication on this machine):
+//
+// { "min_time_ms": 200, "crc32_accelerated": true, "results": [ { "name": "cbc_encrypt",
+//   "bytes": 4096, "iterations": 123456, "ns_per_op": 812.3, "mb_per_s": 4809.7 }, ... ] }
+
+#include "mega.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace mega;
+
+// not the whole of std: std::byte would make mega's byte ambiguous
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::fixed;
+using std::function;
+using std::left;
+using std::ofstream;
+using std::right;
+using std::setprecision;
+using std::setw;
+namespace chrono = std::chrono;
+
+namespace
+{
+
+struct Result
+{
+    string name;
+    size_t bytes;
+    uint64_t iterations;
+    double nsPerOp;
+};
+
+class Benchmark
+{
+public:
+    Benchmark(chrono::milliseconds minTime, string filter)
+        : mMinTime(minTime)
+        , mFilter(std::move(filter))
+    {}
+
+    // runs op in doubling batches until mMinTime is reached, then records the average cost.
+    // bytes is the amount of data op processes, 0 for fixed size operations.
+    void run(const string& name, size_t bytes, const function<void()>& op)
+    {
+        if (!mFilter.empty() && name.find(mFilter) == string::npos)
+        {
+            return;
+        }
+
+        op();  // warm up caches and lazily expanded keys
+
+        uint64_t iterations = 0;
+        uint64_t batch = 1;
+        chrono::nanoseconds elapsed{0};
+        while (elapsed < mMinTime)
+        {
+            auto start = chrono::steady_clock::now();
+            for (uint64_t i = batch; i--; )
+            {
+                op();
+            }
+            elapsed += chrono::steady_clock::now() - start;
+            iterations += batch;
+            batch *= 2;
+        }
+
+        Result r{name, bytes, iterations, double(elapsed.count()) / double(iterations)};
+        print(r);
+        mResults.push_back(std::move(r));
+    }
+
+    bool writeJson(const string& path) const
+    {
+        ofstream out(path);
+        if (!out)
+        {
+            cerr << "Unable to open " << path << endl;
+            return false;
+        }
+
+        out << "{\n  \"min_time_ms\": " << mMinTime.count()
+            << ",\n  \"crc32_accelerated\": " << (HashCRC32::accelerated() ? "true" : "false")
+            << ",\n  \"results\": [\n";
+        for (size_t i = 0; i < mResults.size(); i++)
+        {
+            const Result& r = mResults[i];
+            out << "    { \"name\": \"" << r.name << "\", \"bytes\": " << r.bytes
+                << ", \"iterations\": " << r.iterations
+                << fixed << setprecision(1)
+                << ", \"ns_per_op\": " << r.nsPerOp
+                << ", \"mb_per_s\": " << mbPerSecond(r)
+                << " }" << (i + 1 < mResults.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return bool(out);
+    }
+
+private:
+    static double mbPerSecond(const Result& r)
+    {
+        return r.bytes ? double(r.bytes) * 1e3 / r.nsPerOp : 0.0;
+    }
+
+    static void print(const Result& r)
+    {
+        cout << left << setw(24) << r.name << right << setw(10) << r.bytes
+             << fixed << setprecision(1) << setw(16) << r.nsPerOp << " ns/op";
+        if (r.bytes)
+        {
+            cout << setw(12) << mbPerSecond(r) << " MB/s";
+        }
+        cout << endl;
+    }
+
+    chrono::milliseconds mMinTime;
+    string mFilter;
+    vector<Result> mResults;
+};
+
+void benchmarkSymmCipher(Benchmark& bench, PrnGen& rng, const vector<size_t>& sizes)
+{
+    SymmCipher cipher;
+    string key = rng.genstring(SymmCipher::KEYLENGTH);
+    cipher.setkey(reinterpret_cast<const byte*>(key.data()));
+
+    byte iv[12];
+    rng.genblock(iv, sizeof(iv));
+    byte tag[16];
+    byte mac[SymmCipher::BLOCKSIZE];
+
+    byte block[SymmCipher::BLOCKSIZE] = {};
+    bench.run("ecb_encrypt", SymmCipher::BLOCKSIZE, [&]() { cipher.ecb_encrypt(block); });
+    bench.run("setkey", 0, [&]()
+    {
+        // a different key every time, re-setting the key in use is free
+        key[0]++;
+        cipher.setkey(reinterpret_cast<const byte*>(key.data()));
+        cipher.ecb_encrypt(block);
+    });
+
+    for (size_t size : sizes)
+    {
+        // whole blocks, as required by CBC without padding
+        size_t aligned = (size + SymmCipher::BLOCKSIZE - 1) & ~size_t(SymmCipher::BLOCKSIZE - 1);
+        vector<byte> buf(aligned);
+        rng.genblock(buf.data(), buf.size());
+
+        bench.run("ctr_crypt", size, [&]()
+        {
+            cipher.ctr_crypt(buf.data(), unsigned(size), 0, 0, mac, true);
+        });
+        bench.run("ctr_crypt_nomac", size, [&]()
+        {
+            cipher.ctr_crypt(buf.data(), unsigned(size), 0, 0, nullptr, true);
+        });
+
+        // upload chunks encrypted and MACed together, one lane per chunk
+        vector<byte> laneBuf(aligned * SymmCipher::MAX_CTR_LANES);
+        byte laneMacs[SymmCipher::MAX_CTR_LANES][SymmCipher::BLOCKSIZE];
+        SymmCipher::CtrLane lanes[SymmCipher::MAX_CTR_LANES];
+        for (unsigned l = 0; l < SymmCipher::MAX_CTR_LANES; l++)
+        {
+            lanes[l] = { laneBuf.data() + l * aligned, unsigned(size), m_off_t(l * aligned), laneMacs[l] };
+        }
+        bench.run("ctr_encrypt_lanes", size * SymmCipher::MAX_CTR_LANES, [&]()
+        {
+            cipher.ctr_encrypt_lanes(lanes, SymmCipher::MAX_CTR_LANES, 0);
+        });
+        bench.run("ctr_decrypt", size, [&]()
+        {
+            cipher.ctr_crypt(buf.data(), unsigned(size), 0, 0, mac, false);
+        });
+        bench.run("cbc_encrypt", aligned, [&]() { cipher.cbc_encrypt(buf.data(), buf.size()); });
+        bench.run("cbc_decrypt", aligned, [&]() { cipher.cbc_decrypt(buf.data(), buf.size()); });
+
+        bench.run("gcm_encrypt", size, [&]()
+        {
+            cipher.gcm_encrypt_buffer(buf.data(), buf.data(), size, iv, sizeof(iv), tag, sizeof(tag));
+        });
+        cipher.gcm_encrypt_buffer(buf.data(), buf.data(), size, iv, sizeof(iv), tag, sizeof(tag));
+        vector<byte> plain(size);
+        bench.run("gcm_decrypt", size, [&]()
+        {
+            cipher.gcm_decrypt_buffer(buf.data(), plain.data(), size, iv, sizeof(iv), tag, sizeof(tag));
+        });
+
+        string in(reinterpret_cast<const char*>(buf.data()), size);
+        bench.run("gcm_encrypt_string", size, [&]()
+        {
+            string out;
+            cipher.gcm_encrypt(&in, iv, sizeof(iv), sizeof(tag), &out);
+        });
+        bench.run("ccm_encrypt", size, [&]()
+        {
+            cipher.ccm_encrypt_buffer(buf.data(), buf.data(), size, iv, sizeof(iv), tag, sizeof(tag));
+        });
+    }
+}
+
+void benchmarkHashes(Benchmark& bench, PrnGen& rng, const vector<size_t>& sizes)
+{
+    for (size_t size : sizes)
+    {
+        vector<byte> buf(size);
+        rng.genblock(buf.data(), buf.size());
+
+        auto crc32 = [&]()
+        {
+            HashCRC32 crc;
+            byte out[4];
+            crc.add(buf.data(), unsigned(buf.size()));
+            crc.get(out);
+        };
+        bench.run("HashCRC32", size, crc32);
+        HashCRC32::setAccelerationEnabled(false);
+        bench.run("HashCRC32_portable", size, crc32);
+        HashCRC32::setAccelerationEnabled(true);
+        bench.run("HashSHA256", size, [&]()
+        {
+            HashSHA256 sha;
+            string out;
+            sha.add(buf.data(), unsigned(buf.size()));
+            sha.get(&out);
+        });
+        bench.run("HashSHA512", size, [&]()
+        {
+            Hash sha;
+            string out;
+            sha.add(buf.data(), unsigned(buf.size()));
+            sha.get(&out);
+        });
+        bench.run("HMACSHA256", size, [&]()
+        {
+            static const byte key[32] = {};
+            HMACSHA256 hmac(key, sizeof(key));
+            byte out[32];
+            hmac.add(buf.data(), buf.size());
+            hmac.get(out);
+        });
+    }
+
+    // the iteration count used for account password derivation
+    PBKDF2_HMAC_SHA512 pbkdf2;
+    const string password = "correct horse battery staple";
+    byte salt[32] = {};
+    byte derived[32];
+    bench.run("PBKDF2_HMAC_SHA512", 0, [&]()
+    {
+        pbkdf2.deriveKey(derived, sizeof(derived),
+                         reinterpret_cast<const byte*>(password.data()), password.size(),
+                         salt, sizeof(salt), 100000);
+    });
+}
+
+// serves a file held in memory to FileFingerprint::genfingerprint()
+class MemoryInputStream : public InputStreamAccess
+{
+public:
+    explicit MemoryInputStream(const vector<byte>& data)
+        : mData(data)
+    {}
+
+    m_off_t size() override
+    {
+        return m_off_t(mData.size());
+    }
+
+    bool read(byte* buffer, unsigned size) override
+    {
+        if (mPosition + size > mData.size())
+        {
+            return false;
+        }
+        if (buffer)
+        {
+            memcpy(buffer, mData.data() + mPosition, size);
+        }
+        mPosition += size;
+        return true;
+    }
+
+private:
+    const vector<byte>& mData;
+    size_t mPosition = 0;
+};
+
+void benchmarkFingerprints(Benchmark& bench, PrnGen& rng)
+{
+    // full coverage of a small file and sparse coverage of a large one
+    for (size_t size : { size_t(8192), size_t(16 << 20) })
+    {
+        vector<byte> file(size);
+        rng.genblock(file.data(), file.size());
+
+        auto fingerprint = [&]()
+        {
+            MemoryInputStream is(file);
+            FileFingerprint fp;
+            fp.genfingerprint(&is, 0);
+        };
+        bench.run("fingerprint", size, fingerprint);
+        HashCRC32::setAccelerationEnabled(false);
+        bench.run("fingerprint_portable_crc", size, fingerprint);
+        HashCRC32::setAccelerationEnabled(true);
+    }
+
+    // the same from a file, whose sparse blocks are fetched in one batched read
+    // (with the file in the OS cache, so this is the cost beyond the disk itself)
+    FSACCESS_CLASS fsAccess;
+    LocalPath path;
+    if (!fsAccess.cwd(path))
+    {
+        return;
+    }
+    path.appendWithSeparator(LocalPath::fromRelativePath("crypto_benchmark_fingerprint.bin"), false);
+
+    vector<byte> file(16 << 20);
+    rng.genblock(file.data(), file.size());
+    {
+        auto fa = fsAccess.newfileaccess(false);
+        if (!fa->fopen(path, false, true, FSLogging::logOnError)
+            || !fa->fwrite(file.data(), unsigned(file.size()), 0))
+        {
+            return;
+        }
+    }
+
+    bench.run("fingerprint_file", file.size(), [&]()
+    {
+        auto fa = fsAccess.newfileaccess(false);
+        if (fa->fopen(path, FSLogging::logOnError))
+        {
+            FileFingerprint fp;
+            fp.genfingerprint(fa.get());
+        }
+    });
+
+    fsAccess.unlinklocal(path);
+}
+
+void benchmarkMetaMac(Benchmark& bench, PrnGen& rng)
+{
+    // a file on disk, large enough for generateMetaMac() to read it on several threads
+    FSACCESS_CLASS fsAccess;
+    LocalPath path;
+    if (!fsAccess.cwd(path))
+    {
+        return;
+    }
+    path.appendWithSeparator(LocalPath::fromRelativePath("crypto_benchmark_metamac.bin"), false);
+
+    const size_t size = size_t(METAMAC_PARALLEL_MIN_SIZE) * 2;
+    {
+        auto fa = fsAccess.newfileaccess(false);
+        if (!fa->fopen(path, false, true, FSLogging::logOnError))
+        {
+            return;
+        }
+
+        vector<byte> piece(1 << 20);
+        rng.genblock(piece.data(), piece.size());
+        for (size_t pos = 0; pos < size; pos += piece.size())
+        {
+            fa->fwrite(piece.data(), unsigned(piece.size()), m_off_t(pos));
+        }
+    }
+
+    SymmCipher cipher;
+    string key = rng.genstring(SymmCipher::KEYLENGTH);
+    cipher.setkey(reinterpret_cast<const byte*>(key.data()));
+
+    for (unsigned threads : { 1u, 4u })
+    {
+        bench.run("metamac_" + std::to_string(threads) + "_threads", size, [&]()
+        {
+            auto fa = fsAccess.newfileaccess(false);
+            if (fa->fopen(path, true, false, FSLogging::logOnError))
+            {
+                generateMetaMac(cipher, *fa, 0, threads);
+            }
+        });
+    }
+
+    fsAccess.unlinklocal(path);
+}
+
+void benchmarkNodeAttributes(Benchmark& bench, PrnGen& rng)
+{
+    // the per-node work done while parsing fetchnodes: keying the recycled node cipher,
+    // decrypting the attribute blob and parsing its JSON
+    const size_t numNodes = 1024;
+    vector<string> keys(numNodes);
+    vector<string> attrs(numNodes);
+
+    SymmCipher cipher;
+    for (size_t i = 0; i < numNodes; i++)
+    {
+        keys[i] = rng.genstring(FILENODEKEYLENGTH);
+        cipher.setkey(&keys[i]);
+        string json = "\"n\":\"file" + std::to_string(i) + ".jpg\",\"c\":\"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA\"";
+        MegaClient::makeattr(&cipher, &attrs[i], json.c_str());
+    }
+
+    size_t next = 0;
+    bench.run("node_attribute_decrypt", 0, [&]()
+    {
+        const string& attr = attrs[next];
+        cipher.setkey(&keys[next]);
+        next = (next + 1) % numNodes;
+
+        std::unique_ptr<byte[]> buf(Node::decryptattr(&cipher, attr.c_str(), attr.size()));
+        if (buf)
+        {
+            AttrMap map;
+            map.fromjson(reinterpret_cast<char*>(buf.get()) + 5);
+        }
+    });
+}
+
+void benchmarkAsymmetric(Benchmark& bench, PrnGen& rng)
+{
+    AsymmCipher privKey;
+    CryptoPP::Integer pubk[AsymmCipher::PUBKEY];
+    privKey.genkeypair(rng, pubk, 2048);
+
+    string serializedPub;
+    AsymmCipher::serializeintarray(pubk, AsymmCipher::PUBKEY, &serializedPub);
+    AsymmCipher pubKey;
+    pubKey.setkey(AsymmCipher::PUBKEY, reinterpret_cast<const byte*>(serializedPub.data()), int(serializedPub.size()));
+
+    // RSA is used to wrap node and share keys
+    const string plain = rng.genstring(SymmCipher::KEYLENGTH * 2);
+    byte encrypted[AsymmCipher::MAXKEYLENGTH];
+    int encryptedLen = 0;
+    bench.run("rsa2048_encrypt", 0, [&]()
+    {
+        encryptedLen = pubKey.encrypt(rng, reinterpret_cast<const byte*>(plain.data()), plain.size(),
+                                      encrypted, sizeof(encrypted));
+    });
+    byte decrypted[SymmCipher::KEYLENGTH * 2];
+    bench.run("rsa2048_decrypt", 0, [&]()
+    {
+        privKey.decrypt(encrypted, size_t(encryptedLen), decrypted, sizeof(decrypted));
+    });
+
+    EdDSA signer(rng);
+    for (size_t size : { size_t(64), size_t(4096) })
+    {
+        const string msg = rng.genstring(size);
+        const auto* msgBytes = reinterpret_cast<const unsigned char*>(msg.data());
+        unsigned char sig[crypto_sign_BYTES];
+        bench.run("ed25519_sign", size, [&]() { signer.sign(msgBytes, msg.size(), sig); });
+        bench.run("ed25519_verify", size, [&]() { EdDSA::verify(msgBytes, msg.size(), sig, signer.pubKey); });
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    string jsonPath;
+    string filter;
+    long minTimeMs = 200;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else if (arg == "--min-time-ms" && i + 1 < argc)
+        {
+            minTimeMs = atol(argv[++i]);
+        }
+        else if (arg == "--filter" && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [--json <file>] [--min-time-ms <ms>] [--filter <substring>]" << endl;
+            return 1;
+        }
+    }
+
+    Benchmark bench(chrono::milliseconds(std::max(minTimeMs, 1L)), filter);
+    PrnGen rng;
+    const vector<size_t> sizes = { 16, 256, 4096, 65536, 1048576 };
+
+    benchmarkSymmCipher(bench, rng, sizes);
+    benchmarkHashes(bench, rng, sizes);
+    benchmarkFingerprints(bench, rng);
+    benchmarkMetaMac(bench, rng);
+    benchmarkNodeAttributes(bench, rng);
+    benchmarkAsymmetric(bench, rng);
+
+    if (!jsonPath.empty() && !bench.writeJson(jsonPath))
+    {
+        return 1;
+    }
+    return 0;
+}
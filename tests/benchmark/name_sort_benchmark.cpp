@@ -0,0 +1,174 @@
+/**
+ * @file name_sort_benchmark.cpp
+ * @brief Cost of ordering the names of large flat folders as the sync does
+ *
+ * (c) 2013 by Mega Limited, Auckland, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+// Usage: name_sort_benchmark [--repeat <n>] [--non-ascii-percent <p>]
+//
+// Builds a folder of N entries seen three times over (cloud, sync and filesystem
+// names, as Sync::computeSyncTriplets sees them), then sorts the rows and walks
+// the equal runs, once comparing every pair with compareUtf and once using
+// NameSortKey with compareUtf only as the fallback. Reported times are the best
+// of --repeat runs and include computing the keys.
+
+#include "mega.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace mega;
+using namespace std;
+
+namespace
+{
+
+struct Row
+{
+    const string* name;
+    bool escaped;  // cloud names may carry escapes
+    NameSortKey key;
+};
+
+vector<string> makeNames(size_t count, unsigned nonAsciiPercent)
+{
+    vector<string> names;
+    names.reserve(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        // Shuffle the order a little so the sort has something to do.
+        size_t n = (i * 2654435761u) % count;
+        string name = (n % 3 ? "IMG_" : "document ") + to_string(n) + (n % 2 ? ".jpg" : ".PDF");
+        if (n % 100 < nonAsciiPercent)
+        {
+            name += "\xc3\xa9";
+        }
+        names.push_back(std::move(name));
+    }
+    return names;
+}
+
+template<typename Prepare, typename Compare>
+double sortAndMerge(vector<Row>& rows, Prepare prepare, Compare compare)
+{
+    auto start = chrono::steady_clock::now();
+
+    for (auto& row : rows) prepare(row);
+
+    sort(rows.begin(), rows.end(), [&](const Row& a, const Row& b) { return compare(a, b) < 0; });
+
+    // Walk the runs of equal names, as combineTripletSet does.
+    size_t sets = 0;
+    for (auto i = rows.begin(); i != rows.end(); ++sets)
+    {
+        auto j = i + 1;
+        while (j != rows.end() && !compare(*i, *j)) ++j;
+        i = j;
+    }
+
+    chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    if (sets != rows.size() / 3)
+    {
+        cerr << "Unexpected number of name sets: " << sets << endl;
+        exit(1);
+    }
+    return elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    long repeat = 5;
+    long nonAsciiPercent = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--repeat" && i + 1 < argc)
+        {
+            repeat = max(atol(argv[++i]), 1L);
+        }
+        else if (arg == "--non-ascii-percent" && i + 1 < argc)
+        {
+            nonAsciiPercent = min(max(atol(argv[++i]), 0L), 100L);
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [--repeat <n>] [--non-ascii-percent <p>]" << endl;
+            return 1;
+        }
+    }
+
+    cout << left << setw(10) << "entries" << setw(8) << "case"
+         << right << setw(16) << "compareUtf ms" << setw(16) << "sort key ms" << setw(10) << "speedup" << endl;
+
+    for (size_t count : { 1000, 10000, 100000 })
+    {
+        auto names = makeNames(count, unsigned(nonAsciiPercent));
+
+        for (auto caseInsensitive : { false, true })
+        {
+            double utfBest = 0;
+            double keyBest = 0;
+
+            for (long r = 0; r < repeat; r++)
+            {
+                vector<Row> rows;
+                rows.reserve(names.size() * 3);
+                for (auto& n : names) rows.push_back(Row{&n, true, {}});
+                for (auto& n : names) rows.push_back(Row{&n, false, {}});
+                for (auto& n : names) rows.push_back(Row{&n, false, {}});
+
+                auto byUtf = rows;
+                double utf = sortAndMerge(byUtf, [](Row&) {}, [&](const Row& a, const Row& b)
+                {
+                    return compareUtf(*a.name, a.escaped, *b.name, b.escaped, caseInsensitive);
+                });
+
+                double key = sortAndMerge(rows, [&](Row& row)
+                {
+                    row.key.update(*row.name);
+                },
+                [&](const Row& a, const Row& b)
+                {
+                    if (a.key.isAscii() && b.key.isAscii())
+                    {
+                        return NameSortKey::compareAscii(*a.name, *b.name, caseInsensitive);
+                    }
+                    return compareUtf(*a.name, a.escaped, *b.name, b.escaped, caseInsensitive);
+                });
+
+                utfBest = r ? min(utfBest, utf) : utf;
+                keyBest = r ? min(keyBest, key) : key;
+            }
+
+            cout << left << setw(10) << count << setw(8) << (caseInsensitive ? "ci" : "cs")
+                 << right << fixed << setprecision(2)
+                 << setw(16) << utfBest << setw(16) << keyBest
+                 << setw(9) << (keyBest > 0 ? utfBest / keyBest : 0.0) << "x" << endl;
+        }
+    }
+    return 0;
+}
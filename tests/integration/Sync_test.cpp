@@ -6477,6 +6477,57 @@ TEST_F(SyncTest, BasicSync_AddLocalFolder)
     ASSERT_TRUE(clientA2->confirmModel_mainthread(model2.findnode("f"), backupId2));
 }
 
+TEST_F(SyncTest, BasicSync_SmallChangeOnlyVisitsItsPath)
+{
+    // An idle sync should not visit any folder, and a change deep in the tree
+    // should be reached by passing through the folders above it rather than
+    // evaluating each of their rows.
+    fs::path localtestroot = makeNewTestRoot();
+    StandardClientInUse clientA1 = g_clientManager->getCleanStandardClient(0, localtestroot); // user 1 client 1
+    ASSERT_TRUE(clientA1->resetBaseFolderMulticlient());
+    ASSERT_TRUE(clientA1->makeCloudSubdirs("f", 4, 3));
+    ASSERT_TRUE(CatchupClients(clientA1));
+
+    handle backupId1 = clientA1->setupSync_mainthread("sync1", "f", false, true);
+    ASSERT_NE(backupId1, UNDEF);
+    waitonsyncs(std::chrono::seconds(4), clientA1);
+
+    Model model;
+    model.root->addkid(model.buildModelSubdirs("f", 4, 3, 0));
+    ASSERT_TRUE(clientA1->confirmModel_mainthread(model.findnode("f"), backupId1));
+
+    auto* sync = clientA1->syncByBackupId(backupId1);
+    ASSERT_NE(sync, nullptr);
+
+    // Idle.
+    auto evaluated = sync->mFoldersEvaluated.load();
+    auto passedThrough = sync->mFoldersPassedThrough.load();
+
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+
+    out() << "idle: folders evaluated " << sync->mFoldersEvaluated.load() - evaluated
+          << ", passed through " << sync->mFoldersPassedThrough.load() - passedThrough;
+    ASSERT_EQ(sync->mFoldersEvaluated.load(), evaluated);
+    ASSERT_EQ(sync->mFoldersPassedThrough.load(), passedThrough);
+
+    // One new file, three levels down, in a tree of 85 folders.
+    ASSERT_TRUE(createFile(clientA1->syncSet(backupId1).localpath / "f_1" / "f_1_2" / "f_1_2_3" / "newfile", "newfile"));
+
+    waitonsyncs(std::chrono::seconds(4), clientA1);
+
+    model.findnode("f/f_1/f_1_2/f_1_2_3")->addkid(model.makeModelSubfile("newfile"));
+    ASSERT_TRUE(clientA1->confirmModel_mainthread(model.findnode("f"), backupId1));
+
+    auto evaluatedForChange = sync->mFoldersEvaluated.load() - evaluated;
+    auto passedForChange = sync->mFoldersPassedThrough.load() - passedThrough;
+
+    out() << "one change: folders evaluated " << evaluatedForChange << ", passed through " << passedForChange;
+
+    // Every pass goes through the root, f_1 and f_1_2 on the way to f_1_2_3.
+    ASSERT_GT(passedForChange, 0u);
+    ASSERT_LE(evaluatedForChange, passedForChange);
+}
+
 // todo: add this test once the sync can keep up with file system notifications - at the moment
 // it's too slow because we wait for the cloud before processing the next layer of files+folders.
 // So if we add enough changes to exercise the notification queue, we can't check the results because
@@ -19,6 +19,8 @@
 #include "mega.h"
 #include "../src/crypto/sodium.cpp"
 #include <math.h>
+#include <atomic>
+#include <thread>
 #include "gtest/gtest.h"
 
 using namespace mega;
@@ -393,3 +395,376 @@ TEST(Crypto, SymmCipher_isZeroKey)
     key_test6.replace(SymmCipher::BLOCKSIZE, SymmCipher::BLOCKSIZE, "0123456789ABCDEF");
     ASSERT_EQ(SymmCipher::isZeroKey(reinterpret_cast<byte*>(key_test6.data()), FILENODEKEYLENGTH), true);
 }
+
+namespace
+{
+// one block per AES call, as ctr_crypt originally did
+void referenceCtrCrypt(SymmCipher& cipher, byte* data, unsigned len, m_off_t pos, SymmCipher::ctr_iv ctriv, byte* mac, bool encrypt)
+{
+    byte ctr[SymmCipher::BLOCKSIZE], tmp[SymmCipher::BLOCKSIZE];
+    MemAccess::set<int64_t>(ctr, static_cast<int64_t>(ctriv));
+    SymmCipher::setint64(pos / SymmCipher::BLOCKSIZE, ctr + sizeof ctriv);
+    memcpy(mac, ctr, sizeof ctriv);
+    memcpy(mac + sizeof ctriv, ctr, sizeof ctriv);
+
+    for (int left = static_cast<int>(len); left > 0; left -= SymmCipher::BLOCKSIZE, data += SymmCipher::BLOCKSIZE)
+    {
+        if (encrypt)
+        {
+            SymmCipher::xorblock(data, mac);
+            cipher.ecb_encrypt(mac);
+        }
+        cipher.ecb_encrypt(ctr, tmp);
+        SymmCipher::xorblock(tmp, data);
+        if (!encrypt)
+        {
+            SymmCipher::xorblock(data, mac, left < SymmCipher::BLOCKSIZE ? left : SymmCipher::BLOCKSIZE);
+            cipher.ecb_encrypt(mac);
+        }
+        SymmCipher::incblock(ctr);
+    }
+}
+
+std::vector<byte> paddedTestData(unsigned len, byte seed)
+{
+    std::vector<byte> data(len + SymmCipher::BLOCKSIZE, 0);
+    for (unsigned i = 0; i < len; i++)
+    {
+        data[i] = static_cast<byte>(seed + i * 7);
+    }
+    return data;
+}
+}
+
+TEST(Crypto, SymmCipher_ctr_crypt_matchesBlockwise)
+{
+    byte key[SymmCipher::KEYLENGTH] = { 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 1, 2, 3, 4, 5, 6 };
+    SymmCipher cipher;
+    cipher.setkey(key);
+    const SymmCipher::ctr_iv ctriv = 0x0123456789abcdefull;
+
+    for (unsigned len : { 1u, 16u, 17u, 127u, 128u, 129u, 1000u, 131072u })
+    {
+        for (bool encrypt : { true, false })
+        {
+            auto expected = paddedTestData(len, byte(len));
+            auto actual = expected;
+            byte expectedMac[SymmCipher::BLOCKSIZE], actualMac[SymmCipher::BLOCKSIZE];
+
+            referenceCtrCrypt(cipher, expected.data(), len, 1024 * 1024, ctriv, expectedMac, encrypt);
+            cipher.ctr_crypt(actual.data(), len, 1024 * 1024, ctriv, actualMac, encrypt);
+
+            ASSERT_EQ(0, memcmp(expected.data(), actual.data(), len)) << "len " << len << " encrypt " << encrypt;
+            ASSERT_EQ(0, memcmp(expectedMac, actualMac, sizeof(actualMac))) << "len " << len << " encrypt " << encrypt;
+        }
+    }
+}
+
+TEST(Crypto, SymmCipher_ctr_encrypt_lanes_matchesCtrCrypt)
+{
+    byte key[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    SymmCipher cipher;
+    cipher.setkey(key);
+    const SymmCipher::ctr_iv ctriv = 0xfedcba9876543210ull;
+
+    // the last piece is shorter, like the end of a file
+    const std::vector<unsigned> lengths = { 131072, 262144, 393216, 524288, 655360, 786432, 917504, 4099 };
+    std::vector<std::vector<byte>> expected, actual;
+    std::vector<std::array<byte, SymmCipher::BLOCKSIZE>> expectedMacs(lengths.size()), actualMacs(lengths.size());
+    SymmCipher::CtrLane lanes[SymmCipher::MAX_CTR_LANES];
+
+    m_off_t pos = 0;
+    for (size_t i = 0; i < lengths.size(); i++)
+    {
+        expected.push_back(paddedTestData(lengths[i], byte(i)));
+        actual.push_back(expected.back());
+
+        cipher.ctr_crypt(expected[i].data(), lengths[i], pos, ctriv, expectedMacs[i].data(), true);
+        lanes[i] = { actual[i].data(), lengths[i], pos, actualMacs[i].data() };
+        pos += lengths[i];
+    }
+
+    cipher.ctr_encrypt_lanes(lanes, unsigned(lengths.size()), ctriv);
+
+    for (size_t i = 0; i < lengths.size(); i++)
+    {
+        ASSERT_EQ(expected[i], actual[i]) << "lane " << i;
+        ASSERT_EQ(expectedMacs[i], actualMacs[i]) << "lane " << i;
+    }
+}
+
+TEST(Crypto, SymmCipher_bufferAndStreamingAeadMatchStringApi)
+{
+    byte keyBytes[SymmCipher::KEYLENGTH] = { 3, 1, 4, 1, 5, 9, 2, 6, 5, 3, 5, 8, 9, 7, 9, 3 };
+    byte iv[12] = { 2, 7, 1, 8, 2, 8, 1, 8, 2, 8, 4, 5 };
+    SymmCipher key(keyBytes);
+
+    PrnGen rng;
+    const string plain = rng.genstring(100000);
+
+    for (unsigned taglen : { 8u, 16u })
+    {
+        string expectedGcm, expectedCcm;
+        ASSERT_TRUE(key.gcm_encrypt(&plain, iv, sizeof(iv), taglen, &expectedGcm));
+        ASSERT_TRUE(key.ccm_encrypt(&plain, iv, sizeof(iv), taglen, &expectedCcm));
+
+        // in place, tag right behind the data
+        string gcm = plain;
+        gcm.resize(plain.size() + taglen);
+        byte* gcmBuf = reinterpret_cast<byte*>(gcm.data());
+        ASSERT_TRUE(key.gcm_encrypt_buffer(gcmBuf, gcmBuf, plain.size(), iv, sizeof(iv), gcmBuf + plain.size(), taglen));
+        EXPECT_EQ(gcm, expectedGcm);
+
+        string ccm(plain.size() + taglen, '\0');
+        byte* ccmBuf = reinterpret_cast<byte*>(ccm.data());
+        ASSERT_TRUE(key.ccm_encrypt_buffer(reinterpret_cast<const byte*>(plain.data()), ccmBuf, plain.size(), iv, sizeof(iv), ccmBuf + plain.size(), taglen));
+        EXPECT_EQ(ccm, expectedCcm);
+
+        // uneven pieces through the streaming interface
+        string streamed(plain.size() + taglen, '\0');
+        byte* streamedBuf = reinterpret_cast<byte*>(streamed.data());
+        ASSERT_TRUE(key.gcm_encrypt_init(iv, sizeof(iv)));
+        for (size_t pos = 0, piece = 1; pos < plain.size(); pos += piece, piece = piece * 3 + 1)
+        {
+            piece = std::min(piece, plain.size() - pos);
+            ASSERT_TRUE(key.gcm_encrypt_update(reinterpret_cast<const byte*>(plain.data()) + pos, streamedBuf + pos, piece));
+        }
+        ASSERT_TRUE(key.gcm_encrypt_final(streamedBuf + plain.size(), taglen));
+        EXPECT_EQ(streamed, expectedGcm);
+
+        string decrypted(plain.size(), '\0');
+        byte* decryptedBuf = reinterpret_cast<byte*>(decrypted.data());
+        ASSERT_TRUE(key.gcm_decrypt_buffer(gcmBuf, decryptedBuf, plain.size(), iv, sizeof(iv), gcmBuf + plain.size(), taglen));
+        EXPECT_EQ(decrypted, plain);
+
+        decrypted.assign(plain.size(), '\0');
+        ASSERT_TRUE(key.ccm_decrypt_buffer(ccmBuf, decryptedBuf, plain.size(), iv, sizeof(iv), ccmBuf + plain.size(), taglen));
+        EXPECT_EQ(decrypted, plain);
+
+        decrypted.assign(plain.size(), '\0');
+        ASSERT_TRUE(key.gcm_decrypt_init(iv, sizeof(iv)));
+        ASSERT_TRUE(key.gcm_decrypt_update(gcmBuf, decryptedBuf, 1000));
+        ASSERT_TRUE(key.gcm_decrypt_update(gcmBuf + 1000, decryptedBuf + 1000, plain.size() - 1000));
+        ASSERT_TRUE(key.gcm_decrypt_final(gcmBuf + plain.size(), taglen));
+        EXPECT_EQ(decrypted, plain);
+
+        // tampering is detected by every variant
+        gcmBuf[10] ^= 1;
+        ccmBuf[10] ^= 1;
+        EXPECT_FALSE(key.gcm_decrypt_buffer(gcmBuf, decryptedBuf, plain.size(), iv, sizeof(iv), gcmBuf + plain.size(), taglen));
+        EXPECT_FALSE(key.ccm_decrypt_buffer(ccmBuf, decryptedBuf, plain.size(), iv, sizeof(iv), ccmBuf + plain.size(), taglen));
+        ASSERT_TRUE(key.gcm_decrypt_init(iv, sizeof(iv)));
+        ASSERT_TRUE(key.gcm_decrypt_update(gcmBuf, decryptedBuf, plain.size()));
+        EXPECT_FALSE(key.gcm_decrypt_final(gcmBuf + plain.size(), taglen));
+    }
+}
+
+TEST(Crypto, SymmCipher_rekeyingMatchesFreshCipher)
+{
+    // key schedules are expanded lazily; a recycled cipher must behave like a fresh one
+    byte keyA[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    byte keyB[SymmCipher::KEYLENGTH] = { 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1 };
+    byte iv[12] = { 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9 };
+    const string plain(64, 'x');
+
+    SymmCipher fresh(keyB);
+    string expectedGcm, expectedCcm;
+    ASSERT_TRUE(fresh.gcm_encrypt(&plain, iv, sizeof(iv), 16, &expectedGcm));
+    ASSERT_TRUE(fresh.ccm_encrypt(&plain, iv, sizeof(iv), 8, &expectedCcm));
+    byte expectedEcb[SymmCipher::BLOCKSIZE] = {};
+    fresh.ecb_encrypt(expectedEcb);
+    string expectedCbc = plain;
+    ASSERT_TRUE(fresh.cbc_encrypt((byte*)expectedCbc.data(), expectedCbc.size()));
+
+    SymmCipher recycled(keyA);
+    byte block[SymmCipher::BLOCKSIZE] = {};
+    recycled.ecb_encrypt(block);
+
+    // a caller supplied key must not survive setting the cipher's own key again
+    string ignored;
+    ASSERT_TRUE(recycled.cbc_encrypt_with_key(plain, ignored, keyB, sizeof(keyB)));
+    recycled.setkey(keyA);
+
+    recycled.setkey(keyB);
+    recycled.setkey(keyB);
+
+    string gcm, ccm;
+    ASSERT_TRUE(recycled.gcm_encrypt(&plain, iv, sizeof(iv), 16, &gcm));
+    ASSERT_TRUE(recycled.ccm_encrypt(&plain, iv, sizeof(iv), 8, &ccm));
+    byte ecb[SymmCipher::BLOCKSIZE] = {};
+    recycled.ecb_encrypt(ecb);
+    string cbc = plain;
+    ASSERT_TRUE(recycled.cbc_encrypt((byte*)cbc.data(), cbc.size()));
+
+    EXPECT_EQ(gcm, expectedGcm);
+    EXPECT_EQ(ccm, expectedCcm);
+    EXPECT_EQ(0, memcmp(ecb, expectedEcb, sizeof(ecb)));
+    EXPECT_EQ(cbc, expectedCbc);
+
+    string decrypted;
+    ASSERT_TRUE(recycled.gcm_decrypt(&gcm, iv, sizeof(iv), 16, &decrypted));
+    EXPECT_EQ(decrypted, plain);
+}
+
+TEST(Crypto, NodeAttributeDecrypt_recycledCipher)
+{
+    // fetchnodes rekeys one cipher per node; every attribute must decrypt with its own key
+    const unsigned numNodes = 100;
+    PrnGen rng;
+    std::vector<string> keys(numNodes);
+    std::vector<string> attrs(numNodes);
+
+    SymmCipher cipher;
+    for (unsigned i = 0; i < numNodes; i++)
+    {
+        keys[i] = rng.genstring(FILENODEKEYLENGTH);
+        cipher.setkey(&keys[i]);
+        string json = "\"n\":\"file" + std::to_string(i) + ".jpg\"";
+        MegaClient::makeattr(&cipher, &attrs[i], json.c_str());
+    }
+
+    for (unsigned i = 0; i < numNodes; i++)
+    {
+        cipher.setkey(&keys[i]);
+        std::unique_ptr<::mega::byte[]> buf(Node::decryptattr(&cipher, attrs[i].c_str(), attrs[i].size()));
+        ASSERT_TRUE(buf) << "node " << i;
+
+        AttrMap map;
+        map.fromjson(reinterpret_cast<char*>(buf.get()) + 5);
+        EXPECT_EQ(map.map['n'], "file" + std::to_string(i) + ".jpg");
+    }
+}
+
+TEST(Crypto, SymmCipher_sharedAcrossThreads)
+{
+    // ECB is used on ciphers shared between threads (master key, share keys), so it
+    // must not modify the cipher, even on its first use after setkey()
+    PrnGen rng;
+    ::mega::byte key[SymmCipher::KEYLENGTH];
+    rng.genblock(key, sizeof(key));
+
+    ::mega::byte expected[SymmCipher::BLOCKSIZE * 4];
+    rng.genblock(expected, sizeof(expected));
+    ::mega::byte plain[sizeof(expected)];
+    memcpy(plain, expected, sizeof(plain));
+    {
+        SymmCipher reference(key);
+        reference.ecb_encrypt(expected, nullptr, sizeof(expected));
+    }
+
+    SymmCipher shared(key);
+    std::atomic<unsigned> mismatches{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([&]()
+        {
+            for (int i = 0; i < 1000; i++)
+            {
+                ::mega::byte block[sizeof(plain)];
+                shared.ecb_encrypt(plain, block, sizeof(block));
+                if (memcmp(block, expected, sizeof(block)))
+                {
+                    ++mismatches;
+                }
+                shared.ecb_decrypt(block, sizeof(block));
+                if (memcmp(block, plain, sizeof(block)))
+                {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    EXPECT_EQ(mismatches, 0u);
+}
+
+TEST(Crypto, SymmCipher_threadLocalCipher)
+{
+    byte keyA[FILENODEKEYLENGTH] = {};
+    byte keyB[SymmCipher::KEYLENGTH] = {};
+    for (unsigned i = 0; i < sizeof(keyA); i++) keyA[i] = static_cast<byte>(i * 7 + 1);
+    for (unsigned i = 0; i < sizeof(keyB); i++) keyB[i] = static_cast<byte>(i * 13 + 5);
+
+    SymmCipher freshA;
+    freshA.setkey(keyA, FILENODE);
+
+    SymmCipher* a = SymmCipher::threadLocalCipher(keyA, FILENODE);
+    ASSERT_NE(a, nullptr);
+    EXPECT_EQ(0, memcmp(a->key, freshA.key, SymmCipher::KEYLENGTH));
+    EXPECT_EQ(a, SymmCipher::threadLocalCipher(string((const char*)keyA, sizeof(keyA))));
+    EXPECT_EQ(nullptr, SymmCipher::threadLocalCipher(string(5, 'x')));
+
+    SymmCipher* b = SymmCipher::threadLocalCipher(keyB);
+    EXPECT_NE(a, b);
+    EXPECT_EQ(a, SymmCipher::threadLocalCipher(keyA, FILENODE));
+
+    // other threads get their own instances
+    SymmCipher* other = nullptr;
+    std::thread t([&]() { other = SymmCipher::threadLocalCipher(keyA, FILENODE); });
+    t.join();
+    EXPECT_NE(other, a);
+
+    // ciphers keep working after other keys came and went
+    for (unsigned i = 0; i < SymmCipher::THREAD_CIPHER_CACHE_SIZE * 2; i++)
+    {
+        byte k[SymmCipher::KEYLENGTH] = { static_cast<byte>(i + 100) };
+        SymmCipher::threadLocalCipher(k);
+    }
+
+    byte expected[SymmCipher::BLOCKSIZE] = {};
+    byte actual[SymmCipher::BLOCKSIZE] = {};
+    freshA.ecb_encrypt(expected);
+    SymmCipher::threadLocalCipher(keyA, FILENODE)->ecb_encrypt(actual);
+    EXPECT_EQ(0, memcmp(expected, actual, sizeof(actual)));
+}
+
+TEST(Crypto, HashCRC32_acceleratedMatchesPortable)
+{
+    auto crcOf = [](const byte* data, const std::vector<unsigned>& pieces)
+    {
+        HashCRC32 crc;
+        for (unsigned piece : pieces)
+        {
+            crc.add(data, piece);
+            data += piece;
+        }
+        uint32_t value;
+        crc.get(reinterpret_cast<byte*>(&value));
+        return value;
+    };
+
+    const string check = "123456789";
+    EXPECT_EQ(crcOf(reinterpret_cast<const byte*>(check.data()), { 9 }), 0xCBF43926u);
+
+    PrnGen rng;
+    const string data = rng.genstring(10000);
+    const byte* bytes = reinterpret_cast<const byte*>(data.data());
+
+    std::vector<std::vector<unsigned>> splits = {
+        { 0 }, { 1 }, { 15 }, { 63 }, { 64 }, { 65 }, { 127 }, { 2048 }, { 10000 },
+        { 100, 9900 }, { 63, 1, 64, 4000, 17 }, { 2500, 2500, 2500, 2500 }
+    };
+
+    for (const auto& pieces : splits)
+    {
+        HashCRC32::setAccelerationEnabled(false);
+        uint32_t portable = crcOf(bytes, pieces);
+        HashCRC32::setAccelerationEnabled(true);
+        uint32_t accelerated = crcOf(bytes, pieces);
+        EXPECT_EQ(portable, accelerated) << "first piece " << pieces[0];
+    }
+
+    // the hash resets after get(), as the fingerprint code relies on
+    HashCRC32 crc;
+    uint32_t first, second;
+    crc.add(bytes, 1000);
+    crc.get(reinterpret_cast<byte*>(&first));
+    crc.add(bytes, 1000);
+    crc.get(reinterpret_cast<byte*>(&second));
+    EXPECT_EQ(first, second);
+}
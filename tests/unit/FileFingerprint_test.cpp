@@ -24,8 +24,10 @@
 #include <gtest/gtest.h>
 
 #include <mega/filefingerprint.h>
+#include <mega/filesystem.h>
 
 #include "DefaultedFileAccess.h"
+#include "megafs.h"
 
 namespace {
 
@@ -537,3 +539,124 @@ TEST(FileFingerprint, serializefingerprint_unserializefingerprint)
 //}
 
 
+
+TEST(FileFingerprint, genfingerprint_FileAccess_batchedReadsMatchStream)
+{
+    using namespace mega;
+
+    FSACCESS_CLASS fsAccess;
+    LocalPath path;
+    ASSERT_TRUE(fsAccess.cwd(path));
+    path.appendWithSeparator(LocalPath::fromRelativePath("genfingerprint_test.bin"), false);
+
+    // sparse blocks all within one read, some grouped, and all far apart
+    for (m_off_t fileSize : { m_off_t(20000), m_off_t(1024 * 1024), m_off_t(3 * 1024 * 1024 + 5) })
+    {
+        std::vector<byte> content(static_cast<size_t>(fileSize));
+        for (size_t i = 0; i < content.size(); i++)
+        {
+            content[i] = static_cast<byte>(i * 13 + (i >> 10));
+        }
+
+        {
+            auto fa = fsAccess.newfileaccess(false);
+            ASSERT_TRUE(fa->fopen(path, false, true, FSLogging::logOnError));
+            ASSERT_TRUE(fa->ftruncate());
+            ASSERT_TRUE(fa->fwrite(content.data(), static_cast<unsigned>(content.size()), 0));
+        }
+
+        auto fa = fsAccess.newfileaccess(false);
+        ASSERT_TRUE(fa->fopen(path, FSLogging::logOnError));
+        FileFingerprint batched;
+        ASSERT_TRUE(batched.genfingerprint(fa.get()));
+
+        auto streamFa = fsAccess.newfileaccess(false);
+        ASSERT_TRUE(streamFa->fopen(path, true, false, FSLogging::logOnError));
+        FileInputStream is(streamFa.get());
+        FileFingerprint streamed;
+        ASSERT_TRUE(streamed.genfingerprint(&is, batched.mtime));
+
+        ASSERT_TRUE(batched.isvalid);
+        ASSERT_EQ(batched.size, fileSize);
+        ASSERT_EQ(batched.crc, streamed.crc) << "size " << fileSize;
+    }
+
+    fsAccess.unlinklocal(path);
+}
+
+namespace {
+
+// reads through another FileAccess, counting what is actually read
+class CountingFileAccess : public mega::FileAccess
+{
+public:
+    explicit CountingFileAccess(std::unique_ptr<mega::FileAccess> inner)
+        : mega::FileAccess(nullptr)
+        , mInner(std::move(inner))
+    {
+        size = mInner->size;
+        mtime = mInner->mtime;
+    }
+
+    bool fopen(const mega::LocalPath&, bool, bool, mega::FSLogging, mega::DirAccess*, bool, bool, mega::LocalPath*) override { return false; }
+    void updatelocalname(const mega::LocalPath&, bool) override {}
+    void fclose() override {}
+    bool fwrite(const mega::byte*, unsigned, m_off_t) override { return false; }
+    bool fstat(mega::m_time_t&, m_off_t&) override { return false; }
+    bool ftruncate(m_off_t) override { return false; }
+
+    m_off_t bytesRead = 0;
+    unsigned reads = 0;
+
+protected:
+    bool sysread(mega::byte* dst, unsigned len, m_off_t pos) override
+    {
+        bytesRead += len;
+        ++reads;
+        return mInner->frawread(dst, len, pos, true, mega::FSLogging::logOnError);
+    }
+
+    bool sysstat(mega::m_time_t*, m_off_t*, mega::FSLogging) override { return false; }
+    bool sysopen(bool, mega::FSLogging) override { return false; }
+    void sysclose() override {}
+
+private:
+    std::unique_ptr<mega::FileAccess> mInner;
+};
+
+}
+
+TEST(FileFingerprint, genfingerprint_FileAccess_readsLittleMoreThanTheSparseBlocks)
+{
+    using namespace mega;
+
+    FSACCESS_CLASS fsAccess;
+    LocalPath path;
+    ASSERT_TRUE(fsAccess.cwd(path));
+    path.appendWithSeparator(LocalPath::fromRelativePath("genfingerprint_reads_test.bin"), false);
+
+    // the sparse blocks are a few KB apart, closer than MAX_COALESCED_READ
+    const m_off_t fileSize = 4 * 1024 * 1024 + 3;
+    {
+        std::vector<byte> content(static_cast<size_t>(fileSize), byte(0x5a));
+        auto fa = fsAccess.newfileaccess(false);
+        ASSERT_TRUE(fa->fopen(path, false, true, FSLogging::logOnError));
+        ASSERT_TRUE(fa->ftruncate());
+        ASSERT_TRUE(fa->fwrite(content.data(), static_cast<unsigned>(content.size()), 0));
+    }
+
+    auto inner = fsAccess.newfileaccess(false);
+    ASSERT_TRUE(inner->fopen(path, true, false, FSLogging::logOnError));
+    CountingFileAccess fa(std::move(inner));
+
+    FileFingerprint fp;
+    ASSERT_TRUE(fp.genfingerprint(&fa));
+    ASSERT_TRUE(fp.isvalid);
+    ASSERT_EQ(fp.size, fileSize);
+
+    // 8 KB of sparse blocks are needed, not the bulk of the file
+    EXPECT_LE(fa.bytesRead, 2 * 8192) << fa.reads << " reads";
+
+    fa.fclose();
+    fsAccess.unlinklocal(path);
+}
@@ -0,0 +1,157 @@
+/**
+ * (c) 2024 by Mega Limited, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <gtest/gtest.h>
+
+#include <mega/filesystem.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "megafs.h"
+#include "megawaiter.h"
+
+using namespace mega;
+
+namespace
+{
+
+ScanService::RequestPtr makeRequest(handle owner, const string& device)
+{
+    return std::make_shared<ScanService::ScanRequest>(nullptr, false, LocalPath(), UNDEF,
+                                                      map<LocalPath, FSNode>(), nullptr, device, owner);
+}
+
+} // anonymous
+
+TEST(ScanService, PendingQueueIsFairAcrossSyncsAndDevices)
+{
+    ScanService::PendingQueue queue(1);
+
+    // A big sync queues many scans before two small syncs queue theirs.
+    std::vector<ScanService::RequestPtr> big;
+    for (int i = 0; i < 4; ++i)
+    {
+        big.push_back(makeRequest(1, "diskA"));
+        queue.push(big.back());
+    }
+    auto smallA = makeRequest(2, "diskA");
+    auto smallB = makeRequest(3, "diskB");
+    queue.push(smallA);
+    queue.push(smallB);
+
+    // One scan at a time per device: diskA is taken by the big sync,
+    // but the small sync on diskB doesn't have to wait for it.
+    ASSERT_EQ(queue.pop(), big[0]);
+    ASSERT_EQ(queue.pop(), smallB);
+    ASSERT_EQ(queue.pop(), nullptr);
+
+    // When diskA frees up, the small sync gets its turn before the big one continues.
+    queue.done(big[0]);
+    ASSERT_EQ(queue.pop(), smallA);
+    queue.done(smallA);
+    ASSERT_EQ(queue.pop(), big[1]);
+
+    queue.done(smallB);
+    queue.done(big[1]);
+    ASSERT_EQ(queue.pop(), big[2]);
+    queue.done(big[2]);
+    ASSERT_EQ(queue.pop(), big[3]);
+    ASSERT_TRUE(queue.empty());
+}
+
+TEST(ScanService, PendingQueueTakeAllIgnoresDeviceCapacity)
+{
+    ScanService::PendingQueue queue(1);
+
+    auto first = makeRequest(1, "diskA");
+    auto second = makeRequest(1, "diskA");
+    auto other = makeRequest(2, "diskA");
+    queue.push(first);
+    queue.push(second);
+    queue.push(other);
+
+    ASSERT_EQ(queue.pop(), first);
+    ASSERT_EQ(queue.pop(), nullptr);
+
+    auto rest = queue.takeAll();
+    ASSERT_EQ(rest.size(), 2u);
+    EXPECT_NE(std::find(rest.begin(), rest.end(), second), rest.end());
+    EXPECT_NE(std::find(rest.begin(), rest.end(), other), rest.end());
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(ScanService, StoppingCompletesQueuedRequests)
+{
+    // one thread, so that most requests are still queued when the service goes away
+    ScanService::setPoolSize(1, 1);
+
+    FSACCESS_CLASS fsAccess;
+    LocalPath missing;
+    ASSERT_TRUE(fsAccess.cwd(missing));
+    missing.appendWithSeparator(LocalPath::fromRelativePath("scan-service-test-missing"), false);
+
+    auto waiter = std::make_shared<WAIT_CLASS>();
+    std::vector<ScanService::RequestPtr> requests;
+    {
+        ScanService service;
+        for (int i = 0; i < 200; ++i)
+        {
+            requests.push_back(service.queueScan(missing, UNDEF, false, map<LocalPath, FSNode>(),
+                                                 waiter, nullptr, "disk", 1));
+        }
+    }
+
+    ScanService::setPoolSize(0, 0);
+
+    for (auto& request : requests)
+    {
+        ASSERT_TRUE(request->completed());
+        EXPECT_NE(request->completionResult(), SCAN_SUCCESS);
+    }
+}
+
+TEST(ScanService, MetricsAreForgottenWithTheirOwner)
+{
+    const handle owner = 0x1234;
+
+    FSACCESS_CLASS fsAccess;
+    LocalPath cwd;
+    ASSERT_TRUE(fsAccess.cwd(cwd));
+    auto cwdNode = FSNode::fromPath(fsAccess, cwd, false, FSLogging::logOnError);
+    ASSERT_TRUE(cwdNode);
+
+    auto waiter = std::make_shared<WAIT_CLASS>();
+    {
+        ScanService service;
+        auto request = service.queueScan(cwd, cwdNode->fsid, false, map<LocalPath, FSNode>(),
+                                         waiter, nullptr, "disk", owner);
+        while (!request->completed())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        ASSERT_EQ(request->completionResult(), SCAN_SUCCESS);
+    }
+
+    EXPECT_EQ(ScanService::metrics(owner).foldersScanned, 1u);
+
+    ScanService::forgetMetrics(owner);
+    EXPECT_EQ(ScanService::metrics(owner).foldersScanned, 0u);
+}
@@ -568,3 +568,105 @@ TEST(Serialization, Node_forFolder_withoutShares_32bit)
     auto dn = client.cli->mNodeManager.getNodeFromBlob(&data);
     checkDeserializedNode(*dn, *n, true);
 }
+
+TEST(Serialization, chunkmac_map_progressDeltas_200GBUpload)
+{
+    // Persist upload progress the way the transfer slot does: a progress record per confirmed
+    // chunk, and the full record again every Transfer::MAX_CHUNKMAC_DELTAS records
+    const m_off_t fileSize = m_off_t(200) << 30;
+
+    mega::byte key[mega::SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    mega::SymmCipher cipher;
+    cipher.setkey(key);
+
+    std::vector<m_off_t> chunks;
+    for (m_off_t pos = 0; pos < fileSize; pos = mega::ChunkedHash::chunkceil(pos, fileSize))
+    {
+        chunks.push_back(pos);
+    }
+    for (size_t i = 0; i + 1 < chunks.size(); i += 2)
+    {
+        // confirmations from several connections arrive slightly out of order
+        std::swap(chunks[i], chunks[i + 1]);
+    }
+
+    mega::chunkmac_map macs;
+    std::string fullRecord;
+    std::vector<std::string> progressRecords;
+    size_t fullBytes = 0, progressBytes = 0, largestFull = 0, largestProgress = 0;
+    mega::byte data[mega::SymmCipher::BLOCKSIZE] = {};
+
+    for (m_off_t pos : chunks)
+    {
+        mega::chunkmac_map uploaded;
+        uploaded.ctr_encrypt(pos, &cipher, data, sizeof(data), pos, 0, false);
+        macs.finishedUploadChunks(uploaded);
+        macs.updateContiguousProgress(fileSize);
+        macs.updateMacsmacProgress(&cipher);
+
+        std::string full;
+        macs.serialize(full);
+        fullBytes += full.size();
+        largestFull = std::max(largestFull, full.size());
+
+        std::string progress;
+        if (!fullRecord.empty()
+            && progressRecords.size() < mega::Transfer::MAX_CHUNKMAC_DELTAS
+            && macs.serializeDelta(progress))
+        {
+            progressBytes += progress.size();
+            largestProgress = std::max(largestProgress, progress.size());
+            progressRecords.push_back(std::move(progress));
+        }
+        else
+        {
+            progressBytes += full.size();
+            fullRecord = std::move(full);
+            progressRecords.clear();
+        }
+        macs.markPersisted();
+    }
+
+    // resuming from the last full record plus its progress records gives the same state
+    mega::chunkmac_map restored;
+    const char* ptr = fullRecord.data();
+    ASSERT_TRUE(restored.unserialize(ptr, fullRecord.data() + fullRecord.size()));
+    for (auto& record : progressRecords)
+    {
+        ptr = record.data();
+        ASSERT_TRUE(restored.unserializeDelta(ptr, record.data() + record.size()));
+        ASSERT_EQ(ptr, record.data() + record.size());
+    }
+
+    std::string expected, actual;
+    macs.serialize(expected);
+    restored.serialize(actual);
+    ASSERT_EQ(expected, actual);
+    ASSERT_EQ(macs.macsmac(&cipher), restored.macsmac(&cipher));
+
+    // progress records only carry the chunks they add (and the macsmac so far), however far into the file
+    ASSERT_LT(largestProgress, 100u);
+    ASSERT_LT(largestProgress * 10, largestFull);
+    ASSERT_LT(progressBytes * 10, fullBytes);
+}
+
+TEST(Serialization, chunkmac_map_progressDelta_needsFullRecordAfterClear)
+{
+    mega::byte key[mega::SymmCipher::KEYLENGTH] = {};
+    mega::SymmCipher cipher;
+    cipher.setkey(key);
+
+    mega::byte data[mega::SymmCipher::BLOCKSIZE] = {};
+    mega::chunkmac_map macs;
+    macs.ctr_encrypt(0, &cipher, data, sizeof(data), 0, 0, true);
+
+    // nothing has been written yet, so there is nothing to be a delta of
+    std::string progress;
+    ASSERT_FALSE(macs.serializeDelta(progress));
+
+    macs.markPersisted();
+    ASSERT_TRUE(macs.serializeDelta(progress));
+
+    macs.clear();
+    ASSERT_FALSE(macs.serializeDelta(progress));
+}
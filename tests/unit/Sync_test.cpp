@@ -34,8 +34,12 @@
 #include <mega/sync.h>
 #include <mega/types.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <numeric>
+#include <set>
+#include <thread>
 
 #ifdef ENABLE_SYNC
 
@@ -1139,5 +1143,640 @@ TEST_F(SyncConfigStoreTest, Write)
 
 } // SyncConfigTests
 
+class RecordingDbTable
+  : public mt::DefaultedDbTable
+{
+public:
+    RecordingDbTable(mega::PrnGen& rng)
+      : DefaultedDbTable(rng, true, nullptr)
+    {
+    }
+
+    bool put(uint32_t id, char* data, unsigned size) override
+    {
+        checkTransaction();
+        records[id] = std::string(data, size);
+        ++puts;
+        return true;
+    }
+
+    bool del(uint32_t id) override
+    {
+        checkTransaction();
+        records.erase(id);
+        ++dels;
+        return true;
+    }
+
+    void begin() override
+    {
+        ++transactions;
+    }
+
+    std::map<uint32_t, std::string> records;
+    int puts = 0;
+    int dels = 0;
+    int transactions = 0;
+}; // RecordingDbTable
+
+TEST(DbTableAsyncWriter, CoalescesChangesIntoOneTransaction)
+{
+    using namespace mega;
+
+    PrnGen rng;
+    auto recorder = new RecordingDbTable(rng);
+    unique_ptr<DbTable> table(recorder);
+
+    recorder->records[2] = "old";
+    recorder->records[3] = "old";
+
+    {
+        DbTableAsyncWriter writer(table, std::make_shared<DbTableWriterThread>());
+
+        writer.put(1, "a");
+        writer.put(1, "b");
+        writer.del(2);
+        writer.put(3, "c");
+        writer.del(3);
+        writer.put(4, "d");
+        writer.drain();
+
+        // Only the last change to each record is written, all in one go.
+        EXPECT_EQ(recorder->records, (std::map<uint32_t, std::string>{{1, "b"}, {4, "d"}}));
+        EXPECT_EQ(recorder->puts, 2);
+        EXPECT_EQ(recorder->dels, 2);
+        EXPECT_EQ(recorder->transactions, 1);
+
+        auto stats = writer.stats();
+        EXPECT_EQ(stats.recordsWritten, 2u);
+        EXPECT_EQ(stats.recordsDeleted, 2u);
+        EXPECT_EQ(stats.bytesWritten, 2u);
+        EXPECT_EQ(stats.changesCoalesced, 2u);
+        EXPECT_EQ(stats.batches, 1u);
+
+        // Anything queued is written when the writer goes away.
+        writer.put(5, "e");
+    }
+
+    EXPECT_EQ(recorder->records[5], "e");
+    EXPECT_EQ(recorder->transactions, 2);
+}
+
+TEST(DbTableAsyncWriter, NumbersRecordsAndHandsNextidBack)
+{
+    using namespace mega;
+
+    struct Record : Cacheable
+    {
+        bool serialize(string*) const override { return true; }
+    };
+
+    PrnGen rng;
+    auto recorder = new RecordingDbTable(rng);
+    unique_ptr<DbTable> table(recorder);
+    table->nextid = 64;
+
+    SymmCipher key;
+    ::mega::byte keyData[SymmCipher::KEYLENGTH] = {};
+    key.setkey(keyData);
+
+    Record fresh;
+    Record known;
+    known.dbid = 0x25;
+
+    {
+        DbTableAsyncWriter writer(table, std::make_shared<DbTableWriterThread>());
+
+        writer.put(5, fresh, "fresh", &key);
+        writer.put(5, known, "known", &key);
+
+        // New records are numbered by the writer, without touching the table.
+        EXPECT_EQ(fresh.dbid, (64u + DbTable::IDSPACING) | 5u);
+        EXPECT_EQ(known.dbid, 0x25u);
+        EXPECT_EQ(writer.nextid(), 64u + DbTable::IDSPACING);
+        EXPECT_EQ(table->nextid, 64u);
+
+        writer.drain();
+
+        // Records are stored encrypted.
+        ASSERT_EQ(recorder->records.size(), 2u);
+        string stored = recorder->records[fresh.dbid];
+        EXPECT_NE(stored, "fresh");
+        ASSERT_TRUE(PaddedCBC::decrypt(&stored, &key));
+        EXPECT_EQ(stored, "fresh");
+    }
+
+    EXPECT_EQ(table->nextid, 64u + DbTable::IDSPACING);
+}
+
+TEST(DbTableAsyncWriter, WritersShareOneThread)
+{
+    using namespace mega;
+
+    PrnGen rng;
+    auto thread = std::make_shared<DbTableWriterThread>();
+
+    vector<RecordingDbTable*> recorders;
+    vector<unique_ptr<DbTable>> tables;
+    vector<unique_ptr<DbTableAsyncWriter>> writers;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        recorders.push_back(new RecordingDbTable(rng));
+        tables.emplace_back(recorders.back());
+    }
+
+    for (auto& table : tables)
+    {
+        writers.emplace_back(new DbTableAsyncWriter(table, thread));
+    }
+
+    // Interleave flushes so the worker has several tables queued at once.
+    for (uint32_t round = 0; round < 50; ++round)
+    {
+        for (size_t i = 0; i < writers.size(); ++i)
+        {
+            writers[i]->put(round % 5, std::to_string(i) + ":" + std::to_string(round));
+            writers[i]->flush();
+        }
+    }
+
+    for (auto& writer : writers)
+    {
+        writer->drain();
+    }
+
+    // Each table holds the last change made to each of its records.
+    for (size_t i = 0; i < recorders.size(); ++i)
+    {
+        ASSERT_EQ(recorders[i]->records.size(), 5u);
+        for (uint32_t id = 0; id < 5; ++id)
+        {
+            EXPECT_EQ(recorders[i]->records[id], std::to_string(i) + ":" + std::to_string(45 + id));
+        }
+    }
+
+    writers.clear();
+
+    // Only the writers' shared thread is left.
+    EXPECT_EQ(thread.use_count(), 1);
+}
+
+TEST(LocalNodeArena, ReusesSlotsAndOutlivesItsOwner)
+{
+    using namespace mega;
+
+    std::atomic<uint64_t> totalBytes{0};
+    auto arena = new LocalNodeArena(totalBytes);
+
+    // Slots are distinct and come out of whole blocks.
+    std::set<void*> slots;
+    for (int i = 0; i < 2000; ++i)
+    {
+        EXPECT_TRUE(slots.insert(arena->allocate(sizeof(LocalNode))).second);
+    }
+
+    auto usage = arena->usage();
+    EXPECT_EQ(usage.nodes, 2000u);
+    EXPECT_GE(usage.slotSize, sizeof(LocalNode));
+    EXPECT_GE(usage.reservedBytes, usage.nodes * usage.slotSize);
+    EXPECT_EQ(usage.reservedBytes % LocalNodeArena::BLOCK_SIZE, 0u);
+    EXPECT_EQ(totalBytes.load(), usage.reservedBytes);
+
+    // A freed slot is handed out again before any new memory.
+    void* freed = *slots.begin();
+    slots.erase(slots.begin());
+    LocalNodeArena::deallocate(freed);
+    EXPECT_EQ(arena->allocate(sizeof(LocalNode)), freed);
+    slots.insert(freed);
+    EXPECT_EQ(arena->usage().reservedBytes, usage.reservedBytes);
+
+    // Once released, the arena stays until its last node is freed.
+    arena->release();
+    EXPECT_EQ(totalBytes.load(), usage.reservedBytes);
+
+    for (auto slot : slots)
+    {
+        LocalNodeArena::deallocate(slot);
+    }
+    EXPECT_EQ(totalBytes.load(), 0u);
+}
+
+TEST(LocalNodeArena, AllocatesAndFreesFromSeveralThreads)
+{
+    using namespace mega;
+
+    std::atomic<uint64_t> totalBytes{0};
+    auto arena = new LocalNodeArena(totalBytes);
+
+    const int numThreads = 4;
+    const int perThread = 5000;
+    vector<vector<void*>> slots(numThreads);
+    vector<std::thread> threads;
+
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            for (int i = 0; i < perThread; ++i)
+            {
+                slots[t].push_back(arena->allocate(sizeof(LocalNode)));
+
+                // keep the free list busy too
+                if (i % 3 == 2)
+                {
+                    LocalNodeArena::deallocate(slots[t].back());
+                    slots[t].pop_back();
+                }
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // No slot was handed out twice.
+    std::set<void*> distinct;
+    size_t total = 0;
+    for (auto& s : slots)
+    {
+        distinct.insert(s.begin(), s.end());
+        total += s.size();
+    }
+    EXPECT_EQ(distinct.size(), total);
+    EXPECT_EQ(arena->usage().nodes, total);
+
+    arena->release();
+
+    // The last node freed, on whichever thread, takes the arena with it.
+    threads.clear();
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.emplace_back([&, t]()
+        {
+            for (auto slot : slots[t])
+            {
+                LocalNodeArena::deallocate(slot);
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(totalBytes.load(), 0u);
+}
+
+TEST(Syncs, ProbeRootsMatchesProbingEachRootAlone)
+{
+    using namespace mega;
+    using SyncConfigTests::Directory;
+    using SyncConfigTests::Utilities;
+
+    FSACCESS_CLASS fsAccess;
+    Directory root(fsAccess, Utilities::randomPathAbsolute());
+
+    // Folders, files and missing paths, so that every kind of probe result is exercised.
+    vector<pair<LocalPath, FSLogging>> roots;
+    vector<std::unique_ptr<Directory>> folders;
+    for (size_t i = 0; i < 3 * Syncs::ROOT_PROBE_PARALLEL_MIN; ++i)
+    {
+        auto path = Utilities::randomPath(root);
+        switch (i % 3)
+        {
+            case 0: folders.emplace_back(new Directory(fsAccess, path)); break;
+            case 1: ASSERT_TRUE(Utilities::randomFile(path)); break;
+            default: break;
+        }
+        roots.emplace_back(path, FSLogging::logExceptFileNotFound);
+    }
+
+    // Probed on this thread below the threshold, and in parallel from it on.
+    for (auto count : {Syncs::ROOT_PROBE_PARALLEL_MIN - 1, roots.size()})
+    {
+        vector<pair<LocalPath, FSLogging>> some(roots.begin(), roots.begin() + long(count));
+        auto probes = Syncs::probeRoots(fsAccess, some);
+        ASSERT_EQ(probes.size(), count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto expected = Syncs::probeRoot(fsAccess, some[i].first, some[i].second);
+            EXPECT_EQ(probes[i].opened, i % 3 != 2) << i;
+            EXPECT_EQ(probes[i].opened, expected.opened) << i;
+            EXPECT_EQ(probes[i].type, expected.type) << i;
+            EXPECT_EQ(probes[i].fsid, expected.fsid) << i;
+            EXPECT_EQ(probes[i].fingerprint, expected.fingerprint) << i;
+        }
+    }
+}
+
+TEST(StateCacheSnapshot, RoundTripsOnlyForTheSameDatabaseState)
+{
+    using namespace mega;
+    using SyncConfigTests::Directory;
+    using SyncConfigTests::Utilities;
+
+    FSACCESS_CLASS fsAccess;
+    PrnGen rng;
+    Directory root(fsAccess, Utilities::randomPathAbsolute());
+
+    SymmCipher key;
+    key.setkey(reinterpret_cast<const byte*>(Utilities::randomBytes(SymmCipher::KEYLENGTH).data()));
+
+    auto dbPath = Utilities::randomPath(root);
+    ASSERT_TRUE(Utilities::randomFile(dbPath, 4096));
+
+    auto origin = StateCacheSnapshot::originOf(fsAccess, dbPath);
+    ASSERT_TRUE(origin.valid());
+    EXPECT_EQ(origin.dbSize, 4096);
+
+    // Enough records to span several encrypted pieces.
+    std::vector<std::string> records;
+    for (size_t i = 0; i < 20000; ++i)
+    {
+        records.push_back(Utilities::randomBytes(1 + i % 200));
+    }
+
+    auto path = StateCacheSnapshot::pathFor(dbPath);
+    {
+        StateCacheSnapshot::Writer writer(fsAccess, path, key, rng, origin, 12345);
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            ASSERT_TRUE(writer.add(uint32_t(i + 1) * 16, uint32_t(i), records[i]));
+        }
+        ASSERT_TRUE(writer.commit());
+    }
+
+    {
+        StateCacheSnapshot snapshot;
+        ASSERT_TRUE(snapshot.load(path, key, origin));
+        EXPECT_EQ(snapshot.nextid(), 12345u);
+
+        uint32_t dbid;
+        uint32_t crc;
+        std::string record;
+        size_t i = 0;
+        for (; snapshot.next(dbid, crc, record); ++i)
+        {
+            ASSERT_LT(i, records.size());
+            EXPECT_EQ(dbid, uint32_t(i + 1) * 16);
+            EXPECT_EQ(crc, uint32_t(i));
+            EXPECT_EQ(record, records[i]);
+        }
+        EXPECT_EQ(i, records.size());
+    }
+
+    // A different database state, a different key or a damaged file are all rejected.
+    auto changed = origin;
+    changed.dbSize += 1;
+    EXPECT_FALSE(StateCacheSnapshot().load(path, key, changed));
+
+    SymmCipher otherKey;
+    otherKey.setkey(reinterpret_cast<const byte*>(Utilities::randomBytes(SymmCipher::KEYLENGTH).data()));
+    EXPECT_FALSE(StateCacheSnapshot().load(path, otherKey, origin));
+
+    {
+        auto fa = fsAccess.newfileaccess(false);
+        ASSERT_TRUE(fa->fopen(path, true, true, FSLogging::logOnError));
+        byte b = 0;
+        ASSERT_TRUE(fa->frawread(&b, 1, StateCacheSnapshot::HEADER_SIZE + 100, true, FSLogging::logOnError));
+        b ^= 1;
+        ASSERT_TRUE(fa->fwrite(&b, 1, StateCacheSnapshot::HEADER_SIZE + 100));
+    }
+    EXPECT_FALSE(StateCacheSnapshot().load(path, key, origin));
+
+    // An unfinished snapshot leaves nothing behind.
+    fsAccess.unlinklocal(path);
+    {
+        StateCacheSnapshot::Writer writer(fsAccess, path, key, rng, origin, 0);
+        ASSERT_TRUE(writer.add(16, 1, records[0]));
+    }
+    EXPECT_FALSE(fsAccess.fileExistsAt(path));
+    auto tmpPath = path;
+    tmpPath.append(LocalPath::fromRelativePath(".tmp"));
+    EXPECT_FALSE(fsAccess.fileExistsAt(tmpPath));
+}
+
+namespace
+{
+
+using namespace mega;
+
+// A package install as the platform layer reports it: every file is created, written a few
+// times and closed, every folder is created and has its permissions set and its contents
+// listed, and part way through the event stream overflows so the platform asks for a
+// recursive rescan.
+vector<Notification> recordedEventStorm(LocalNode* root, size_t packages, size_t files)
+{
+    vector<Notification> storm;
+    string sep(1, LocalPath::localPathSeparator_utf8);
+
+    auto event = [&](Notification::ScanRequirement sr, const string& path)
+    {
+        storm.emplace_back(0, sr, LocalPath::fromRelativePath(path), root);
+    };
+
+    for (size_t p = 0; p < packages; ++p)
+    {
+        auto package = "node_modules" + sep + "pkg" + std::to_string(p);
+
+        event(Notification::NEEDS_PARENT_SCAN, package);
+        event(Notification::NEEDS_PARENT_SCAN, package);
+        event(Notification::FOLDER_NEEDS_SELF_SCAN, package);
+
+        if (p == packages / 2)
+        {
+            event(Notification::FOLDER_NEEDS_SCAN_RECURSIVE, package);
+        }
+
+        for (size_t f = 0; f < files; ++f)
+        {
+            auto file = package + sep + "lib" + sep + "file" + std::to_string(f) + ".js";
+
+            for (auto i = 0; i < 5; ++i)
+            {
+                event(Notification::NEEDS_PARENT_SCAN, file);
+            }
+        }
+
+        event(Notification::FOLDER_NEEDS_SELF_SCAN, package + sep + "lib");
+    }
+
+    return storm;
+}
+
+bool covers(const Notification& recursive, const Notification& n)
+{
+    auto base = recursive.path.toPath(false);
+    auto path = n.path.toPath(false);
+
+    return recursive.localnode == n.localnode
+           && n.scanRequirement != Notification::NEEDS_PARENT_SCAN
+           && !path.compare(0, base.size(), base)
+           && (path.size() == base.size() || path[base.size()] == LocalPath::localPathSeparator_utf8);
+}
+
+} // namespace
+
+TEST(NotificationDeque, CoalescesRepeatsAndSubsumedChildren)
+{
+    using namespace mega;
+
+    auto* root = reinterpret_cast<LocalNode*>(uintptr_t(0x1000));
+    auto storm = recordedEventStorm(root, 50, 40);
+
+    NotificationDeque queue;
+    for (auto n : storm)
+    {
+        queue.pushBack(std::move(n));
+    }
+
+    std::deque<Notification> batch;
+    queue.popAll(batch);
+    EXPECT_TRUE(queue.empty());
+
+    auto stats = queue.stats();
+    EXPECT_EQ(stats.raw, storm.size());
+    EXPECT_EQ(stats.delivered(), batch.size());
+
+    // Each package folder is delivered for a parent and a self scan, its lib folder for a
+    // self scan and each file once.  The package that asked for a recursive scan also has
+    // that one, which stands for its lib folder's later self scan (but not for its files).
+    EXPECT_EQ(batch.size(), 50u * 3 + 1 + 50u * 40 - 1);
+    EXPECT_EQ(stats.subsumed, 1u);
+
+    uint64_t repeats = 0;
+    for (auto& n : batch)
+    {
+        unsigned expected = 1;
+        if (n.scanRequirement == Notification::NEEDS_PARENT_SCAN)
+        {
+            expected = n.path.toPath(false).find("lib") == string::npos ? 2 : 5;
+        }
+        EXPECT_EQ(n.repeats, expected) << n.path;
+        repeats += n.repeats;
+    }
+    EXPECT_EQ(repeats, stats.raw - stats.subsumed);
+
+    // Once taken, the same events queue up afresh.
+    queue.pushBack(Notification(storm.front()));
+    queue.pushBack(Notification(storm.front()));
+    ASSERT_EQ(queue.size(), 1u);
+
+    // Notifications for a removed node are no longer coalesced with.
+    queue.replaceLocalNodePointers(root, (LocalNode*)~0);
+    queue.pushBack(Notification(storm.front()));
+
+    Notification n;
+    ASSERT_TRUE(queue.popFront(n));
+    EXPECT_TRUE(n.invalidated());
+    EXPECT_EQ(n.repeats, 2u);
+    ASSERT_TRUE(queue.popFront(n));
+    EXPECT_EQ(n.localnode, root);
+    EXPECT_EQ(n.repeats, 1u);
+    EXPECT_FALSE(queue.popFront(n));
+}
+
+TEST(NotificationDeque, KeepsFileNotificationsBelowRecursiveScans)
+{
+    using namespace mega;
+
+    auto* root = reinterpret_cast<LocalNode*>(uintptr_t(0x1000));
+    string sep(1, LocalPath::localPathSeparator_utf8);
+    auto package = LocalPath::fromRelativePath("pkg");
+    auto lib = LocalPath::fromRelativePath("pkg" + sep + "lib");
+    auto file = LocalPath::fromRelativePath("pkg" + sep + "lib" + sep + "index.js");
+
+    NotificationDeque queue;
+    queue.pushBack(Notification(0, Notification::FOLDER_NEEDS_SCAN_RECURSIVE, package, root));
+
+    // The file changed after the recursive scan was asked for: it still needs fingerprinting
+    // again, so its notification must reach the sync.  The folder's self scan is covered.
+    queue.pushBack(Notification(0, Notification::NEEDS_PARENT_SCAN, file, root));
+    queue.pushBack(Notification(0, Notification::FOLDER_NEEDS_SELF_SCAN, lib, root));
+    queue.pushBack(Notification(0, Notification::FOLDER_NEEDS_SELF_SCAN, package, root));
+
+    std::deque<Notification> batch;
+    queue.popAll(batch);
+
+    ASSERT_EQ(batch.size(), 2u);
+    EXPECT_EQ(batch[0].scanRequirement, Notification::FOLDER_NEEDS_SCAN_RECURSIVE);
+    EXPECT_EQ(batch[1].scanRequirement, Notification::NEEDS_PARENT_SCAN);
+    EXPECT_EQ(batch[1].path, file);
+    EXPECT_EQ(queue.stats().subsumed, 2u);
+}
+
+TEST(NotificationDeque, ReplaysEventStormFromManyThreads)
+{
+    using namespace mega;
+
+    auto* root = reinterpret_cast<LocalNode*>(uintptr_t(0x1000));
+    auto storm = recordedEventStorm(root, 50, 40);
+
+    NotificationDeque queue;
+    std::atomic<size_t> producing{4};
+    vector<std::thread> producers;
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        producers.emplace_back([&]()
+        {
+            for (auto n : storm)
+            {
+                queue.pushBack(std::move(n));
+            }
+            --producing;
+        });
+    }
+
+    // Drain while the storm is still arriving, as the sync thread would.
+    vector<Notification> delivered;
+    std::deque<Notification> batch;
+    do
+    {
+        queue.popAll(batch);
+        std::move(batch.begin(), batch.end(), std::back_inserter(delivered));
+    }
+    while (producing || !queue.empty());
+
+    for (auto& t : producers)
+    {
+        t.join();
+    }
+
+    auto stats = queue.stats();
+    EXPECT_EQ(stats.raw, 4 * storm.size());
+    EXPECT_EQ(stats.delivered(), delivered.size());
+    EXPECT_LT(delivered.size(), storm.size());
+
+    uint64_t repeats = 0;
+    set<pair<int, LocalPath>> seen;
+    vector<const Notification*> recursive;
+    for (auto& n : delivered)
+    {
+        repeats += n.repeats;
+        seen.emplace(n.scanRequirement, n.path);
+        if (n.scanRequirement == Notification::FOLDER_NEEDS_SCAN_RECURSIVE)
+        {
+            recursive.push_back(&n);
+        }
+    }
+    EXPECT_EQ(repeats, stats.raw - stats.subsumed);
+
+    // Nothing is lost: every event is delivered, or falls under a delivered recursive scan.
+    for (auto& raw : storm)
+    {
+        EXPECT_TRUE(seen.count({raw.scanRequirement, raw.path})
+                    || std::any_of(recursive.begin(), recursive.end(), [&](const Notification* r)
+                       {
+                           return covers(*r, raw);
+                       }))
+            << raw.path;
+    }
+}
+
 #endif
 
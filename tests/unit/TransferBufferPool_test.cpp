@@ -0,0 +1,101 @@
+/**
+ * (c) 2024 by Mega Limited, New Zealand
+ *
+ * This file is part of the MEGA SDK - Client Access Engine.
+ *
+ * Applications using the MEGA API must present a valid application key
+ * and comply with the the rules set forth in the Terms of Service.
+ *
+ * The MEGA SDK is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * @copyright Simplified (2-clause) BSD License.
+ *
+ * You should have received a copy of the license along with this
+ * program.
+ */
+
+#include <gtest/gtest.h>
+
+#include <mega/http.h>
+
+using mega::TransferBufferPool;
+
+TEST(TransferBufferPool, smallBuffersAreNotPooled)
+{
+    TransferBufferPool pool;
+
+    size_t capacity = 0;
+    mega::byte* b = pool.allocate(1000, capacity);
+    ASSERT_NE(b, nullptr);
+    ASSERT_EQ(capacity, 1000u);
+
+    pool.release(b, capacity);
+    ASSERT_EQ(pool.usage().idleBytes, 0u);
+    ASSERT_EQ(pool.usage().inUseBytes, 0u);
+}
+
+TEST(TransferBufferPool, capacityRoundsUpToSizeClass)
+{
+    const size_t min = TransferBufferPool::MIN_POOLED_SIZE;
+
+    ASSERT_EQ(TransferBufferPool::capacityFor(min), min);
+    ASSERT_EQ(TransferBufferPool::capacityFor(min + 1), min + min / 4);
+    ASSERT_EQ(TransferBufferPool::capacityFor(16 * 1024 * 1024), 16u * 1024 * 1024);
+    ASSERT_EQ(TransferBufferPool::capacityFor(16 * 1024 * 1024 + 1), 20u * 1024 * 1024);
+}
+
+TEST(TransferBufferPool, releasedBuffersAreReused)
+{
+    TransferBufferPool pool;
+
+    size_t capacity = 0;
+    mega::byte* first = pool.allocate(1024 * 1024, capacity);
+    pool.release(first, capacity);
+
+    auto usage = pool.usage();
+    ASSERT_EQ(usage.idleBytes, capacity);
+    ASSERT_EQ(usage.inUseBytes, 0u);
+
+    // a request in the same size class gets the same buffer back
+    size_t capacity2 = 0;
+    mega::byte* second = pool.allocate(1024 * 1024 - 100, capacity2);
+    ASSERT_EQ(second, first);
+    ASSERT_EQ(capacity2, capacity);
+
+    usage = pool.usage();
+    ASSERT_EQ(usage.heapAllocations, 1u);
+    ASSERT_EQ(usage.reuses, 1u);
+    ASSERT_EQ(usage.idleBytes, 0u);
+    ASSERT_EQ(usage.peakInUseBytes, capacity);
+
+    pool.release(second, capacity2);
+}
+
+TEST(TransferBufferPool, idleMemoryIsCapped)
+{
+    TransferBufferPool pool;
+    pool.setMaxIdleBytes(3 * 1024 * 1024);
+
+    size_t capacity[4];
+    mega::byte* b[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        b[i] = pool.allocate(1024 * 1024, capacity[i]);
+    }
+    ASSERT_EQ(pool.usage().peakInUseBytes, 4u * 1024 * 1024);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        pool.release(b[i], capacity[i]);
+    }
+
+    auto usage = pool.usage();
+    ASSERT_EQ(usage.idleBytes, 3u * 1024 * 1024);
+    ASSERT_EQ(usage.inUseBytes, 0u);
+
+    pool.setMaxIdleBytes(0);
+    ASSERT_EQ(pool.usage().idleBytes, 0u);
+    ASSERT_EQ(pool.usage().peakIdleBytes, 3u * 1024 * 1024);
+}
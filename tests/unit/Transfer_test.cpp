@@ -21,6 +21,7 @@
 #include <mega/megaclient.h>
 #include <mega/megaapp.h>
 #include <mega/transfer.h>
+#include <mega/transferslot.h>
 
 #include "DefaultedFileSystemAccess.h"
 #include "utils.h"
@@ -87,3 +88,380 @@ TEST(Transfer, serialize_unserialize)
 }
 
 
+
+namespace
+{
+
+mega::NewNode makeUploadNewNode(char fill)
+{
+    mega::NewNode nn;
+    nn.source = mega::NEW_UPLOAD;
+    nn.type = mega::FILENODE;
+    nn.nodekey.assign(mega::FILENODEKEYLENGTH, fill);
+    std::fill(nn.uploadtoken.begin(), nn.uploadtoken.end(), static_cast<mega::byte>(fill));
+    nn.attrstring.reset(new std::string("attrs"));
+    return nn;
+}
+
+}
+
+TEST(Transfer, putnodesCoalescer_mergesUploadsIntoSameFolder)
+{
+    mega::MegaApp app;
+    auto client = mt::makeClient(app);
+
+    mega::byte key[mega::SymmCipher::KEYLENGTH];
+    std::fill(key, key + sizeof(key), mega::byte(1));
+    client->key.setkey(key);
+
+    mega::NodeHandle folder = mega::NodeHandle().set6byte(42);
+    mega::NodeHandle otherFolder = mega::NodeHandle().set6byte(43);
+
+    auto& coalescer = client->putnodesCoalescer;
+    for (int i = 0; i < 3; ++i)
+    {
+        coalescer.add(folder, mega::NoVersioning, mega::PUTNODES_APP, false,
+                      makeUploadNewNode(char('a' + i)), i + 1, nullptr);
+    }
+    coalescer.add(otherFolder, mega::NoVersioning, mega::PUTNODES_APP, false,
+                  makeUploadNewNode('z'), 4, nullptr);
+
+    // nothing is sent until the window elapses
+    ASSERT_FALSE(coalescer.empty());
+    ASSERT_EQ(client->performanceStats.uploadPutnodesCommands, 0u);
+
+    coalescer.flush(true);
+
+    ASSERT_TRUE(coalescer.empty());
+    ASSERT_TRUE(client->reqs.readyToSend());
+    ASSERT_EQ(client->performanceStats.uploadPutnodesCommands, 2u);
+    ASSERT_EQ(client->performanceStats.uploadPutnodesNodes, 4u);
+}
+
+TEST(Transfer, putnodesCoalescer_disabledSendsImmediately)
+{
+    mega::MegaApp app;
+    auto client = mt::makeClient(app);
+
+    mega::byte key[mega::SymmCipher::KEYLENGTH];
+    std::fill(key, key + sizeof(key), mega::byte(1));
+    client->key.setkey(key);
+
+    auto& coalescer = client->putnodesCoalescer;
+    coalescer.setWindow(0);
+
+    mega::NodeHandle folder = mega::NodeHandle().set6byte(42);
+    coalescer.add(folder, mega::NoVersioning, mega::PUTNODES_APP, false,
+                  makeUploadNewNode('a'), 1, nullptr);
+    coalescer.add(folder, mega::NoVersioning, mega::PUTNODES_APP, false,
+                  makeUploadNewNode('b'), 2, nullptr);
+
+    ASSERT_TRUE(coalescer.empty());
+    ASSERT_EQ(client->performanceStats.uploadPutnodesCommands, 2u);
+    ASSERT_EQ(client->performanceStats.uploadPutnodesNodes, 2u);
+}
+
+TEST(Transfer, putnodesCoalescer_clearFailsHeldBackUploads)
+{
+    mega::MegaApp app;
+    auto client = mt::makeClient(app);
+
+    mega::byte key[mega::SymmCipher::KEYLENGTH];
+    std::fill(key, key + sizeof(key), mega::byte(1));
+    client->key.setkey(key);
+
+    std::vector<mega::error> results;
+    auto completion = [&results](const mega::Error& e, mega::targettype_t, std::vector<mega::NewNode>& nn, bool, int, const std::map<std::string, std::string>&)
+    {
+        EXPECT_EQ(nn.size(), 1u);
+        results.push_back(e);
+    };
+
+    mega::NodeHandle folder = mega::NodeHandle().set6byte(42);
+    auto& coalescer = client->putnodesCoalescer;
+    coalescer.add(folder, mega::NoVersioning, mega::PUTNODES_APP, false, makeUploadNewNode('a'), 1, completion);
+    coalescer.add(folder, mega::NoVersioning, mega::PUTNODES_APP, false, makeUploadNewNode('b'), 2, completion);
+
+    // as on local logout: nothing is sent, but no upload is left waiting for its result
+    coalescer.clear();
+
+    ASSERT_TRUE(coalescer.empty());
+    ASSERT_EQ(client->performanceStats.uploadPutnodesCommands, 0u);
+    ASSERT_EQ(results, (std::vector<mega::error>{mega::API_EINCOMPLETE, mega::API_EINCOMPLETE}));
+}
+
+TEST(Transfer, putnodesCoalescer_syncUploadsAreNotHeldBack)
+{
+    mega::MegaApp app;
+    auto client = mt::makeClient(app);
+
+    mega::byte key[mega::SymmCipher::KEYLENGTH];
+    std::fill(key, key + sizeof(key), mega::byte(1));
+    client->key.setkey(key);
+
+    mega::File file;
+    file.syncxfer = true;
+    file.h = mega::NodeHandle().set6byte(42);
+    file.name = "file";
+
+    mega::UploadToken token;
+    mega::FileNodeKey filekey;
+    std::fill(token.begin(), token.end(), mega::byte(2));
+    std::fill(filekey.bytes.begin(), filekey.bytes.end(), mega::byte(3));
+
+    file.sendPutnodesOfUpload(client.get(), mega::UploadHandle(), token, filekey, mega::PUTNODES_SYNC,
+                              mega::NodeHandle().set6byte(7), nullptr, nullptr, false);
+
+    // sent straight away, ahead of anything the sync sends afterwards
+    ASSERT_TRUE(client->putnodesCoalescer.empty());
+    ASSERT_TRUE(client->reqs.readyToSend());
+}
+
+#if defined(MEGA_MEASURE_CODE) || defined(DEBUG)
+
+namespace
+{
+
+struct PutnodesOutcome
+{
+    mega::Error e = mega::API_EINTERNAL;
+    int tag = 0;
+    size_t nodes = 0;
+    mega::byte nodekeyFill = 0;
+    int calls = 0;
+};
+
+// queue three uploads into one folder and hold back the coalesced command
+// (it is moved into held, which owns it from then on)
+mega::Command* sendCoalescedPutnodes(mega::MegaClient& client, std::vector<PutnodesOutcome>& outcomes, mega::Request& held)
+{
+    mega::byte key[mega::SymmCipher::KEYLENGTH];
+    std::fill(key, key + sizeof(key), mega::byte(1));
+    client.key.setkey(key);
+
+    mega::Command* sent = nullptr;
+    client.reqs.deferRequests = [&sent](mega::Command* c)
+    {
+        sent = c;
+        return true;
+    };
+
+    mega::NodeHandle folder = mega::NodeHandle().set6byte(42);
+    for (size_t i = 0; i < outcomes.size(); ++i)
+    {
+        int tag = int(i) + 1;
+        client.pendingtcids[tag].push_back(0);
+
+        auto* outcome = &outcomes[i];
+        client.putnodesCoalescer.add(folder, mega::NoVersioning, mega::PUTNODES_APP, false,
+                                     makeUploadNewNode(char('a' + i)), tag,
+                                     [outcome](const mega::Error& e, mega::targettype_t, std::vector<mega::NewNode>& nn, bool, int tag, const std::map<std::string, std::string>&)
+                                     {
+                                         outcome->e = e;
+                                         outcome->tag = tag;
+                                         outcome->nodes = nn.size();
+                                         outcome->nodekeyFill = nn.empty() ? mega::byte(0) : mega::byte(nn.front().nodekey.front());
+                                         ++outcome->calls;
+                                     });
+    }
+
+    client.putnodesCoalescer.flush(true);
+    client.reqs.deferRequests = nullptr;
+    held.swap(client.reqs.deferredRequests);
+    return sent;
+}
+
+}
+
+TEST(Transfer, putnodesCoalescer_fansNodeResultsOutToEachUpload)
+{
+    mega::MegaApp app;
+    auto client = mt::makeClient(app);
+
+    std::vector<PutnodesOutcome> outcomes(3);
+    mega::Request held;
+    mega::Command* cmd = sendCoalescedPutnodes(*client, outcomes, held);
+    ASSERT_NE(cmd, nullptr);
+
+    // every node of the batch was refused, each with its own error
+    mega::JSON json("\"e\":[-11,-9,-2]}");
+    ASSERT_TRUE(cmd->procresult(mega::Command::Result(mega::Command::CmdObject), json));
+
+    const mega::error expected[] = { mega::API_EACCESS, mega::API_ENOENT, mega::API_EARGS };
+    for (size_t i = 0; i < outcomes.size(); ++i)
+    {
+        EXPECT_EQ(outcomes[i].calls, 1);
+        EXPECT_EQ(outcomes[i].tag, int(i) + 1);
+        EXPECT_EQ(outcomes[i].e, expected[i]);
+        EXPECT_EQ(outcomes[i].nodes, 1u);
+        EXPECT_EQ(outcomes[i].nodekeyFill, mega::byte('a' + i));
+
+        // the pending records of every upload are released, not just the first one's
+        EXPECT_EQ(client->pendingtcids.count(int(i) + 1), 0u);
+    }
+}
+
+TEST(Transfer, putnodesCoalescer_mapsBatchErrorToEveryUpload)
+{
+    mega::MegaApp app;
+    auto client = mt::makeClient(app);
+
+    std::vector<PutnodesOutcome> outcomes(3);
+    mega::Request held;
+    mega::Command* cmd = sendCoalescedPutnodes(*client, outcomes, held);
+    ASSERT_NE(cmd, nullptr);
+
+    mega::JSON json;
+    ASSERT_TRUE(cmd->procresult(mega::Command::Result(mega::Command::CmdError, mega::API_EACCESS), json));
+
+    for (size_t i = 0; i < outcomes.size(); ++i)
+    {
+        EXPECT_EQ(outcomes[i].calls, 1);
+        EXPECT_EQ(outcomes[i].tag, int(i) + 1);
+        EXPECT_EQ(outcomes[i].e, mega::API_EACCESS);
+        EXPECT_EQ(outcomes[i].nodes, 1u);
+        EXPECT_EQ(client->pendingtcids.count(int(i) + 1), 0u);
+    }
+}
+
+#endif
+
+namespace
+{
+
+// a completed read of [pos, pos + len)
+mega::AsyncIOContext* finishedRead(m_off_t pos, unsigned len, bool failed = false)
+{
+    auto* context = new mega::AsyncIOContext;
+    context->posOfBuffer = pos;
+    context->dataBufferLen = len;
+    context->finished = true;
+    context->failed = failed;
+    return context;
+}
+
+mega::UploadReadAheadQueue::Chunk readAheadChunk(mega::AsyncIOContext* read)
+{
+    mega::UploadReadAheadQueue::Chunk chunk;
+    chunk.req = std::make_shared<mega::HttpReqUL>();
+    chunk.asyncIO = read;
+    chunk.size = read->dataBufferLen;
+    return chunk;
+}
+
+}
+
+TEST(Transfer, uploadReadAhead_keepsWithinBudget)
+{
+    mega::UploadReadAheadQueue queue(3, 1000);
+
+    // a single chunk is always allowed, however large
+    ASSERT_TRUE(queue.hasRoomFor(5000));
+
+    queue.push(readAheadChunk(finishedRead(0, 600)));
+    ASSERT_TRUE(queue.hasRoomFor(400));
+    ASSERT_FALSE(queue.hasRoomFor(401));
+
+    queue.push(readAheadChunk(finishedRead(600, 200)));
+    queue.push(readAheadChunk(finishedRead(800, 100)));
+    ASSERT_EQ(queue.bufferedBytes(), 900);
+    ASSERT_FALSE(queue.hasRoomFor(1));
+}
+
+TEST(Transfer, uploadReadAhead_hitHandsEncryptedChunksOutInFileOrder)
+{
+    mega::UploadReadAheadQueue queue(4, 1 << 20);
+
+    auto first = readAheadChunk(finishedRead(0, 100));
+    auto second = readAheadChunk(finishedRead(100, 100));
+    second.asyncIO->finished = false;   // still reading
+
+    auto firstReq = first.req;
+    auto secondReq = second.req;
+    auto* secondRead = second.asyncIO;
+    queue.push(std::move(first));
+    queue.push(std::move(second));
+
+    std::vector<std::pair<m_off_t, m_off_t>> encrypted;
+    auto encrypt = [&encrypted](const std::shared_ptr<mega::HttpReqXfer>&, m_off_t pos, m_off_t npos)
+    {
+        encrypted.emplace_back(pos, npos);
+    };
+
+    queue.advance(encrypt);
+    ASSERT_EQ(encrypted.size(), 1u);
+    ASSERT_EQ(encrypted[0], std::make_pair(m_off_t(0), m_off_t(100)));
+
+    secondRead->finished = true;
+    queue.advance(encrypt);
+    ASSERT_EQ(encrypted.size(), 2u);
+    ASSERT_EQ(encrypted[1], std::make_pair(m_off_t(100), m_off_t(200)));
+
+    // a free connection gets the earliest chunk, already encrypted
+    mega::UploadReadAheadQueue::Chunk taken;
+    ASSERT_TRUE(queue.take(taken));
+    ASSERT_EQ(taken.req, firstReq);
+    ASSERT_EQ(taken.asyncIO, nullptr);
+    ASSERT_EQ(queue.bufferedBytes(), 100);
+
+    ASSERT_TRUE(queue.take(taken));
+    ASSERT_EQ(taken.req, secondReq);
+    ASSERT_FALSE(queue.take(taken));
+    ASSERT_EQ(queue.bufferedBytes(), 0);
+}
+
+TEST(Transfer, uploadReadAhead_failedReadIsHandedBackForRewind)
+{
+    mega::UploadReadAheadQueue queue(4, 1 << 20);
+    queue.push(readAheadChunk(finishedRead(0, 100)));
+    queue.push(readAheadChunk(finishedRead(100, 100, true)));
+    queue.push(readAheadChunk(finishedRead(200, 100)));
+
+    std::vector<m_off_t> encrypted;
+    auto encrypt = [&encrypted](const std::shared_ptr<mega::HttpReqXfer>&, m_off_t pos, m_off_t)
+    {
+        encrypted.push_back(pos);
+    };
+
+    // the chunk before the failure is kept; the failed one and those behind it are dropped,
+    // and the slot rewinds to where the failure was so a connection reads it again
+    ASSERT_EQ(queue.advance(encrypt), 100);
+    ASSERT_EQ(encrypted, std::vector<m_off_t>{0});
+    ASSERT_EQ(queue.size(), 1u);
+    ASSERT_EQ(queue.bufferedBytes(), 100);
+
+    mega::UploadReadAheadQueue::Chunk taken;
+    ASSERT_TRUE(queue.take(taken));
+    ASSERT_EQ(taken.asyncIO, nullptr);
+    ASSERT_FALSE(queue.take(taken));
+
+    // nothing failed
+    queue.push(readAheadChunk(finishedRead(100, 100)));
+    ASSERT_EQ(queue.advance(encrypt), -1);
+}
+
+TEST(Transfer, uploadReadAhead_clearCancelsPendingReads)
+{
+    struct TrackedRead : mega::AsyncIOContext
+    {
+        int* deleted;
+        explicit TrackedRead(int* d) : deleted(d) { finished = true; dataBufferLen = 100; }
+        ~TrackedRead() override { ++*deleted; }
+    };
+
+    int deleted = 0;
+    {
+        mega::UploadReadAheadQueue queue(4, 1 << 20);
+        queue.push(readAheadChunk(new TrackedRead(&deleted)));
+        queue.push(readAheadChunk(new TrackedRead(&deleted)));
+
+        queue.clear();
+        ASSERT_EQ(deleted, 2);
+        ASSERT_EQ(queue.size(), 0u);
+        ASSERT_EQ(queue.bufferedBytes(), 0);
+
+        // and whatever is still queued when the slot goes away
+        queue.push(readAheadChunk(new TrackedRead(&deleted)));
+    }
+    ASSERT_EQ(deleted, 3);
+}
@@ -431,6 +431,50 @@ TEST_F(ComparatorTest, CompareLocalPathAgainstString)
     }
 }
 
+TEST_F(ComparatorTest, NameSortKeyOrdersLikeCompareUtf)
+{
+    const vector<string> names = {
+        "", "a", "A", "ab", "aB", "AB", "abc", "b", "Z", "_", "[", "`", "{",
+        "0", "9", "a b", "a.txt", "A.TXT", "a~1", "file10", "file2",
+    };
+
+    auto sign = [](int v) { return (v > 0) - (v < 0); };
+
+    for (auto caseInsensitive : {false, true})
+    {
+        for (auto& lhs : names)
+        {
+            NameSortKey key;
+            key.update(lhs);
+            ASSERT_TRUE(key.isAscii());
+
+            for (auto& rhs : names)
+            {
+                EXPECT_EQ(sign(NameSortKey::compareAscii(lhs, rhs, caseInsensitive)),
+                          sign(compareUtf(lhs, true, rhs, false, caseInsensitive)))
+                    << "\"" << lhs << "\" vs \"" << rhs << "\" caseInsensitive " << caseInsensitive;
+            }
+        }
+    }
+
+    // Escapes and non-ASCII names are left to compareUtf.
+    for (string name : {"a%30b", "caf\xc3\xa9"})
+    {
+        NameSortKey key;
+        key.update(name);
+        EXPECT_FALSE(key.isAscii());
+    }
+
+    // The key is kept until reset.
+    NameSortKey key;
+    key.update("abc");
+    key.update("caf\xc3\xa9");
+    EXPECT_TRUE(key.isAscii());
+    key.reset();
+    key.update("caf\xc3\xa9");
+    EXPECT_FALSE(key.isAscii());
+}
+
 TEST(Conversion, HexVal)
 {
     // Decimal [0-9]
@@ -686,6 +730,68 @@ TEST_F(SqliteDBTest, ProbeCurrent)
     EXPECT_TRUE(dbAccess.probe(fsAccess, name));
 }
 
+TEST_F(SqliteDBTest, FingerprintCachePersists)
+{
+    ::mega::byte keyBytes[SymmCipher::KEYLENGTH] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    SymmCipher key(keyBytes);
+
+    FileFingerprint fp;
+    fp.size = 1234;
+    fp.mtime = 1000;
+    fp.crc = {1, 2, 3, 4};
+    fp.isvalid = true;
+
+    {
+        SqliteDbAccess dbAccess(rootPath);
+        FingerprintCache cache;
+
+        cache.attach(unique_ptr<DbTable>(dbAccess.open(rng, fsAccess, name, DB_OPEN_FLAG_TRANSACTED, nullptr)), key);
+        EXPECT_EQ(cache.size(), 0u);
+
+        cache.store("fs", 42, 77, fp);
+        cache.store("", 43, 77, fp);    // unknown filesystem, not cached
+        cache.store("fs", UNDEF, 77, fp);
+        EXPECT_EQ(cache.size(), 1u);
+        EXPECT_TRUE(cache.hasPendingWrites());
+
+        cache.flush();
+        EXPECT_FALSE(cache.hasPendingWrites());
+
+        // Rewritten in place: reloading finds no duplicate record to remove.
+        fp.crc = {5, 6, 7, 8};
+        cache.store("fs", 42, 77, fp);
+        EXPECT_TRUE(cache.hasPendingWrites());
+
+        cache.detach(false);
+    }
+
+    SqliteDbAccess dbAccess(rootPath);
+    FingerprintCache cache;
+
+    cache.attach(unique_ptr<DbTable>(dbAccess.open(rng, fsAccess, name, DB_OPEN_FLAG_TRANSACTED, nullptr)), key);
+    ASSERT_EQ(cache.size(), 1u);
+    EXPECT_FALSE(cache.hasPendingWrites());
+
+    FileFingerprint found;
+    EXPECT_TRUE(cache.lookup("fs", 42, 1234, 1000, 77, found));
+    EXPECT_EQ(found, fp);
+    EXPECT_TRUE(found.isvalid);
+
+    // Any change to the file's attributes invalidates the entry.
+    FileFingerprint missed;
+    EXPECT_FALSE(cache.lookup("fs", 42, 1235, 1000, 77, missed));
+    EXPECT_FALSE(cache.lookup("fs", 42, 1234, 1001, 77, missed));
+    EXPECT_FALSE(cache.lookup("fs", 42, 1234, 1000, 78, missed));
+    EXPECT_FALSE(cache.lookup("other", 42, 1234, 1000, 77, missed));
+    EXPECT_FALSE(cache.lookup("fs", 41, 1234, 1000, 77, missed));
+    EXPECT_FALSE(missed.isvalid);
+
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.misses(), 5u);
+
+    cache.detach(true);
+}
+
 TEST_F(SqliteDBTest, ProbeLegacy)
 {
     SqliteDbAccess dbAccess(rootPath);
@@ -1602,3 +1708,73 @@ TEST(LikeCompare, CombinedMatch)
 
     ASSERT_FALSE(likeCompare("HÉ?l*e\\*", "heLloé"));
 }
+
+TEST(Utils, parallelFor_callsEachIndexOnce)
+{
+    for (size_t count : {0u, 1u, 7u, 1000u})
+    {
+        std::vector<std::atomic<int>> calls(count);
+        for (auto& c : calls) c = 0;
+
+        parallelFor(count, 4, [&calls](size_t i) { ++calls[i]; });
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            EXPECT_EQ(calls[i].load(), 1) << "index " << i << " of " << count;
+        }
+    }
+}
+
+TEST(Utils, generateMetaMac_parallelMatchesSerial)
+{
+    using namespace mega;
+
+    FSACCESS_CLASS fsAccess;
+    LocalPath path;
+    ASSERT_TRUE(fsAccess.cwd(path));
+    path.appendWithSeparator(LocalPath::fromRelativePath("generateMetaMac_test.bin"), false);
+
+    // large enough for the parallel path to read many more blocks than there are workers,
+    // so some are still queued when the reading finishes, and not ending on a chunk boundary
+    const m_off_t fileSize = 2 * METAMAC_PARALLEL_MIN_SIZE + 3 * 1024 * 1024 + 777;
+    {
+        auto fa = fsAccess.newfileaccess(false);
+        ASSERT_TRUE(fa->fopen(path, false, true, FSLogging::logOnError));
+
+        std::vector<::mega::byte> piece(1024 * 1024);
+        for (m_off_t pos = 0; pos < fileSize; pos += m_off_t(piece.size()))
+        {
+            for (size_t i = 0; i < piece.size(); i++)
+            {
+                piece[i] = static_cast<::mega::byte>((pos >> 20) * 31 + i * 7);
+            }
+            auto len = static_cast<unsigned>(std::min<m_off_t>(m_off_t(piece.size()), fileSize - pos));
+            ASSERT_TRUE(fa->fwrite(piece.data(), len, pos));
+        }
+    }
+
+    ::mega::byte key[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    SymmCipher cipher;
+    cipher.setkey(key);
+    const int64_t iv = 0x1122334455667788;
+
+    auto metaMac = [&](unsigned maxThreads)
+    {
+        auto fa = fsAccess.newfileaccess(false);
+        EXPECT_TRUE(fa->fopen(path, true, false, FSLogging::logOnError));
+
+        return generateMetaMac(cipher, *fa, iv, maxThreads);
+    };
+
+    auto serial = metaMac(1);
+    auto twoWorkers = metaMac(2);
+    auto fourWorkers = metaMac(4);
+
+    fsAccess.unlinklocal(path);
+
+    ASSERT_TRUE(serial.first);
+    ASSERT_TRUE(twoWorkers.first);
+    ASSERT_TRUE(fourWorkers.first);
+    ASSERT_EQ(serial.second, twoWorkers.second);
+    ASSERT_EQ(serial.second, fourWorkers.second);
+}